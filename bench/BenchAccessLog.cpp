@@ -0,0 +1,80 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <benchmark/benchmark.h>
+#include <string>
+#include "utils.hpp"
+
+using utils::AccessLog;
+using utils::AsyncLogger;
+using utils::LoggerOptions;
+using utils::LogSink;
+
+static void fill(AccessLog *log) {
+    log->SetUpBasic("host", "OPENIO-rawx-1");
+    log->LocalServer("127.0.0.1:6200");
+    log->RemoteClient("127.0.0.1:45678");
+    log->RequestType("GET");
+    log->StatusCode(200);
+    log->ResponseTime(1234);
+    log->ResponseSize(1048576);
+    log->UserID(std::string(64, 'C'));
+    log->RequestID(std::string(32, 'R'));
+}
+
+/** Synchronous formatting of the line */
+static void BM_AccessLog_LogToPrint(benchmark::State &state) {
+    AccessLog log;
+    fill(&log);
+    std::string chunk(64, 'A');
+    while (state.KeepRunning())
+        benchmark::DoNotOptimize(log.LogToPrint("INF", chunk));
+}
+BENCHMARK(BM_AccessLog_LogToPrint);
+
+/**
+ * Cost on the request thread with the asynchronous pipeline, the lines go
+ * to /dev/null. The loop pushes faster than one thread can format, the
+ * "dropped" counter tells how many records did not fit.
+ */
+static void BM_AccessLog_Log(benchmark::State &state) {
+    static AsyncLogger *logger = nullptr;
+    if (state.thread_index() == 0) {
+        LoggerOptions options;
+        options.sink = LogSink::File;
+        options.path = "/dev/null";
+        options.ringSize = 65536;
+        options.flushInterval = std::chrono::milliseconds(1);
+        logger = new AsyncLogger(options);
+        logger->Start();
+        AsyncLogger::Install(logger);
+    }
+    AccessLog log;
+    fill(&log);
+    std::string chunk(64, 'A');
+    while (state.KeepRunning())
+        log.Log("INF", chunk);
+    if (state.thread_index() == 0) {
+        state.counters["dropped"] = logger->Dropped();
+        AsyncLogger::Install(nullptr);
+        delete logger;
+    }
+}
+BENCHMARK(BM_AccessLog_Log)->ThreadRange(1, 8)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,160 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <benchmark/benchmark.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "blob.hpp"
+#include "utils.hpp"
+
+using blob::DiskDownload;
+using blob::DiskUpload;
+using blob::FileSlice;
+using utils::XAttr;
+
+static const char *kChunk = "./bench-chunk";
+static const int kChunkSize = 16 * 1024 * 1024;
+
+/** A chunk shared by the download benchmarks, written once */
+static void makeChunk() {
+    static bool done = false;
+    if (done)
+        return;
+    std::vector<uint8_t> data(kChunkSize, 'x');
+    int fd = open(kChunk, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    if (fd < 0 || write(fd, data.data(), data.size()) != kChunkSize)
+        abort();
+    close(fd);
+    done = true;
+}
+
+static void BM_FileSlice_Construct(benchmark::State &state) {
+    std::vector<uint8_t> data(state.range(0), 'x');
+    while (state.KeepRunning()) {
+        FileSlice slice(data.data(), data.size());
+        benchmark::DoNotOptimize(slice.data());
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_FileSlice_Construct)->RangeMultiplier(4)->Range(1024, 1 << 20);
+
+/**
+ * Write fragments of the given size, as received from the network.
+ * The file is restarted every 256MiB to bound the disk usage.
+ */
+static void BM_DiskUpload_Write(benchmark::State &state) {
+    const std::string path {"./bench-upload"};
+    const int64_t restart = 256 << 20;
+    std::vector<uint8_t> data(state.range(0), 'x');
+    auto slice = std::make_shared<FileSlice>(data.data(), data.size());
+    XAttr xattr;
+    unlink(path.c_str());
+    std::unique_ptr<DiskUpload> upload(new DiskUpload(path));
+    upload->XAttr(&xattr);
+    upload->Prepare();
+    int64_t written = 0;
+    while (state.KeepRunning()) {
+        upload->Write(slice);
+        written += state.range(0);
+        if (written >= restart) {
+            state.PauseTiming();
+            upload->Abort();
+            unlink(path.c_str());
+            upload.reset(new DiskUpload(path));
+            upload->XAttr(&xattr);
+            upload->Prepare();
+            written = 0;
+            state.ResumeTiming();
+        }
+    }
+    upload->Commit();
+    upload->Abort();
+    unlink(path.c_str());
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_DiskUpload_Write)->RangeMultiplier(4)->Range(4096, 1 << 20);
+
+/**
+ * Read the whole chunk (from the page cache) with the given buffer size.
+ */
+static void BM_DiskDownload_Read(benchmark::State &state) {
+    makeChunk();
+    XAttr xattr;
+    DiskDownload download;
+    download.Path(kChunk);
+    download.XAttr(&xattr);
+    download.BufferSize(state.range(0));
+    download.Prepare();
+    while (state.KeepRunning()) {
+        auto slice = std::make_shared<FileSlice>();
+        download.Read(slice);
+        if (download.isEof()) {
+            state.PauseTiming();
+            download.Abort();
+            download.Prepare();
+            state.ResumeTiming();
+        }
+    }
+    download.Abort();
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_DiskDownload_Read)->RangeMultiplier(4)->Range(4096, 1 << 20);
+
+/**
+ * A complete ranged GET: open, xattr, reads until the end of the range.
+ * 0: whole chunk, 1: first 4KiB, 2: 1MiB in the middle, 3: last 64KiB.
+ */
+static void BM_DiskDownload_Range(benchmark::State &state) {
+    makeChunk();
+    int begin = 0, end = kChunkSize - 1;
+    switch (state.range(0)) {
+        case 1:
+            end = 4095;
+            break;
+        case 2:
+            begin = kChunkSize / 2;
+            end = begin + (1 << 20) - 1;
+            break;
+        case 3:
+            begin = kChunkSize - 65536;
+            break;
+    }
+    XAttr xattr;
+    while (state.KeepRunning()) {
+        DiskDownload download;
+        download.Path(kChunk);
+        download.XAttr(&xattr);
+        if (state.range(0) != 0)
+            download.setRange(begin, end);
+        download.Prepare();
+        while (!download.isEof()) {
+            auto slice = std::make_shared<FileSlice>();
+            download.Read(slice);
+            if (slice->size() == 0)
+                break;
+        }
+        download.Abort();
+    }
+    state.SetBytesProcessed(state.iterations() * (end + 1 - begin));
+}
+BENCHMARK(BM_DiskDownload_Range)->DenseRange(0, 3);
+
+BENCHMARK_MAIN();
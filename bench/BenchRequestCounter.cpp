@@ -0,0 +1,74 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <benchmark/benchmark.h>
+#include <mutex> // NOLINT
+#include "utils.hpp"
+
+using utils::RequestCounter;
+
+/**
+ * The counters touched by a successful GET, as done by the handlers.
+ * With one shard per thread, the time per request must stay flat when
+ * the number of threads grows.
+ */
+static void BM_RequestCounter_Request(benchmark::State &state) {
+    static RequestCounter counter;
+    while (state.KeepRunning()) {
+        counter.incGetHits();
+        counter.incR2xxHits();
+        counter.incBread(4096);
+        counter.incGetTime(100);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RequestCounter_Request)->ThreadRange(1, 64)->UseRealTime();
+
+/**
+ * Same pattern with one mutex around the counters, as a reference point.
+ */
+static void BM_MutexCounter_Request(benchmark::State &state) {
+    static std::mutex mutex;
+    static uint64_t values[4];
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 4; i++) {
+            std::lock_guard<std::mutex> lock(mutex);
+            values[i] += i;
+        }
+    }
+    benchmark::DoNotOptimize(values);
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_MutexCounter_Request)->ThreadRange(1, 64)->UseRealTime();
+
+/**
+ * Reading the stats while the request threads keep counting.
+ */
+static void BM_RequestCounter_Snapshot(benchmark::State &state) {
+    static RequestCounter counter;
+    while (state.KeepRunning()) {
+        if (state.thread_index() == 0) {
+            benchmark::DoNotOptimize(counter.Snapshot());
+        } else {
+            counter.incGetHits();
+        }
+    }
+}
+BENCHMARK(BM_RequestCounter_Snapshot)->ThreadRange(1, 16)->UseRealTime();
+
+BENCHMARK_MAIN();
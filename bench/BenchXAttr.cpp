@@ -0,0 +1,242 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <benchmark/benchmark.h>
+#include <attr/xattr.h>
+#include <fcntl.h>
+#include <strings.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+#include "pool.hpp"
+#include "utils.hpp"
+#include "volume.hpp"
+
+using utils::Attr;
+using utils::XAttr;
+
+/** Heap allocations of the process, to report them per request */
+static std::atomic<uint64_t> allocations {0};
+
+void *operator new(size_t size) {
+    allocations++;
+    void *p = malloc(size);
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+static const char *kPath = "./bench-xattr";
+
+/** All the attributes of a chunk, with realistic values */
+static void fill(XAttr *xattr) {
+    xattr->addXAttr("content.container", std::string(64, 'C'));
+    xattr->addXAttr("content.id", std::string(32, 'I'));
+    xattr->addXAttr("content.path", "path/to/the/object");
+    xattr->addXAttr("content.version", "1501234567890123");
+    xattr->addXAttr("content.storage_policy", "THREECOPIES");
+    xattr->addXAttr("content.chunk_method", "plain/nb_copy=3");
+    xattr->addXAttr("metachunk.size", "1048576");
+    xattr->addXAttr("metachunk.hash", std::string(32, 'H'));
+    xattr->addXAttr("chunk.id", std::string(64, 'A'));
+    xattr->addXAttr("chunk.hash", std::string(32, 'H'));
+    xattr->addXAttr("chunk.position", "0");
+    xattr->addXAttr("chunk.size", "1048576");
+}
+
+static int openChunk() {
+    int fd = open(kPath, O_CREAT | O_RDWR, 0644);
+    if (fd < 0)
+        abort();
+    return fd;
+}
+
+static void BM_XAttr_Retrieve(benchmark::State &state) {
+    int fd = openChunk();
+    XAttr source;
+    fill(&source);
+    source.writeXAttr(fd);
+    while (state.KeepRunning()) {
+        XAttr xattr;
+        xattr.retrieveXAttr(fd);
+        benchmark::DoNotOptimize(xattr);
+    }
+    close(fd);
+    unlink(kPath);
+}
+BENCHMARK(BM_XAttr_Retrieve);
+
+/** The attributes are created: they are removed out of the timing */
+static void BM_XAttr_Write(benchmark::State &state) {
+    int fd = openChunk();
+    XAttr xattr;
+    fill(&xattr);
+    auto names = xattr.XAttrNamesValues();
+    while (state.KeepRunning()) {
+        xattr.writeXAttr(fd);
+        state.PauseTiming();
+        for (auto &elem : names)
+            fremovexattr(fd, elem.first.c_str());
+        state.ResumeTiming();
+    }
+    close(fd);
+    unlink(kPath);
+}
+BENCHMARK(BM_XAttr_Write);
+
+static void BM_XAttr_GetHTTP(benchmark::State &state) {
+    XAttr xattr;
+    fill(&xattr);
+    while (state.KeepRunning())
+        benchmark::DoNotOptimize(xattr.getHTTP("chunk-size"));
+}
+BENCHMARK(BM_XAttr_GetHTTP);
+
+static void BM_XAttr_AddHTTP(benchmark::State &state) {
+    XAttr xattr;
+    std::string value(64, 'A');
+    while (state.KeepRunning())
+        xattr.addHTTP("chunk-id", value);
+}
+BENCHMARK(BM_XAttr_AddHTTP);
+
+static void BM_XAttr_HTTPNamesValues(benchmark::State &state) {
+    XAttr xattr;
+    fill(&xattr);
+    while (state.KeepRunning())
+        benchmark::DoNotOptimize(xattr.HTTPNamesValues());
+}
+BENCHMARK(BM_XAttr_HTTPNamesValues);
+
+using Headers = std::vector<std::pair<std::string, std::string>>;
+
+/** The headers of a PUT, as the proxy sends them */
+static Headers putHeaders() {
+    XAttr xattr;
+    fill(&xattr);
+    Headers headers {{"Host", "127.0.0.1:6200"}, {"Content-Length", "1048576"},
+                     {"X-oio-req-id", std::string(32, 'R')}};
+    for (auto &elem : xattr.HTTPNamesValues())
+        headers.push_back(elem);
+    return headers;
+}
+
+/** What the header lookups by name cost (copy of the value) */
+static std::string rawGet(const Headers &headers, const std::string &name) {
+    for (auto &header : headers) {
+        if (strcasecmp(header.first.c_str(), name.c_str()) == 0)
+            return header.second;
+    }
+    return std::string();
+}
+
+static void reportAllocations(benchmark::State &state, uint64_t before) {
+    state.counters["allocs_per_req"] = static_cast<double>(
+        allocations - before) / state.iterations();
+}
+
+/** Parse then echo the metadata of a PUT, one name list per request */
+static void BM_Headers_ByName(benchmark::State &state) {
+    Headers headers = putHeaders();
+    uint64_t before = allocations;
+    while (state.KeepRunning()) {
+        XAttr xattr;
+        std::vector<std::string> names {"content-id", "container-id",
+                "content-storage-policy", "content-chunk-method",
+                "content-path", "chunk-id", "chunk-pos"};
+        for (auto &elem : names)
+            xattr.addHTTP(elem, rawGet(headers, xattr.HttpPrefix() + elem));
+        std::vector<std::string> reply {"container-id", "content-id",
+                "content-path", "content-version", "content-storage-policy",
+                "content-chunk-method", "chunk-id", "chunk-hash", "chunk-pos",
+                "chunk-size"};
+        for (auto &elem : reply) {
+            auto header = std::make_pair(xattr.HttpPrefix() + elem,
+                                         xattr.getHTTP(elem));
+            benchmark::DoNotOptimize(header);
+        }
+    }
+    reportAllocations(state, before);
+}
+BENCHMARK(BM_Headers_ByName);
+
+/** The same through the attribute tables, in one pass over the headers */
+static void BM_Headers_Tables(benchmark::State &state) {
+    Headers headers = putHeaders();
+    uint64_t before = allocations;
+    while (state.KeepRunning()) {
+        XAttr xattr;
+        for (auto &header : headers)
+            xattr.SetHeader(header.first, header.second);
+        for (unsigned int i = 0; i < utils::kAttrs; i++) {
+            auto header = std::make_pair(utils::kAttributes[i].header,
+                                         &xattr.Get(static_cast<Attr>(i)));
+            benchmark::DoNotOptimize(header);
+        }
+    }
+    reportAllocations(state, before);
+}
+BENCHMARK(BM_Headers_Tables);
+
+/** The members of a handler filled by each request */
+struct Request {
+    XAttr xattr;
+    std::string path;
+    std::string etag;
+};
+
+/** The same members, on the buffers of the previous requests */
+struct LoanedRequest : public Request {
+    utils::Loan<XAttr> xattrLoan {&xattr};
+    utils::Loan<std::string> pathLoan {&path};
+    utils::Loan<std::string> etagLoan {&etag};
+};
+
+/** Attributes, path and entity tag of a request, as the handlers do */
+template <typename T>
+static void BM_Request(benchmark::State &state) {
+    Headers headers = putHeaders();
+    const std::string volume("/var/lib/oio/sds/OPENIO/rawx-1");
+    uint64_t before = allocations;
+    while (state.KeepRunning()) {
+        T request;
+        for (auto &header : headers)
+            request.xattr.SetHeader(header.first, header.second);
+        blob::ChunkPathIn(volume, request.xattr.Get(Attr::ChunkId),
+                          &request.path);
+        utils::ChunkETag(request.xattr.Get(Attr::ChunkHash), &request.etag);
+        benchmark::DoNotOptimize(request);
+    }
+    reportAllocations(state, before);
+}
+BENCHMARK_TEMPLATE(BM_Request, Request);
+BENCHMARK_TEMPLATE(BM_Request, LoanedRequest);
+
+BENCHMARK_MAIN();
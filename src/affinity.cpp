@@ -0,0 +1,191 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <dirent.h>
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "affinity.hpp"
+
+bool utils::ParseCpuList(const std::string &value, std::vector<int> *cpus) {
+    std::vector<int> parsed;
+    std::stringstream in(value);
+    std::string part;
+    while (std::getline(in, part, ',')) {
+        if (part.empty())
+            continue;
+        char *end = nullptr;
+        long low = strtol(part.c_str(), &end, 10);  // NOLINT
+        long high = low;  // NOLINT
+        if (end == part.c_str())
+            return false;
+        if (*end == '-') {
+            const char *start = end + 1;
+            high = strtol(start, &end, 10);
+            if (end == start)
+                return false;
+        }
+        if (*end != '\0' && *end != '\n')
+            return false;
+        if (low < 0 || high < low || high >= CPU_SETSIZE)
+            return false;
+        for (long cpu = low; cpu <= high; cpu++)  // NOLINT
+            parsed.push_back(static_cast<int>(cpu));
+    }
+    if (parsed.empty())
+        return false;
+    *cpus = parsed;
+    return true;
+}
+
+int utils::CpuNode(int cpu) {
+    std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+    DIR *dh = opendir(dir.c_str());
+    if (dh == nullptr)
+        return -1;
+    int node = -1;
+    struct dirent *entry;
+    while ((entry = readdir(dh)) != nullptr) {
+        if (strncmp(entry->d_name, "node", 4) == 0
+                && entry->d_name[4] >= '0' && entry->d_name[4] <= '9') {
+            node = atoi(entry->d_name + 4);
+            break;
+        }
+    }
+    closedir(dh);
+    return node;
+}
+
+std::vector<int> utils::NodeCpus(int node) {
+    std::vector<int> cpus;
+    std::ifstream in("/sys/devices/system/node/node" + std::to_string(node)
+                     + "/cpulist");
+    std::string list;
+    if (std::getline(in, list))
+        ParseCpuList(list, &cpus);
+    return cpus;
+}
+
+int utils::NodeCount() {
+    std::ifstream in("/sys/devices/system/node/online");
+    std::string list;
+    std::vector<int> nodes;
+    if (std::getline(in, list) && ParseCpuList(list, &nodes))
+        return nodes.back() + 1;
+    return 1;
+}
+
+bool utils::PinThread(int cpu) {
+    if (cpu < 0 || cpu >= CPU_SETSIZE)
+        return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+bool utils::PinThread(const std::vector<int> &cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu < 0 || cpu >= CPU_SETSIZE)
+            return false;
+        CPU_SET(cpu, &set);
+    }
+    if (CPU_COUNT(&set) == 0)
+        return false;
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+int utils::CurrentNode() {
+    // sched_getcpu() is served by the vDSO, the nodes are looked up once
+    static const std::vector<int> nodes = []() {
+        std::vector<int> nodes(CPU_SETSIZE, -1);
+        for (int node = 0; node < NodeCount(); node++) {
+            for (int cpu : NodeCpus(node))
+                nodes[cpu] = node;
+        }
+        return nodes;
+    }();
+    int cpu = sched_getcpu();
+    if (cpu < 0 || cpu >= CPU_SETSIZE)
+        return -1;
+    return nodes[cpu];
+}
+
+static int readNode(const std::string &path) {
+    std::ifstream in(path);
+    int node = -1;
+    if (in >> node)
+        return node;
+    return -1;
+}
+
+int utils::VolumeNode(const std::string &path) {
+    struct stat sb;
+    if (stat(path.c_str(), &sb) != 0)
+        return -1;
+    std::string block = "/sys/dev/block/" + std::to_string(major(sb.st_dev))
+            + ":" + std::to_string(minor(sb.st_dev));
+    char *real = realpath(block.c_str(), nullptr);
+    if (real == nullptr)
+        return -1;
+    // Walk up from the partition to the controller of the disk
+    std::string dir = real;
+    free(real);
+    while (dir.size() > strlen("/sys/devices")) {
+        int node = readNode(dir + "/device/numa_node");
+        if (node < 0)
+            node = readNode(dir + "/numa_node");
+        if (node >= 0)
+            return node;
+        dir.resize(dir.rfind('/'));
+    }
+    return -1;
+}
+
+utils::NodeTraffic::Counts utils::NodeTraffic::Get(unsigned int node) const {
+    Counts counts;
+    if (node < kMaxNodes) {
+        counts.local = nodes[node].local.load(std::memory_order_relaxed);
+        counts.remote = nodes[node].remote.load(std::memory_order_relaxed);
+        counts.bytes = nodes[node].bytes.load(std::memory_order_relaxed);
+    }
+    return counts;
+}
+
+bool utils::PreferNode(int node) {
+    constexpr int kBits = 8 * sizeof(unsigned long);  // NOLINT
+    if (node < 0 || node >= 16 * kBits)
+        return false;
+    unsigned long mask[16] = {0};  // NOLINT
+    mask[node / kBits] = 1UL << (node % kBits);
+    return syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask,
+                   16 * kBits + 1) == 0;
+}
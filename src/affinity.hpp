@@ -0,0 +1,105 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#ifndef SRC_AFFINITY_HPP_
+#define SRC_AFFINITY_HPP_
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace utils {
+
+/**
+ * Parse a list of CPUs as found in /sys, e.g. "0-3,8,10-11".
+ * @return false if the list is malformed
+ */
+bool ParseCpuList(const std::string &value, std::vector<int> *cpus);
+
+/** @return the NUMA node of the CPU, or -1 if unknown */
+int CpuNode(int cpu);
+
+/** @return the CPUs of the NUMA node, empty if unknown */
+std::vector<int> NodeCpus(int node);
+
+/** @return the number of NUMA nodes, at least 1 */
+int NodeCount();
+
+/** Bind the calling thread to the CPU */
+bool PinThread(int cpu);
+/** Bind the calling thread to the set of CPUs */
+bool PinThread(const std::vector<int> &cpus);
+
+/** @return the NUMA node the calling thread runs on, -1 if unknown */
+int CurrentNode();
+
+/**
+ * Find the NUMA node of the controller of the disk holding the path,
+ * from the sysfs entry of its block device.
+ * @return the node, -1 if unknown (virtual devices, no NUMA)
+ */
+int VolumeNode(const std::string &path);
+
+/**
+ * Allocate the memory of the calling thread on the node, falling back on
+ * the other nodes when it is full.
+ */
+bool PreferNode(int node);
+
+/**
+ * I/O on the volumes of each NUMA node, split between the ones submitted
+ * by a thread of the same node (local) and from another node (remote).
+ */
+class NodeTraffic {
+ public:
+    static constexpr unsigned int kMaxNodes = 8;
+
+    struct Counts {
+        uint64_t local {0};
+        uint64_t remote {0};
+        uint64_t bytes {0};
+    };
+
+    /** Nothing is recorded for the volumes of unknown node */
+    inline void Record(int volumeNode, int threadNode, uint64_t bytes) {
+        if (volumeNode < 0 || volumeNode >= static_cast<int>(kMaxNodes))
+            return;
+        auto &node = nodes[volumeNode];
+        if (volumeNode == threadNode)
+            node.local.fetch_add(1, std::memory_order_relaxed);
+        else
+            node.remote.fetch_add(1, std::memory_order_relaxed);
+        node.bytes.fetch_add(bytes, std::memory_order_relaxed);
+    }
+    Counts Get(unsigned int node) const;
+
+ private:
+    struct Node {
+        std::atomic<uint64_t> local {0};
+        std::atomic<uint64_t> remote {0};
+        std::atomic<uint64_t> bytes {0};
+        char padding[64 - 3 * sizeof(uint64_t)];
+    };
+    std::array<Node, kMaxNodes> nodes;
+};
+
+}  // namespace utils
+
+#endif  // SRC_AFFINITY_HPP_
@@ -16,15 +16,30 @@
  * License along with this library.
  */
 #include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
 #include <cstdio>
 #include <cerrno>
+#include <cstring>
 #include <fstream>
+#include <mutex> // NOLINT
+#include <vector>
 #include "blob.hpp"
 
 using blob::Status;
 using blob::Cause;
+using blob::Codec;
+using blob::Mapping;
+using blob::FrameWriter;
+using blob::FrameReader;
 using blob::DiskUpload;
 using blob::DiskDownload;
 using blob::DiskRemoval;
@@ -46,54 +61,211 @@ int DiskUpload::makeParent(std::string path) {
 }
 
 /**
- * Check if the file not already existed
+ * A hidden name next to the chunk, unique to the upload: the scrubber and
+ * the GETs never see it
+ * @return an empty string if the path has no file name
+ */
+static std::string temporaryPath(const std::string &path) {
+    static std::atomic<uint64_t> sequence {0};
+    auto slash = path.rfind('/');
+    std::string name = slash == std::string::npos ? path
+            : path.substr(slash + 1);
+    if (name.empty())
+        return "";
+    return path.substr(0, path.size() - name.size()) + "." + name + "."
+            + std::to_string(getpid()) + "." + std::to_string(sequence++);
+}
+
+/**
+ * The pid in a name made by temporaryPath()
+ * @return -1 if the name isn't a temporary one
+ */
+static long temporaryOwner(const std::string &name) {
+    auto last = name.rfind('.');
+    if (name.empty() || name[0] != '.' || last == std::string::npos
+            || last < 2)
+        return -1;
+    auto middle = name.rfind('.', last - 1);
+    if (middle == std::string::npos || middle < 2 || last == middle + 1
+            || last - middle > 10 || last + 1 == name.size())
+        return -1;
+    for (auto i = middle + 1; i < name.size(); i++) {
+        if (i != last && !isdigit(static_cast<unsigned char>(name[i])))
+            return -1;
+    }
+    return std::stol(name.substr(middle + 1, last - middle - 1));
+}
+
+/** Unlink the temporary files of the other processes in dir */
+static unsigned int sweepDirectory(const std::string &dir, int depth) {
+    DIR *dh = opendir(dir.c_str());
+    if (dh == nullptr)
+        return 0;
+    unsigned int removed = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dh)) != nullptr) {
+        std::string name {entry->d_name};
+        std::string path = dir + "/" + name;
+        unsigned char type = entry->d_type;
+        if (type == DT_UNKNOWN) {
+            struct stat sb;
+            if (lstat(path.c_str(), &sb) != 0)
+                continue;
+            type = S_ISDIR(sb.st_mode) ? DT_DIR :
+                    (S_ISREG(sb.st_mode) ? DT_REG : DT_UNKNOWN);
+        }
+        if (type == DT_DIR && depth == 0 && name[0] != '.') {
+            removed += sweepDirectory(path, depth + 1);
+        } else if (type == DT_REG) {
+            long pid = temporaryOwner(name);
+            if (pid >= 0 && pid != getpid() && unlink(path.c_str()) == 0)
+                removed++;
+        }
+    }
+    closedir(dh);
+    return removed;
+}
+
+unsigned int blob::SweepUploads(const std::string &volume) {
+    return sweepDirectory(volume, 0);
+}
+
+/**
+ * Check if the file not already existed, to refuse the upload before its
+ * body (Commit() decides, another upload may create it meanwhile)
  * Create the path if not already created
- * Open the file for writing
+ * Create the temporary file for writing
  */
 Status DiskUpload::Prepare() {
-    makeParent(path);
-    struct stat sb;
-    if (stat(path.c_str(), &sb) == 0)
-        return Status(Cause::InternalError);
-    file = fopen(path.c_str(), "w");
-    if (file == NULL) {
-        return Status(Cause::InternalError);
+    {
+        utils::PhaseScope scope(trace, utils::Phase::Open);
+        makeParent(path);
+        struct stat sb;
+        if (stat(path.c_str(), &sb) == 0)
+            return Status(Cause::Already);
+        tmpPath = temporaryPath(path);
+        if (tmpPath.empty())
+            return Status(Cause::InternalError);
+        fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                  0666);
+        if (fd < 0) {
+            tmpPath.clear();
+            return Status(Cause::InternalError);
+        }
+        file = fdopen(fd, "w");
+        if (file == NULL) {
+            close(fd);
+            fd = -1;
+            unlink(tmpPath.c_str());
+            tmpPath.clear();
+            return Status(Cause::InternalError);
+        }
     }
-    fd = fileno(file);
+    if (codec != Codec::None)
+        frames.reset(new FrameWriter(codec, frameOptions));
+    utils::PhaseScope scope(trace, utils::Phase::XAttr);
     xattr->writeXAttr(fd);
     return Status();
 }
 
 /**
- * Finalise the write (flush) and push it to the non temporary place
+ * Finalise the write (flush) and push it to the non temporary place: the
+ * chunk appears complete, or not at all
+ * @return Cause::Already if another upload created the chunk meanwhile
  */
 Status DiskUpload::Commit() {
+    utils::PhaseScope scope(trace, utils::Phase::Commit);
+    if (frames) {
+        compressed.clear();
+        if (!frames->Finish(&compressed))
+            return Status(Cause::InternalError);
+        auto status = writeAll(compressed.data(), compressed.size());
+        if (!status.Ok())
+            return status;
+    }
+    // The attributes only known at the end (e.g. the size and the hash of
+    // a chunked upload), those written by Prepare() are kept
+    xattr->writeXAttr(fd);
     if (fflush(file) != 0)
         return Status(Cause::InternalError);
+    // Only clean pages can be dropped: write back the tail first
+    if (cache.Drop(std::max(expected, written))) {
+        sync_file_range(fd, previous, 0, SYNC_FILE_RANGE_WAIT_BEFORE
+                        | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+    // Unlike rename(), never replaces a chunk
+    if (link(tmpPath.c_str(), path.c_str()) != 0)
+        return Status(errno == EEXIST ? Cause::Already : Cause::InternalError);
+    unlink(tmpPath.c_str());
+    tmpPath.clear();
     return Status();
 }
 
 /**
- * Write the data to the file, the Write may be buffered
+ * Start the writeback of the bytes written since the last call, then wait
+ * for the one started by the previous call. The disk is kept busy while the
+ * dirty pages of the upload stay bounded, instead of piling up until the
+ * kernel flushes them all at once.
+ */
+void DiskUpload::writeback() {
+    if (fflush(file) != 0)
+        return;
+    sync_file_range(fd, started, written - started, SYNC_FILE_RANGE_WRITE);
+    if (started > previous) {
+        sync_file_range(fd, previous, started - previous,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE
+                        | SYNC_FILE_RANGE_WAIT_AFTER);
+        if (cache.Drop(std::max(expected, written)))
+            posix_fadvise(fd, previous, started - previous,
+                          POSIX_FADV_DONTNEED);
+    }
+    previous = started;
+    started = written;
+}
+
+/**
+ * Write the data to the file, the Write may be buffered. A compressed
+ * chunk only writes the frames completed.
  */
 Status DiskUpload::Write(std::shared_ptr<Slice> slice) {
-    int sizeSent = 0;
-    size_t rc;
-    do {
-        rc = fwrite(slice->data() - sizeSent, sizeof(char),
-                    slice->size() - sizeSent, file);
+    utils::PhaseScope scope(trace, utils::Phase::Write);
+    if (!frames)
+        return writeAll(slice->data(), slice->size());
+    compressed.clear();
+    if (!frames->Write(slice->data(), slice->size(), &compressed))
+        return Status(Cause::InternalError);
+    return writeAll(compressed.data(), compressed.size());
+}
+
+Status DiskUpload::writeAll(const uint8_t *data, size_t length) {
+    size_t sizeSent = 0;
+    while (sizeSent < length) {
+        size_t rc = fwrite(data + sizeSent, sizeof(char), length - sizeSent,
+                           file);
+        if (rc == 0)
+            return Status(Cause::InternalError);
         sizeSent += rc;
-    }while (sizeSent != slice->size());
+    }
+    written += sizeSent;
+    if (cache.writeback > 0 && written - started >= cache.writeback)
+        writeback();
     return Status();
 }
 
 
 /**
- * Stop the writing and delete the temporary file
+ * Stop the writing and delete the temporary file, unless committed
  */
 Status DiskUpload::Abort() {
-    if (file != NULL)
+    if (file != NULL) {
         fclose(file);
+        file = NULL;
+    }
+    if (!tmpPath.empty()) {
+        unlink(tmpPath.c_str());
+        tmpPath.clear();
+    }
     return Status();
 }
 
@@ -102,23 +274,88 @@ Status DiskUpload::Abort() {
  * and read the xattr attribute
  */
 Status DiskDownload::Prepare() {
-    file = fopen(path.c_str(), "r");
+    {
+        utils::PhaseScope scope(trace, utils::Phase::Open);
+        file = fopen(path.c_str(), "r");
+    }
     if (file == NULL)
         return Status(Cause::InternalError);
 
     if (begin > -1 )
         if (fseek(file, begin, SEEK_SET) != 0)
             return Status(Cause::InternalError);
+    position = std::max(begin, 0);
 
     fd = fileno(file);
-    xattr->retrieveXAttr(fd);
+    {
+        utils::PhaseScope scope(trace, utils::Phase::XAttr);
+        xattr->retrieveXAttr(fd);
+    }
+    struct stat sb;
+    if (fstat(fd, &sb) != 0)
+        return Status(Cause::InternalError);
+    fileSize = storedSize = sb.st_size;
+    if (ChunkCodec(xattr->Get(utils::Attr::ContentChunkMethod))
+            != Codec::None) {
+        frames = std::make_shared<FrameReader>();
+        auto status = frames->Open(fd, storedSize);
+        if (!status.Ok())
+            return status;
+        fileSize = frames->PlainSize();
+        advise(fileSize);
+        frames->DropBehind(drop);
+        return Status();
+    }
+    if (fileSize > 0 && fileSize < cache.mapBelow && !cache.Drop(fileSize))
+        mapping = Mapping::Map(fd, fileSize);
+    if (!mapping)
+        advise(fileSize);
     return Status();
 }
 
+void DiskDownload::Stored() {
+    if (!frames)
+        return;
+    stored = true;
+    fileSize = storedSize;
+}
+
+/**
+ * Short ranges are random reads, where the read-ahead only wastes the
+ * disk and the cache. Anything else is read sequentially, and its first
+ * bytes are prefetched.
+ */
+void DiskDownload::advise(uint64_t size) {
+    uint64_t length = 0;
+    if (static_cast<uint64_t>(position) < size)
+        length = size - position;
+    if (end > -1)
+        length = std::min<uint64_t>(length, end + 1 - position);
+    drop = cache.Drop(size);
+    if (begin > -1 && length < cache.randomBelow) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+    } else if (cache.readahead > 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        uint64_t from = position;
+        // The frames holding the plain bytes of a compressed chunk
+        if (frames) {
+            from = frames->StoredOffset(position);
+            length = frames->StoredOffset(position + length
+                                          + frames->FrameSize() - 1) - from;
+        }
+        posix_fadvise(fd, from, std::min(length, cache.readahead),
+                      POSIX_FADV_WILLNEED);
+    }
+}
+
 /**
  * Check if there still are data to read
  */
 bool DiskDownload::isEof() {
+    if (end > -1 && position > end)
+        return true;
+    if (frames && !stored)
+        return static_cast<uint64_t>(position) >= fileSize;
     return feof(file);
 }
 
@@ -128,7 +365,6 @@ bool DiskDownload::setRange(int begin, int end) {
 
     this->begin = begin;
     this->end = end;
-    buffer_size = end - begin;
     return true;
 }
 
@@ -146,14 +382,48 @@ bool DiskDownload::setRange(std::string bytesRange) {
  * Read the data and fill the Slice
  */
 Status DiskDownload::Read(std::shared_ptr<Slice> slice) {
+    utils::PhaseScope scope(trace, utils::Phase::Read);
+    int size = buffer_size;
+    if (end > -1)
+        size = std::min(size, end + 1 - position);
     // FIXME(KR) this allocation can be problematic
-    char *buffer = new char(buffer_size);
-    int tmp_read = fread(buffer, sizeof(char), buffer_size, file);
-    if (tmp_read == 0) {
-        delete buffer;
+    std::vector<uint8_t> buffer(size);
+    if (frames && !stored) {
+        uint32_t got = 0;
+        auto status = frames->ReadAt(position, buffer.data(), size, &got);
+        if (!status.Ok())
+            return status;
+        position += got;
+        slice->append(buffer.data(), got);
+        return Status();
+    }
+    int tmp_read = fread(buffer.data(), sizeof(char), size, file);
+    if (tmp_read == 0 && ferror(file))
         return Status(Cause::InternalError);
+    position += tmp_read;
+    if (drop && tmp_read > 0)
+        posix_fadvise(fd, position - tmp_read, tmp_read, POSIX_FADV_DONTNEED);
+    slice->append(buffer.data(), tmp_read);
+    return Status();
+}
+
+Status DiskDownload::ReadAt(uint64_t offset, uint8_t *buffer,
+                            uint32_t length, uint32_t *got) {
+    if (frames && !stored)
+        return frames->ReadAt(offset, buffer, length, got);
+    *got = 0;
+    while (*got < length) {
+        ssize_t rc = pread(fd, buffer + *got, length - *got, offset + *got);
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc < 0)
+            return Status(Cause::InternalError);
+        if (rc == 0)
+            break;
+        *got += rc;
     }
-    slice->append(reinterpret_cast<uint8_t *>(buffer), tmp_read);
+    if (drop && *got > 0)
+        posix_fadvise(fd, offset, *got, POSIX_FADV_DONTNEED);
     return Status();
 }
 
@@ -161,13 +431,136 @@ Status DiskDownload::Read(std::shared_ptr<Slice> slice) {
  * Stop reading and close the  file handler
  */
 Status DiskDownload::Abort() {
+    mapping = nullptr;
+    if (file != NULL) {
+        fclose(file);
+        file = NULL;
+    }
     return Status();
 }
 
+namespace {
+
+/**
+ * Address range of each live mapping, read by the SIGBUS handler: only
+ * atomics, no lock.
+ */
+struct MappingGuard {
+    std::atomic<bool> used {false};
+    std::atomic<uintptr_t> start {0};
+    std::atomic<uintptr_t> end {0};
+    std::atomic<bool> truncated {false};
+};
+
+std::array<MappingGuard, Mapping::kMaxMappings> guards;
+struct sigaction previousSigbus;
+uintptr_t pageSize = 4096;
+std::once_flag sigbusInstalled;
+
+/**
+ * A fault in a mapped chunk means the chunk was truncated: the pages from
+ * the faulting one to the end of the mapping are replaced by anonymous
+ * zero pages and the access is retried. Any other fault goes to the
+ * previous handler.
+ */
+void onSigbus(int sig, siginfo_t *info, void *context) {
+    auto addr = reinterpret_cast<uintptr_t>(info->si_addr);
+    for (auto &guard : guards) {
+        uintptr_t start = guard.start.load();
+        uintptr_t end = guard.end.load();
+        if (start == 0 || addr < start || addr >= end)
+            continue;
+        uintptr_t page = addr & ~(pageSize - 1);
+        void *zeros = mmap(reinterpret_cast<void *>(page), end - page,
+                           PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+                           -1, 0);
+        if (zeros != MAP_FAILED) {
+            guard.truncated = true;
+            return;
+        }
+        break;
+    }
+    if ((previousSigbus.sa_flags & SA_SIGINFO)
+            && previousSigbus.sa_sigaction != nullptr) {
+        previousSigbus.sa_sigaction(sig, info, context);
+    } else if (previousSigbus.sa_handler != SIG_DFL
+            && previousSigbus.sa_handler != SIG_IGN) {
+        previousSigbus.sa_handler(sig);
+    } else {
+        // The access is retried and kills the process, as without handler
+        signal(SIGBUS, SIG_DFL);
+    }
+}
+
+void installSigbus() {
+    long size = sysconf(_SC_PAGESIZE);
+    if (size > 0)
+        pageSize = size;
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = onSigbus;
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGBUS, &action, &previousSigbus);
+}
+
+}  // namespace
+
+std::shared_ptr<Mapping> Mapping::Map(int fd, uint64_t size) {
+    if (size == 0)
+        return nullptr;
+    std::call_once(sigbusInstalled, installSigbus);
+    void *addr = mmap(nullptr, size, PROT_READ, MAP_SHARED | MAP_POPULATE,
+                      fd, 0);
+    if (addr == MAP_FAILED)
+        return nullptr;
+    std::shared_ptr<Mapping> mapping(
+        new Mapping(static_cast<uint8_t *>(addr), size));
+    for (unsigned int i = 0; i < kMaxMappings; i++) {
+        bool used = false;
+        if (!guards[i].used.compare_exchange_strong(used, true))
+            continue;
+        auto start = reinterpret_cast<uintptr_t>(addr);
+        guards[i].truncated = false;
+        guards[i].end = (start + size + pageSize - 1) & ~(pageSize - 1);
+        guards[i].start = start;
+        mapping->guard = i;
+        return mapping;
+    }
+    // Unguarded, a truncation would kill the process
+    return nullptr;
+}
+
+Mapping::~Mapping() {
+    if (guard >= 0) {
+        guards[guard].start = 0;
+        guards[guard].end = 0;
+        guards[guard].used = false;
+    }
+    munmap(base, size);
+}
+
+bool Mapping::Truncated() const {
+    return guard >= 0 && guards[guard].truncated;
+}
+
+bool Mapping::Touch(uint64_t offset, uint64_t length) const {
+    if (offset >= size)
+        return length == 0;
+    uint64_t last = std::min(offset + length, size);
+    volatile uint8_t sink = 0;
+    for (uint64_t at = offset; at < last; at += pageSize)
+        sink = sink + base[at];
+    if (last > offset)
+        sink = sink + base[last - 1];
+    return !Truncated();
+}
+
 /**
  * Search if the file exist and that we can delete it
  */
 Status DiskRemoval::Prepare() {
+    utils::PhaseScope scope(trace, utils::Phase::Open);
     struct stat sb;
     if (stat(path.c_str(), &sb) != 0)
         return Status(Cause::InternalError);
@@ -178,6 +571,7 @@ Status DiskRemoval::Prepare() {
  * Remove the file
  */
 Status DiskRemoval::Commit() {
+    utils::PhaseScope scope(trace, utils::Phase::Remove);
     if (remove(path.c_str()))
         return Status(Cause::InternalError);
     return Status();
@@ -19,9 +19,11 @@
 #ifndef SRC_BLOB_HPP_
 #define SRC_BLOB_HPP_
 
+#include <algorithm>
 #include <memory>
 #include <string>
 #include <vector>
+#include "compress.hpp"
 #include "utils.hpp"
 
 namespace blob {
@@ -37,7 +39,9 @@ enum class Cause {
     NetworkError,
     ProtocolError,
     Unsupported,
-    InternalError
+    Corrupted,
+    InternalError,
+    Interrupted
 };
 
 enum class TransactionStep {
@@ -148,7 +152,7 @@ class Slice {
 
 class FileSlice : public Slice {
  public:
-    FileSlice();
+    FileSlice() {}
     FileSlice(uint8_t* data, uint64_t length ) {
         append(data, (uint32_t) length);
     }
@@ -165,6 +169,41 @@ class FileSlice : public Slice {
     std::vector<uint8_t> inner;
 };
 
+/**
+ * Page cache hints given to the kernel for one transfer. They never change
+ * the data read or written, only what stays in the cache and when the
+ * dirty pages are written back.
+ */
+struct CachePolicy {
+    /**
+     * Sequential read-ahead, and prefetch (WILLNEED) of the first bytes of
+     * the transfer when it starts. 0 leaves the kernel heuristics.
+     */
+    uint64_t readahead {4 << 20};
+    /** Ranges shorter than this disable the read-ahead, 0 for never */
+    uint64_t randomBelow {256 << 10};
+    /** Drop the pages behind every transfer: cold data */
+    bool dropBehind {false};
+    /** Drop the pages behind the transfers of larger chunks, 0 for never */
+    uint64_t dropAbove {64 << 20};
+    /**
+     * Start the writeback every `writeback` bytes written and wait for the
+     * previous one: an upload never holds more than twice as much dirty
+     * pages. 0 leaves the writeback to the kernel.
+     */
+    uint64_t writeback {8 << 20};
+    /**
+     * Chunks smaller than this are mapped and sent from the page cache
+     * without any copy, 0 for never
+     */
+    uint64_t mapBelow {256 << 10};
+
+    /** @return true if the pages of a chunk of this size are dropped */
+    inline bool Drop(uint64_t size) const {
+        return dropBehind || (dropAbove > 0 && size >= dropAbove);
+    }
+};
+
 class Upload {
  public:
     virtual Status Prepare() = 0;
@@ -194,39 +233,157 @@ class DiskUpload : public Upload {
     explicit DiskUpload(std::string path) : path{path} {}
     inline void Path(std::string path) {this->path = path;}
     inline void XAttr(utils::XAttr *xattr) {this->xattr = xattr;}
+    inline void Trace(utils::PhaseTrace *trace) {this->trace = trace;}
+    inline void Cache(const CachePolicy &cache) {this->cache = cache;}
+    /** Size announced by the client, 0 if unknown */
+    inline void ExpectedSize(uint64_t size) {expected = size;}
+    /** Store the chunk in frames of the codec, None to store it as is */
+    inline void Compression(Codec codec, const FrameOptions &options) {
+        this->codec = codec;
+        frameOptions = options;
+    }
+    /** The compressor of the chunk once prepared, null if stored as is */
+    inline const FrameWriter *Frames() const { return frames.get(); }
     Status Prepare() override;
     Status Commit() override;
     Status Write(std::shared_ptr<Slice>) override;
     Status Abort() override;
  private:
     utils::XAttr *xattr;
+    utils::PhaseTrace *trace {nullptr};
     int fd {-1};
     int makeParent(std::string path);
+    void writeback();
+    Status writeAll(const uint8_t *data, size_t length);
+    Codec codec {Codec::None};
+    FrameOptions frameOptions;
+    std::unique_ptr<FrameWriter> frames;
+    /** The frames completed by a write, kept from a write to the next */
+    std::vector<uint8_t> compressed;
+    CachePolicy cache;
+    uint64_t expected {0};
+    uint64_t written {0};
+    /** Start of the writeback before the last one, and of the last one */
+    uint64_t previous {0};
+    uint64_t started {0};
     std::string tmpPath;
     std::string path;
     FILE *file {NULL};
     mode_t mode {0755};
 };
 
+/**
+ * Read-only mapping of a chunk, populated when mapped and unmapped with its
+ * last reference.
+ * Reading a page the file doesn't back anymore (truncated chunk) raises no
+ * SIGBUS: the missing pages read as zeros and the mapping is marked as
+ * Truncated(). A process maps at most kMaxMappings chunks at once.
+ */
+class Mapping {
+ public:
+    static constexpr unsigned int kMaxMappings = 1024;
+
+    /** @return null if the chunk cannot be mapped */
+    static std::shared_ptr<Mapping> Map(int fd, uint64_t size);
+    ~Mapping();
+    Mapping(const Mapping&) = delete;
+    Mapping& operator=(const Mapping&) = delete;
+
+    inline uint8_t *Data() const { return base; }
+    inline uint64_t Size() const { return size; }
+    bool Truncated() const;
+    /**
+     * Fault the pages of a range in now, so that sending them doesn't wait
+     * for the disk.
+     * @return false if the range isn't backed by the chunk anymore
+     */
+    bool Touch(uint64_t offset, uint64_t length) const;
+
+ private:
+    Mapping(uint8_t *base, uint64_t size) : base{base}, size{size} {}
+
+    uint8_t *base;
+    uint64_t size;
+    /** Index of the guard of the mapping, -1 if none */
+    int guard {-1};
+};
+
 class DiskDownload : public Download {
  public:
     DiskDownload() {}
     inline void Path(std::string path) {this->path = path;}
     inline void XAttr(utils::XAttr *xattr) {this->xattr = xattr;}
+    inline void Trace(utils::PhaseTrace *trace) {this->trace = trace;}
     bool setRange(std::string bytesRange);
     bool setRange(int begin, int end);
+    /** Serve the whole chunk again */
+    inline void resetRange() { begin = end = -1; }
+    inline bool Ranged() const { return begin > -1; }
+    inline int BufferSize() const { return buffer_size; }
+    inline void BufferSize(int size) { buffer_size = size; }
+    inline void Cache(const CachePolicy &cache) {this->cache = cache;}
     Status Prepare() override;
     bool isEof() override;
     Status Read(std::shared_ptr<Slice>) override;
     Status Abort() override;
+
+    /** Size of the chunk, once prepared */
+    inline uint64_t Size() const { return fileSize; }
+    /** Offset of the first byte to send, once prepared */
+    inline uint64_t Start() const { return std::max(begin, 0); }
+    /** Offset past the last byte to send, once prepared */
+    inline uint64_t Stop() const {
+        if (end > -1)
+            return std::min<uint64_t>(end + 1, fileSize);
+        return fileSize;
+    }
+    /**
+     * Read at an offset with pread(), several threads may read at once
+     * once prepared. The tracing is left to the caller.
+     * @param got the bytes read, less than length at the end of the file
+     */
+    Status ReadAt(uint64_t offset, uint8_t *buffer, uint32_t length,
+                  uint32_t *got);
+    /**
+     * The mapping of the chunk once prepared, if it is small enough (see
+     * CachePolicy::mapBelow) and its pages aren't dropped, otherwise null.
+     * A compressed chunk is never mapped.
+     */
+    inline std::shared_ptr<const Mapping> Mapped() const { return mapping; }
+    /**
+     * The seek table of the chunk once prepared if it is compressed (its
+     * chunk method names a codec), otherwise null. The sizes and the
+     * offsets are those of the plain bytes.
+     */
+    inline std::shared_ptr<const FrameReader> Frames() const {
+        return frames;
+    }
+    /**
+     * Serve a compressed chunk as stored, a valid stream of its codec: the
+     * sizes and the offsets become those of the file
+     */
+    void Stored();
+
  private:
+    void advise(uint64_t size);
+
     utils::XAttr *xattr;
+    utils::PhaseTrace *trace {nullptr};
+    CachePolicy cache;
+    bool drop {false};
+    uint64_t fileSize {0};
+    /** Size of the file, fileSize is the plain size of a compressed one */
+    uint64_t storedSize {0};
+    std::shared_ptr<const Mapping> mapping;
+    std::shared_ptr<FrameReader> frames;
+    bool stored {false};
     int fd {-1};
     int begin {-1};
     int end {-1};
+    int position {0};
     std::string path;
     FILE *file {NULL};
-    int buffer_size {-1};
+    int buffer_size {65536};
 };
 
 class DiskRemoval : public Removal {
@@ -234,15 +391,25 @@ class DiskRemoval : public Removal {
     DiskRemoval() {}
     inline void Path(std::string path) {this->path = path;}
     inline void XAttr(utils::XAttr *xattr) {this->xattr = xattr;}
+    inline void Trace(utils::PhaseTrace *trace) {this->trace = trace;}
     Status Prepare() override;
     Status Commit() override;
     Status Abort() override;
  private:
     utils::XAttr *xattr;
+    utils::PhaseTrace *trace {nullptr};
     int fd {-1};
     std::string path;
     FILE *file {NULL};
 };
+
+/**
+ * Remove the temporary files that the uploads of another process left in
+ * a volume and its fan-out directories, when it died before their
+ * Commit() or Abort().
+ * @return the number of files removed
+ */
+unsigned int SweepUploads(const std::string &volume);
 }  // namespace blob
 
 #endif  // SRC_BLOB_HPP_
@@ -0,0 +1,370 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <lz4frame.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <zstd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "blob.hpp"
+#include "compress.hpp"
+
+using blob::Status;
+using blob::Cause;
+using blob::Codec;
+using blob::FrameOptions;
+using blob::FrameWriter;
+using blob::FrameReader;
+
+static constexpr uint8_t kSeekTableVersion = 1;
+
+const char *blob::CodecName(Codec codec) {
+    switch (codec) {
+        case Codec::None:
+            return "identity";
+        case Codec::Lz4:
+            return "lz4";
+        case Codec::Zstd:
+            return "zstd";
+    }
+    return "unknown";
+}
+
+bool blob::CodecParse(const std::string &value, Codec *codec) {
+    for (auto known : {Codec::None, Codec::Lz4, Codec::Zstd}) {
+        if (strcasecmp(value.c_str(), CodecName(known)) == 0) {
+            *codec = known;
+            return true;
+        }
+    }
+    return false;
+}
+
+Codec blob::ChunkCodec(const std::string &method) {
+    auto slash = method.find('/');
+    if (slash == std::string::npos)
+        return Codec::None;
+    size_t start = slash + 1;
+    while (start < method.size()) {
+        auto comma = method.find(',', start);
+        if (comma == std::string::npos)
+            comma = method.size();
+        auto param = method.substr(start, comma - start);
+        auto equal = param.find('=');
+        Codec codec = Codec::None;
+        if (equal != std::string::npos
+                && param.compare(0, equal, "compression") == 0
+                && CodecParse(param.substr(equal + 1), &codec))
+            return codec;
+        start = comma + 1;
+    }
+    return Codec::None;
+}
+
+namespace {
+
+uint64_t cpuNanos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void put32(std::vector<uint8_t> *out, uint32_t value) {
+    for (int i = 0; i < 4; i++)
+        out->push_back(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+void put64(std::vector<uint8_t> *out, uint64_t value) {
+    for (int i = 0; i < 8; i++)
+        out->push_back(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+uint32_t get32(const uint8_t *in) {
+    uint32_t value = 0;
+    for (int i = 3; i >= 0; i--)
+        value = (value << 8) | in[i];
+    return value;
+}
+
+uint64_t get64(const uint8_t *in) {
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; i--)
+        value = (value << 8) | in[i];
+    return value;
+}
+
+bool readAll(int fd, uint8_t *buffer, size_t length, uint64_t offset) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t rc = pread(fd, buffer + done, length - done, offset + done);
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc <= 0)
+            return false;
+        done += rc;
+    }
+    return true;
+}
+
+/** The decompression contexts of a thread, kept from a frame to the next */
+struct Decoders {
+    ~Decoders() {
+        ZSTD_freeDCtx(zstd);
+        if (lz4 != nullptr)
+            LZ4F_freeDecompressionContext(lz4);
+    }
+    ZSTD_DCtx *zstd {nullptr};
+    LZ4F_dctx *lz4 {nullptr};
+};
+
+thread_local Decoders decoders;
+
+bool decompressLz4(const uint8_t *src, size_t srcLength, uint8_t *dst,
+                   size_t length) {
+    if (decoders.lz4 == nullptr && LZ4F_isError(
+            LZ4F_createDecompressionContext(&decoders.lz4, LZ4F_VERSION))) {
+        decoders.lz4 = nullptr;
+        return false;
+    }
+    size_t made = 0;
+    size_t used = 0;
+    size_t rc = 1;
+    while (rc != 0 && used < srcLength) {
+        size_t dstSize = length - made;
+        size_t srcSize = srcLength - used;
+        rc = LZ4F_decompress(decoders.lz4, dst + made, &dstSize, src + used,
+                             &srcSize, nullptr);
+        if (LZ4F_isError(rc) || (dstSize == 0 && srcSize == 0))
+            break;
+        made += dstSize;
+        used += srcSize;
+    }
+    if (rc == 0 && made == length)
+        return true;
+    // Truncated or corrupted: the next frame starts afresh
+    LZ4F_resetDecompressionContext(decoders.lz4);
+    return false;
+}
+
+/** @return false unless the frame decompresses to exactly length bytes */
+bool decompress(Codec codec, const uint8_t *src, size_t srcLength,
+                uint8_t *dst, size_t length) {
+    switch (codec) {
+        case Codec::Zstd: {
+            if (decoders.zstd == nullptr)
+                decoders.zstd = ZSTD_createDCtx();
+            if (decoders.zstd == nullptr)
+                return false;
+            size_t rc = ZSTD_decompressDCtx(decoders.zstd, dst, length, src,
+                                            srcLength);
+            return !ZSTD_isError(rc) && rc == length;
+        }
+        case Codec::Lz4:
+            return decompressLz4(src, srcLength, dst, length);
+        case Codec::None:
+            break;
+    }
+    return false;
+}
+
+}  // namespace
+
+FrameWriter::FrameWriter(Codec codec, FrameOptions options)
+        : codec{codec}, options{options} {
+    if (this->options.frameSize == 0)
+        this->options.frameSize = FrameOptions().frameSize;
+    if (codec == Codec::Zstd)
+        context = ZSTD_createCCtx();
+    frame.reserve(this->options.frameSize);
+}
+
+FrameWriter::~FrameWriter() {
+    if (codec == Codec::Zstd)
+        ZSTD_freeCCtx(static_cast<ZSTD_CCtx *>(context));
+}
+
+bool FrameWriter::Write(const uint8_t *data, size_t length,
+                        std::vector<uint8_t> *out) {
+    plain += length;
+    while (length > 0) {
+        // A whole frame in the data is compressed from there
+        if (frame.empty() && length >= options.frameSize) {
+            if (!compress(data, options.frameSize, out))
+                return false;
+            data += options.frameSize;
+            length -= options.frameSize;
+            continue;
+        }
+        size_t taken = std::min<size_t>(length,
+                                        options.frameSize - frame.size());
+        frame.insert(frame.end(), data, data + taken);
+        data += taken;
+        length -= taken;
+        if (frame.size() == options.frameSize) {
+            if (!compress(frame.data(), frame.size(), out))
+                return false;
+            frame.clear();
+        }
+    }
+    return true;
+}
+
+bool FrameWriter::Finish(std::vector<uint8_t> *out) {
+    if (!frame.empty()) {
+        if (!compress(frame.data(), frame.size(), out))
+            return false;
+        frame.clear();
+    }
+    size_t start = out->size();
+    uint32_t content = sizes.size() * 4 + kFooterSize;
+    put32(out, kSkippableMagic);
+    put32(out, content);
+    for (auto size : sizes)
+        put32(out, size);
+    put32(out, sizes.size());
+    put32(out, options.frameSize);
+    put64(out, plain);
+    out->push_back(static_cast<uint8_t>(codec));
+    out->push_back(kSeekTableVersion);
+    out->push_back(0);
+    out->push_back(0);
+    put32(out, kSeekTableMagic);
+    stored += out->size() - start;
+    return true;
+}
+
+bool FrameWriter::compress(const uint8_t *data, size_t length,
+                           std::vector<uint8_t> *out) {
+    uint64_t start = cpuNanos();
+    size_t offset = out->size();
+    size_t made = 0;
+    bool ok = false;
+    if (codec == Codec::Zstd && context != nullptr) {
+        size_t bound = ZSTD_compressBound(length);
+        out->resize(offset + bound);
+        made = ZSTD_compressCCtx(static_cast<ZSTD_CCtx *>(context),
+                                 out->data() + offset, bound, data, length,
+                                 options.level != 0 ? options.level
+                                 : ZSTD_CLEVEL_DEFAULT);
+        ok = !ZSTD_isError(made);
+    } else if (codec == Codec::Lz4) {
+        LZ4F_preferences_t prefs;
+        memset(&prefs, 0, sizeof(prefs));
+        prefs.frameInfo.contentSize = length;
+        prefs.compressionLevel = options.level;
+        size_t bound = LZ4F_compressFrameBound(length, &prefs);
+        out->resize(offset + bound);
+        made = LZ4F_compressFrame(out->data() + offset, bound, data, length,
+                                  &prefs);
+        ok = !LZ4F_isError(made);
+    }
+    out->resize(ok ? offset + made : offset);
+    nanos += cpuNanos() - start;
+    if (!ok)
+        return false;
+    sizes.push_back(made);
+    stored += made;
+    return true;
+}
+
+Status FrameReader::Open(int fd, uint64_t fileSize) {
+    this->fd = fd;
+    uint8_t footer[kFooterSize];
+    if (fileSize < kFooterSize + 8
+            || !readAll(fd, footer, kFooterSize, fileSize - kFooterSize))
+        return Status(Cause::Corrupted);
+    uint64_t frames = get32(footer);
+    frameSize = get32(footer + 4);
+    plain = get64(footer + 8);
+    codec = static_cast<Codec>(footer[16]);
+    if (get32(footer + 20) != kSeekTableMagic
+            || footer[17] != kSeekTableVersion
+            || (codec != Codec::Lz4 && codec != Codec::Zstd)
+            || frameSize == 0
+            || frames != (plain + frameSize - 1) / frameSize
+            || frames * 4 + kFooterSize + 8 > fileSize)
+        return Status(Cause::Corrupted);
+    uint64_t tableSize = frames * 4 + kFooterSize;
+    uint64_t tableStart = fileSize - tableSize - 8;
+    std::vector<uint8_t> table(frames * 4 + 8);
+    if (!readAll(fd, table.data(), table.size(), tableStart))
+        return Status(Cause::Corrupted);
+    if (get32(table.data()) != kSkippableMagic
+            || get32(table.data() + 4) != tableSize)
+        return Status(Cause::Corrupted);
+    offsets.clear();
+    offsets.reserve(frames + 1);
+    offsets.push_back(0);
+    for (uint64_t i = 0; i < frames; i++)
+        offsets.push_back(offsets.back() + get32(table.data() + 8 + i * 4));
+    if (offsets.back() != tableStart)
+        return Status(Cause::Corrupted);
+    return Status();
+}
+
+/**
+ * A frame wholly in the range is decompressed in place, the frames at its
+ * edges in a buffer of their own.
+ */
+Status FrameReader::ReadAt(uint64_t offset, uint8_t *buffer,
+                           uint32_t length, uint32_t *got) {
+    *got = 0;
+    if (offset >= plain || length == 0)
+        return Status();
+    uint64_t last = std::min<uint64_t>(offset + length, plain);
+    std::vector<uint8_t> src;
+    std::vector<uint8_t> edge;
+    uint64_t spent = 0;
+    for (uint64_t index = offset / frameSize;
+            index * frameSize < last; index++) {
+        uint64_t start = index * frameSize;
+        uint64_t size = std::min<uint64_t>(frameSize, plain - start);
+        uint64_t from = offsets[index];
+        src.resize(offsets[index + 1] - from);
+        if (!readAll(fd, src.data(), src.size(), from))
+            return Status(Cause::InternalError);
+        if (drop)
+            posix_fadvise(fd, from, src.size(), POSIX_FADV_DONTNEED);
+        bool whole = start >= offset && start + size <= last;
+        if (!whole)
+            edge.resize(size);
+        uint8_t *dst = whole ? buffer + (start - offset) : edge.data();
+        uint64_t begin = cpuNanos();
+        bool ok = decompress(codec, src.data(), src.size(), dst, size);
+        spent += cpuNanos() - begin;
+        if (!ok) {
+            nanos += spent;
+            return Status(Cause::Corrupted);
+        }
+        if (!whole) {
+            uint64_t first = std::max(start, offset);
+            uint64_t end = std::min(start + size, last);
+            memcpy(buffer + (first - offset), edge.data() + (first - start),
+                   end - first);
+        }
+    }
+    nanos += spent;
+    *got = last - offset;
+    return Status();
+}
@@ -0,0 +1,164 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#ifndef SRC_COMPRESS_HPP_
+#define SRC_COMPRESS_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace blob {
+
+class Status;
+
+/** Compression of a chunk at rest */
+enum class Codec : uint8_t {
+    None, Lz4, Zstd
+};
+
+/** @return the name of the codec, also its HTTP content-coding */
+const char *CodecName(Codec codec);
+
+/** @return false if the value doesn't name a codec */
+bool CodecParse(const std::string &value, Codec *codec);
+
+/**
+ * The codec asked by the "compression" parameter of a chunk method, e.g.
+ * "plain/nb_copy=3,compression=zstd". None without parameter or for an
+ * unknown codec: the chunk is stored as is.
+ */
+Codec ChunkCodec(const std::string &method);
+
+struct FrameOptions {
+    /** Plain bytes per frame, the unit of decompression of a range */
+    uint32_t frameSize {128 << 10};
+    /** 0 for the default level of the codec */
+    int level {0};
+};
+
+/**
+ * A compressed chunk is a sequence of frames, each made of frameSize plain
+ * bytes (the last one shorter) compressed on their own, followed by their
+ * seek table in a skippable frame: the file is a valid zstd (or LZ4) stream
+ * as a whole, and a range only decompresses the frames it overlaps.
+ * The seek table holds the compressed size of each frame, then a footer of
+ * kFooterSize bytes: the count of frames, frameSize, the plain size, the
+ * codec and a version, all little-endian.
+ */
+constexpr uint32_t kSkippableMagic = 0x184D2A5E;
+constexpr uint32_t kSeekTableMagic = 0x58574152;
+constexpr uint32_t kFooterSize = 24;
+
+/**
+ * Compresses the plain bytes as they come, frame by frame. Not thread-safe:
+ * one writer per upload.
+ */
+class FrameWriter {
+ public:
+    FrameWriter(Codec codec, FrameOptions options);
+    ~FrameWriter();
+    FrameWriter(const FrameWriter&) = delete;
+    FrameWriter& operator=(const FrameWriter&) = delete;
+
+    /**
+     * Append plain bytes, the frames they complete are appended to out
+     * @return false if the codec failed
+     */
+    bool Write(const uint8_t *data, size_t length, std::vector<uint8_t> *out);
+    /** Append the last frame and the seek table to out */
+    bool Finish(std::vector<uint8_t> *out);
+
+    inline uint64_t PlainBytes() const { return plain; }
+    /** Bytes of the frames and of the seek table appended so far */
+    inline uint64_t StoredBytes() const { return stored; }
+    /** CPU time spent compressing */
+    inline uint64_t Nanos() const { return nanos; }
+
+ private:
+    bool compress(const uint8_t *data, size_t length,
+                  std::vector<uint8_t> *out);
+
+    const Codec codec;
+    FrameOptions options;
+    void *context {nullptr};
+    /** Plain bytes of the frame being filled */
+    std::vector<uint8_t> frame;
+    std::vector<uint32_t> sizes;
+    uint64_t plain {0};
+    uint64_t stored {0};
+    uint64_t nanos {0};
+};
+
+/**
+ * Reads the plain bytes of a compressed chunk through its seek table.
+ * ReadAt() may be called by several threads at once.
+ */
+class FrameReader {
+ public:
+    FrameReader() {}
+    FrameReader(const FrameReader&) = delete;
+    FrameReader& operator=(const FrameReader&) = delete;
+
+    /**
+     * Load the seek table at the end of the file
+     * @return Corrupted if the file doesn't end with a valid one
+     */
+    Status Open(int fd, uint64_t fileSize);
+    /** Drop the pages of the frames once decompressed */
+    inline void DropBehind(bool drop) { this->drop = drop; }
+
+    inline Codec Compression() const { return codec; }
+    inline uint64_t PlainSize() const { return plain; }
+    inline uint32_t FrameSize() const { return frameSize; }
+    inline size_t Frames() const { return offsets.size() - 1; }
+    /**
+     * @return the offset in the file of the frame holding a plain byte, the
+     * end of the frames past the plain size
+     */
+    inline uint64_t StoredOffset(uint64_t offset) const {
+        return offsets[std::min<uint64_t>(offset / frameSize, Frames())];
+    }
+    /** CPU time spent decompressing, by all the readers */
+    inline uint64_t Nanos() const { return nanos.load(); }
+
+    /**
+     * Read plain bytes, only the frames overlapping the range are read and
+     * decompressed
+     * @param got the bytes read, less than length at the end of the chunk
+     * @return Corrupted if a frame doesn't decompress to its size
+     */
+    Status ReadAt(uint64_t offset, uint8_t *buffer, uint32_t length,
+                  uint32_t *got);
+
+ private:
+    int fd {-1};
+    bool drop {false};
+    Codec codec {Codec::None};
+    uint32_t frameSize {0};
+    uint64_t plain {0};
+    /** Offset of each frame in the file, then the end of the last one */
+    std::vector<uint64_t> offsets;
+    std::atomic<uint64_t> nanos {0};
+};
+
+}  // namespace blob
+
+#endif  // SRC_COMPRESS_HPP_
@@ -0,0 +1,136 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+#include "flight.hpp"
+
+using blob::BlockRef;
+using blob::Flight;
+using blob::Flights;
+
+Flight::Flight(uint64_t start, uint64_t stop, uint64_t window)
+        : start{start}, stop{std::max(start, stop)}, window{window},
+          claimed{start} {}
+
+Flight::Seat Flight::Join(Sink sink) {
+    Seat seat;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (closed || failed)
+        return seat;
+    seat.id = nextSeat++;
+    seat.shared = !sinks.empty() || !retained.empty();
+    seat.retained = retained;
+    sinks[seat.id] = std::move(sink);
+    return seat;
+}
+
+void Flight::Leave(uint64_t id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    sinks.erase(id);
+}
+
+bool Flight::Claim(uint32_t size, uint64_t *offset, uint32_t *length) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (failed || claimed >= stop)
+        return false;
+    *offset = claimed;
+    *length = std::min<uint64_t>(std::max(size, 1u), stop - claimed);
+    claimed += *length;
+    return true;
+}
+
+/**
+ * The sinks are called out of the lock: a reader joining meanwhile finds
+ * the block in the retained ones.
+ */
+void Flight::Publish(BlockRef block) {
+    std::vector<Sink> targets;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (failed)
+            return;
+        if (!closed) {
+            retainedBytes += block->length;
+            if (retainedBytes > window) {
+                closed = true;
+                retained.clear();
+            } else {
+                retained.push_back(block);
+            }
+        }
+        targets.reserve(sinks.size());
+        for (auto &sink : sinks)
+            targets.push_back(sink.second);
+    }
+    for (auto &sink : targets)
+        sink(block);
+}
+
+void Flight::Fail() {
+    std::vector<Sink> targets;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (failed)
+            return;
+        failed = true;
+        retained.clear();
+        for (auto &sink : sinks)
+            targets.push_back(sink.second);
+    }
+    for (auto &sink : targets)
+        sink(nullptr);
+}
+
+bool Flight::Joinable() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return !closed && !failed;
+}
+
+size_t Flight::Readers() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return sinks.size();
+}
+
+std::shared_ptr<Flight> Flights::Get(const std::string &key, uint64_t start,
+                                     uint64_t stop) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto &flight = flights[key];
+    if (!flight || !flight->Joinable())
+        flight = std::make_shared<Flight>(start, stop, window);
+    return flight;
+}
+
+void Flights::Leave(const std::string &key,
+                    const std::shared_ptr<Flight> &flight, uint64_t id) {
+    flight->Leave(id);
+    if (flight->Readers() > 0)
+        return;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = flights.find(key);
+    if (it != flights.end() && it->second == flight
+            && flight->Readers() == 0)
+        flights.erase(it);
+}
+
+size_t Flights::Size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return flights.size();
+}
@@ -0,0 +1,136 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#ifndef SRC_FLIGHT_HPP_
+#define SRC_FLIGHT_HPP_
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex> // NOLINT
+#include <string>
+#include <vector>
+
+namespace blob {
+
+/** A block of a chunk, read once and shared by the readers of a Flight */
+struct SharedBlock {
+    /** A block to read in a buffer of its own */
+    SharedBlock(uint64_t offset, uint32_t capacity, uint64_t reader)
+            : offset{offset}, reader{reader},
+              data{new uint8_t[capacity > 0 ? capacity : 1]},
+              memory{data, std::default_delete<uint8_t[]>()} {}
+    /** A block in the memory kept by `memory` (e.g. a mapping) */
+    SharedBlock(uint64_t offset, uint32_t length, uint64_t reader,
+                uint8_t *data, std::shared_ptr<const void> memory)
+            : offset{offset}, length{length}, reader{reader}, data{data},
+              memory{memory} {}
+
+    uint64_t offset;
+    uint32_t length {0};
+    /** Seat of the reader who read it */
+    uint64_t reader;
+    uint8_t *data;
+    std::shared_ptr<const void> memory;
+};
+
+using BlockRef = std::shared_ptr<const SharedBlock>;
+
+/**
+ * One stream of reads of a range of a chunk, shared by the concurrent
+ * readers of that range. Each reader claims the next block when it has
+ * room for it, reads it and publishes it: every block is handed to all
+ * the readers, in any order.
+ * The blocks from the start of the range are retained up to a window so
+ * that a late reader catches up; past the window the flight doesn't
+ * accept new readers. Thread-safe.
+ */
+class Flight {
+ public:
+    /** Called with each block published, with null if the flight failed */
+    using Sink = std::function<void(const BlockRef &block)>;
+
+    struct Seat {
+        /** 0 when the flight doesn't accept readers anymore */
+        uint64_t id {0};
+        /** Other readers were there: the blocks are shared */
+        bool shared {false};
+        /** Blocks published before the reader joined */
+        std::vector<BlockRef> retained;
+    };
+
+    Flight(uint64_t start, uint64_t stop, uint64_t window);
+    Flight(const Flight&) = delete;
+    Flight& operator=(const Flight&) = delete;
+
+    Seat Join(Sink sink);
+    void Leave(uint64_t id);
+
+    /**
+     * Reserve the next block to read.
+     * @return false once the whole range is claimed
+     */
+    bool Claim(uint32_t size, uint64_t *offset, uint32_t *length);
+    void Publish(BlockRef block);
+    /** A read failed: the readers are told, and no one can join */
+    void Fail();
+
+    bool Joinable() const;
+    size_t Readers() const;
+
+ private:
+    const uint64_t start;
+    const uint64_t stop;
+    const uint64_t window;
+    uint64_t claimed;
+    uint64_t nextSeat {1};
+    std::map<uint64_t, Sink> sinks;
+    std::vector<BlockRef> retained;
+    uint64_t retainedBytes {0};
+    bool closed {false};
+    bool failed {false};
+    mutable std::mutex mutex;
+};
+
+/**
+ * The flights in progress, by key (the chunk and its range). A key maps
+ * to the last flight started, the former ones end with their readers.
+ */
+class Flights {
+ public:
+    /** @param window bytes retained for the late readers of a flight */
+    explicit Flights(uint64_t window = 4 << 20) : window{window} {}
+
+    /** @return the flight of the key, started if none accepts readers */
+    std::shared_ptr<Flight> Get(const std::string &key, uint64_t start,
+                                uint64_t stop);
+    /** Leave a flight, forgotten with its last reader */
+    void Leave(const std::string &key, const std::shared_ptr<Flight> &flight,
+               uint64_t id);
+    size_t Size() const;
+
+ private:
+    const uint64_t window;
+    std::map<std::string, std::shared_ptr<Flight>> flights;
+    mutable std::mutex mutex;
+};
+
+}  // namespace blob
+
+#endif  // SRC_FLIGHT_HPP_
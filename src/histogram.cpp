@@ -0,0 +1,162 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <cmath>
+#include "histogram.hpp"
+#include "utils.hpp"
+
+using utils::HistogramSnapshot;
+using utils::LatencyHistogram;
+using utils::LatencyStats;
+using utils::Method;
+using utils::StatusClass;
+
+constexpr unsigned int LatencyHistogram::kShards;
+
+unsigned int utils::HistogramBucket(uint64_t value) {
+    if (value < (2u << kHistogramSubBits))
+        return value;
+    if (value >> kHistogramMaxBits)
+        return kHistogramBuckets - 1;
+    unsigned int msb = 63 - __builtin_clzll(value);
+    unsigned int shift = msb - kHistogramSubBits;
+    return (shift << kHistogramSubBits) + (value >> shift);
+}
+
+uint64_t utils::HistogramBucketValue(unsigned int bucket) {
+    if (bucket < (1u << kHistogramSubBits))
+        return bucket;
+    unsigned int shift = (bucket >> kHistogramSubBits) - 1;
+    uint64_t mantissa = (bucket & ((1u << kHistogramSubBits) - 1))
+            + (1u << kHistogramSubBits);
+    // Middle of the bucket
+    return (mantissa << shift) + ((1ULL << shift) >> 1);
+}
+
+void HistogramSnapshot::Merge(const HistogramSnapshot &other) {
+    for (unsigned int i = 0; i < kHistogramBuckets; i++)
+        buckets[i] += other.buckets[i];
+    count += other.count;
+    sum += other.sum;
+}
+
+uint64_t HistogramSnapshot::Percentile(double q) const {
+    if (count == 0)
+        return 0;
+    uint64_t rank = static_cast<uint64_t>(std::ceil(q * count));
+    if (rank == 0)
+        rank = 1;
+    uint64_t seen = 0;
+    for (unsigned int i = 0; i < kHistogramBuckets; i++) {
+        seen += buckets[i];
+        if (seen >= rank)
+            return HistogramBucketValue(i);
+    }
+    return HistogramBucketValue(kHistogramBuckets - 1);
+}
+
+void LatencyHistogram::Record(uint64_t nanos) {
+    auto &shard = shards[ThreadSlot() % kShards];
+    shard.buckets[HistogramBucket(nanos)].fetch_add(
+        1, std::memory_order_relaxed);
+    shard.count.fetch_add(1, std::memory_order_relaxed);
+    shard.sum.fetch_add(nanos, std::memory_order_relaxed);
+}
+
+HistogramSnapshot LatencyHistogram::Snapshot() const {
+    HistogramSnapshot snapshot;
+    for (auto &shard : shards) {
+        for (unsigned int i = 0; i < kHistogramBuckets; i++)
+            snapshot.buckets[i] += shard.buckets[i].load(
+                std::memory_order_relaxed);
+        snapshot.count += shard.count.load(std::memory_order_relaxed);
+        snapshot.sum += shard.sum.load(std::memory_order_relaxed);
+    }
+    return snapshot;
+}
+
+uint64_t LatencyHistogram::Count() const {
+    uint64_t count = 0;
+    for (auto &shard : shards)
+        count += shard.count.load(std::memory_order_relaxed);
+    return count;
+}
+
+const char *utils::MethodName(Method method) {
+    static const char *names[kMethods] = {
+        "get", "put", "del", "stat", "info", "other"
+    };
+    return names[static_cast<unsigned int>(method)];
+}
+
+const char *utils::StatusClassName(StatusClass cls) {
+    static const char *names[kStatusClasses] = {
+        "2xx", "3xx", "4xx", "5xx", "other"
+    };
+    return names[static_cast<unsigned int>(cls)];
+}
+
+StatusClass utils::StatusClassOf(int code) {
+    switch (code / 100) {
+        case 2:
+            return StatusClass::R2xx;
+        case 3:
+            return StatusClass::R3xx;
+        case 4:
+            return StatusClass::R4xx;
+        case 5:
+            return StatusClass::R5xx;
+        default:
+            return StatusClass::Other;
+    }
+}
+
+LatencyHistogram &LatencyStats::at(bool ttfb, Method method,
+                                   StatusClass cls) {
+    return histograms[(ttfb ? kMethods * kStatusClasses : 0)
+                      + static_cast<unsigned int>(method) * kStatusClasses
+                      + static_cast<unsigned int>(cls)];
+}
+
+const LatencyHistogram &LatencyStats::at(bool ttfb, Method method,
+                                         StatusClass cls) const {
+    return histograms[(ttfb ? kMethods * kStatusClasses : 0)
+                      + static_cast<unsigned int>(method) * kStatusClasses
+                      + static_cast<unsigned int>(cls)];
+}
+
+void LatencyStats::Record(Method method, int code, uint64_t ttfb,
+                          uint64_t total) {
+    auto cls = StatusClassOf(code);
+    at(false, method, cls).Record(total);
+    if (ttfb > 0)
+        at(true, method, cls).Record(ttfb);
+}
+
+HistogramSnapshot LatencyStats::Total(Method method, StatusClass cls) const {
+    return at(false, method, cls).Snapshot();
+}
+
+HistogramSnapshot LatencyStats::FirstByte(Method method,
+                                          StatusClass cls) const {
+    return at(true, method, cls).Snapshot();
+}
+
+uint64_t LatencyStats::Count(Method method, StatusClass cls) const {
+    return at(false, method, cls).Count();
+}
@@ -0,0 +1,151 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#ifndef SRC_HISTOGRAM_HPP_
+#define SRC_HISTOGRAM_HPP_
+
+#include <array>
+#include <atomic>
+#include <chrono> // NOLINT
+#include <cstdint>
+
+namespace utils {
+
+/**
+ * Log-linear bucketing of a duration in nanoseconds: exact under 16ns,
+ * then 8 buckets per power of two (12.5% worst-case relative error), up
+ * to 2^36 ns (~68s). Longer durations land in the last bucket.
+ */
+constexpr unsigned int kHistogramSubBits = 3;
+constexpr unsigned int kHistogramMaxBits = 36;
+constexpr unsigned int kHistogramBuckets =
+        (kHistogramMaxBits - kHistogramSubBits + 1) << kHistogramSubBits;
+
+unsigned int HistogramBucket(uint64_t value);
+uint64_t HistogramBucketValue(unsigned int bucket);
+
+/**
+ * Plain copy of a histogram, to be merged with others and queried.
+ */
+struct HistogramSnapshot {
+    std::array<uint64_t, kHistogramBuckets> buckets {};
+    uint64_t count {0};
+    uint64_t sum {0};
+
+    void Merge(const HistogramSnapshot &other);
+    /** @param q the quantile, e.g. 0.99. @return a value in nanoseconds */
+    uint64_t Percentile(double q) const;
+    inline uint64_t Mean() const { return count ? sum / count : 0; }
+};
+
+/**
+ * Latency histogram recorded without lock: the calling thread picks one
+ * of a few shards and increments one bucket with a relaxed atomic add.
+ * The shards are merged into a HistogramSnapshot when read.
+ */
+class LatencyHistogram {
+ public:
+    static constexpr unsigned int kShards = 8;
+
+    void Record(uint64_t nanos);
+    HistogramSnapshot Snapshot() const;
+    /** @return the number of values recorded, cheaper than a Snapshot() */
+    uint64_t Count() const;
+
+ private:
+    /** Padded to a multiple of the cache line */
+    struct Shard {
+        std::array<std::atomic<uint64_t>, kHistogramBuckets> buckets {};
+        std::atomic<uint64_t> count {0};
+        std::atomic<uint64_t> sum {0};
+        char padding[64 - ((kHistogramBuckets + 2) * 8) % 64];
+    };
+    std::array<Shard, kShards> shards;
+};
+
+enum class Method : unsigned int {
+    Get, Put, Delete, Stat, Info, Other, Count
+};
+
+enum class StatusClass : unsigned int {
+    R2xx, R3xx, R4xx, R5xx, Other, Count
+};
+
+constexpr unsigned int kMethods = static_cast<unsigned int>(Method::Count);
+constexpr unsigned int kStatusClasses =
+        static_cast<unsigned int>(StatusClass::Count);
+
+const char *MethodName(Method method);
+const char *StatusClassName(StatusClass cls);
+StatusClass StatusClassOf(int code);
+
+/**
+ * Total time and time-to-first-byte histograms of the requests, per method
+ * and per class of status.
+ */
+class LatencyStats {
+ public:
+    void Record(Method method, int code, uint64_t ttfb, uint64_t total);
+    HistogramSnapshot Total(Method method, StatusClass cls) const;
+    HistogramSnapshot FirstByte(Method method, StatusClass cls) const;
+    /** @return the number of requests recorded */
+    uint64_t Count(Method method, StatusClass cls) const;
+
+ private:
+    LatencyHistogram &at(bool ttfb, Method method, StatusClass cls);
+    const LatencyHistogram &at(bool ttfb, Method method,
+                               StatusClass cls) const;
+    std::array<LatencyHistogram, 2 * kMethods * kStatusClasses> histograms;
+};
+
+/**
+ * Monotonic timestamps of a request, in nanoseconds.
+ */
+class RequestTimer {
+ public:
+    inline void Start() {
+        start = Clock::now();
+        firstByte = Clock::time_point();
+    }
+    /** Mark the first byte of the reply, only the first call counts */
+    inline void FirstByte() {
+        if (firstByte == Clock::time_point())
+            firstByte = Clock::now();
+    }
+    /** @return the nanoseconds elapsed since Start() */
+    inline uint64_t Elapsed() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            Clock::now() - start).count();
+    }
+    /** @return the time to first byte, or 0 if nothing was sent */
+    inline uint64_t TimeToFirstByte() const {
+        if (firstByte == Clock::time_point())
+            return 0;
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            firstByte - start).count();
+    }
+
+ private:
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point start;
+    Clock::time_point firstByte;
+};
+
+}  // namespace utils
+
+#endif  // SRC_HISTOGRAM_HPP_
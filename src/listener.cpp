@@ -0,0 +1,103 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "listener.hpp"
+
+using utils::ListenOptions;
+
+static int listenOne(const struct addrinfo *ai, int backlog) {
+    int fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC,
+                    ai->ai_protocol);
+    if (fd < 0)
+        return -1;
+    int one = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0
+            || setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one,
+                          sizeof(one)) != 0
+            || bind(fd, ai->ai_addr, ai->ai_addrlen) != 0
+            || listen(fd, backlog) != 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+std::vector<int> utils::ListenReusePort(const ListenOptions &options) {
+    std::vector<int> fds;
+    struct addrinfo hints, *result = nullptr;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+    std::string port = std::to_string(options.port);
+    int rc = getaddrinfo(options.host.empty() ? nullptr : options.host.c_str(),
+                         port.c_str(), &hints, &result);
+    if (rc != 0) {
+        errno = EADDRNOTAVAIL;
+        return fds;
+    }
+    for (unsigned int i = 0; i < std::max(options.sockets, 1u); i++) {
+        int fd = listenOne(result, options.backlog);
+        if (fd < 0)
+            break;
+        fds.push_back(fd);
+        if (i == 0 && options.port == 0) {
+            // The others must share the port picked by the kernel
+            uint16_t bound = htons(LocalPort(fd));
+            if (result->ai_family == AF_INET6)
+                reinterpret_cast<struct sockaddr_in6 *>(
+                    result->ai_addr)->sin6_port = bound;
+            else
+                reinterpret_cast<struct sockaddr_in *>(
+                    result->ai_addr)->sin_port = bound;
+        }
+    }
+    freeaddrinfo(result);
+    if (fds.size() < std::max(options.sockets, 1u)) {
+        int err = errno;
+        for (int fd : fds)
+            close(fd);
+        fds.clear();
+        errno = err;
+    }
+    return fds;
+}
+
+uint16_t utils::LocalPort(int fd) {
+    struct sockaddr_storage ss;
+    socklen_t len = sizeof(ss);
+    if (getsockname(fd, reinterpret_cast<struct sockaddr *>(&ss), &len) != 0)
+        return 0;
+    if (ss.ss_family == AF_INET6)
+        return ntohs(reinterpret_cast<struct sockaddr_in6 *>(&ss)->sin6_port);
+    if (ss.ss_family == AF_INET)
+        return ntohs(reinterpret_cast<struct sockaddr_in *>(&ss)->sin_port);
+    return 0;
+}
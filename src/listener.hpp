@@ -0,0 +1,49 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#ifndef SRC_LISTENER_HPP_
+#define SRC_LISTENER_HPP_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace utils {
+
+struct ListenOptions {
+    std::string host {"0.0.0.0"};
+    /** 0 picks a free port, the same for all the sockets */
+    uint16_t port {6200};
+    /** Number of sockets bound on the address */
+    unsigned int sockets {1};
+    int backlog {1024};
+};
+
+/**
+ * Open sockets listening on the same address with SO_REUSEPORT, so that
+ * the kernel balances the incoming connections between them.
+ * @return the sockets, or nothing with errno set
+ */
+std::vector<int> ListenReusePort(const ListenOptions &options);
+
+/** @return the port the socket is bound to, 0 on error */
+uint16_t LocalPort(int fd);
+
+}  // namespace utils
+
+#endif  // SRC_LISTENER_HPP_
@@ -0,0 +1,291 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <fcntl.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <ctime>
+#include <string>
+#include "logger.hpp"
+#include "stats.hpp"
+#include "utils.hpp"
+
+using utils::AccessRecord;
+using utils::AsyncLogger;
+using utils::LoggerOptions;
+using utils::LogRing;
+using utils::LogSink;
+using utils::StatsWriter;
+
+constexpr unsigned int AsyncLogger::kMaxRings;
+
+namespace {
+
+std::atomic<AsyncLogger *> installed {nullptr};
+
+/** Longest formatted line, the fields of the record are bounded */
+constexpr size_t kMaxLine = 1024;
+
+void field(StatsWriter *out, const char *value) {
+    out->Text(" ");
+    out->Text(value[0] != '\0' ? value : "-");
+}
+
+}  // namespace
+
+void utils::FormatAccess(StatsWriter *out, const AccessRecord &record,
+                         const char *stamp, const std::string &hostname,
+                         const std::string &instanceID, pid_t pid) {
+    out->Text(stamp);
+    out->Text(" ");
+    out->Text(hostname.data(), hostname.size());
+    out->Text(" ");
+    out->Text(instanceID.data(), instanceID.size());
+    out->Text(" ");
+    out->Number(pid);
+    out->Text(" ");
+    out->Number(record.threadID);
+    out->Text(" access");
+    field(out, record.level);
+    field(out, record.localServer);
+    field(out, record.remoteClient);
+    field(out, record.requestType);
+    out->Text(" ");
+    out->Number(record.statusCode);
+    out->Text(" ");
+    out->Number(record.responseTime);
+    out->Text(" ");
+    out->Number(record.responseSize);
+    field(out, record.userID);
+    field(out, record.requestID);
+    field(out, record.message);
+}
+
+LogRing::LogRing(size_t capacity) {
+    size_t size = 1;
+    while (size < capacity)
+        size <<= 1;
+    slots.resize(size);
+    mask = size - 1;
+}
+
+bool LogRing::TryPush(const AccessRecord &record) {
+    uint64_t t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) > mask)
+        return false;
+    slots[t & mask] = record;
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+}
+
+const AccessRecord *LogRing::Front() const {
+    uint64_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire))
+        return nullptr;
+    return &slots[h & mask];
+}
+
+void LogRing::Pop() {
+    head.store(head.load(std::memory_order_relaxed) + 1,
+               std::memory_order_release);
+}
+
+AsyncLogger::AsyncLogger(LoggerOptions options)
+        : options{options}, pid{::getpid()},
+          rings{new std::atomic<LogRing *>[kMaxRings]},
+          batch(std::max(options.batchSize, 2 * kMaxLine)) {
+    for (unsigned int i = 0; i < kMaxRings; i++)
+        rings[i].store(nullptr);
+}
+
+AsyncLogger::~AsyncLogger() {
+    Stop();
+    if (Installed() == this)
+        Install(nullptr);
+    for (unsigned int i = 0; i < kMaxRings; i++)
+        delete rings[i].load();
+}
+
+void AsyncLogger::Install(AsyncLogger *logger) {
+    installed.store(logger, std::memory_order_release);
+}
+
+AsyncLogger *AsyncLogger::Installed() {
+    return installed.load(std::memory_order_acquire);
+}
+
+bool AsyncLogger::open() {
+    switch (options.sink) {
+        case LogSink::File:
+            if (fd >= 0)
+                ::close(fd);
+            fd = ::open(options.path.c_str(),
+                        O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+            return fd >= 0;
+        case LogSink::Syslog:
+            openlog(options.path.empty() ? "rawx" : options.path.c_str(),
+                    LOG_NDELAY, LOG_LOCAL0);
+            return true;
+        case LogSink::Stderr:
+            fd = STDERR_FILENO;
+            return true;
+    }
+    return false;
+}
+
+bool AsyncLogger::Start() {
+    if (running)
+        return true;
+    if (!open())
+        return false;
+    running = true;
+    worker = std::thread([this]() { run(); });
+    return true;
+}
+
+void AsyncLogger::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!running)
+            return;
+        running = false;
+    }
+    wakeup.notify_all();
+    if (worker.joinable())
+        worker.join();
+    if (options.sink == LogSink::File && fd >= 0)
+        ::close(fd);
+    else if (options.sink == LogSink::Syslog)
+        closelog();
+    fd = -1;
+}
+
+bool AsyncLogger::Push(const AccessRecord &record) {
+    unsigned int slot = ThreadSlot();
+    if (slot >= kMaxRings) {
+        dropped++;
+        return false;
+    }
+    LogRing *ring = rings[slot].load(std::memory_order_acquire);
+    if (ring == nullptr) {
+        // Once per thread slot, the ring is reused by the next threads
+        ring = new LogRing(options.ringSize);
+        rings[slot].store(ring, std::memory_order_release);
+        unsigned int count = ringCount.load();
+        while (count <= slot && !ringCount.compare_exchange_weak(count,
+                                                                 slot + 1)) {}
+    }
+    if (!ring->TryPush(record)) {
+        dropped++;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * The producers never wake the thread up, it polls the rings every
+ * flushInterval, or right away while there is a backlog.
+ */
+void AsyncLogger::run() {
+    while (true) {
+        bool stopping = !running;
+        size_t count = drain();
+        flush();
+        if (stopping)
+            break;
+        if (count == 0) {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeup.wait_for(lock, options.flushInterval,
+                            [this]() { return !running; });
+        }
+    }
+}
+
+size_t AsyncLogger::drain() {
+    size_t count = 0;
+    unsigned int max = ringCount.load();
+    for (unsigned int i = 0; i < max; i++) {
+        LogRing *ring = rings[i].load(std::memory_order_acquire);
+        if (ring == nullptr)
+            continue;
+        // Bounded, so that a busy thread doesn't starve the others
+        for (size_t n = 0; n < options.ringSize; n++) {
+            const AccessRecord *record = ring->Front();
+            if (record == nullptr)
+                break;
+            append(*record);
+            ring->Pop();
+            count++;
+        }
+    }
+    return count;
+}
+
+/** The timestamp is formatted again only when the second changes */
+const char *AsyncLogger::stamp(int64_t timestamp) {
+    int64_t second = timestamp / 1000000;
+    if (second != stampSecond) {
+        time_t t = second;
+        struct tm tm;
+        localtime_r(&t, &tm);
+        strftime(stampText, sizeof(stampText), "%b %d %H:%M:%S", &tm);
+        stampSecond = second;
+    }
+    return stampText;
+}
+
+void AsyncLogger::append(const AccessRecord &record) {
+    if (batch.size() - batchLength < kMaxLine)
+        flush();
+    StatsWriter out(batch.data() + batchLength, kMaxLine - 1);
+    FormatAccess(&out, record, stamp(record.timestamp), options.hostname,
+                 options.instanceID, pid);
+    batchLength += out.Size();
+    batch[batchLength++] = '\n';
+    written++;
+}
+
+void AsyncLogger::flush() {
+    if (batchLength == 0)
+        return;
+    if (reopen.exchange(false))
+        open();
+    if (options.sink == LogSink::Syslog) {
+        size_t start = 0;
+        for (size_t i = 0; i < batchLength; i++) {
+            if (batch[i] != '\n')
+                continue;
+            syslog(LOG_INFO, "%.*s", static_cast<int>(i - start),
+                   batch.data() + start);
+            start = i + 1;
+        }
+    } else {
+        size_t done = 0;
+        while (done < batchLength) {
+            ssize_t rc = ::write(fd, batch.data() + done, batchLength - done);
+            if (rc < 0 && errno == EINTR)
+                continue;
+            if (rc <= 0)
+                break;
+            done += rc;
+        }
+    }
+    batchLength = 0;
+}
@@ -0,0 +1,172 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#ifndef SRC_LOGGER_HPP_
+#define SRC_LOGGER_HPP_
+
+#include <sys/types.h>
+#include <atomic>
+#include <chrono> // NOLINT
+#include <condition_variable> // NOLINT
+#include <cstdint>
+#include <memory>
+#include <mutex> // NOLINT
+#include <string>
+#include <thread> // NOLINT
+#include <vector>
+
+namespace utils {
+
+class StatsWriter;
+
+/**
+ * Fixed-size access log record, copied as is in the ring buffers. The
+ * strings are NUL-terminated and truncated to the size of their field.
+ */
+struct AccessRecord {
+    int64_t timestamp {0};     // CLOCK_REALTIME, in microseconds
+    uint64_t responseTime {0};  // microseconds
+    uint64_t responseSize {0};
+    pid_t threadID {0};
+    uint16_t statusCode {0};
+    char level[4] {};
+    char requestType[8] {};
+    char localServer[48] {};
+    char remoteClient[48] {};
+    char userID[72] {};
+    char requestID[72] {};
+    char message[160] {};
+};
+
+/**
+ * Write one access log line, without the trailing newline.
+ * @param stamp the already formatted timestamp of the record
+ */
+void FormatAccess(StatsWriter *out, const AccessRecord &record,
+                  const char *stamp, const std::string &hostname,
+                  const std::string &instanceID, pid_t pid);
+
+/**
+ * Single producer, single consumer ring of records.
+ */
+class LogRing {
+ public:
+    /** @param capacity rounded up to a power of two */
+    explicit LogRing(size_t capacity);
+    LogRing(const LogRing&) = delete;
+    LogRing& operator=(const LogRing&) = delete;
+
+    /** Producer side. @return false if the ring is full */
+    bool TryPush(const AccessRecord &record);
+    /** Consumer side. @return the oldest record, or null if empty */
+    const AccessRecord *Front() const;
+    /** Consumer side, release the record returned by Front() */
+    void Pop();
+
+ private:
+    std::vector<AccessRecord> slots;
+    size_t mask;
+    // Producer and consumer indexes on distinct cache lines
+    char padding0[64];
+    std::atomic<uint64_t> head {0};
+    char padding1[64];
+    std::atomic<uint64_t> tail {0};
+    char padding2[64];
+};
+
+enum class LogSink {
+    File, Syslog, Stderr
+};
+
+struct LoggerOptions {
+    LogSink sink {LogSink::Stderr};
+    /** Path of the file for LogSink::File, ident for LogSink::Syslog */
+    std::string path;
+    std::string hostname {"-"};
+    std::string instanceID {"-"};
+    /** Records per thread */
+    size_t ringSize {4096};
+    size_t batchSize {64 * 1024};
+    std::chrono::milliseconds flushInterval {50};
+};
+
+/**
+ * Access log pipeline: each request thread pushes binary records in its
+ * own ring, a background thread formats them and writes them in batches.
+ * Push() never blocks nor allocates once the ring of the thread exists:
+ * when the ring is full the record is dropped and counted.
+ */
+class AsyncLogger {
+ public:
+    static constexpr unsigned int kMaxRings = 256;
+
+    explicit AsyncLogger(LoggerOptions options);
+    ~AsyncLogger();
+    AsyncLogger(const AsyncLogger&) = delete;
+    AsyncLogger& operator=(const AsyncLogger&) = delete;
+
+    /** Open the sink and start the background thread */
+    bool Start();
+    /** Drain the rings, flush and join the background thread */
+    void Stop();
+    /** Reopen the file on the next batch (e.g. after a logrotate) */
+    inline void Reopen() { reopen = true; }
+
+    /** @return false if the record was dropped */
+    bool Push(const AccessRecord &record);
+
+    inline uint64_t Dropped() const { return dropped.load(); }
+    inline uint64_t Written() const { return written.load(); }
+
+    /**
+     * Set the logger used by AccessLog::Log(). The logger must outlive the
+     * requests, uninstall it (with nullptr) before destroying it.
+     */
+    static void Install(AsyncLogger *logger);
+    static AsyncLogger *Installed();
+
+ private:
+    void run();
+    /** @return the number of records consumed */
+    size_t drain();
+    void append(const AccessRecord &record);
+    void flush();
+    bool open();
+    const char *stamp(int64_t timestamp);
+
+    LoggerOptions options;
+    pid_t pid;
+    std::unique_ptr<std::atomic<LogRing *>[]> rings;
+    std::atomic<unsigned int> ringCount {0};
+    std::vector<char> batch;
+    size_t batchLength {0};
+    int fd {-1};
+    int64_t stampSecond {-1};
+    char stampText[32] {};
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::atomic<bool> running {false};
+    std::atomic<bool> reopen {false};
+    std::atomic<uint64_t> dropped {0};
+    std::atomic<uint64_t> written {0};
+};
+
+}  // namespace utils
+
+#endif  // SRC_LOGGER_HPP_
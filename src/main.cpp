@@ -0,0 +1,429 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <folly/SocketAddress.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <proxygen/httpserver/HTTPServer.h>
+#include <proxygen/httpserver/RequestHandlerFactory.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono> // NOLINT
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <new>
+#include <set>
+#include <string>
+#include <thread> // NOLINT
+#include <vector>
+#include "affinity.hpp"
+#include "listener.hpp"
+#include "logger.hpp"
+#include "pool.hpp"
+#include "rawx.hpp"
+#include "scheduler.hpp"
+#include "scrub.hpp"
+#include "volume.hpp"
+
+DEFINE_string(ip, "0.0.0.0", "IP to bind to");
+DEFINE_int32(port, 6200, "HTTP port");
+DEFINE_int32(listeners, 1, "Sockets bound on the port with SO_REUSEPORT");
+DEFINE_int32(threads, 0, "EventBase threads (0: one per CPU)");
+DEFINE_int32(backlog, 1024, "Length of the accept queue of each socket");
+DEFINE_int32(idle_timeout, 60000, "Idle timeout of the connections, in ms");
+DEFINE_bool(tcp_nodelay, true, "Disable Nagle on the client connections");
+DEFINE_bool(tcp_cork, false, "Only send full segments on the client "
+            "connections (the tail of a reply waits up to 200ms): only for "
+            "bulk transfers of large chunks");
+DEFINE_string(cpus, "", "Pin the EventBase threads on these CPUs in turn, "
+              "e.g. 0-7,16-23, with their memory on the local NUMA node");
+DEFINE_bool(h2c, true, "Accept HTTP/2 over cleartext");
+DEFINE_int32(h2_port, 0, "Also accept HTTP/2 with prior knowledge, without "
+             "upgrade, on this port (0: none)");
+DEFINE_int32(h2_max_streams, 256, "Concurrent HTTP/2 streams per connection");
+DEFINE_int32(h2_stream_window_kb, 1024, "HTTP/2 receive window of a stream, "
+             "in KiB: a paused upload stops being credited past it");
+DEFINE_int32(h2_session_window_kb, 16384, "HTTP/2 receive window of a "
+             "connection, in KiB");
+DEFINE_string(volume, ".", "Directories of the chunks, <path> or "
+              "<id>=<path> separated by commas: /<id>/<chunk-id> is routed "
+              "to the volume <id>, new chunks without id are placed on the "
+              "volumes by free space and load");
+DEFINE_int32(volume_node, -1, "NUMA node of the volumes (-1: the node of "
+             "the controller of each disk, if any)");
+DEFINE_bool(numa, true, "Run the I/O of each volume on its NUMA node, and "
+            "the EventBase threads too when all the volumes share a node, "
+            "unless --cpus is set");
+DEFINE_int32(io_threads, 8, "Threads of the I/O scheduler");
+DEFINE_int32(io_node_threads, 4, "Threads of the I/O scheduler bound to "
+             "each NUMA node of the volumes");
+DEFINE_int32(upload_buffer_kb, 4096, "Stop reading the body of an upload "
+             "when this many KiB wait for the disk, resume under a quarter");
+DEFINE_int32(volume_buffer_mb, 64, "Stop reading the bodies of the uploads "
+             "of a volume when this many MiB wait for its disk, resume under "
+             "a half");
+DEFINE_int32(volume_reject_mb, 256, "Refuse the new uploads of a volume "
+             "with a 503 while this many MiB wait for its disk (0: never)");
+DEFINE_int32(readahead_kb, 4096, "Prefetch this many KiB when a read starts, "
+             "with a sequential read-ahead (0: kernel defaults)");
+DEFINE_int32(random_below_kb, 256, "Disable the read-ahead for the ranges "
+             "shorter than this many KiB (0: never)");
+DEFINE_int32(drop_above_mb, 64, "Keep the chunks larger than this many MiB "
+             "out of the page cache (0: never); background I/O never stays");
+DEFINE_int32(writeback_kb, 8192, "Write back the uploads every this many "
+             "KiB, bounding their dirty pages (0: kernel defaults)");
+DEFINE_int32(download_depth, 8, "Blocks of a download read ahead of the "
+             "client, at most");
+DEFINE_int32(download_block_kb, 1024, "Largest block read for a download, "
+             "in KiB");
+DEFINE_int32(coalesce_window_kb, 4096, "Concurrent GETs of a range share "
+             "their reads, a GET joins while the first KiB read are kept "
+             "(0: no sharing)");
+DEFINE_int32(map_below_kb, 256, "Map the chunks smaller than this many "
+             "KiB and send them without copy (0: never)");
+DEFINE_int32(compress_frame_kb, 128, "Plain KiB per frame of the chunks "
+             "compressed by their chunk method, the unit a range decompresses");
+DEFINE_int32(compress_level, 0, "Level of the codec of the compressed chunks "
+             "(0: the default of the codec)");
+DEFINE_bool(scrub, false, "Check the chunks of each volume against their "
+            "size and hash in the background, as Background I/O");
+DEFINE_int32(scrub_rate_mb, 32, "MiB read per second by the scrubbing of a "
+             "volume (0: unlimited)");
+DEFINE_int32(scrub_iops, 100, "Reads per second of the scrubbing of a "
+             "volume (0: unlimited)");
+DEFINE_int32(scrub_latency_ms, 20, "Slow the scrubbing of a volume down "
+             "while its GETs wait longer than this for their first byte");
+DEFINE_int32(scrub_interval, 86400, "Seconds between the end of a pass of "
+             "the scrubbing and the start of the next one");
+DEFINE_bool(scrub_quarantine, true, "Move the corrupted chunks to the "
+            ".quarantine directory of their volume");
+DEFINE_int32(drain_timeout, 30, "Seconds given to the requests in flight "
+             "to complete on SIGTERM");
+DEFINE_string(access_log, "", "Access log: a path, 'syslog' or 'stderr' "
+              "(default: none)");
+DEFINE_bool(trace, false, "Trace the phases of the requests");
+DEFINE_int32(slow_threshold, 1000, "Log the phases of the requests longer "
+             "than this, in ms (0: never)");
+
+using proxygen::HTTPServer;
+using proxygen::HTTPServerOptions;
+using proxygen::RequestHandlerChain;
+
+/** Counted for /stat (heap.allocs), the array forms come here too */
+void *operator new(size_t size) {
+    utils::CountAllocation();
+    void *p = malloc(size > 0 ? size : 1);
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+/**
+ * Wait for the signals, blocked in every thread: SIGHUP reopens the access
+ * log, SIGTERM and SIGINT stop accepting connections, wait for the requests
+ * in flight (up to --drain_timeout) then stop the server.
+ */
+static void handleSignals(const sigset_t &signals, HTTPServer *server,
+                          utils::RequestCounter *counter,
+                          utils::AsyncLogger *logger) {
+    utils::ServiceLog serviceLog;
+    while (true) {
+        int signal = 0;
+        if (sigwait(&signals, &signal) != 0)
+            continue;
+        if (signal == SIGHUP) {
+            if (logger != nullptr)
+                logger->Reopen();
+            continue;
+        }
+        break;
+    }
+    serviceLog.LogToPrint("INF", "Draining "
+                          + std::to_string(counter->Inflight())
+                          + " requests");
+    server->stopListening();
+    auto deadline = std::chrono::steady_clock::now()
+            + std::chrono::seconds(FLAGS_drain_timeout);
+    while (counter->Inflight() > 0
+            && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    if (counter->Inflight() > 0)
+        serviceLog.LogToPrint("WRN", "Stopping with "
+                              + std::to_string(counter->Inflight())
+                              + " requests in flight");
+    server->stop();
+}
+
+static std::unique_ptr<utils::AsyncLogger> startLogger() {
+    if (FLAGS_access_log.empty())
+        return nullptr;
+    utils::LoggerOptions options;
+    if (FLAGS_access_log == "stderr") {
+        options.sink = utils::LogSink::Stderr;
+    } else if (FLAGS_access_log == "syslog") {
+        options.sink = utils::LogSink::Syslog;
+        options.path = "rawx";
+    } else {
+        options.sink = utils::LogSink::File;
+        options.path = FLAGS_access_log;
+    }
+    char hostname[256] = "-";
+    gethostname(hostname, sizeof(hostname) - 1);
+    options.hostname = hostname;
+    std::unique_ptr<utils::AsyncLogger> logger(new utils::AsyncLogger(options));
+    if (!logger->Start())
+        return nullptr;
+    utils::AsyncLogger::Install(logger.get());
+    return logger;
+}
+
+/** A scrubber per volume, reading as Background tasks of the scheduler */
+static void startScrubbers(const blob::Volumes &volumes,
+                           std::shared_ptr<blob::IoScheduler> scheduler) {
+    for (auto &volume : volumes.All()) {
+        blob::ScrubOptions scrubbing;
+        scrubbing.volume = volume->path;
+        scrubbing.bytesPerSec = static_cast<uint64_t>(
+            std::max(FLAGS_scrub_rate_mb, 0)) << 20;
+        scrubbing.iops = std::max(FLAGS_scrub_iops, 0);
+        scrubbing.latencyTarget = std::chrono::milliseconds(
+            std::max(FLAGS_scrub_latency_ms, 1));
+        scrubbing.interval = std::chrono::seconds(
+            std::max(FLAGS_scrub_interval, 1));
+        scrubbing.moveCorrupted = FLAGS_scrub_quarantine;
+        volume->scrubber = std::make_shared<blob::Scrubber>(scrubbing);
+        volume->scrubber->Scheduler(scheduler);
+        volume->scrubber->Start();
+    }
+}
+
+static void stopScrubbers(const blob::Volumes &volumes) {
+    for (auto &volume : volumes.All()) {
+        if (volume->scrubber)
+            volume->scrubber->Stop();
+    }
+}
+
+int main(int argc, char **argv) {
+    gflags::SetUsageMessage("OpenIO rawx service");
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    google::InitGoogleLogging(argv[0]);
+    google::InstallFailureSignalHandler();
+
+    std::vector<int> cpus;
+    if (!FLAGS_cpus.empty() && !utils::ParseCpuList(FLAGS_cpus, &cpus)) {
+        LOG(ERROR) << "Invalid CPU list: " << FLAGS_cpus;
+        return 2;
+    }
+    std::vector<std::pair<std::string, std::string>> volumeList;
+    if (!blob::ParseVolumeList(FLAGS_volume, &volumeList)) {
+        LOG(ERROR) << "Invalid volume list: " << FLAGS_volume;
+        return 2;
+    }
+
+    // Inherited by every thread started from now on
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    utils::ListenOptions listen;
+    listen.host = FLAGS_ip;
+    listen.port = FLAGS_port;
+    listen.sockets = std::max(FLAGS_listeners, 1);
+    listen.backlog = FLAGS_backlog;
+    auto fds = utils::ListenReusePort(listen);
+    if (fds.empty()) {
+        LOG(ERROR) << "Cannot listen on " << FLAGS_ip << ":" << FLAGS_port
+                   << ": " << strerror(errno);
+        return 1;
+    }
+    std::vector<int> h2fds;
+    if (FLAGS_h2_port > 0) {
+        listen.port = FLAGS_h2_port;
+        h2fds = utils::ListenReusePort(listen);
+        if (h2fds.empty()) {
+            LOG(ERROR) << "Cannot listen on " << FLAGS_ip << ":"
+                       << FLAGS_h2_port << ": " << strerror(errno);
+            return 1;
+        }
+    }
+
+    auto logger = startLogger();
+    if (!FLAGS_access_log.empty() && !logger) {
+        LOG(ERROR) << "Cannot open the access log " << FLAGS_access_log;
+        return 1;
+    }
+
+    blob::IoSchedulerOptions ioOptions;
+    ioOptions.threads = std::max(FLAGS_io_threads, 1);
+    ioOptions.nodeThreads = std::max(FLAGS_io_node_threads, 1);
+    auto volumes = std::make_shared<blob::Volumes>();
+    std::set<int> nodes;
+    for (auto &entry : volumeList) {
+        auto volume = std::make_shared<blob::Volume>();
+        volume->id = entry.first;
+        volume->path = entry.second;
+        if (FLAGS_numa) {
+            int node = FLAGS_volume_node >= 0 ? FLAGS_volume_node
+                    : utils::VolumeNode(volume->path);
+            volume->node = node < utils::NodeCount() ? node : -1;
+        }
+        if (volume->node >= 0)
+            ioOptions.volumeNodes[volume->path] = volume->node;
+        nodes.insert(volume->node);
+        if (!volumes->Add(volume)) {
+            LOG(ERROR) << "Duplicate volume id " << volume->id;
+            return 2;
+        }
+        // The bodies of the uploads a previous rawx didn't finish
+        auto swept = blob::SweepUploads(volume->path);
+        if (swept > 0)
+            LOG(WARNING) << "Removed " << swept << " unfinished uploads from "
+                         << volume->path;
+    }
+    volumes->Refresh();
+    // A connection is served by the thread that accepted it: when all the
+    // volumes share a node, keep the EventBase threads there as well.
+    if (cpus.empty() && nodes.size() == 1 && *nodes.begin() >= 0)
+        cpus = utils::NodeCpus(*nodes.begin());
+
+    auto scheduler = std::make_shared<blob::IoScheduler>(ioOptions);
+    std::unique_ptr<rawx::RawxHandlerFactory> factory(
+        new rawx::RawxHandlerFactory(scheduler));
+    factory->Volumes(volumes);
+    rawx::IngressLimits ingress;
+    ingress.uploadHigh = static_cast<uint64_t>(
+        std::max(FLAGS_upload_buffer_kb, 1)) << 10;
+    ingress.uploadLow = ingress.uploadHigh / 4;
+    ingress.volumeHigh = static_cast<uint64_t>(
+        std::max(FLAGS_volume_buffer_mb, 1)) << 20;
+    ingress.volumeLow = ingress.volumeHigh / 2;
+    ingress.volumeReject = static_cast<uint64_t>(
+        std::max(FLAGS_volume_reject_mb, 0)) << 20;
+    factory->Ingress(ingress);
+    auto caching = rawx::DefaultCachePolicies();
+    for (auto &policy : caching) {
+        policy.readahead = static_cast<uint64_t>(
+            std::max(FLAGS_readahead_kb, 0)) << 10;
+        policy.randomBelow = static_cast<uint64_t>(
+            std::max(FLAGS_random_below_kb, 0)) << 10;
+        policy.dropAbove = static_cast<uint64_t>(
+            std::max(FLAGS_drop_above_mb, 0)) << 20;
+        policy.writeback = static_cast<uint64_t>(
+            std::max(FLAGS_writeback_kb, 0)) << 10;
+        policy.mapBelow = static_cast<uint64_t>(
+            std::max(FLAGS_map_below_kb, 0)) << 10;
+    }
+    factory->Caching(caching);
+    rawx::PipelineOptions pipeline;
+    pipeline.maxDepth = std::max(FLAGS_download_depth, 1);
+    pipeline.minDepth = std::min(pipeline.minDepth, pipeline.maxDepth);
+    pipeline.maxBlock = static_cast<uint32_t>(
+        std::max(FLAGS_download_block_kb, 4)) << 10;
+    pipeline.minBlock = std::min(pipeline.minBlock, pipeline.maxBlock);
+    factory->Pipeline(pipeline);
+    blob::FrameOptions compressing;
+    compressing.frameSize = static_cast<uint32_t>(
+        std::max(FLAGS_compress_frame_kb, 4)) << 10;
+    compressing.level = FLAGS_compress_level;
+    factory->Compressing(compressing);
+    if (FLAGS_coalesce_window_kb > 0)
+        factory->Coalescing(std::make_shared<blob::Flights>(
+            static_cast<uint64_t>(FLAGS_coalesce_window_kb) << 10));
+    else
+        factory->Coalescing(nullptr);
+    factory->Pinning(cpus);
+    factory->Tracing(FLAGS_trace,
+                     std::chrono::milliseconds(FLAGS_slow_threshold));
+    auto counter = factory->Counter();
+
+    // The accepted connections get these options
+    folly::AsyncSocket::OptionMap socketOptions;
+    socketOptions[{IPPROTO_TCP, TCP_NODELAY}] = FLAGS_tcp_nodelay ? 1 : 0;
+    if (FLAGS_tcp_cork)
+        socketOptions[{IPPROTO_TCP, TCP_CORK}] = 1;
+    std::vector<HTTPServer::IPConfig> IPs;
+    for (size_t i = 0; i < fds.size(); i++) {
+        IPs.emplace_back(folly::SocketAddress(FLAGS_ip, FLAGS_port, true),
+                         HTTPServer::Protocol::HTTP);
+        IPs.back().acceptorSocketOptions = socketOptions;
+    }
+    // The prebound sockets are given to the addresses in the same order
+    for (size_t i = 0; i < h2fds.size(); i++) {
+        IPs.emplace_back(folly::SocketAddress(FLAGS_ip, FLAGS_h2_port, true),
+                         HTTPServer::Protocol::HTTP2);
+        IPs.back().acceptorSocketOptions = socketOptions;
+    }
+    fds.insert(fds.end(), h2fds.begin(), h2fds.end());
+
+    HTTPServerOptions options;
+    options.threads = FLAGS_threads > 0 ? static_cast<size_t>(FLAGS_threads)
+            : std::thread::hardware_concurrency();
+    options.idleTimeout = std::chrono::milliseconds(FLAGS_idle_timeout);
+    options.listenBacklog = FLAGS_backlog;
+    options.enableContentCompression = false;
+    options.h2cEnabled = FLAGS_h2c;
+    // The flow control of each stream relays the pauses of its handler, the
+    // window of the connection only has to cover several of them
+    size_t streamWindow = static_cast<size_t>(
+        std::max(FLAGS_h2_stream_window_kb, 64)) << 10;
+    size_t sessionWindow = static_cast<size_t>(
+        std::max(FLAGS_h2_session_window_kb, 64)) << 10;
+    options.maxConcurrentIncomingStreams = std::max(FLAGS_h2_max_streams, 1);
+    options.initialReceiveWindow = streamWindow;
+    options.receiveStreamWindowSize = streamWindow;
+    options.receiveSessionWindowSize = std::max(sessionWindow, streamWindow);
+    options.useExistingSockets(fds);
+    options.handlerFactories = RequestHandlerChain()
+            .addThen(std::move(factory))
+            .build();
+
+    HTTPServer server(std::move(options));
+    server.bind(IPs);
+    std::thread signaler(handleSignals, std::cref(signals), &server,
+                         counter.get(), logger.get());
+    if (FLAGS_scrub)
+        startScrubbers(*volumes, scheduler);
+    server.start();
+    signaler.join();
+    stopScrubbers(*volumes);
+
+    if (logger) {
+        utils::AsyncLogger::Install(nullptr);
+        logger->Stop();
+    }
+    return 0;
+}
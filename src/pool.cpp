@@ -0,0 +1,47 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <atomic>
+#include "pool.hpp"
+
+namespace {
+
+/** Threads share a slot beyond kSlots */
+struct alignas(64) AllocationSlot {
+    std::atomic<uint64_t> count {0};
+};
+
+constexpr unsigned int kSlots = 64;
+AllocationSlot slots[kSlots];
+std::atomic<unsigned int> nextSlot {0};
+
+}  // namespace
+
+/** Neither allocates nor locks: it runs inside operator new */
+void utils::CountAllocation() noexcept {
+    static thread_local unsigned int slot =
+            nextSlot.fetch_add(1, std::memory_order_relaxed) % kSlots;
+    slots[slot].count.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t utils::HeapAllocations() noexcept {
+    uint64_t total = 0;
+    for (auto &slot : slots)
+        total += slot.count.load(std::memory_order_relaxed);
+    return total;
+}
@@ -0,0 +1,202 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#ifndef SRC_POOL_HPP_
+#define SRC_POOL_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace utils {
+
+/**
+ * Count one heap allocation of the calling thread. Called by the operator
+ * new of the program when it replaces it, the count stays 0 otherwise.
+ */
+void CountAllocation() noexcept;
+
+/** @return the heap allocations counted so far, by all the threads */
+uint64_t HeapAllocations() noexcept;
+
+/**
+ * Blocks of `Size` bytes kept by each thread once freed, up to kKept, and
+ * handed back before asking the allocator: the objects created and
+ * destroyed at the rate of the requests reuse the same, hot, memory.
+ * A block freed by another thread joins the blocks of that thread.
+ */
+template <size_t Size>
+class BlockCache {
+ public:
+    static constexpr size_t kKept = 64;
+
+    static void *Get() {
+        if (closed() || cache().blocks.empty())
+            return ::operator new(Size);
+        auto &blocks = cache().blocks;
+        void *block = blocks.back();
+        blocks.pop_back();
+        return block;
+    }
+
+    static void Put(void *block) noexcept {
+        if (closed() || cache().blocks.size() >= kKept) {
+            ::operator delete(block);
+            return;
+        }
+        cache().blocks.push_back(block);
+    }
+
+    /** @return true if the next Get() of the thread reuses a block */
+    static bool Available() {
+        return !closed() && !cache().blocks.empty();
+    }
+
+ private:
+    struct Cache {
+        Cache() { blocks.reserve(kKept); }
+        ~Cache() {
+            closed() = true;
+            for (void *block : blocks)
+                ::operator delete(block);
+        }
+        std::vector<void *> blocks;
+    };
+
+    static Cache &cache() {
+        static thread_local Cache cache;
+        return cache;
+    }
+
+    /** Set once the blocks of the exiting thread are released */
+    static bool &closed() {
+        static thread_local bool closed {false};
+        return closed;
+    }
+};
+
+template <size_t Size>
+constexpr size_t BlockCache<Size>::kKept;
+
+/**
+ * Base of a class whose instances live in the BlockCache of their size.
+ * Instances of a larger derived class come from the allocator.
+ */
+template <typename T>
+class Pooled {
+ public:
+    static void *operator new(size_t size) {
+        if (size != sizeof(T))
+            return ::operator new(size);
+        return BlockCache<sizeof(T)>::Get();
+    }
+
+    static void operator delete(void *p, size_t size) noexcept {
+        if (size != sizeof(T))
+            ::operator delete(p);
+        else
+            BlockCache<sizeof(T)>::Put(p);
+    }
+
+    /** @return true if the next instance made by the thread reuses memory */
+    static bool Recycled() {
+        return BlockCache<sizeof(T)>::Available();
+    }
+};
+
+/** Empty a spare string, keeping its buffer */
+inline void Reset(std::string *value) noexcept {
+    value->clear();
+}
+
+/**
+ * Objects kept by each thread once a request is over, emptied but with
+ * their capacity, up to kKept: the members of the next requests take them
+ * over and fill them without allocating. A type is made spare by a
+ * Reset(T *) overload emptying it, found by argument lookup.
+ */
+template <typename T>
+class Spares {
+ public:
+    static constexpr size_t kKept = 64;
+
+    /** Swap a default-constructed member with a spare, if any */
+    static void Lend(T *member) {
+        if (closed() || cache().spares.empty())
+            return;
+        auto &spares = cache().spares;
+        std::swap(*member, spares.back());
+        spares.pop_back();
+    }
+
+    /** Keep the content of the member, which is left empty */
+    static void Return(T *member) noexcept {
+        if (closed() || cache().spares.size() >= kKept)
+            return;
+        Reset(member);
+        cache().spares.push_back(std::move(*member));
+    }
+
+    /** @return the spares of the calling thread */
+    static size_t Kept() {
+        return closed() ? 0 : cache().spares.size();
+    }
+
+ private:
+    struct Cache {
+        Cache() { spares.reserve(kKept); }
+        ~Cache() { closed() = true; }
+        std::vector<T> spares;
+    };
+
+    static Cache &cache() {
+        static thread_local Cache cache;
+        return cache;
+    }
+
+    static bool &closed() {
+        static thread_local bool closed {false};
+        return closed;
+    }
+};
+
+template <typename T>
+constexpr size_t Spares<T>::kKept;
+
+/**
+ * Lend a spare to an empty member for the lifetime of the loan, declared
+ * after the member so that it is returned before the member is destroyed.
+ */
+template <typename T>
+class Loan {
+ public:
+    explicit Loan(T *member) : member {member} { Spares<T>::Lend(member); }
+    ~Loan() { Spares<T>::Return(member); }
+    Loan(const Loan&) = delete;
+    Loan& operator=(const Loan&) = delete;
+
+ private:
+    T *member;
+};
+
+}  // namespace utils
+
+#endif  // SRC_POOL_HPP_
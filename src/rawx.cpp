@@ -23,14 +23,22 @@
 #include <proxygen/httpserver/ResponseBuilder.h>
 #include <folly/io/IOBuf.h>
 #include <folly/io/async/EventBase.h>
+#include <folly/io/async/EventBaseManager.h>
+#include <strings.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <string>
 #include <vector>
 #include <iostream>
 
+#include "affinity.hpp"
 #include "utils.hpp"
 #include "blob.hpp"
 
 using folly::IOBuf;
 using rawx::RawxHandlerFactory;
+using rawx::IoHandler;
 using rawx::DownloadHandler;
 using rawx::UploadHandler;
 using rawx::RemovalHandler;
@@ -42,10 +50,101 @@ using proxygen::ResponseBuilder;
 using proxygen::HTTPMessage;
 using blob::Slice;
 using blob::FileSlice;
+using blob::IoClass;
+using blob::IoScheduler;
 using utils::RequestCounter;
+using utils::Attr;
 
+/** The attributes an upload must bring */
+static constexpr Attr kUploadRequired[] = {
+    Attr::ContentId, Attr::ContentContainer, Attr::ContentStoragePolicy,
+    Attr::ContentChunkMethod, Attr::ContentPath, Attr::ChunkId,
+    Attr::ChunkPosition
+};
 
-void RawxHandlerFactory::onServerStart(folly::EventBase*) noexcept {}
+/**
+ * Queue of the tasks touching every volume, no path of a volume is empty:
+ * the lookups of the chunks without volume in their URL, and the refreshes
+ * of their space
+ */
+static const char kLookups[] = "";
+
+/** The attributes echoed by the reply of an upload */
+static constexpr Attr kUploadReply[] = {
+    Attr::ContentContainer, Attr::ContentId, Attr::ContentPath,
+    Attr::ContentVersion, Attr::ContentStoragePolicy,
+    Attr::ContentChunkMethod, Attr::ChunkId, Attr::ChunkHash,
+    Attr::ChunkPosition, Attr::ChunkSize
+};
+
+bool rawx::ChunkPath(const std::string &volume, const std::string &url,
+                     std::string *path) {
+    size_t start = (!url.empty() && url[0] == '/') ? 1 : 0;
+    std::string id = url.substr(start);
+    if (!blob::ValidChunkId(id))
+        return false;
+    blob::ChunkPathIn(volume, id, path);
+    return true;
+}
+
+void rawx::ReplyETag(const utils::XAttr &xattr,
+                     const std::string &acceptEncoding, bool ranged,
+                     std::string *etag) {
+    utils::ChunkETag(xattr.Get(Attr::ChunkHash), etag);
+    auto codec = blob::ChunkCodec(xattr.Get(Attr::ContentChunkMethod));
+    if (!etag->empty() && !ranged && codec != blob::Codec::None
+            && utils::AcceptsCoding(acceptEncoding, blob::CodecName(codec)))
+        etag->insert(0, "W/");
+}
+
+rawx::CachePolicies rawx::DefaultCachePolicies() {
+    CachePolicies policies;
+    policies[static_cast<unsigned int>(IoClass::Background)].dropBehind = true;
+    return policies;
+}
+
+std::shared_ptr<blob::Volumes> rawx::LocalVolumes() {
+    auto volumes = std::make_shared<blob::Volumes>();
+    volumes->Add(std::make_shared<blob::Volume>());
+    return volumes;
+}
+
+RawxHandlerFactory::RawxHandlerFactory()
+        : RawxHandlerFactory(std::make_shared<IoScheduler>(
+            blob::IoSchedulerOptions())) {}
+
+RawxHandlerFactory::RawxHandlerFactory(std::shared_ptr<IoScheduler> scheduler)
+        : requestCounter {std::make_shared<RequestCounter>()},
+          scheduler {scheduler} {}
+
+void RawxHandlerFactory::Tracing(bool enabled,
+                                 std::chrono::milliseconds slowThreshold) {
+    auto &phases = requestCounter->Phases();
+    phases.Enabled(enabled);
+    phases.SlowThreshold(slowThreshold);
+}
+
+void RawxHandlerFactory::Volume(const std::string &path, int node) {
+    auto volume = std::make_shared<blob::Volume>();
+    volume->path = path;
+    volume->node = node;
+    volumes = std::make_shared<blob::Volumes>();
+    volumes->Add(volume);
+}
+
+void RawxHandlerFactory::onServerStart(folly::EventBase*) noexcept {
+    if (cpus.empty())
+        return;
+    int cpu = cpus[nextCpu++ % cpus.size()];
+    if (!utils::PinThread(cpu)) {
+        serviceLog.LogToPrint("WRN", "Cannot pin a thread on CPU "
+                              + std::to_string(cpu));
+        return;
+    }
+    int node = utils::CpuNode(cpu);
+    if (node >= 0)
+        utils::PreferNode(node);
+}
 
 void RawxHandlerFactory::onServerStop() noexcept {}
 
@@ -57,14 +156,32 @@ RequestHandler* RawxHandlerFactory::onRequest(RequestHandler*,
         // TODO(KR) Write access log and error
     }
     switch (*method) {
-        case HTTPMethod::GET:
-            return new DownloadHandler(requestCounter);
-            break;
-        case HTTPMethod::PUT:
-            return new UploadHandler(requestCounter);
-            break;
+        case HTTPMethod::GET: {
+            if (msg->getPath() == "/stat" || msg->getPath() == "/metrics")
+                return new StatHandler(requestCounter, volumes, scheduler);
+            if (DownloadHandler::Recycled())
+                requestCounter->incPooled();
+            auto handler = new DownloadHandler(requestCounter, scheduler,
+                                               volumes);
+            handler->Caching(caching);
+            handler->Pipeline(pipeline);
+            handler->Coalescing(flights);
+            return handler;
+        }
+        case HTTPMethod::PUT: {
+            if (UploadHandler::Recycled())
+                requestCounter->incPooled();
+            auto handler = new UploadHandler(requestCounter, scheduler,
+                                             volumes);
+            handler->Ingress(ingress);
+            handler->Caching(caching);
+            handler->Compressing(compressing);
+            return handler;
+        }
         case HTTPMethod::DELETE:
-            return new RemovalHandler(requestCounter);
+            if (RemovalHandler::Recycled())
+                requestCounter->incPooled();
+            return new RemovalHandler(requestCounter, scheduler, volumes);
             break;
         default:
             return nullptr;
@@ -73,20 +190,191 @@ RequestHandler* RawxHandlerFactory::onRequest(RequestHandler*,
     return nullptr;
 }
 
+void IoHandler::classify(proxygen::HTTPMessage *headers, IoClass byDefault) {
+    ioClass = byDefault;
+    auto &value = headers->getHeaders().getSingleOrEmpty("X-oio-io-class");
+    if (!value.empty())
+        blob::IoClassParse(value, &ioClass);
+}
+
+int IoHandler::route(const std::string &url, bool create, uint64_t size,
+                     std::string *path) {
+    auto found = volumes->Route(url, &chunkId);
+    if (!blob::ValidChunkId(chunkId))
+        return 400;
+    auto &all = volumes->All();
+    if (all.empty())
+        return 507;
+    // Locate() costs an access() per volume, and a stale space a statvfs()
+    // per volume: locate() does them on the I/O threads
+    if (!found && all.size() == 1 && (!create || !volumes->Stale())) {
+        found = create ? volumes->Place(size) : all.front();
+        if (!found)
+            return 507;
+    }
+    if (found)
+        bind(found, path);
+    return 0;
+}
+
+void IoHandler::bind(std::shared_ptr<blob::Volume> found,
+                     std::string *path) {
+    blob::ChunkPathIn(found->path, chunkId, path);
+    volume = found;
+    volume->requests++;
+    volume->inflight++;
+}
+
+void IoHandler::locate(bool create, uint64_t size, std::string *path,
+                       std::function<void(int)> then) {
+    if (volume) {
+        then(0);
+        return;
+    }
+    schedule(0, [this, create, size]() {
+        if (!create) {
+            located = volumes->Locate(chunkId);
+            return blob::Status();
+        }
+        if (volumes->All().size() > 1 && volumes->Locate(chunkId))
+            return blob::Status(blob::Cause::Already);
+        volumes->RefreshIfStale();
+        located = volumes->Place(size);
+        return blob::Status();
+    }, [this, create, path, then](blob::Status status) {
+        if (status.Why() == blob::Cause::Already) {
+            then(409);
+            return;
+        }
+        if (!located && create) {
+            then(507);
+            return;
+        }
+        // Found nowhere: any volume will do, opening the chunk will fail
+        bind(located ? located : volumes->All().front(), path);
+        located.reset();
+        then(0);
+    });
+}
+
+void IoHandler::begin(RequestCounter *counter) {
+    timer.Start();
+    active = counter;
+    active->incInflight();
+    if (counter->Phases().Enabled()) {
+        traced = &trace;
+        parseStart = utils::PhaseTrace::Now();
+    }
+}
+
+void IoHandler::schedule(uint64_t cost, std::function<blob::Status()> io,
+                         std::function<void(blob::Status)> then) {
+    uint64_t now = 0;
+    if (traced != nullptr) {
+        now = utils::PhaseTrace::Now();
+        // Everything until the first I/O is the parsing of the request
+        if (parseStart != 0) {
+            traced->Add(utils::Phase::Parse, now - parseStart);
+            parseStart = 0;
+        }
+    }
+    if (!scheduler) {
+        then(io());
+        return;
+    }
+    if (active != nullptr && volume)
+        active->Nodes().Record(volume->node, utils::CurrentNode(), cost);
+    auto evb = folly::EventBaseManager::get()->getEventBase();
+    blob::IoTask task;
+    task.cls = ioClass;
+    task.volume = volume ? volume->path : kLookups;
+    task.cost = cost;
+    // Several tasks of a request may run at once: besides the single traced
+    // blob operation, the trace is only written from the EventBase thread
+    // (see PhaseTrace)
+    task.run = [this, evb, io, then, now]() {
+        uint64_t queued = 0;
+        if (traced != nullptr)
+            queued = utils::PhaseTrace::Now() - now;
+        auto status = io();
+        evb->runInEventBaseThread([this, status, then, queued]() {
+            if (traced != nullptr)
+                traced->Add(utils::Phase::Queue, queued);
+            pending--;
+            if (!terminated)
+                then(status);
+            if (terminated && pending == 0)
+                delete this;
+        });
+    };
+    pending++;
+    if (!scheduler->Submit(std::move(task))) {
+        pending--;
+        then(blob::Status(blob::Cause::InternalError));
+    }
+}
+
+uint64_t IoHandler::record(RequestCounter *counter, utils::Method method,
+                           utils::AccessLog *log) {
+    uint64_t total = timer.Elapsed();
+    counter->Latency().Record(method, statusCode, timer.TimeToFirstByte(),
+                              total);
+    log->ResponseTime(total / 1000);
+    // The scrubbing of the volume backs off while the foreground requests
+    // wait. The first byte of an upload follows its body: not a disk wait.
+    uint64_t ttfb = timer.TimeToFirstByte();
+    if (volume && volume->scrubber && ioClass == IoClass::Foreground
+            && method != utils::Method::Put && ttfb > 0)
+        volume->scrubber->Feedback(std::chrono::microseconds(ttfb / 1000));
+    if (traced != nullptr) {
+        if (endedAt != 0)
+            traced->Add(utils::Phase::Egress,
+                        utils::PhaseTrace::Now() - endedAt);
+        auto &phases = counter->Phases();
+        phases.Record(trace);
+        uint64_t threshold = phases.SlowThreshold();
+        if (threshold > 0 && total >= threshold) {
+            phases.incSlow();
+            log->Slow(trace);
+        }
+    }
+    return total;
+}
+
+void IoHandler::terminate() {
+    if (active != nullptr) {
+        active->decInflight();
+        active = nullptr;
+        if (volume)
+            volume->inflight--;
+    }
+    terminated = true;
+    if (pending == 0)
+        delete this;
+}
+
+DownloadHandler::~DownloadHandler() {
+    leave();
+    download.Abort();
+}
+
 bool DownloadHandler::headerCheck(proxygen::HTTPMessage *headers) {
-    std::string tmpheader = headers->getHeaders().rawGet("X-oio-req-id");
-    if (tmpheader.empty())
+    auto &all = headers->getHeaders();
+    auto &requestId = all.getSingleOrEmpty("X-oio-req-id");
+    if (requestId.empty())
         return false;
-    accessLog.RequestID(tmpheader);
-    path = headers->getURL();
-
-    if (path.empty())
+    accessLog.RequestID(requestId);
+    if (route(headers->getPath(), false, 0, &path) != 0)
         return false;
-    path = path.substr(0, 3) + "/" + path;
 
-    tmpheader = headers->getHeaders().rawGet("Range");
-    if (!tmpheader.empty()) {
-        return download.setRange(tmpheader);
+    ifMatch = all.getSingleOrEmpty(proxygen::HTTP_HEADER_IF_MATCH);
+    ifNoneMatch = all.getSingleOrEmpty(proxygen::HTTP_HEADER_IF_NONE_MATCH);
+    ifRange = all.getSingleOrEmpty(proxygen::HTTP_HEADER_IF_RANGE);
+    acceptEncoding = all.getSingleOrEmpty(
+        proxygen::HTTP_HEADER_ACCEPT_ENCODING);
+    auto &range = all.getSingleOrEmpty(proxygen::HTTP_HEADER_RANGE);
+    if (!range.empty()) {
+        return download.setRange(range);
     }
 
     return true;
@@ -109,56 +397,330 @@ void DownloadHandler::Abort() noexcept {
 
 void DownloadHandler::onRequest(
     std::unique_ptr<proxygen::HTTPMessage> headers) noexcept {
-    beginOfRequest = std::time(nullptr);
+    begin(requestCounter.get());
     requestCounter->incGetHits();
     accessLog.RequestType("GET");
+    classify(headers.get(), IoClass::Foreground);
     if (!headerCheck(headers.get())) {
         serviceLog.LogToPrint("INF", "Header not conform to the GET request");
-        ResponseBuilder(downstream_).status(400, "Bad Request");
-        requestCounter->incR4xxHits();
+        reply(400, "Bad Request");
         return;
     }
-    download.Path(path);
-    if (!download.Prepare().Ok()) {
-        serviceLog.LogToPrint("INF", "Error with the path to the Chunk");
-        accessLog.StatusCode("404");
-        ResponseBuilder(downstream_).status(404, "Chunk not found");
+    locate(false, 0, &path, [this](int) {
+        download.Path(path);
+        download.Cache(cachePolicy());
+        download.XAttr(&xattr);
+        download.Trace(traced);
+        if (ifMatch.empty() && ifNoneMatch.empty() && ifRange.empty())
+            open();
+        else
+            revalidate();
+    });
+}
+
+void DownloadHandler::reply(int code, const std::string &reason) noexcept {
+    ResponseBuilder response(downstream_);
+    response.status(code, reason);
+    if (!etag.empty())
+        response.header("ETag", etag);
+    if (code == 416)
+        response.header("Content-Range",
+                        "bytes */" + std::to_string(download.Size()));
+    response.sendWithEOM();
+    accessLog.StatusCode(code);
+    replied(code);
+    if (code >= 500)
+        requestCounter->incR5xxHits();
+    else if (code >= 400)
         requestCounter->incR4xxHits();
-        return;
-    }
-    accessLog.UserID(xattr.getHTTP("container-id"));
-    sendHeader();
-    sendData();
+    else
+        requestCounter->incOtherHits();
+    if (code == 404)
+        requestCounter->incR404Hits();
 }
 
+void DownloadHandler::revalidate() noexcept {
+    schedule(0, [this]() {
+        utils::PhaseScope scope(traced, utils::Phase::XAttr);
+        if (!xattr.retrieveXAttr(path))
+            return blob::Status(blob::Cause::NotFound);
+        return blob::Status();
+    }, [this](blob::Status status) {
+        if (!status.Ok()) {
+            serviceLog.LogToPrint("INF", "Error with the path to the Chunk");
+            reply(404, "Chunk not found");
+            return;
+        }
+        accessLog.UserID(xattr.Get(Attr::ContentContainer));
+        // The tag the 200 would carry, a 304 must repeat it
+        rawx::ReplyETag(xattr, acceptEncoding, download.Ranged(), &etag);
+        switch (utils::EvaluatePreconditions(etag, ifMatch, ifNoneMatch)) {
+            case utils::Precondition::NotModified:
+                reply(304, "Not Modified");
+                return;
+            case utils::Precondition::Failed:
+                reply(412, "Precondition Failed");
+                return;
+            case utils::Precondition::Proceed:
+                break;
+        }
+        if (!utils::RangeApplies(etag, ifRange))
+            download.resetRange();
+        open();
+    });
+}
+
+void DownloadHandler::open() noexcept {
+    schedule(0, [this]() { return download.Prepare(); },
+             [this](blob::Status status) {
+        if (!status.Ok()) {
+            serviceLog.LogToPrint("INF", "Error with the path to the Chunk");
+            reply(404, "Chunk not found");
+            return;
+        }
+        accessLog.UserID(xattr.Get(Attr::ContentContainer));
+        utils::ChunkETag(xattr.Get(Attr::ChunkHash), &etag);
+        if (download.Ranged() && download.Start() >= download.Size()) {
+            reply(416, "Range Not Satisfiable");
+            return;
+        }
+        // A client decoding the codec gets the whole chunk as stored
+        auto frames = download.Frames();
+        if (frames && !download.Ranged() && utils::AcceptsCoding(
+                acceptEncoding, blob::CodecName(frames->Compression()))) {
+            download.Stored();
+            encoding = blob::CodecName(frames->Compression());
+            if (!etag.empty())
+                etag.insert(0, "W/");
+        }
+        sendHeader();
+        board();
+        sendData();
+    });
+}
+
+/** 200 for the whole chunk, 206 for a range */
 void DownloadHandler::sendHeader() noexcept {
-    auto namesValues = xattr.HTTPNamesValues();
-    ResponseBuilder(downstream_).status(206, "Partial Content");
-    for (auto &elem : namesValues) {
-        ResponseBuilder(downstream_).header<std::string>(elem.first,
-                                                         elem.second);
+    bool ranged = download.Ranged();
+    int code = ranged ? 206 : 200;
+    ResponseBuilder response(downstream_);
+    response.status(code, ranged ? "Partial Content" : "OK");
+    for (unsigned int i = 0; i < utils::kAttrs; i++) {
+        auto &value = xattr.Get(static_cast<Attr>(i));
+        if (!value.empty())
+            response.header(utils::kAttributes[i].header, value);
+    }
+    if (!etag.empty())
+        response.header("ETag", etag);
+    if (download.Frames())
+        response.header("Vary", "Accept-Encoding");
+    if (!encoding.empty())
+        response.header("Content-Encoding", encoding);
+    if (ranged) {
+        response.header("Content-Range", "bytes "
+                        + std::to_string(download.Start()) + "-"
+                        + std::to_string(download.Stop() - 1) + "/"
+                        + std::to_string(download.Size()));
     }
+    accessLog.StatusCode(code);
+    replied(code);
     requestCounter->incR2xxHits();
-    ResponseBuilder(downstream_).send();
+    response.send();
+}
+
+/** An IOBuf on the memory of the block, released with the last one */
+static std::unique_ptr<IOBuf> wrapBlock(const blob::BlockRef &block) {
+    auto ref = new blob::BlockRef(block);
+    return IOBuf::takeOwnership(block->data, block->length,
+                                [](void *, void *ref) {
+        delete static_cast<blob::BlockRef *>(ref);
+    }, ref);
+}
+
+void DownloadHandler::board() noexcept {
+    uint64_t start = download.Start();
+    stop = std::max(download.Stop(), start);
+    nextSend = start;
+    depth = std::max(pipeline.minDepth, 1u);
+    block = std::max(pipeline.minBlock, 1u);
+    blob::Flight::Seat joined;
+    if (flights) {
+        // The bytes stored and the plain bytes are different flights
+        flightKey = path + ":" + encoding + ":" + std::to_string(start)
+                + "-" + std::to_string(stop);
+        flight = flights->Get(flightKey, start, stop);
+        joined = flight->Join(sink());
+    }
+    if (joined.id == 0) {
+        flightKey.clear();
+        flight = std::make_shared<blob::Flight>(start, stop, 0);
+        joined = flight->Join(sink());
+    }
+    seat = reader = joined.id;
+    if (joined.shared)
+        requestCounter->incCoalesced();
+    for (auto &retained : joined.retained)
+        ready[retained->offset] = retained;
+}
+
+blob::Flight::Sink DownloadHandler::sink() noexcept {
+    receiver = std::make_shared<DownloadHandler *>(this);
+    auto target = receiver;
+    auto evb = folly::EventBaseManager::get()->getEventBase();
+    return [evb, target](const blob::BlockRef &block) {
+        evb->runInEventBaseThread([target, block]() {
+            if (*target != nullptr)
+                (*target)->receive(block);
+        });
+    };
+}
+
+void DownloadHandler::leave() noexcept {
+    if (receiver)
+        *receiver = nullptr;
+    if (!flight)
+        return;
+    if (!flightKey.empty())
+        flights->Leave(flightKey, flight, seat);
+    else
+        flight->Leave(seat);
+    flight = nullptr;
+    flightKey.clear();
+}
+
+/**
+ * Keep the blocks following what was sent, the others come again with the
+ * new flight.
+ */
+void DownloadHandler::detach() noexcept {
+    uint64_t end = nextSend;
+    auto it = ready.begin();
+    for (; it != ready.end() && it->first == end; ++it)
+        end += it->second->length;
+    ready.erase(it, ready.end());
+    leave();
+    flight = std::make_shared<blob::Flight>(end, stop, 0);
+    seat = flight->Join(sink()).id;
+}
+
+void DownloadHandler::receive(const blob::BlockRef &read) noexcept {
+    if (failed || finished)
+        return;
+    if (read == nullptr) {
+        serviceLog.LogToPrint("INF", "Error reading the chunk");
+        failed = true;
+        Abort();
+        return;
+    }
+    if (read->offset < nextSend || ready.count(read->offset) > 0)
+        return;
+    // The client was waiting for this block: read more, and larger
+    if (read->offset == nextSend && !egressPaused) {
+        depth = std::min(depth + 1, std::max(pipeline.maxDepth, 1u));
+        block = std::min(block * 2, std::max(pipeline.maxBlock, 1u));
+    }
+    ready[read->offset] = read;
+    // A slow client doesn't hold the others back
+    if (ready.size() > 2 * std::max(pipeline.maxDepth, 1u))
+        detach();
+    sendData();
 }
 
 void DownloadHandler::sendData() noexcept {
-    std::shared_ptr<Slice> slice;
-    while (!download.isEof()) {
-        if (!download.Read(slice).Ok()) {
-            serviceLog.LogToPrint("INF", "Error reading the chunk");
-            Abort();
-            return;
-        }
-        ResponseBuilder(downstream_).body(IOBuf::wrapBuffer(
-            slice->data(), (unsigned int)slice->size()));
-        ResponseBuilder(downstream_).send();
+    if (failed || finished)
+        return;
+    while (!ready.empty() && ready.begin()->first == nextSend) {
+        auto read = std::move(ready.begin()->second);
+        ready.erase(ready.begin());
+        nextSend += read->length;
+        requestCounter->incBread(read->length);
+        if (read->reader != reader)
+            requestCounter->incBshared(read->length);
+        volume->bytesRead += read->length;
+        ResponseBuilder(downstream_).body(wrapBlock(read)).send();
+    }
+    if (nextSend >= stop) {
+        finished = true;
+        leave();
+        ResponseBuilder(downstream_).sendWithEOM();
+        ended();
+        return;
+    }
+    fill();
+}
+
+void DownloadHandler::fill() noexcept {
+    while (flight && !egressPaused && reading + ready.size() < depth) {
+        if (!readBlock())
+            break;
     }
-    ResponseBuilder(downstream_).sendWithEOM();
+}
+
+/**
+ * Read one block on the I/O scheduler and publish it to the readers of
+ * the flight. The block is allocated by the worker, on its NUMA node, and
+ * sent as is.
+ */
+bool DownloadHandler::readBlock() noexcept {
+    uint64_t offset = 0;
+    uint32_t length = 0;
+    if (!flight->Claim(block, &offset, &length))
+        return false;
+    // detach() may replace the flight meanwhile
+    auto reads = flight;
+    auto nanos = std::make_shared<uint64_t>(0);
+    uint64_t tag = reader;
+    reading++;
+    schedule(length, [this, reads, offset, length, nanos, tag]() {
+        uint64_t start = utils::PhaseTrace::Now();
+        std::shared_ptr<blob::SharedBlock> read;
+        blob::Status status;
+        auto mapped = download.Mapped();
+        if (mapped) {
+            // Sent from the page cache: the pages are only faulted in
+            read = std::make_shared<blob::SharedBlock>(offset, length, tag,
+                mapped->Data() + offset, mapped);
+            if (!mapped->Touch(offset, length))
+                status = blob::Status(blob::Cause::InternalError);
+        } else {
+            read = std::make_shared<blob::SharedBlock>(offset, length, tag);
+            status = download.ReadAt(offset, read->data, length,
+                                     &read->length);
+        }
+        *nanos = utils::PhaseTrace::Now() - start;
+        // The chunk was truncated since it was opened
+        if (status.Ok() && read->length < length)
+            status = blob::Status(blob::Cause::InternalError);
+        // The readers learn a failure from the flight
+        if (status.Ok())
+            reads->Publish(read);
+        else
+            reads->Fail();
+        return status;
+    }, [this, nanos](blob::Status status) {
+        reading--;
+        if (traced != nullptr)
+            traced->Add(utils::Phase::Read, *nanos);
+        if (status.Ok())
+            sendData();
+    });
+    return true;
+}
+
+void DownloadHandler::onEgressPaused() noexcept {
+    egressPaused = true;
+    depth = std::max(depth / 2, std::max(pipeline.minDepth, 1u));
+}
+
+void DownloadHandler::onEgressResumed() noexcept {
+    egressPaused = false;
+    fill();
 }
 
 void DownloadHandler::onError(proxygen::ProxygenError err) noexcept {
     serviceLog.LogToPrint("INF", getErrorString(err));
+    leave();
+    terminate();
 }
 
 void DownloadHandler::onBody(std::unique_ptr<folly::IOBuf>) noexcept {
@@ -166,35 +728,46 @@ void DownloadHandler::onBody(std::unique_ptr<folly::IOBuf>) noexcept {
 }
 
 void DownloadHandler::onUpgrade(proxygen::UpgradeProtocol) noexcept {
-    serviceLog.LogToPrint("INF", "Upgrade to h2c are not handled");
+    // h2c is negotiated by the session, before any handler
+    serviceLog.LogToPrint("INF", "Protocol upgrades are not handled");
 }
 
 void DownloadHandler::requestComplete() noexcept {
-    endOfRequest = std::time(nullptr);
-    accessLog.LogToPrint("INF", xattr.getHTTP("chunk-id"));
+    uint64_t total = record(requestCounter.get(), utils::Method::Get,
+                            &accessLog);
+    requestCounter->incGetTime(total / 1000);
+    auto frames = download.Frames();
+    if (frames)
+        requestCounter->incDecompressTime(frames->Nanos() / 1000);
+    accessLog.Log("INF", xattr.Get(Attr::ChunkId));
+    leave();
+    terminate();
 }
 
 void DownloadHandler::onEOM() noexcept  {}
 
+/**
+ * One pass over the headers. The chunk-hash and chunk-size are computed
+ * from the body when absent.
+ */
 bool UploadHandler::headerCheck(proxygen::HTTPMessage *headers) {
-    std::vector<std::string> names {"content-id", "container-id",
-                "content-storage-policy", "content-chunk-method",
-                "content-path", "chunk-id", "chunk-pos"};
-    std::string tmpheader;
-    for (auto &elem :  names) {
-        tmpheader = headers->getHeaders().rawGet(xattr.HttpPrefix() + elem);
-        if (!tmpheader.empty()) {
-            xattr.addHTTP(xattr.HttpPrefix()+elem, tmpheader);
-        } else {
+    headers->getHeaders().forEach([this](const std::string &name,
+                                         const std::string &value) {
+        if (!value.empty())
+            xattr.SetHeader(name, value);
+    });
+    for (auto attr : kUploadRequired) {
+        if (xattr.Get(attr).empty())
             return false;
-        }
     }
-    path = headers->getHeaders().rawGet(xattr.XAttrPrefix()+ "chunk-id");
-    path = path.substr(0, 3) + "/" + path;
     return true;
 }
 
-int UploadHandler::size() {
+UploadHandler::~UploadHandler() {
+    upload.Abort();
+}
+
+uint64_t UploadHandler::size() {
     return sizeUploaded;
 }
 
@@ -218,60 +791,305 @@ void UploadHandler::onRequest(
     std::unique_ptr<proxygen::HTTPMessage> headers) noexcept {
     requestCounter->incPutHits();
     accessLog.RequestType("PUT");
-    beginOfRequest = std::time(nullptr);
-    headerCheck(headers.get());
+    begin(requestCounter.get());
+    classify(headers.get(), IoClass::Foreground);
+    multiplexed = headers->getProtocolString().compare(0, 5, "HTTP/") != 0;
+    auto &expect = headers->getHeaders().getSingleOrEmpty(
+        proxygen::HTTP_HEADER_EXPECT);
+    if (!expect.empty()) {
+        if (strcasecmp(expect.c_str(), "100-continue") != 0) {
+            fail(417, "Expectation Failed");
+            return;
+        }
+        expectContinue = true;
+    }
+    if (!headerCheck(headers.get())) {
+        serviceLog.LogToPrint("INF", "Header not conform to the PUT request");
+        fail(400, "Bad Request");
+        return;
+    }
+    // A chunked body has no Content-Length, the chunk may announce its size
+    auto &length = headers->getHeaders().getSingleOrEmpty(
+        proxygen::HTTP_HEADER_CONTENT_LENGTH);
+    uint64_t expected = strtoull(length.empty()
+            ? xattr.Get(Attr::ChunkSize).c_str() : length.c_str(), nullptr, 10);
+    // An unknown algorithm is trusted as is
+    auto &hash = xattr.Get(Attr::ChunkHash);
+    hashing = hasher.Init(hash.empty() ? 32 : hash.size());
+    int code = route(headers->getPath(), true, expected, &path);
+    if (code != 0) {
+        serviceLog.LogToPrint("INF", "No volume for the chunk");
+        fail(code, code == 507 ? "Insufficient Storage" : "Bad Request");
+        return;
+    }
+    // The body received meanwhile waits for the chunk
+    writing = true;
+    locate(true, expected, &path, [this, expected](int code) {
+        writing = false;
+        if (code != 0) {
+            serviceLog.LogToPrint("INF", "No volume for the chunk");
+            fail(code, code == 507 ? "Insufficient Storage" : "Conflict");
+            return;
+        }
+        // The body received meanwhile is on the volume from now on
+        int64_t before = volume->buffered.fetch_add(buffered);
+        // The disk is far behind: the client had better try another rawx
+        if (limits.volumeReject > 0
+                && before >= static_cast<int64_t>(limits.volumeReject)) {
+            serviceLog.LogToPrint("INF",
+                                  "Too many bytes waiting for the volume");
+            fail(503, "Service Unavailable");
+            return;
+        }
+        prepare(expected);
+    });
+}
+
+void UploadHandler::prepare(uint64_t expected) noexcept {
     upload.Path(path);
-    if (!upload.Prepare().Ok()) {
-        serviceLog.LogToPrint("INF", "Error with the path of file");
-        ResponseBuilder(downstream_).status(400, "Bad Request").send();
-        accessLog.StatusCode("400");
-        requestCounter->incR4xxHits();
+    upload.Cache(cachePolicy());
+    upload.ExpectedSize(expected);
+    upload.XAttr(&xattr);
+    upload.Trace(traced);
+    upload.Compression(blob::ChunkCodec(xattr.Get(Attr::ContentChunkMethod)),
+                       compressing);
+    writing = true;
+    schedule(0, [this]() { return upload.Prepare(); },
+             [this](blob::Status status) {
+        writing = false;
+        if (status.Why() == blob::Cause::Already) {
+            serviceLog.LogToPrint("INF", "The chunk already exists");
+            fail(409, "Conflict");
+            return;
+        }
+        if (!status.Ok()) {
+            serviceLog.LogToPrint("INF", "Error with the path of file");
+            fail(500, "Internal Server Error");
+            return;
+        }
+        created = true;
+        if (expectContinue) {
+            expectContinue = false;
+            ResponseBuilder(downstream_).status(100, "Continue").send();
+        }
+        flush();
+    });
+}
+
+void UploadHandler::fail(int code, std::string reason) noexcept {
+    failed = true;
+    pending.clear();
+    drain(buffered);
+    discard();
+    // Let the rest of the body be read and discarded
+    if (paused) {
+        paused = false;
+        downstream_->resumeIngress();
     }
+    ResponseBuilder response(downstream_);
+    response.status(code, reason);
+    // The client won't send the body: nothing would end the request. An
+    // HTTP/2 stream is reset alone.
+    if (expectContinue && !multiplexed)
+        response.closeConnection();
+    response.sendWithEOM();
+    accessLog.StatusCode(code);
+    replied(code);
+    if (code >= 500)
+        requestCounter->incR5xxHits();
+    else
+        requestCounter->incR4xxHits();
+}
+
+/** Never called with a write in flight, which would race the abort */
+void UploadHandler::discard() noexcept {
+    if (!created)
+        return;
+    created = false;
+    schedule(0, [this]() { return upload.Abort(); }, [](blob::Status) {});
 }
 
 void UploadHandler::onBody(std::unique_ptr<folly::IOBuf> body)
         noexcept  {
-    sizeUploaded += body->length();
-    std::shared_ptr<Slice> slice(new FileSlice(body->writableData(),
-                                               body->length()));
-    upload.Write(slice);
+    if (failed)
+        return;
+    uint64_t length = body->computeChainDataLength();
+    sizeUploaded += length;
+    buffered += length;
+    requestCounter->incBuffered(length);
+    if (volume)
+        volume->buffered += length;
+    pending.push_back(std::move(body));
+    if (!writing)
+        flush();
+    throttle();
+}
+
+/**
+ * The volume limit only pauses the uploads with bytes of their own being
+ * written: they are sure to be called back, and an upload that wrote all
+ * its bytes always resumes.
+ */
+void UploadHandler::throttle() noexcept {
+    if (failed)
+        return;
+    uint64_t onVolume = volume ? std::max<int64_t>(volume->buffered, 0) : 0;
+    if (!paused) {
+        if (buffered >= limits.uploadHigh
+                || (buffered > 0 && onVolume >= limits.volumeHigh)) {
+            paused = true;
+            downstream_->pauseIngress();
+            requestCounter->incPaused();
+        }
+    } else if (buffered <= limits.uploadLow
+               && (buffered == 0 || onVolume <= limits.volumeLow)) {
+        paused = false;
+        downstream_->resumeIngress();
+    }
+}
+
+void UploadHandler::drain(uint64_t bytes) noexcept {
+    bytes = std::min(bytes, buffered);
+    buffered -= bytes;
+    requestCounter->decBuffered(bytes);
+    if (volume)
+        volume->buffered -= bytes;
+}
+
+/**
+ * Write all the buffers received so far in one I/O. Only one write is in
+ * flight at a time so that the order of the body is kept.
+ */
+void UploadHandler::flush() noexcept {
+    if (failed)
+        return;
+    if (pending.empty()) {
+        if (eom)
+            commit();
+        return;
+    }
+    std::shared_ptr<Slice> slice = std::make_shared<FileSlice>();
+    for (auto &body : pending) {
+        IOBuf *buf = body.get();
+        do {
+            slice->append(buf->writableData(), buf->length());
+            buf = buf->next();
+        } while (buf != body.get());
+    }
+    pending.clear();
+    writing = true;
+    schedule(slice->size(), [this, slice]() {
+        auto status = upload.Write(slice);
+        if (status.Ok() && hashing)
+            hasher.Update(slice->data(), slice->size());
+        return status;
+    },
+             [this, slice](blob::Status status) {
+        writing = false;
+        drain(slice->size());
+        if (!status.Ok()) {
+            serviceLog.LogToPrint("INF", "Error writing the chunk");
+            fail(500, "Internal Server Error");
+            return;
+        }
+        requestCounter->incBwritten(slice->size());
+        volume->bytesWritten += slice->size();
+        flush();
+        throttle();
+    });
+}
+
+void UploadHandler::commit() noexcept {
+    if (!seal()) {
+        serviceLog.LogToPrint("INF", "The size or the hash of the chunk "
+                              "differs");
+        fail(400, "Bad Request");
+        return;
+    }
+    writing = true;
+    schedule(0, [this]() { return upload.Commit(); },
+             [this](blob::Status status) {
+        if (status.Why() == blob::Cause::Already) {
+            serviceLog.LogToPrint("INF", "The chunk was created meanwhile");
+            fail(409, "Conflict");
+            return;
+        }
+        if (!status.Ok()) {
+            serviceLog.LogToPrint("INF", "Error committing the chunk");
+            fail(500, "Internal Server Error");
+            return;
+        }
+        auto frames = upload.Frames();
+        if (frames != nullptr) {
+            requestCounter->incCompressed(frames->PlainBytes(),
+                                          frames->StoredBytes());
+            requestCounter->incCompressTime(frames->Nanos() / 1000);
+        }
+        created = false;
+        accessLog.UserID(xattr.Get(Attr::ContentContainer));
+        sendHeader();
+    });
+}
+
+bool UploadHandler::seal() noexcept {
+    auto &size = xattr.Get(Attr::ChunkSize);
+    if (!size.empty() && strtoull(size.c_str(), nullptr, 10) != sizeUploaded)
+        return false;
+    xattr.Set(Attr::ChunkSize, std::to_string(sizeUploaded));
+    if (!hashing)
+        return true;
+    std::string digest = hasher.Final();
+    auto &hash = xattr.Get(Attr::ChunkHash);
+    if (hash.empty()) {
+        xattr.Set(Attr::ChunkHash, digest);
+        return true;
+    }
+    return strcasecmp(hash.c_str(), digest.c_str()) == 0;
 }
 
 void UploadHandler::sendHeader() noexcept {
-    std::vector<std::string> names {"container-id", "content-id",
-                "content-path", "content-version", "content-storage-policy",
-                "content-chunk-method", "chunk-id", "chunk-hash", "chunk-pos",
-                "chunk-size"};
-    ResponseBuilder(downstream_).status(201, "Created");
-    accessLog.StatusCode("201");
-    for (auto &elem : names) {
-        ResponseBuilder(downstream_).header<std::string>(
-            xattr.HttpPrefix()+elem, xattr.getHTTP(elem));
-    }
-    ResponseBuilder(downstream_).header<std::string>("Content-Length",
-                                                     std::to_string(size()));
-    ResponseBuilder(downstream_).sendWithEOM();
+    ResponseBuilder response(downstream_);
+    response.status(201, "Created");
+    accessLog.StatusCode(201);
+    replied(201);
+    for (auto attr : kUploadReply)
+        response.header(utils::NamesOf(attr).header, xattr.Get(attr));
+    response.header<std::string>("Content-Length", "0");
+    response.sendWithEOM();
+    ended();
     requestCounter->incR2xxHits();
 }
 
 void UploadHandler::onEOM() noexcept  {
-    upload.Commit();
-    accessLog.UserID(xattr.getHTTP("container-id"));
-    sendHeader();
+    eom = true;
+    if (!writing)
+        flush();
 }
 
 void UploadHandler::onUpgrade(proxygen::UpgradeProtocol)
         noexcept  {
-    serviceLog.LogToPrint("INF", "Upgrade to h2c are not handled");
+    // h2c is negotiated by the session, before any handler
+    serviceLog.LogToPrint("INF", "Protocol upgrades are not handled");
 }
 
 void UploadHandler::requestComplete() noexcept  {
-    endOfRequest = std::time(nullptr);
-    accessLog.LogToPrint("INF", xattr.getHTTP("chunk-id"));
+    drain(buffered);
+    uint64_t total = record(requestCounter.get(), utils::Method::Put,
+                            &accessLog);
+    requestCounter->incPutTime(total / 1000);
+    accessLog.Log("INF", xattr.Get(Attr::ChunkId));
+    terminate();
 }
 
 void UploadHandler::onError(proxygen::ProxygenError err) noexcept  {
     serviceLog.LogToPrint("INF", getErrorString(err));
+    failed = true;
+    pending.clear();
+    drain(buffered);
+    // Otherwise the destructor drops the chunk, once the write is over
+    if (!writing)
+        discard();
+    terminate();
 }
 
 void RemovalHandler::Abort() noexcept {
@@ -279,33 +1097,42 @@ void RemovalHandler::Abort() noexcept {
 }
 
 bool RemovalHandler::headerCheck(proxygen::HTTPMessage* headers) {
-    path = headers->getURL();
-    if (path.empty())
-        return false;
-    chunk_id = path;
-    path = path.substr(0, 3) + "/" + path;
-    return true;
+    chunk_id = headers->getPath();
+    return route(chunk_id, false, 0, &path) == 0;
 }
 
 void RemovalHandler::onRequest(std::unique_ptr<proxygen::HTTPMessage> headers)
         noexcept  {
     requestCounter->incDelHits();
     accessLog.RequestType("DELETE");
-    beginOfRequest = std::time(nullptr);
+    begin(requestCounter.get());
+    classify(headers.get(), IoClass::Background);
     if (!headerCheck(headers.get())) {
         ResponseBuilder(downstream_).status(400, "Bad Request").sendWithEOM();
-        accessLog.StatusCode("400");
+        accessLog.StatusCode(400);
+        replied(400);
         requestCounter->incR4xxHits();
         return;
     }
-    removal.Path(path);
-    if (!removal.Prepare().Ok()) {
-        ResponseBuilder(downstream_).status(404, "Chunk not found")
-                .sendWithEOM();
-        accessLog.StatusCode("404");
-        requestCounter->incR404Hits();
-        return;
-    }
+    locate(false, 0, &path, [this](int) {
+        removal.Path(path);
+        removal.Trace(traced);
+        schedule(0, [this]() { return removal.Prepare(); },
+                 [this](blob::Status status) {
+            if (!status.Ok()) {
+                ResponseBuilder(downstream_).status(404, "Chunk not found")
+                        .sendWithEOM();
+                accessLog.StatusCode(404);
+                replied(404);
+                requestCounter->incR4xxHits();
+                requestCounter->incR404Hits();
+                return;
+            }
+            prepared = true;
+            if (eom)
+                commit();
+        });
+    });
 }
 
 void RemovalHandler::onBody(std::unique_ptr<folly::IOBuf>)
@@ -314,24 +1141,47 @@ void RemovalHandler::onBody(std::unique_ptr<folly::IOBuf>)
 }
 
 void RemovalHandler::onEOM() noexcept  {
-    removal.Commit();
-    ResponseBuilder(downstream_).status(204, "No Content");
-    accessLog.StatusCode("204");
-    ResponseBuilder(downstream_).sendWithEOM();
-    requestCounter->incR2xxHits();
+    eom = true;
+    if (prepared)
+        commit();
+}
+
+void RemovalHandler::commit() noexcept {
+    prepared = false;
+    schedule(0, [this]() { return removal.Commit(); },
+             [this](blob::Status status) {
+        if (!status.Ok()) {
+            ResponseBuilder(downstream_).status(500, "Internal Server Error")
+                    .sendWithEOM();
+            accessLog.StatusCode(500);
+            replied(500);
+            requestCounter->incR5xxHits();
+            return;
+        }
+        ResponseBuilder(downstream_).status(204, "No Content").sendWithEOM();
+        accessLog.StatusCode(204);
+        replied(204);
+        ended();
+        requestCounter->incR2xxHits();
+    });
 }
 
 void RemovalHandler::requestComplete() noexcept  {
-    endOfRequest = std::time(nullptr);
-    accessLog.LogToPrint("INF", chunk_id);
+    uint64_t total = record(requestCounter.get(), utils::Method::Delete,
+                            &accessLog);
+    requestCounter->incDelTime(total / 1000);
+    accessLog.Log("INF", chunk_id);
+    terminate();
 }
 
 void RemovalHandler::onError(proxygen::ProxygenError err) noexcept {
     serviceLog.LogToPrint("INF", getErrorString(err));
+    terminate();
 }
 
 void RemovalHandler::onUpgrade(proxygen::UpgradeProtocol) noexcept {
-    serviceLog.LogToPrint("INF", "Upgrade to h2c are not handled");
+    // h2c is negotiated by the session, before any handler
+    serviceLog.LogToPrint("INF", "Protocol upgrades are not handled");
 }
 
 bool RemovalHandler::GetClientAddr() {
@@ -345,24 +1195,124 @@ bool RemovalHandler::GetClientAddr() {
     return false;
 }
 
-void StatHandler::onRequest(std::unique_ptr<proxygen::HTTPMessage>)
+void StatHandler::onRequest(std::unique_ptr<proxygen::HTTPMessage> headers)
         noexcept {
-    // TODO(KR)
+    timer.Start();
+    requestCounter->incInflight();
+    requestCounter->incStatHits();
+    if (headers->getPath() == "/metrics")
+        format = utils::StatsFormat::Prometheus;
+    const std::string &value = headers->getQueryParam("format");
+    if (!value.empty() && !utils::StatsFormatParse(value, &format)) {
+        statusCode = 400;
+        timer.FirstByte();
+        ResponseBuilder(downstream_).status(400, "Bad Request").sendWithEOM();
+        requestCounter->incR4xxHits();
+    }
 }
-void StatHandler::onBody(std::unique_ptr<folly::IOBuf>) noexcept {
-    // TODO(KR)
+
+/**
+ * Render in a buffer sized after the previous replies, and only render
+ * again if it was too small.
+ */
+std::unique_ptr<folly::IOBuf> StatHandler::render() {
+    static std::atomic<size_t> sizeHint {utils::kStatsBufferSize};
+    std::vector<utils::VolumeReport> reports;
+    for (auto &volume : volumes->All()) {
+        utils::VolumeReport report;
+        report.id = volume->id;
+        report.path = volume->path;
+        report.hasUsage = volume->stated;
+        report.usage.totalBytes = volume->totalBytes;
+        report.usage.freeBytes = volume->freeBytes;
+        report.usage.availBytes = volume->availBytes;
+        report.usage.totalInodes = volume->totalInodes;
+        report.usage.freeInodes = volume->freeInodes;
+        report.inflight = volume->inflight;
+        report.buffered = volume->buffered;
+        report.requests = volume->requests;
+        report.bytesRead = volume->bytesRead;
+        report.bytesWritten = volume->bytesWritten;
+        if (volume->scrubber) {
+            report.scrubbed = true;
+            report.scrub = volume->scrubber->Stats();
+        }
+        reports.push_back(report);
+    }
+    size_t capacity = sizeHint.load(std::memory_order_relaxed);
+    while (true) {
+        auto body = IOBuf::create(capacity);
+        size_t needed = utils::RenderStats(
+            format, *requestCounter, reports,
+            reinterpret_cast<char *>(body->writableData()), capacity);
+        if (needed <= capacity) {
+            body->append(needed);
+            return body;
+        }
+        // Some room for the counters that keep growing meanwhile
+        capacity = needed + needed / 4;
+        sizeHint.store(capacity, std::memory_order_relaxed);
+    }
 }
+
+void StatHandler::onBody(std::unique_ptr<folly::IOBuf>) noexcept {}
+
 void StatHandler::onEOM() noexcept {
-    // TODO(KR)
+    if (statusCode != 0)
+        return;
+    if (!scheduler || !volumes->Stale()) {
+        reply();
+        return;
+    }
+    auto evb = folly::EventBaseManager::get()->getEventBase();
+    blob::IoTask task;
+    task.volume = kLookups;
+    task.cost = 0;
+    task.run = [this, evb]() {
+        volumes->RefreshIfStale();
+        evb->runInEventBaseThread([this]() {
+            refreshing = false;
+            if (terminated)
+                delete this;
+            else
+                reply();
+        });
+    };
+    refreshing = true;
+    if (!scheduler->Submit(std::move(task))) {
+        refreshing = false;
+        reply();
+    }
 }
-void StatHandler::onUpgrade(proxygen::UpgradeProtocol) noexcept {
-    // TODO(KR)
+
+void StatHandler::reply() noexcept {
+    auto body = render();
+    statusCode = 200;
+    timer.FirstByte();
+    ResponseBuilder(downstream_)
+            .status(200, "OK")
+            .header("Content-Type", utils::StatsContentType(format))
+            .body(std::move(body))
+            .sendWithEOM();
+    requestCounter->incR2xxHits();
 }
+
+void StatHandler::onUpgrade(proxygen::UpgradeProtocol) noexcept {}
+
 void StatHandler::requestComplete() noexcept {
-    // TODO(KR)
+    uint64_t total = timer.Elapsed();
+    requestCounter->incStatTime(total / 1000);
+    requestCounter->Latency().Record(utils::Method::Stat, statusCode,
+                                     timer.TimeToFirstByte(), total);
+    requestCounter->decInflight();
+    delete this;
 }
+
 void StatHandler::onError(proxygen::ProxygenError) noexcept {
-    // TODO(KR)
+    requestCounter->decInflight();
+    terminated = true;
+    if (!refreshing)
+        delete this;
 }
 
 void InfoHandler::onRequest(std::unique_ptr<proxygen::HTTPMessage>)
@@ -19,15 +19,120 @@
 #ifndef SRC_RAWX_HPP_
 #define SRC_RAWX_HPP_
 
+#include <array>
+#include <atomic>
+#include <chrono> // NOLINT
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
 #include <string>
+#include <vector>
 #include <proxygen/httpserver/RequestHandlerFactory.h> // NOLINT
 #include "utils.hpp"
 #include "blob.hpp"
+#include "flight.hpp"
+#include "pool.hpp"
+#include "scheduler.hpp"
+#include "scrub.hpp"
+#include "stats.hpp"
+#include "volume.hpp"
 
 namespace rawx {
 
+/**
+ * Map the URL of a request ("/<chunk-id>") to the path of the chunk in the
+ * volume, with a fan-out on the first 3 characters of the id.
+ * @return false if the URL isn't a hexadecimal chunk id
+ */
+bool ChunkPath(const std::string &volume, const std::string &url,
+               std::string *path);
+
+/**
+ * Entity tag of the reply to a GET of a chunk, from its attributes alone:
+ * weak when the whole chunk would be sent as stored, compressed with a
+ * codec the client accepts, strong for the plain bytes.
+ */
+void ReplyETag(const utils::XAttr &xattr, const std::string &acceptEncoding,
+               bool ranged, std::string *etag);
+
+/** @return a set made of the current directory alone, with no id */
+std::shared_ptr<blob::Volumes> LocalVolumes();
+
+/**
+ * Bounds of the upload bodies received but not written yet. Reading the
+ * socket of an upload is paused once it holds `uploadHigh` bytes, or once
+ * the uploads of its volume hold `volumeHigh` bytes, and resumed under the
+ * low marks. A new upload is refused while its volume holds `volumeReject`
+ * bytes (0 for never).
+ */
+struct IngressLimits {
+    uint64_t uploadHigh {4 << 20};
+    uint64_t uploadLow {1 << 20};
+    uint64_t volumeHigh {64 << 20};
+    uint64_t volumeLow {32 << 20};
+    uint64_t volumeReject {256 << 20};
+};
+
+/**
+ * Read-ahead of the downloads: up to `depth` blocks are read on the I/O
+ * scheduler while the previous ones are sent. The depth and the size of the
+ * blocks start low and grow while the client waits for the disk, the depth
+ * halves when the client doesn't keep up (egress paused).
+ */
+struct PipelineOptions {
+    unsigned int minDepth {2};
+    unsigned int maxDepth {8};
+    uint32_t minBlock {64 << 10};
+    uint32_t maxBlock {1 << 20};
+};
+
+/** Page cache policy of the transfers, per I/O class */
+using CachePolicies = std::array<blob::CachePolicy, blob::kIoClasses>;
+
+/**
+ * @return the default policies: the background transfers (rebuilds,
+ * scrubbing) always drop their pages
+ */
+CachePolicies DefaultCachePolicies();
+
 class RawxHandlerFactory : public proxygen::RequestHandlerFactory {
  public:
+    RawxHandlerFactory();
+    explicit RawxHandlerFactory(std::shared_ptr<blob::IoScheduler> scheduler);
+    /**
+     * Trace the phases of the requests, and log the requests longer than
+     * slowThreshold (0 to disable the log)
+     */
+    void Tracing(bool enabled, std::chrono::milliseconds slowThreshold);
+    /**
+     * Serve a single volume, "." by default: the root directory of the
+     * chunks and the NUMA node of its disk (-1 if unknown)
+     */
+    void Volume(const std::string &path, int node = -1);
+    /** Serve several volumes, the requests are routed by Volumes::Route() */
+    inline void Volumes(std::shared_ptr<blob::Volumes> volumes) {
+        this->volumes = volumes;
+    }
+    /**
+     * Pin each EventBase thread on the next CPU of the list, and prefer
+     * the memory of the NUMA node of that CPU
+     */
+    inline void Pinning(std::vector<int> cpus) { this->cpus = cpus; }
+    inline void Ingress(IngressLimits limits) { ingress = limits; }
+    inline void Caching(CachePolicies policies) { caching = policies; }
+    inline void Pipeline(PipelineOptions options) { pipeline = options; }
+    /** Frames of the chunks whose chunk method asks for a compression */
+    inline void Compressing(blob::FrameOptions options) {
+        compressing = options;
+    }
+    /** Share the reads of the concurrent GETs of a range, null to disable */
+    inline void Coalescing(std::shared_ptr<blob::Flights> flights) {
+        this->flights = flights;
+    }
+    inline std::shared_ptr<utils::RequestCounter> Counter() const {
+        return requestCounter;
+    }
     void onServerStart(folly::EventBase* evb) noexcept override;
     void onServerStop() noexcept override;
     proxygen::RequestHandler* onRequest(proxygen::RequestHandler*,
@@ -36,15 +141,138 @@ class RawxHandlerFactory : public proxygen::RequestHandlerFactory {
 
  private:
     std::shared_ptr<utils::RequestCounter> requestCounter;
+    std::shared_ptr<blob::IoScheduler> scheduler;
+    std::shared_ptr<blob::Volumes> volumes {LocalVolumes()};
+    std::vector<int> cpus;
+    std::atomic<unsigned int> nextCpu {0};
+    IngressLimits ingress;
+    CachePolicies caching {DefaultCachePolicies()};
+    PipelineOptions pipeline;
+    blob::FrameOptions compressing;
+    std::shared_ptr<blob::Flights> flights {
+        std::make_shared<blob::Flights>()};
     utils::AccessLog accessLog;
     utils::ServiceLog serviceLog;
 };
 
-class DownloadHandler : public proxygen::RequestHandler {
+/**
+ * Base of the handlers hitting the disk: the blob operations are queued on
+ * the I/O scheduler and their continuation runs back in the EventBase
+ * thread of the request. Without scheduler, everything runs inline.
+ * The handler deletes itself once the request is over and no operation is
+ * pending anymore.
+ */
+class IoHandler : public proxygen::RequestHandler {
+ public:
+    IoHandler() {}
+    explicit IoHandler(std::shared_ptr<blob::IoScheduler> scheduler,
+                       std::shared_ptr<blob::Volumes> volumes = nullptr)
+            : scheduler {scheduler},
+              volumes {volumes ? volumes : LocalVolumes()} {}
+    inline void Caching(const CachePolicies &policies) { caching = policies; }
+
+ protected:
+    /**
+     * Set ioClass from the X-oio-io-class header, or to the given default
+     */
+    void classify(proxygen::HTTPMessage *headers, blob::IoClass byDefault);
+    /**
+     * Find the volume of the chunk named by the URL, and the path of the
+     * chunk in it, without any system call: the volume is left unknown
+     * when only locate() can tell it. A new chunk (create) without volume
+     * in its URL goes to the volume chosen by the placement policy.
+     * @param size expected size of a new chunk, 0 if unknown
+     * @return 0, or the status to reply: 400 for an invalid URL, 507 if no
+     * volume has room for the new chunk
+     */
+    int route(const std::string &url, bool create, uint64_t size,
+              std::string *path);
+    /**
+     * Continue a successful route() once the volume is known: a chunk
+     * searched in several volumes, or placed on a space to refresh, is
+     * looked up on the I/O threads.
+     * @param then called with 0, or the status to reply: 409 if a new
+     * chunk already exists in another volume, 507 if no volume has room
+     */
+    void locate(bool create, uint64_t size, std::string *path,
+                std::function<void(int)> then);
+    /** @return the page cache policy of the class of the request */
+    inline const blob::CachePolicy &cachePolicy() const {
+        return caching[static_cast<unsigned int>(ioClass)];
+    }
+    /**
+     * Must follow a successful route(). Without volume, the task is queued
+     * with the lookups.
+     */
+    void schedule(uint64_t cost, std::function<blob::Status()> io,
+                  std::function<void(blob::Status)> then);
+    /** Start the timer, and the phase trace if enabled */
+    void begin(utils::RequestCounter *counter);
+    /** The last byte of the reply was handed to proxygen */
+    inline void ended() {
+        if (traced != nullptr)
+            endedAt = utils::PhaseTrace::Now();
+    }
+    /** To be called from requestComplete() and onError() */
+    void terminate();
+    /** Mark the reply status as sent */
+    inline void replied(int code) {
+        statusCode = code;
+        timer.FirstByte();
+    }
+    /**
+     * Record the latency and the phases of the request, log the phases if
+     * the request was slow.
+     * @return the total duration of the request in nanoseconds
+     */
+    uint64_t record(utils::RequestCounter *counter, utils::Method method,
+                    utils::AccessLog *log);
+
+    std::shared_ptr<blob::IoScheduler> scheduler;
+    std::shared_ptr<blob::Volumes> volumes {LocalVolumes()};
+    /** Set by route() */
+    std::shared_ptr<blob::Volume> volume;
+    /** The chunk id of the URL, set by route() */
+    std::string chunkId;
+    utils::Loan<std::string> chunkIdLoan {&chunkId};
+    blob::IoClass ioClass {blob::IoClass::Foreground};
+    CachePolicies caching {DefaultCachePolicies()};
+    utils::RequestTimer timer;
+    int statusCode {0};
+    /** Points to trace when the tracing is enabled */
+    utils::PhaseTrace *traced {nullptr};
+
+ private:
+    /** Serve the request from this volume */
+    void bind(std::shared_ptr<blob::Volume> found, std::string *path);
+
+    /** Found by the lookup of locate() */
+    std::shared_ptr<blob::Volume> located;
+    utils::PhaseTrace trace;
+    uint64_t parseStart {0};
+    uint64_t endedAt {0};
+    /** Counts the request in flight until terminate() */
+    utils::RequestCounter *active {nullptr};
+    unsigned int pending {0};
+    bool terminated {false};
+};
+
+class DownloadHandler : public IoHandler,
+                        public utils::Pooled<DownloadHandler> {
  public:
     DownloadHandler() {}
-    explicit DownloadHandler(std::shared_ptr<utils::RequestCounter> rc)
-            : requestCounter {rc} {}
+    explicit DownloadHandler(std::shared_ptr<utils::RequestCounter> rc,
+                             std::shared_ptr<blob::IoScheduler> scheduler
+                             = nullptr,
+                             std::shared_ptr<blob::Volumes> volumes
+                             = nullptr)
+            : IoHandler {scheduler, volumes}, requestCounter {rc} {}
+    ~DownloadHandler();
+    inline void Pipeline(PipelineOptions options) { pipeline = options; }
+    inline void Coalescing(std::shared_ptr<blob::Flights> flights) {
+        this->flights = flights;
+    }
+    /** Send the blocks received in order, then read more */
     void sendData() noexcept;
     void sendHeader() noexcept;
     bool GetClientAddr();
@@ -56,25 +284,93 @@ class DownloadHandler : public proxygen::RequestHandler {
     void onUpgrade(proxygen::UpgradeProtocol proto) noexcept override;
     void requestComplete() noexcept override;
     void onError(proxygen::ProxygenError err) noexcept override;
+    void onEgressPaused() noexcept override;
+    void onEgressResumed() noexcept override;
     void Abort() noexcept;
 
  private:
+    /** Reply without body */
+    void reply(int code, const std::string &reason) noexcept;
+    /**
+     * Evaluate the conditional headers on the attributes of the chunk,
+     * read without opening it: a 304 or a 412 never touches the data
+     */
+    void revalidate() noexcept;
+    /** Open the chunk and send it */
+    void open() noexcept;
+    /**
+     * Join the reads of the concurrent GETs of the same range, or read
+     * alone through a flight of our own
+     */
+    void board() noexcept;
+    /** @return a sink handing the blocks to this handler until leave() */
+    blob::Flight::Sink sink() noexcept;
+    void leave() noexcept;
+    /** Leave the flight, read the rest alone */
+    void detach() noexcept;
+    void receive(const blob::BlockRef &block) noexcept;
+    /** Schedule reads until `depth` blocks are read or waiting */
+    void fill() noexcept;
+    /** @return false when every block of the flight is claimed */
+    bool readBlock() noexcept;
+
     std::shared_ptr<utils::RequestCounter> requestCounter;
-    time_t beginOfRequest;
-    time_t endOfRequest;
     utils::AccessLog accessLog;
     utils::ServiceLog serviceLog;
     blob::DiskDownload download;
     utils::XAttr xattr;
     std::string path;
+    std::string etag;
+    std::string ifMatch;
+    std::string ifNoneMatch;
+    std::string ifRange;
+    std::string acceptEncoding;
+    /** Content-coding of a compressed chunk sent as stored */
+    std::string encoding;
+    /** The buffers of the previous requests of the thread */
+    utils::Loan<utils::XAttr> xattrLoan {&xattr};
+    utils::Loan<std::string> pathLoan {&path};
+    utils::Loan<std::string> etagLoan {&etag};
+
+    PipelineOptions pipeline;
+    unsigned int depth {0};
+    uint32_t block {0};
+    /** Blocks received and not sent yet, by offset */
+    std::map<uint64_t, blob::BlockRef> ready;
+    unsigned int reading {0};
+    uint64_t nextSend {0};
+    uint64_t stop {0};
+    bool egressPaused {false};
+    bool failed {false};
+    bool finished {false};
+
+    std::shared_ptr<blob::Flights> flights;
+    std::shared_ptr<blob::Flight> flight;
+    /** Empty for a flight of our own */
+    std::string flightKey;
+    uint64_t seat {0};
+    /** Tags the blocks read by this handler */
+    uint64_t reader {0};
+    /** Cleared by leave(): the blocks still on their way are ignored */
+    std::shared_ptr<DownloadHandler *> receiver;
 };
 
-class UploadHandler : public proxygen::RequestHandler {
+class UploadHandler : public IoHandler,
+                      public utils::Pooled<UploadHandler> {
  public:
     UploadHandler() {}
-    explicit UploadHandler(std::shared_ptr<utils::RequestCounter> rc)
-            : requestCounter {rc} {}
-    int size();
+    explicit UploadHandler(std::shared_ptr<utils::RequestCounter> rc,
+                           std::shared_ptr<blob::IoScheduler> scheduler
+                           = nullptr,
+                           std::shared_ptr<blob::Volumes> volumes
+                           = nullptr)
+            : IoHandler {scheduler, volumes}, requestCounter {rc} {}
+    ~UploadHandler();
+    inline void Ingress(IngressLimits limits) { this->limits = limits; }
+    inline void Compressing(blob::FrameOptions options) {
+        compressing = options;
+    }
+    uint64_t size();
     void sendHeader() noexcept;
     bool GetClientAddr();
     bool headerCheck(proxygen::HTTPMessage *headers);
@@ -85,25 +381,72 @@ class UploadHandler : public proxygen::RequestHandler {
     void onUpgrade(proxygen::UpgradeProtocol proto) noexcept override;
     void requestComplete() noexcept override;
     void onError(proxygen::ProxygenError err) noexcept override;
+    /**
+     * "Expect: 100-continue" is answered by the handler: 100 Continue once
+     * the upload is admitted and its chunk created, a final status and no
+     * body read otherwise
+     */
+    bool canHandleExpect() noexcept override { return true; }
     void Abort() noexcept;
 
  private:
+    void flush() noexcept;
+    void commit() noexcept;
+    /**
+     * Check the size and the hash of the body against those announced, and
+     * record them for the commit.
+     * @return false on a mismatch
+     */
+    bool seal() noexcept;
+    /** Create the chunk on the volume found, then ask for the body */
+    void prepare(uint64_t expected) noexcept;
+    void fail(int code, std::string reason) noexcept;
+    /** Delete the chunk being written, if any, on the I/O threads */
+    void discard() noexcept;
+    /** Pause or resume the ingress after the buffered bytes changed */
+    void throttle() noexcept;
+    /** The bytes were written, or dropped */
+    void drain(uint64_t bytes) noexcept;
+
     std::shared_ptr<utils::RequestCounter> requestCounter;
-    time_t beginOfRequest;
-    time_t endOfRequest;
     utils::AccessLog accessLog;
     utils::ServiceLog serviceLog;
-    int sizeUploaded {0};
+    uint64_t sizeUploaded {0};
+    std::deque<std::unique_ptr<folly::IOBuf>> pending;
+    /** Received and not written yet, pending or being written */
+    uint64_t buffered {0};
+    IngressLimits limits;
+    blob::FrameOptions compressing;
+    bool paused {false};
+    bool writing {false};
+    bool eom {false};
+    bool failed {false};
+    /** The chunk was prepared and isn't committed: discard() deletes it */
+    bool created {false};
+    /** The client waits for a 100 Continue before sending the body */
+    bool expectContinue {false};
+    /** A stream of an HTTP/2 connection, which other requests share */
+    bool multiplexed {false};
     blob::DiskUpload upload;
+    /** Hash of the body, updated by the writes (one at a time) */
+    blob::ChunkHasher hasher;
+    bool hashing {false};
     utils::XAttr xattr;
     std::string path;
+    utils::Loan<utils::XAttr> xattrLoan {&xattr};
+    utils::Loan<std::string> pathLoan {&path};
 };
 
-class RemovalHandler : public proxygen::RequestHandler {
+class RemovalHandler : public IoHandler,
+                       public utils::Pooled<RemovalHandler> {
  public:
     RemovalHandler() {}
-    explicit RemovalHandler(std::shared_ptr<utils::RequestCounter> rc)
-            : requestCounter {rc} {}
+    explicit RemovalHandler(std::shared_ptr<utils::RequestCounter> rc,
+                            std::shared_ptr<blob::IoScheduler> scheduler
+                            = nullptr,
+                            std::shared_ptr<blob::Volumes> volumes
+                            = nullptr)
+            : IoHandler {scheduler, volumes}, requestCounter {rc} {}
     void sendHeader();
     bool GetClientAddr();
     bool headerCheck(proxygen::HTTPMessage *headers);
@@ -117,21 +460,35 @@ class RemovalHandler : public proxygen::RequestHandler {
     void Abort() noexcept;
 
  private:
+    void commit() noexcept;
+
     std::shared_ptr<utils::RequestCounter> requestCounter;
-    time_t beginOfRequest;
-    time_t endOfRequest;
+    bool prepared {false};
+    bool eom {false};
     std::string chunk_id;
     utils::AccessLog accessLog;
     utils::ServiceLog serviceLog;
     blob::DiskRemoval removal;
     std::string path;
+    utils::Loan<std::string> pathLoan {&path};
 };
 
+/**
+ * Serves the counters on /stat (oio text format, or Prometheus with
+ * ?format=prometheus) and on /metrics (Prometheus). The space of the
+ * volumes is the one of their last refresh, done on the I/O scheduler
+ * before the rendering when it is stale: the EventBase never stat()s.
+ */
 class StatHandler : public proxygen::RequestHandler {
  public:
     StatHandler() {}
-    explicit StatHandler(std::shared_ptr<utils::RequestCounter> rc)
-            :requestCounter {rc} {}
+    explicit StatHandler(std::shared_ptr<utils::RequestCounter> rc,
+                         std::shared_ptr<blob::Volumes> volumes = nullptr,
+                         std::shared_ptr<blob::IoScheduler> scheduler
+                         = nullptr)
+            :requestCounter {rc},
+             volumes {volumes ? volumes : LocalVolumes()},
+             scheduler {scheduler} {}
     void onRequest(std::unique_ptr<proxygen::HTTPMessage> headers)
             noexcept override;
     void onBody(std::unique_ptr<folly::IOBuf> body) noexcept override;
@@ -141,7 +498,18 @@ class StatHandler : public proxygen::RequestHandler {
     void onError(proxygen::ProxygenError err) noexcept override;
 
  private:
+    std::unique_ptr<folly::IOBuf> render();
+    void reply() noexcept;
+
     std::shared_ptr<utils::RequestCounter> requestCounter;
+    std::shared_ptr<blob::Volumes> volumes {LocalVolumes()};
+    std::shared_ptr<blob::IoScheduler> scheduler;
+    /** A refresh is queued: the handler outlives an error until it ends */
+    bool refreshing {false};
+    bool terminated {false};
+    utils::StatsFormat format {utils::StatsFormat::Oio};
+    utils::RequestTimer timer;
+    int statusCode {0};
 };
 
 class InfoHandler : public proxygen::RequestHandler {
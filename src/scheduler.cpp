@@ -0,0 +1,238 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <strings.h>
+#include <algorithm>
+#include <string>
+#include "affinity.hpp"
+#include "scheduler.hpp"
+
+using blob::IoClass;
+using blob::IoTask;
+using blob::IoScheduler;
+using blob::IoSchedulerOptions;
+using blob::IoSchedulerStats;
+
+using Clock = std::chrono::steady_clock;
+
+const char *blob::IoClassName(IoClass cls) {
+    switch (cls) {
+        case IoClass::Foreground:
+            return "foreground";
+        case IoClass::Background:
+            return "background";
+    }
+    return "unknown";
+}
+
+bool blob::IoClassParse(const std::string &value, IoClass *cls) {
+    if (strcasecmp(value.c_str(), "foreground") == 0) {
+        *cls = IoClass::Foreground;
+        return true;
+    }
+    if (strcasecmp(value.c_str(), "background") == 0) {
+        *cls = IoClass::Background;
+        return true;
+    }
+    return false;
+}
+
+IoScheduler::IoScheduler(IoSchedulerOptions options) : options{options} {
+    for (auto &w : this->options.weights)
+        w = std::max(w, 1u);
+    this->options.volumeInflight = std::max(this->options.volumeInflight, 1u);
+    wakeups[-1];
+    for (auto &vn : options.volumeNodes) {
+        if (vn.second >= 0)
+            wakeups[vn.second];
+    }
+    for (auto &w : wakeups) {
+        int node = w.first;
+        unsigned int count = node < 0 ? options.threads : options.nodeThreads;
+        for (unsigned int i = 0; i < std::max(count, 1u); i++)
+            workers.emplace_back([this, node]() { work(node); });
+    }
+}
+
+IoScheduler::~IoScheduler() {
+    Stop();
+}
+
+bool IoScheduler::Submit(IoTask task) {
+    auto now = Clock::now();
+    int node = -1;
+    auto cls = static_cast<unsigned int>(task.cls);
+    if (task.deadline == Clock::time_point())
+        task.deadline = now + options.deadlines[cls];
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping)
+            return false;
+        auto &vol = volumeOf(task.volume);
+        node = vol.node;
+        auto &queue = vol.queues[cls];
+        if (queue.empty()) {
+            // An idle class doesn't accumulate credit
+            double vclock = *std::min_element(vol.vtime.begin(),
+                                              vol.vtime.end());
+            for (unsigned int c = 0; c < kIoClasses; c++) {
+                if (!vol.queues[c].empty())
+                    vclock = std::max(vclock, vol.vtime[c]);
+            }
+            vol.vtime[cls] = std::max(vol.vtime[cls], vclock);
+        }
+        queue.push_back(Queued{std::move(task), now});
+        stats.classes[cls].queued++;
+    }
+    wakeups.at(node).notify_one();
+    return true;
+}
+
+/**
+ * Must be called with the lock held. The volumes whose node has no worker
+ * are served by the workers of no node.
+ */
+IoScheduler::Volume &IoScheduler::volumeOf(const std::string &name) {
+    auto it = volumes.find(name);
+    if (it != volumes.end())
+        return it->second;
+    auto &vol = volumes[name];
+    auto vn = options.volumeNodes.find(name);
+    if (vn != options.volumeNodes.end() && wakeups.count(vn->second) > 0)
+        vol.node = vn->second;
+    return vol;
+}
+
+void IoScheduler::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    for (auto &w : wakeups)
+        w.second.notify_all();
+    for (auto &w : workers) {
+        if (w.joinable())
+            w.join();
+    }
+    workers.clear();
+}
+
+IoSchedulerStats IoScheduler::Stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+/**
+ * Expired tasks first (earliest deadline), then the non-empty class with
+ * the smallest virtual time.
+ */
+int IoScheduler::pickClass(Volume *vol, Clock::time_point now) {
+    int best = -1;
+    for (unsigned int c = 0; c < kIoClasses; c++) {
+        auto &queue = vol->queues[c];
+        if (queue.empty() || queue.front().task.deadline > now)
+            continue;
+        if (best < 0 || queue.front().task.deadline
+                < vol->queues[best].front().task.deadline)
+            best = c;
+    }
+    if (best >= 0)
+        return best;
+    for (unsigned int c = 0; c < kIoClasses; c++) {
+        if (vol->queues[c].empty())
+            continue;
+        if (best < 0 || vol->vtime[c] < vol->vtime[best])
+            best = c;
+    }
+    return best;
+}
+
+/**
+ * Round-robin on the volumes of the node that still have room for one more
+ * task. Must be called with the lock held.
+ */
+bool IoScheduler::pick(int node, Queued *out, std::string *volume) {
+    if (volumes.empty())
+        return false;
+    auto now = Clock::now();
+    auto it = volumes.upper_bound(cursor);
+    for (size_t i = 0; i < volumes.size(); i++, ++it) {
+        if (it == volumes.end())
+            it = volumes.begin();
+        auto &vol = it->second;
+        if (vol.node != node || vol.inflight >= options.volumeInflight)
+            continue;
+        int cls = pickClass(&vol, now);
+        if (cls < 0)
+            continue;
+        auto &queue = vol.queues[cls];
+        *out = std::move(queue.front());
+        queue.pop_front();
+        vol.inflight++;
+        vol.vtime[cls] += static_cast<double>(
+            std::max<uint64_t>(out->task.cost, 1)) / options.weights[cls];
+        auto &cs = stats.classes[cls];
+        cs.dispatched++;
+        if (out->task.deadline < now)
+            cs.late++;
+        cs.waitMicros += std::chrono::duration_cast<
+            std::chrono::microseconds>(now - out->enqueued).count();
+        stats.inflight++;
+        cursor = it->first;
+        *volume = it->first;
+        return true;
+    }
+    return false;
+}
+
+void IoScheduler::work(int node) {
+    if (node >= 0) {
+        utils::PinThread(utils::NodeCpus(node));
+        utils::PreferNode(node);
+    }
+    auto &wakeup = wakeups.at(node);
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        Queued queued;
+        std::string volume;
+        if (pick(node, &queued, &volume)) {
+            lock.unlock();
+            queued.task.run();
+            queued.task.run = nullptr;
+            lock.lock();
+            volumes[volume].inflight--;
+            stats.inflight--;
+            // A slot was released on that volume
+            wakeup.notify_one();
+            continue;
+        }
+        if (stopping) {
+            bool empty = true;
+            for (auto &vol : volumes) {
+                if (vol.second.node != node)
+                    continue;
+                for (auto &queue : vol.second.queues)
+                    empty = empty && queue.empty();
+            }
+            if (empty)
+                break;
+        }
+        wakeup.wait(lock);
+    }
+    wakeup.notify_all();
+}
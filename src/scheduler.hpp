@@ -0,0 +1,149 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#ifndef SRC_SCHEDULER_HPP_
+#define SRC_SCHEDULER_HPP_
+
+#include <array>
+#include <chrono> // NOLINT
+#include <condition_variable> // NOLINT
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex> // NOLINT
+#include <string>
+#include <thread> // NOLINT
+#include <vector>
+
+namespace blob {
+
+/**
+ * Priority class of an I/O. Client GET/PUT are Foreground, deletions,
+ * scrubbing and rebuild copies are Background.
+ */
+enum class IoClass {
+    Foreground, Background
+};
+
+constexpr unsigned int kIoClasses = 2;
+
+const char *IoClassName(IoClass cls);
+
+/**
+ * Parse the value of the request header telling the class of a request
+ * ("foreground" or "background").
+ * @return true if the value was recognized
+ */
+bool IoClassParse(const std::string &value, IoClass *cls);
+
+struct IoTask {
+    IoClass cls {IoClass::Foreground};
+    std::string volume {"."};
+    /** Expected amount of bytes moved, used to share the disk time */
+    uint64_t cost {1};
+    /** Zero means "now + the default deadline of the class" */
+    std::chrono::steady_clock::time_point deadline {};
+    std::function<void()> run;
+};
+
+struct IoSchedulerOptions {
+    unsigned int threads {8};
+    /** Maximum number of tasks running at once on a given volume */
+    unsigned int volumeInflight {4};
+    std::array<unsigned int, kIoClasses> weights {{16, 1}};
+    std::array<std::chrono::milliseconds, kIoClasses> deadlines {{
+        std::chrono::milliseconds(500), std::chrono::milliseconds(30000)}};
+    /**
+     * NUMA node of the volumes. Their tasks run on workers bound to the
+     * CPUs of the node, which allocate their buffers on the node.
+     */
+    std::map<std::string, int> volumeNodes;
+    /** Workers per node found in volumeNodes */
+    unsigned int nodeThreads {4};
+};
+
+struct IoClassStats {
+    uint64_t queued {0};
+    uint64_t dispatched {0};
+    uint64_t late {0};
+    uint64_t waitMicros {0};
+};
+
+struct IoSchedulerStats {
+    std::array<IoClassStats, kIoClasses> classes;
+    uint64_t inflight {0};
+};
+
+/**
+ * I/O scheduler standing in front of the blob backends.
+ * Tasks are queued per volume and per class. A pool of threads dispatches
+ * them with a weighted fair sharing between the classes (virtual time
+ * advanced by cost / weight), except that a task whose deadline expired
+ * goes first, and never more than `volumeInflight` tasks run on a volume.
+ */
+class IoScheduler {
+ public:
+    explicit IoScheduler(IoSchedulerOptions options);
+    ~IoScheduler();
+    IoScheduler(const IoScheduler&) = delete;
+    IoScheduler& operator=(const IoScheduler&) = delete;
+
+    /**
+     * Queue a task.
+     * @return false if the scheduler is stopping, the task won't run
+     */
+    bool Submit(IoTask task);
+
+    /** Run the queued tasks then join the threads */
+    void Stop();
+
+    IoSchedulerStats Stats();
+
+ private:
+    struct Queued {
+        IoTask task;
+        std::chrono::steady_clock::time_point enqueued;
+    };
+    struct Volume {
+        std::array<std::deque<Queued>, kIoClasses> queues;
+        std::array<double, kIoClasses> vtime {{0, 0}};
+        unsigned int inflight {0};
+        /** Only the workers of this node run the tasks, -1 for any */
+        int node {-1};
+    };
+
+    /** @param node the NUMA node served by the worker, -1 for none */
+    void work(int node);
+    bool pick(int node, Queued *out, std::string *volume);
+    Volume &volumeOf(const std::string &name);
+    int pickClass(Volume *vol, std::chrono::steady_clock::time_point now);
+
+    IoSchedulerOptions options;
+    std::map<std::string, Volume> volumes;
+    std::string cursor;
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    /** One per node, the workers of a node only wait on theirs */
+    std::map<int, std::condition_variable> wakeups;
+    bool stopping {false};
+    IoSchedulerStats stats;
+};
+
+}  // namespace blob
+
+#endif  // SRC_SCHEDULER_HPP_
@@ -0,0 +1,384 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <future> // NOLINT
+#include <memory>
+#include <string>
+#include "scrub.hpp"
+
+using blob::Status;
+using blob::Cause;
+using blob::ChunkHasher;
+using blob::Codec;
+using blob::FrameReader;
+using blob::Throttle;
+using blob::Scrubber;
+using blob::ScrubOptions;
+using blob::ScrubStats;
+using blob::IoTask;
+using blob::IoClass;
+
+static int64_t nowMicros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+ChunkHasher::ChunkHasher() : ctx{EVP_MD_CTX_new()} {}
+
+ChunkHasher::~ChunkHasher() {
+    EVP_MD_CTX_free(ctx);
+}
+
+bool ChunkHasher::Init(size_t hexLength) {
+    const EVP_MD *md = nullptr;
+    switch (hexLength) {
+        case 32:
+            md = EVP_md5();
+            break;
+        case 40:
+            md = EVP_sha1();
+            break;
+        case 64:
+            md = EVP_sha256();
+            break;
+        case 128:
+            md = EVP_sha512();
+            break;
+        default:
+            return false;
+    }
+    return EVP_DigestInit_ex(ctx, md, nullptr) == 1;
+}
+
+void ChunkHasher::Update(const uint8_t *data, size_t length) {
+    EVP_DigestUpdate(ctx, data, length);
+}
+
+std::string ChunkHasher::Final() {
+    static const char hex[] = "0123456789ABCDEF";
+    uint8_t digest[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    EVP_DigestFinal_ex(ctx, digest, &length);
+    std::string out(2 * length, '0');
+    for (unsigned int i = 0; i < length; i++) {
+        out[2 * i] = hex[digest[i] >> 4];
+        out[2 * i + 1] = hex[digest[i] & 0x0F];
+    }
+    return out;
+}
+
+Throttle::Throttle(uint64_t bytesPerSec, uint32_t iops,
+                   std::chrono::microseconds latencyTarget)
+        : bytesPerSec{bytesPerSec}, iops{iops}, latencyTarget{latencyTarget},
+          last{std::chrono::steady_clock::now()} {}
+
+std::chrono::microseconds Throttle::delayFor(uint64_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - last).count();
+    last = now;
+
+    double wait = 0;
+    if (bytesPerSec > 0) {
+        double rate = bytesPerSec * factor;
+        // Allow a burst of one second, and at least one full I/O
+        double burst = std::max(rate, static_cast<double>(bytes));
+        byteTokens = std::min(burst, byteTokens + elapsed * rate);
+        byteTokens -= bytes;
+        if (byteTokens < 0)
+            wait = std::max(wait, -byteTokens / rate);
+    }
+    if (iops > 0) {
+        double rate = iops * factor;
+        double burst = std::max(rate, 1.0);
+        ioTokens = std::min(burst, ioTokens + elapsed * rate);
+        ioTokens -= 1;
+        if (ioTokens < 0)
+            wait = std::max(wait, -ioTokens / rate);
+    }
+    return std::chrono::microseconds(static_cast<int64_t>(wait * 1e6));
+}
+
+void Throttle::Acquire(uint64_t bytes) {
+    auto delay = delayFor(bytes);
+    if (delay.count() > 0)
+        std::this_thread::sleep_for(delay);
+}
+
+void Throttle::Feedback(std::chrono::microseconds latency) {
+    std::lock_guard<std::mutex> lock(mutex);
+    // Exponentially weighted moving average, then AIMD on the factor
+    latencyAvg = 0.9 * latencyAvg + 0.1 * latency.count();
+    if (latencyAvg > latencyTarget.count())
+        factor = std::max(factor * 0.9, 1.0 / 64);
+    else
+        factor = std::min(factor + 0.01, 1.0);
+}
+
+double Throttle::Factor() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return factor;
+}
+
+Scrubber::Scrubber(ScrubOptions options)
+        : options{options},
+          throttle{options.bytesPerSec, options.iops, options.latencyTarget},
+          buffer(options.bufferSize) {}
+
+Scrubber::~Scrubber() {
+    Stop();
+}
+
+void Scrubber::Start() {
+    if (running.exchange(true))
+        return;
+    stopping = false;
+    worker = std::thread([this]() { run(); });
+}
+
+void Scrubber::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+        stopping = true;
+    }
+    wakeup.notify_all();
+    if (worker.joinable())
+        worker.join();
+}
+
+void Scrubber::run() {
+    while (running) {
+        RunOnce();
+        std::unique_lock<std::mutex> lock(mutex);
+        wakeup.wait_for(lock, options.interval, [this]() { return !running; });
+    }
+}
+
+void Scrubber::RunOnce() {
+    passBytes = 0;
+    progress = 0;
+    fanout = 0;
+    passEnd = 0;
+    passStart = nowMicros();
+    scrubDirectory(options.volume, 0);
+    passEnd = nowMicros();
+    passes++;
+}
+
+/**
+ * Walk the fan-out directories (one level) and check each regular file.
+ * Hidden entries (temporary files, quarantine) are skipped.
+ */
+void Scrubber::scrubDirectory(const std::string &dir, int depth) {
+    DIR *dh = opendir(dir.c_str());
+    if (dh == nullptr) {
+        ioErrors++;
+        serviceLog.LogToPrint("ERR", "Scrubber cannot open " + dir);
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dh)) != nullptr) {
+        if (stopping)
+            break;
+        if (entry->d_name[0] == '.')
+            continue;
+        std::string path = dir + "/" + entry->d_name;
+        unsigned char type = entry->d_type;
+        if (type == DT_UNKNOWN) {
+            struct stat sb;
+            if (lstat(path.c_str(), &sb) != 0)
+                continue;
+            type = S_ISDIR(sb.st_mode) ? DT_DIR :
+                    (S_ISREG(sb.st_mode) ? DT_REG : DT_UNKNOWN);
+        }
+        if (type == DT_DIR && depth == 0) {
+            fanout++;
+            scrubDirectory(path, depth + 1);
+            progress++;
+        } else if (type == DT_REG) {
+            handle(path);
+        }
+    }
+    closedir(dh);
+}
+
+void Scrubber::handle(const std::string &path) {
+    auto status = Verify(path);
+    if (status.Why() == Cause::Interrupted)
+        return;
+    chunks++;
+    switch (status.Why()) {
+        case Cause::OK:
+            return;
+        case Cause::NotFound:
+            missingAttr++;
+            serviceLog.LogToPrint("WRN", "Chunk without attributes " + path);
+            return;
+        case Cause::Corrupted:
+            corrupted++;
+            serviceLog.LogToPrint("ERR", "Corrupted chunk " + path);
+            if (options.moveCorrupted && quarantine(path).Ok())
+                quarantined++;
+            return;
+        default:
+            ioErrors++;
+            serviceLog.LogToPrint("ERR", "Scrubber cannot read " + path);
+            return;
+    }
+}
+
+Status Scrubber::Verify(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY | O_NOATIME);
+    if (fd < 0 && errno == EPERM)
+        fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return Status(Cause::InternalError);
+
+    utils::XAttr xattr;
+    xattr.retrieveXAttr(fd);
+    std::string hash = xattr.Get(utils::Attr::ChunkHash);
+    std::string size = xattr.Get(utils::Attr::ChunkSize);
+    ChunkHasher hasher;
+    if ((hash.empty() && size.empty()) ||
+            (!hash.empty() && !hasher.Init(hash.size()))) {
+        close(fd);
+        return Status(Cause::NotFound);
+    }
+    // A compressed chunk is checked on its plain bytes
+    std::unique_ptr<FrameReader> frames;
+    if (blob::ChunkCodec(xattr.Get(utils::Attr::ContentChunkMethod))
+            != Codec::None) {
+        struct stat sb;
+        if (fstat(fd, &sb) != 0) {
+            close(fd);
+            return Status(Cause::InternalError);
+        }
+        frames.reset(new FrameReader());
+        if (!frames->Open(fd, sb.st_size).Ok()) {
+            close(fd);
+            return Status(Cause::Corrupted);
+        }
+        frames->DropBehind(true);
+    }
+
+    // Read-once pattern: ask for read-ahead, drop the pages behind us so
+    // the scrubbing doesn't evict the data of the foreground traffic.
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    off_t offset = 0;
+    while (!stopping) {
+        throttle.Acquire(buffer.size());
+        ssize_t rc = readBlock(fd, frames.get(), offset);
+        if (rc < 0) {
+            if (errno == EINTR)
+                continue;
+            close(fd);
+            return Status(errno == EBADMSG ? Cause::Corrupted
+                          : Cause::InternalError);
+        }
+        if (rc == 0)
+            break;
+        if (!hash.empty())
+            hasher.Update(buffer.data(), rc);
+        if (!frames)
+            posix_fadvise(fd, offset, rc, POSIX_FADV_DONTNEED);
+        offset += rc;
+        bytes += rc;
+        passBytes += rc;
+    }
+    close(fd);
+    if (stopping)
+        return Status(Cause::Interrupted);
+
+    if (!size.empty() && std::to_string(offset) != size)
+        return Status(Cause::Corrupted);
+    if (!hash.empty() && strcasecmp(hasher.Final().c_str(), hash.c_str()) != 0)
+        return Status(Cause::Corrupted);
+    return Status();
+}
+
+ssize_t Scrubber::readAt(int fd, FrameReader *frames, uint64_t offset) {
+    if (frames == nullptr)
+        return read(fd, buffer.data(), buffer.size());
+    uint32_t got = 0;
+    auto status = frames->ReadAt(offset, buffer.data(), buffer.size(), &got);
+    if (status.Ok())
+        return got;
+    errno = status.Why() == Cause::Corrupted ? EBADMSG : EIO;
+    return -1;
+}
+
+ssize_t Scrubber::readBlock(int fd, FrameReader *frames, uint64_t offset) {
+    if (scheduler) {
+        std::promise<std::pair<ssize_t, int>> promise;
+        auto result = promise.get_future();
+        IoTask task;
+        task.cls = IoClass::Background;
+        task.volume = options.volume;
+        task.cost = buffer.size();
+        task.run = [this, fd, frames, offset, &promise]() {
+            ssize_t rc = readAt(fd, frames, offset);
+            promise.set_value(std::make_pair(rc, errno));
+        };
+        if (scheduler->Submit(std::move(task))) {
+            auto rc = result.get();
+            errno = rc.second;
+            return rc.first;
+        }
+    }
+    return readAt(fd, frames, offset);
+}
+
+Status Scrubber::quarantine(const std::string &path) {
+    std::string dir = options.volume + "/" + options.quarantine;
+    if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+        return Status(Cause::InternalError);
+    auto slash = path.rfind('/');
+    std::string name = (slash == std::string::npos) ? path
+            : path.substr(slash + 1);
+    if (rename(path.c_str(), (dir + "/" + name).c_str()) != 0)
+        return Status(Cause::InternalError);
+    return Status();
+}
+
+ScrubStats Scrubber::Stats() const {
+    ScrubStats stats;
+    stats.passes = passes;
+    stats.chunks = chunks;
+    stats.bytes = bytes;
+    stats.corrupted = corrupted;
+    stats.missingAttr = missingAttr;
+    stats.ioErrors = ioErrors;
+    stats.quarantined = quarantined;
+    stats.progress = progress;
+    stats.fanout = fanout;
+    stats.throttle = throttle.Factor();
+    int64_t end = passEnd;
+    int64_t elapsed = (end > 0 ? end : nowMicros()) - passStart;
+    if (elapsed > 0)
+        stats.throughput = passBytes * 1000000 / elapsed;
+    return stats;
+}
@@ -0,0 +1,192 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#ifndef SRC_SCRUB_HPP_
+#define SRC_SCRUB_HPP_
+
+#include <openssl/evp.h>
+#include <atomic>
+#include <chrono> // NOLINT
+#include <condition_variable> // NOLINT
+#include <memory>
+#include <mutex> // NOLINT
+#include <string>
+#include <thread> // NOLINT
+#include <vector>
+#include "blob.hpp"
+#include "scheduler.hpp"
+#include "stats.hpp"
+#include "utils.hpp"
+
+namespace blob {
+
+/**
+ * Streaming hasher used to check the content of a chunk against the
+ * chunk.hash attribute. The algorithm is guessed from the length of the
+ * expected hexadecimal digest (MD5 for the historical 32 chars).
+ */
+class ChunkHasher {
+ public:
+    ChunkHasher();
+    ~ChunkHasher();
+    ChunkHasher(const ChunkHasher&) = delete;
+    ChunkHasher& operator=(const ChunkHasher&) = delete;
+
+    /**
+     * (Re)start the hash computation.
+     * @param hexLength the size of the expected hexadecimal digest
+     * @return false if no algorithm matches the size
+     */
+    bool Init(size_t hexLength = 32);
+    void Update(const uint8_t *data, size_t length);
+    /** @return the uppercase hexadecimal digest */
+    std::string Final();
+
+ private:
+    EVP_MD_CTX *ctx;
+};
+
+/**
+ * Token bucket limiting both a bandwidth and a number of I/O per second.
+ * The effective rates are scaled down when the observed latency of the
+ * foreground traffic exceeds the target, and slowly restored when it
+ * goes back under it.
+ */
+class Throttle {
+ public:
+    Throttle(uint64_t bytesPerSec, uint32_t iops,
+             std::chrono::microseconds latencyTarget);
+
+    /**
+     * Block until one I/O of `bytes` bytes fits in both budgets.
+     * A budget of 0 means unlimited.
+     */
+    void Acquire(uint64_t bytes);
+
+    /** Report the latency of a foreground request (or a disk access) */
+    void Feedback(std::chrono::microseconds latency);
+
+    /** @return the current scaling factor applied to the budgets, in ]0,1] */
+    double Factor() const;
+
+ private:
+    std::chrono::microseconds delayFor(uint64_t bytes);
+
+    const uint64_t bytesPerSec;
+    const uint32_t iops;
+    const std::chrono::microseconds latencyTarget;
+    std::chrono::steady_clock::time_point last;
+    double byteTokens {0};
+    double ioTokens {0};
+    double factor {1.0};
+    double latencyAvg {0};
+    mutable std::mutex mutex;
+};
+
+struct ScrubOptions {
+    std::string volume {"."};
+    std::string quarantine {".quarantine"};
+    uint64_t bytesPerSec {32 * 1024 * 1024};
+    uint32_t iops {100};
+    size_t bufferSize {1024 * 1024};
+    std::chrono::microseconds latencyTarget {std::chrono::milliseconds(20)};
+    std::chrono::seconds interval {std::chrono::hours(24)};
+    bool moveCorrupted {true};
+};
+
+using ScrubStats = utils::ScrubStats;
+
+/**
+ * Background crawler walking the fan-out directories of a volume to check
+ * each chunk against its chunk.size and chunk.hash attributes.
+ */
+class Scrubber {
+ public:
+    explicit Scrubber(ScrubOptions options);
+    ~Scrubber();
+
+    /** Start the background thread, one pass every options.interval */
+    void Start();
+    /** Interrupt the current pass and join the background thread */
+    void Stop();
+    /** Run a complete pass in the calling thread */
+    void RunOnce();
+    /**
+     * Check one chunk.
+     * @return Cause::OK, Cause::NotFound for missing attributes,
+     * Cause::InternalError for I/O errors, Cause::Corrupted when the
+     * content doesn't match the attributes, Cause::Interrupted when
+     * Stop() cut the read short (the chunk is neither checked nor counted).
+     */
+    Status Verify(const std::string &path);
+
+    /**
+     * Route the reads through an I/O scheduler, as Background tasks of
+     * the scrubbed volume.
+     */
+    inline void Scheduler(std::shared_ptr<IoScheduler> scheduler) {
+        this->scheduler = scheduler;
+    }
+
+    /** Report the latency of a foreground request to the throttle */
+    inline void Feedback(std::chrono::microseconds latency) {
+        throttle.Feedback(latency);
+    }
+    ScrubStats Stats() const;
+
+ private:
+    void run();
+    void scrubDirectory(const std::string &dir, int depth);
+    void handle(const std::string &path);
+    Status quarantine(const std::string &path);
+    /**
+     * Read the next block of the chunk in the buffer, the plain bytes at
+     * offset for a compressed chunk
+     * @return -1 with errno EBADMSG if a frame doesn't decompress
+     */
+    ssize_t readBlock(int fd, FrameReader *frames, uint64_t offset);
+    ssize_t readAt(int fd, FrameReader *frames, uint64_t offset);
+
+    ScrubOptions options;
+    Throttle throttle;
+    std::shared_ptr<IoScheduler> scheduler;
+    utils::ServiceLog serviceLog;
+    std::vector<uint8_t> buffer;
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::atomic<bool> running {false};
+    std::atomic<bool> stopping {false};
+
+    std::atomic<uint64_t> passes {0};
+    std::atomic<uint64_t> chunks {0};
+    std::atomic<uint64_t> bytes {0};
+    std::atomic<uint64_t> corrupted {0};
+    std::atomic<uint64_t> missingAttr {0};
+    std::atomic<uint64_t> ioErrors {0};
+    std::atomic<uint64_t> quarantined {0};
+    std::atomic<uint64_t> passBytes {0};
+    std::atomic<uint32_t> progress {0};
+    std::atomic<uint32_t> fanout {0};
+    std::atomic<int64_t> passStart {0};
+    std::atomic<int64_t> passEnd {0};
+};
+
+}  // namespace blob
+
+#endif  // SRC_SCRUB_HPP_
@@ -0,0 +1,595 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <strings.h>
+#include <sys/statvfs.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "pool.hpp"
+#include "stats.hpp"
+
+using utils::HistogramSnapshot;
+using utils::Method;
+using utils::RequestCounter;
+using utils::RequestStats;
+using utils::ScrubStats;
+using utils::Stat;
+using utils::StatsFormat;
+using utils::StatsWriter;
+using utils::StatusClass;
+using utils::VolumeReport;
+using utils::VolumeUsage;
+
+namespace {
+
+/**
+ * Prometheus families of the RequestCounter values, the stats of a
+ * family must be contiguous.
+ */
+struct PromStat {
+    Stat stat;
+    const char *family;
+    const char *labels;
+    const char *help;
+};
+
+const PromStat promStats[] = {
+    {Stat::PutTime, "rawx_request_time_microseconds_total",
+     "method=\"put\"", "Cumulated time spent serving the requests"},
+    {Stat::GetTime, "rawx_request_time_microseconds_total",
+     "method=\"get\"", nullptr},
+    {Stat::DelTime, "rawx_request_time_microseconds_total",
+     "method=\"del\"", nullptr},
+    {Stat::StatTime, "rawx_request_time_microseconds_total",
+     "method=\"stat\"", nullptr},
+    {Stat::InfoTime, "rawx_request_time_microseconds_total",
+     "method=\"info\"", nullptr},
+    {Stat::RawTime, "rawx_request_time_microseconds_total",
+     "method=\"raw\"", nullptr},
+    {Stat::OtherTime, "rawx_request_time_microseconds_total",
+     "method=\"other\"", nullptr},
+    {Stat::PutHits, "rawx_requests_total", "method=\"put\"",
+     "Requests received"},
+    {Stat::GetHits, "rawx_requests_total", "method=\"get\"", nullptr},
+    {Stat::DelHits, "rawx_requests_total", "method=\"del\"", nullptr},
+    {Stat::StatHits, "rawx_requests_total", "method=\"stat\"", nullptr},
+    {Stat::InfoHits, "rawx_requests_total", "method=\"info\"", nullptr},
+    {Stat::RawHits, "rawx_requests_total", "method=\"raw\"", nullptr},
+    {Stat::R2xxHits, "rawx_replies_total", "status=\"2xx\"",
+     "Replies sent, per status"},
+    {Stat::R4xxHits, "rawx_replies_total", "status=\"4xx\"", nullptr},
+    {Stat::R5xxHits, "rawx_replies_total", "status=\"5xx\"", nullptr},
+    {Stat::OtherHits, "rawx_replies_total", "status=\"other\"", nullptr},
+    {Stat::R403Hits, "rawx_replies_by_code_total", "status=\"403\"",
+     "Replies sent with some statuses, also counted in rawx_replies_total"},
+    {Stat::R404Hits, "rawx_replies_by_code_total", "status=\"404\"",
+     nullptr},
+    {Stat::Bread, "rawx_read_bytes_total", nullptr,
+     "Bytes read from the chunks"},
+    {Stat::Bwritten, "rawx_written_bytes_total", nullptr,
+     "Bytes written to the chunks"},
+    {Stat::Paused, "rawx_ingress_pauses_total", nullptr,
+     "Uploads paused until their buffered bytes are written"},
+    {Stat::Coalesced, "rawx_coalesced_requests_total", nullptr,
+     "Downloads that joined the reads of a concurrent one"},
+    {Stat::Bshared, "rawx_coalesced_bytes_total", nullptr,
+     "Bytes sent from blocks read for a concurrent download"},
+    {Stat::Pooled, "rawx_pooled_handlers_total", nullptr,
+     "Request handlers made in the memory of a former one"},
+    {Stat::Bcompressed, "rawx_compression_bytes_total", "side=\"plain\"",
+     "Bytes of the compressed chunks written, plain and as stored"},
+    {Stat::Bstored, "rawx_compression_bytes_total", "side=\"stored\"",
+     nullptr},
+    {Stat::CompressTime, "rawx_compression_cpu_microseconds_total",
+     "op=\"compress\"", "CPU time spent in the codecs of the chunks"},
+    {Stat::DecompressTime, "rawx_compression_cpu_microseconds_total",
+     "op=\"decompress\"", nullptr},
+};
+
+static_assert(sizeof(promStats) / sizeof(promStats[0]) == utils::kStats,
+              "Every counter must have a Prometheus name");
+
+/**
+ * Values of the scrubber of a volume, by oio name and by Prometheus family
+ * (with a kind label when the family has several values, which must be
+ * contiguous).
+ */
+const struct {
+    const char *oio;
+    const char *family;
+    const char *kind;
+    const char *type;
+    const char *help;
+    uint64_t (*value)(const ScrubStats &scrub);
+} scrubStats[] = {
+    {"scrub.passes", "rawx_scrub_passes_total", nullptr, "counter",
+     "Complete passes of the scrubber over the volume",
+     [](const ScrubStats &scrub) { return scrub.passes; }},
+    {"scrub.chunks", "rawx_scrub_chunks_total", nullptr, "counter",
+     "Chunks checked by the scrubber",
+     [](const ScrubStats &scrub) { return scrub.chunks; }},
+    {"scrub.bytes", "rawx_scrub_bytes_total", nullptr, "counter",
+     "Bytes read by the scrubber",
+     [](const ScrubStats &scrub) { return scrub.bytes; }},
+    {"scrub.corrupted", "rawx_scrub_errors_total", "corrupted", "counter",
+     "Chunks found faulty by the scrubber",
+     [](const ScrubStats &scrub) { return scrub.corrupted; }},
+    {"scrub.noattr", "rawx_scrub_errors_total", "missing_attr", "counter",
+     nullptr, [](const ScrubStats &scrub) { return scrub.missingAttr; }},
+    {"scrub.errors", "rawx_scrub_errors_total", "io", "counter", nullptr,
+     [](const ScrubStats &scrub) { return scrub.ioErrors; }},
+    {"scrub.quarantined", "rawx_scrub_quarantined_total", nullptr, "counter",
+     "Corrupted chunks moved to the quarantine",
+     [](const ScrubStats &scrub) { return scrub.quarantined; }},
+    {"scrub.throughput", "rawx_scrub_throughput_bytes", nullptr, "gauge",
+     "Bytes per second read by the current (or last) pass",
+     [](const ScrubStats &scrub) { return scrub.throughput; }},
+    {"scrub.progress", "rawx_scrub_directories", "done", "gauge",
+     "Fan-out directories of the current pass, done and seen",
+     [](const ScrubStats &scrub) -> uint64_t { return scrub.progress; }},
+    {"scrub.fanout", "rawx_scrub_directories", "seen", "gauge", nullptr,
+     [](const ScrubStats &scrub) -> uint64_t { return scrub.fanout; }},
+    {"scrub.throttle.pct", "rawx_scrub_throttle_percent", nullptr, "gauge",
+     "Share of its budget given to the scrubber by the foreground latency",
+     [](const ScrubStats &scrub) {
+         return static_cast<uint64_t>(scrub.throttle * 100 + 0.5);
+     }},
+};
+
+const struct {
+    const char *label;
+    double q;
+} quantiles[] = {
+    {"0.5", 0.5}, {"0.9", 0.9}, {"0.99", 0.99}, {"0.999", 0.999}
+};
+
+void header(StatsWriter *out, const char *family, const char *type,
+            const char *help) {
+    out->Text("# HELP ");
+    out->Text(family);
+    out->Text(" ");
+    out->Text(help);
+    out->Text("\n# TYPE ");
+    out->Text(family);
+    out->Text(" ");
+    out->Text(type);
+    out->Text("\n");
+}
+
+void sample(StatsWriter *out, const char *name, const char *labels,
+            uint64_t value) {
+    out->Text(name);
+    if (labels != nullptr) {
+        out->Text("{");
+        out->Text(labels);
+        out->Text("}");
+    }
+    out->Text(" ");
+    out->Number(value);
+    out->Text("\n");
+}
+
+void renderOio(StatsWriter *out, const RequestCounter &counter,
+               const RequestStats &stats,
+               const std::vector<VolumeReport> &volumes) {
+    for (unsigned int i = 0; i < utils::kStats; i++) {
+        auto stat = static_cast<Stat>(i);
+        out->Text("counter ");
+        out->Text(RequestCounter::Name(stat));
+        out->Text(" ");
+        out->Number(stats[stat]);
+        out->Text("\n");
+    }
+    sample(out, "counter req.slow", nullptr, counter.Phases().Slow());
+    sample(out, "counter heap.allocs", nullptr, utils::HeapAllocations());
+    sample(out, "gauge req.inflight", nullptr,
+           std::max<int64_t>(counter.Inflight(), 0));
+    sample(out, "gauge req.buffered", nullptr,
+           std::max<int64_t>(counter.Buffered(), 0));
+    for (unsigned int n = 0; n < utils::NodeTraffic::kMaxNodes; n++) {
+        auto traffic = counter.Nodes().Get(n);
+        if (traffic.local + traffic.remote == 0)
+            continue;
+        char name[64];
+        snprintf(name, sizeof(name), "counter numa.%u.io.local", n);
+        sample(out, name, nullptr, traffic.local);
+        snprintf(name, sizeof(name), "counter numa.%u.io.remote", n);
+        sample(out, name, nullptr, traffic.remote);
+        snprintf(name, sizeof(name), "counter numa.%u.bytes", n);
+        sample(out, name, nullptr, traffic.bytes);
+    }
+    if (volumes.empty())
+        return;
+    auto &first = volumes.front();
+    out->Text("config volume ");
+    out->Text(first.path.data(), first.path.size());
+    out->Text("\n");
+    if (first.hasUsage) {
+        auto &usage = first.usage;
+        sample(out, "gauge space.total", nullptr, usage.totalBytes);
+        sample(out, "gauge space.free", nullptr, usage.freeBytes);
+        sample(out, "gauge space.avail", nullptr, usage.availBytes);
+        sample(out, "gauge inodes.total", nullptr, usage.totalInodes);
+        sample(out, "gauge inodes.free", nullptr, usage.freeInodes);
+    }
+    for (auto &volume : volumes) {
+        if (volume.id.empty())
+            continue;
+        std::string prefix = "volume." + volume.id + ".";
+        out->Text("config ");
+        out->Text(prefix.data(), prefix.size() - 1);
+        out->Text(" ");
+        out->Text(volume.path.data(), volume.path.size());
+        out->Text("\n");
+        sample(out, ("counter " + prefix + "req").c_str(), nullptr,
+               volume.requests);
+        sample(out, ("counter " + prefix + "bread").c_str(), nullptr,
+               volume.bytesRead);
+        sample(out, ("counter " + prefix + "bwritten").c_str(), nullptr,
+               volume.bytesWritten);
+        sample(out, ("gauge " + prefix + "inflight").c_str(), nullptr,
+               std::max<int64_t>(volume.inflight, 0));
+        sample(out, ("gauge " + prefix + "buffered").c_str(), nullptr,
+               std::max<int64_t>(volume.buffered, 0));
+        if (volume.hasUsage) {
+            sample(out, ("gauge " + prefix + "space.total").c_str(), nullptr,
+                   volume.usage.totalBytes);
+            sample(out, ("gauge " + prefix + "space.avail").c_str(), nullptr,
+                   volume.usage.availBytes);
+        }
+        if (!volume.scrubbed)
+            continue;
+        for (auto &scrub : scrubStats) {
+            std::string name = std::string(scrub.type) + " " + prefix
+                    + scrub.oio;
+            sample(out, name.c_str(), nullptr, scrub.value(volume.scrub));
+        }
+    }
+}
+
+void summary(StatsWriter *out, const char *family, const char *labels,
+             size_t length, const HistogramSnapshot &snapshot) {
+    for (auto &quantile : quantiles) {
+        out->Text(family);
+        out->Text("{");
+        out->Text(labels, length);
+        out->Text(",quantile=\"");
+        out->Text(quantile.label);
+        out->Text("\"} ");
+        out->Number(snapshot.Percentile(quantile.q) / 1000);
+        out->Text("\n");
+    }
+    out->Text(family);
+    out->Text("_sum");
+    sample(out, "", labels, snapshot.sum / 1000);
+    out->Text(family);
+    out->Text("_count");
+    sample(out, "", labels, snapshot.count);
+}
+
+/**
+ * One summary per method and status class, only for the pairs that
+ * received requests.
+ */
+void renderSummary(StatsWriter *out, const utils::LatencyStats &latency,
+                   bool ttfb, const char *family, const char *help) {
+    bool first = true;
+    for (unsigned int m = 0; m < utils::kMethods; m++) {
+        for (unsigned int c = 0; c < utils::kStatusClasses; c++) {
+            auto method = static_cast<Method>(m);
+            auto cls = static_cast<StatusClass>(c);
+            if (latency.Count(method, cls) == 0)
+                continue;
+            HistogramSnapshot snapshot = ttfb
+                    ? latency.FirstByte(method, cls)
+                    : latency.Total(method, cls);
+            if (snapshot.count == 0)
+                continue;
+            if (first) {
+                header(out, family, "summary", help);
+                first = false;
+            }
+            char labels[64];
+            int length = snprintf(labels, sizeof(labels),
+                                  "method=\"%s\",status=\"%s\"",
+                                  utils::MethodName(method),
+                                  utils::StatusClassName(cls));
+            summary(out, family, labels, length, snapshot);
+        }
+    }
+}
+
+void renderPhases(StatsWriter *out, const utils::PhaseStats &phases) {
+    const char *family = "rawx_request_phase_microseconds";
+    bool first = true;
+    for (unsigned int i = 0; i < utils::kPhases; i++) {
+        auto snapshot = phases.Snapshot(static_cast<utils::Phase>(i));
+        if (snapshot.count == 0)
+            continue;
+        if (first) {
+            header(out, family, "summary",
+                   "Time spent per phase by the traced requests");
+            first = false;
+        }
+        char labels[32];
+        int length = snprintf(labels, sizeof(labels), "phase=\"%s\"",
+                              utils::PhaseName(static_cast<utils::Phase>(i)));
+        summary(out, family, labels, length, snapshot);
+    }
+    header(out, "rawx_slow_requests_total", "counter",
+           "Requests longer than the slow threshold");
+    sample(out, "rawx_slow_requests_total", nullptr, phases.Slow());
+}
+
+void renderNodes(StatsWriter *out, const utils::NodeTraffic &nodes) {
+    bool first = true;
+    for (unsigned int n = 0; n < utils::NodeTraffic::kMaxNodes; n++) {
+        auto traffic = nodes.Get(n);
+        if (traffic.local + traffic.remote == 0)
+            continue;
+        if (first) {
+            header(out, "rawx_numa_io_total", "counter",
+                   "I/O on the volumes of the node, by node of the thread");
+            first = false;
+        }
+        char labels[64];
+        snprintf(labels, sizeof(labels),
+                 "node=\"%u\",locality=\"local\"", n);
+        sample(out, "rawx_numa_io_total", labels, traffic.local);
+        snprintf(labels, sizeof(labels),
+                 "node=\"%u\",locality=\"remote\"", n);
+        sample(out, "rawx_numa_io_total", labels, traffic.remote);
+    }
+    if (first)
+        return;
+    header(out, "rawx_numa_io_bytes_total", "counter",
+           "Bytes moved on the volumes of the node");
+    for (unsigned int n = 0; n < utils::NodeTraffic::kMaxNodes; n++) {
+        auto traffic = nodes.Get(n);
+        if (traffic.local + traffic.remote == 0)
+            continue;
+        char labels[32];
+        snprintf(labels, sizeof(labels), "node=\"%u\"", n);
+        sample(out, "rawx_numa_io_bytes_total", labels, traffic.bytes);
+    }
+}
+
+void renderVolumes(StatsWriter *out,
+                   const std::vector<VolumeReport> &volumes) {
+    bool first = true;
+    for (auto &volume : volumes) {
+        if (!volume.hasUsage)
+            continue;
+        if (first) {
+            header(out, "rawx_volume_bytes", "gauge", "Space of the volume");
+            first = false;
+        }
+        auto &usage = volume.usage;
+        std::string labels = "volume=\"" + volume.path + "\"";
+        sample(out, "rawx_volume_bytes", (labels + ",kind=\"total\"").c_str(),
+               usage.totalBytes);
+        sample(out, "rawx_volume_bytes", (labels + ",kind=\"free\"").c_str(),
+               usage.freeBytes);
+        sample(out, "rawx_volume_bytes", (labels + ",kind=\"avail\"").c_str(),
+               usage.availBytes);
+    }
+    first = true;
+    for (auto &volume : volumes) {
+        if (!volume.hasUsage)
+            continue;
+        if (first) {
+            header(out, "rawx_volume_inodes", "gauge", "Inodes of the volume");
+            first = false;
+        }
+        std::string labels = "volume=\"" + volume.path + "\"";
+        sample(out, "rawx_volume_inodes", (labels + ",kind=\"total\"").c_str(),
+               volume.usage.totalInodes);
+        sample(out, "rawx_volume_inodes", (labels + ",kind=\"free\"").c_str(),
+               volume.usage.freeInodes);
+    }
+    first = true;
+    for (auto &volume : volumes) {
+        if (volume.id.empty())
+            continue;
+        if (first) {
+            header(out, "rawx_volume_requests_total", "counter",
+                   "Requests routed to the volume");
+            first = false;
+        }
+        std::string labels = "volume=\"" + volume.id + "\"";
+        sample(out, "rawx_volume_requests_total", labels.c_str(),
+               volume.requests);
+    }
+    if (first)
+        return;
+    header(out, "rawx_volume_io_bytes_total", "counter",
+           "Bytes read and written on the volume");
+    for (auto &volume : volumes) {
+        if (volume.id.empty())
+            continue;
+        std::string labels = "volume=\"" + volume.id + "\"";
+        sample(out, "rawx_volume_io_bytes_total",
+               (labels + ",direction=\"read\"").c_str(), volume.bytesRead);
+        sample(out, "rawx_volume_io_bytes_total",
+               (labels + ",direction=\"write\"").c_str(),
+               volume.bytesWritten);
+    }
+    header(out, "rawx_volume_requests_inflight", "gauge",
+           "Requests being served by the volume");
+    for (auto &volume : volumes) {
+        if (volume.id.empty())
+            continue;
+        std::string labels = "volume=\"" + volume.id + "\"";
+        sample(out, "rawx_volume_requests_inflight", labels.c_str(),
+               std::max<int64_t>(volume.inflight, 0));
+    }
+    header(out, "rawx_volume_buffered_bytes", "gauge",
+           "Upload bytes received and not written yet on the volume");
+    for (auto &volume : volumes) {
+        if (volume.id.empty())
+            continue;
+        std::string labels = "volume=\"" + volume.id + "\"";
+        sample(out, "rawx_volume_buffered_bytes", labels.c_str(),
+               std::max<int64_t>(volume.buffered, 0));
+    }
+}
+
+void renderScrub(StatsWriter *out,
+                 const std::vector<VolumeReport> &volumes) {
+    bool any = false;
+    for (auto &volume : volumes)
+        any = any || (volume.scrubbed && !volume.id.empty());
+    if (!any)
+        return;
+    for (auto &scrub : scrubStats) {
+        if (scrub.help != nullptr)
+            header(out, scrub.family, scrub.type, scrub.help);
+        for (auto &volume : volumes) {
+            if (!volume.scrubbed || volume.id.empty())
+                continue;
+            std::string labels = "volume=\"" + volume.id + "\"";
+            if (scrub.kind != nullptr)
+                labels += std::string(",kind=\"") + scrub.kind + "\"";
+            sample(out, scrub.family, labels.c_str(),
+                   scrub.value(volume.scrub));
+        }
+    }
+}
+
+void renderPrometheus(StatsWriter *out, const RequestCounter &counter,
+                      const RequestStats &stats,
+                      const std::vector<VolumeReport> &volumes) {
+    const char *family = nullptr;
+    for (auto &prom : promStats) {
+        if (family == nullptr || strcmp(family, prom.family) != 0) {
+            family = prom.family;
+            header(out, family, "counter", prom.help);
+        }
+        sample(out, family, prom.labels, stats[prom.stat]);
+    }
+    renderSummary(out, counter.Latency(), false,
+                  "rawx_request_duration_microseconds",
+                  "Duration of the requests");
+    renderSummary(out, counter.Latency(), true,
+                  "rawx_request_ttfb_microseconds",
+                  "Time to the first byte of the replies");
+    renderPhases(out, counter.Phases());
+    header(out, "rawx_heap_allocations_total", "counter",
+           "Heap allocations (operator new) of the process");
+    sample(out, "rawx_heap_allocations_total", nullptr,
+           utils::HeapAllocations());
+    header(out, "rawx_requests_inflight", "gauge", "Requests being served");
+    sample(out, "rawx_requests_inflight", nullptr,
+           std::max<int64_t>(counter.Inflight(), 0));
+    header(out, "rawx_upload_buffered_bytes", "gauge",
+           "Upload bytes received and not written yet");
+    sample(out, "rawx_upload_buffered_bytes", nullptr,
+           std::max<int64_t>(counter.Buffered(), 0));
+    renderNodes(out, counter.Nodes());
+    renderVolumes(out, volumes);
+    renderScrub(out, volumes);
+}
+
+}  // namespace
+
+bool utils::StatsFormatParse(const std::string &value, StatsFormat *format) {
+    if (strcasecmp(value.c_str(), "oio") == 0) {
+        *format = StatsFormat::Oio;
+        return true;
+    }
+    if (strcasecmp(value.c_str(), "prometheus") == 0) {
+        *format = StatsFormat::Prometheus;
+        return true;
+    }
+    return false;
+}
+
+const char *utils::StatsContentType(StatsFormat format) {
+    switch (format) {
+        case StatsFormat::Prometheus:
+            return "text/plain; version=0.0.4";
+        case StatsFormat::Oio:
+            break;
+    }
+    return "text/plain";
+}
+
+bool utils::VolumeUsageOf(const std::string &volume, VolumeUsage *usage) {
+    struct statvfs sv;
+    if (statvfs(volume.c_str(), &sv) != 0)
+        return false;
+    usage->totalBytes = static_cast<uint64_t>(sv.f_blocks) * sv.f_frsize;
+    usage->freeBytes = static_cast<uint64_t>(sv.f_bfree) * sv.f_frsize;
+    usage->availBytes = static_cast<uint64_t>(sv.f_bavail) * sv.f_frsize;
+    usage->totalInodes = sv.f_files;
+    usage->freeInodes = sv.f_ffree;
+    return true;
+}
+
+void StatsWriter::Text(const char *text, size_t length) {
+    if (needed == written && written + length <= capacity) {
+        memcpy(buffer + written, text, length);
+        written += length;
+    }
+    needed += length;
+}
+
+void StatsWriter::Text(const char *text) {
+    Text(text, strlen(text));
+}
+
+void StatsWriter::Number(uint64_t value) {
+    char digits[20];
+    size_t i = sizeof(digits);
+    do {
+        digits[--i] = '0' + (value % 10);
+        value /= 10;
+    } while (value != 0);
+    Text(digits + i, sizeof(digits) - i);
+}
+
+size_t utils::RenderStats(StatsFormat format, const RequestCounter &counter,
+                          const std::string &volume, const VolumeUsage *usage,
+                          char *buffer, size_t capacity) {
+    std::vector<VolumeReport> volumes(1);
+    volumes[0].path = volume;
+    if (usage != nullptr) {
+        volumes[0].hasUsage = true;
+        volumes[0].usage = *usage;
+    }
+    return RenderStats(format, counter, volumes, buffer, capacity);
+}
+
+size_t utils::RenderStats(StatsFormat format, const RequestCounter &counter,
+                          const std::vector<VolumeReport> &volumes,
+                          char *buffer, size_t capacity) {
+    StatsWriter out(buffer, capacity);
+    auto stats = counter.Snapshot();
+    switch (format) {
+        case StatsFormat::Oio:
+            renderOio(&out, counter, stats, volumes);
+            break;
+        case StatsFormat::Prometheus:
+            renderPrometheus(&out, counter, stats, volumes);
+            break;
+    }
+    return out.Needed();
+}
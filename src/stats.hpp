@@ -0,0 +1,145 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#ifndef SRC_STATS_HPP_
+#define SRC_STATS_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "utils.hpp"
+
+namespace utils {
+
+enum class StatsFormat {
+    Oio, Prometheus
+};
+
+/**
+ * Parse the "format" argument of the /stat request ("oio" or "prometheus").
+ * @return true if the value was recognized
+ */
+bool StatsFormatParse(const std::string &value, StatsFormat *format);
+
+/** @return the Content-Type of the format */
+const char *StatsContentType(StatsFormat format);
+
+struct VolumeUsage {
+    uint64_t totalBytes {0};
+    uint64_t freeBytes {0};
+    uint64_t availBytes {0};
+    uint64_t totalInodes {0};
+    uint64_t freeInodes {0};
+};
+
+/**
+ * statvfs() the volume.
+ * @return false if the volume cannot be stat'ed
+ */
+bool VolumeUsageOf(const std::string &volume, VolumeUsage *usage);
+
+/**
+ * Snapshot of the progress and the findings of the scrubber of a volume.
+ */
+struct ScrubStats {
+    uint64_t passes {0};
+    uint64_t chunks {0};
+    uint64_t bytes {0};
+    uint64_t corrupted {0};
+    uint64_t missingAttr {0};
+    uint64_t ioErrors {0};
+    uint64_t quarantined {0};
+    uint64_t throughput {0};  // bytes/s of the current (or last) pass
+    uint32_t progress {0};    // fan-out directories done in the current pass
+    uint32_t fanout {0};      // fan-out directories seen in the current pass
+    double throttle {1.0};
+};
+
+/**
+ * Usage and activity of one volume of the process. The activity is only
+ * rendered for the volumes with an id.
+ */
+struct VolumeReport {
+    std::string id;
+    std::string path;
+    bool hasUsage {false};
+    VolumeUsage usage;
+    int64_t inflight {0};
+    int64_t buffered {0};
+    uint64_t requests {0};
+    uint64_t bytesRead {0};
+    uint64_t bytesWritten {0};
+    /** The volume is scrubbed, rendered with its activity */
+    bool scrubbed {false};
+    ScrubStats scrub;
+};
+
+/**
+ * Append-only writer on a caller-provided buffer, with its own integer
+ * formatting (no locale, no allocation). Once a piece doesn't fit, the
+ * writer stops writing but keeps counting the bytes it would have written,
+ * so that the caller can retry with Needed() bytes.
+ */
+class StatsWriter {
+ public:
+    StatsWriter(char *buffer, size_t capacity)
+            : buffer{buffer}, capacity{capacity} {}
+
+    void Text(const char *text, size_t length);
+    void Text(const char *text);
+    void Number(uint64_t value);
+    /** @return the number of bytes written in the buffer */
+    inline size_t Size() const { return written; }
+    /** @return the number of bytes required to render everything */
+    inline size_t Needed() const { return needed; }
+    inline bool Overflow() const { return needed > written; }
+
+ private:
+    char *buffer;
+    size_t capacity;
+    size_t written {0};
+    size_t needed {0};
+};
+
+/** Initial size of the buffer given to RenderStats() */
+constexpr size_t kStatsBufferSize = 8192;
+
+/**
+ * Render the counters, the latency percentiles and the usage of the volume.
+ * The counters are read from a snapshot of the shards, the request threads
+ * are never blocked.
+ * @param usage may be null when the volume could not be stat'ed
+ * @return the number of bytes required, the output is complete only if it
+ * is not greater than `capacity`
+ */
+size_t RenderStats(StatsFormat format, const RequestCounter &counter,
+                   const std::string &volume, const VolumeUsage *usage,
+                   char *buffer, size_t capacity);
+
+/**
+ * Same as above for a set of volumes. The global "config volume" and
+ * space gauges of the oio format describe the first one.
+ */
+size_t RenderStats(StatsFormat format, const RequestCounter &counter,
+                   const std::vector<VolumeReport> &volumes,
+                   char *buffer, size_t capacity);
+
+}  // namespace utils
+
+#endif  // SRC_STATS_HPP_
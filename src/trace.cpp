@@ -0,0 +1,55 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include "stats.hpp"
+#include "trace.hpp"
+
+using utils::Phase;
+using utils::PhaseStats;
+using utils::PhaseTrace;
+using utils::StatsWriter;
+
+const char *utils::PhaseName(Phase phase) {
+    static const char *names[kPhases] = {
+        "parse", "queue", "open", "xattr", "read", "write", "commit",
+        "remove", "egress"
+    };
+    return names[static_cast<unsigned int>(phase)];
+}
+
+void PhaseTrace::Format(StatsWriter *out) const {
+    bool first = true;
+    for (unsigned int i = 0; i < kPhases; i++) {
+        if (counts[i] == 0)
+            continue;
+        if (!first)
+            out->Text(" ");
+        first = false;
+        out->Text(PhaseName(static_cast<Phase>(i)));
+        out->Text("=");
+        out->Number(nanos[i] / 1000);
+    }
+}
+
+void PhaseStats::Record(const PhaseTrace &trace) {
+    for (unsigned int i = 0; i < kPhases; i++) {
+        auto phase = static_cast<Phase>(i);
+        if (trace.Count(phase) > 0)
+            histograms[i].Record(trace.Nanos(phase));
+    }
+}
@@ -0,0 +1,127 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#ifndef SRC_TRACE_HPP_
+#define SRC_TRACE_HPP_
+
+#include <array>
+#include <atomic>
+#include <chrono> // NOLINT
+#include <cstdint>
+#include "histogram.hpp"
+
+namespace utils {
+
+class StatsWriter;
+
+/**
+ * Steps of a request whose duration is traced.
+ */
+enum class Phase : unsigned int {
+    Parse, Queue, Open, XAttr, Read, Write, Commit, Remove, Egress, Count
+};
+
+constexpr unsigned int kPhases = static_cast<unsigned int>(Phase::Count);
+
+const char *PhaseName(Phase phase);
+
+/**
+ * Time spent by one request in each phase, in nanoseconds. A phase may be
+ * entered several times (one Read per block). Not thread-safe: only the
+ * EventBase thread of the request writes it, and the blob operation given
+ * the trace with Trace() while it runs, a single one in flight at a time.
+ * The other tasks of a request (pipelined reads) time themselves and add
+ * their time from the EventBase thread.
+ */
+class PhaseTrace {
+ public:
+    static inline uint64_t Now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    inline void Add(Phase phase, uint64_t nanos) {
+        auto i = static_cast<unsigned int>(phase);
+        this->nanos[i] += nanos;
+        counts[i]++;
+    }
+    inline uint64_t Nanos(Phase phase) const {
+        return nanos[static_cast<unsigned int>(phase)];
+    }
+    inline uint64_t Count(Phase phase) const {
+        return counts[static_cast<unsigned int>(phase)];
+    }
+    /** Write "phase=micros" for each phase entered */
+    void Format(StatsWriter *out) const;
+
+ private:
+    std::array<uint64_t, kPhases> nanos {};
+    std::array<uint64_t, kPhases> counts {};
+};
+
+/**
+ * Add the lifetime of the scope to a phase, nothing if the trace is null.
+ */
+class PhaseScope {
+ public:
+    PhaseScope(PhaseTrace *trace, Phase phase)
+            : trace{trace}, phase{phase},
+              start{trace != nullptr ? PhaseTrace::Now() : 0} {}
+    ~PhaseScope() {
+        if (trace != nullptr)
+            trace->Add(phase, PhaseTrace::Now() - start);
+    }
+    PhaseScope(const PhaseScope&) = delete;
+    PhaseScope& operator=(const PhaseScope&) = delete;
+
+ private:
+    PhaseTrace *trace;
+    Phase phase;
+    uint64_t start;
+};
+
+/**
+ * Histograms of the time spent per phase by the traced requests, and the
+ * settings of the tracing.
+ */
+class PhaseStats {
+ public:
+    void Record(const PhaseTrace &trace);
+    inline HistogramSnapshot Snapshot(Phase phase) const {
+        return histograms[static_cast<unsigned int>(phase)].Snapshot();
+    }
+
+    inline bool Enabled() const { return enabled.load(); }
+    inline void Enabled(bool enabled) { this->enabled = enabled; }
+    /** Requests longer than the threshold are logged, 0 disables it */
+    inline uint64_t SlowThreshold() const { return threshold.load(); }
+    inline void SlowThreshold(std::chrono::nanoseconds threshold) {
+        this->threshold = threshold.count();
+    }
+    inline void incSlow() { slow++; }
+    inline uint64_t Slow() const { return slow.load(); }
+
+ private:
+    std::array<LatencyHistogram, kPhases> histograms;
+    std::atomic<bool> enabled {true};
+    std::atomic<uint64_t> threshold {1000000000};
+    std::atomic<uint64_t> slow {0};
+};
+
+}  // namespace utils
+
+#endif  // SRC_TRACE_HPP_
@@ -19,31 +19,50 @@
 #include <pthread.h>
 #include <gflags/gflags.h>
 #include <attr/xattr.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <strings.h>
 #include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
 #include <ctime>
+#include <mutex> // NOLINT
+#include <new>
 #include <string>
 #include <vector>
+#include "stats.hpp"
 #include "utils.hpp"
 
 using utils::XAttr;
 using utils::AccessLog;
 using utils::ServiceLog;
+using utils::AsyncLogger;
+using utils::StatsWriter;
+using utils::PhaseTrace;
 using utils::RequestCounter;
+using utils::RequestStats;
+using utils::Stat;
+
+namespace {
+
+pid_t threadID() {
+    static thread_local pid_t tid = syscall(SYS_gettid);
+    return tid;
+}
+
+}  // namespace
 
 void AccessLog::SetUpBasic(std::string hostname, std::string instanceID) {
     this->hostname = hostname;
     this->instanceID = instanceID;
-    this->PID = ::getpid();
-    this->threadID = pthread_self();
-    this->logType = "access";
 }
 
 void ServiceLog::SetUpBasic(std::string hostname, std::string instanceID) {
     this->hostname = hostname;
     this->instanceID = instanceID;
-    this->PID = ::getpid();
-    this->threadID = pthread_self();
+    this->PID = std::to_string(::getpid());
+    this->threadID = std::to_string(::threadID());
     this->logType = "log";
 }
 
@@ -59,44 +78,86 @@ std::string ServiceLog::LogToPrint(std::string level, std::string message) {
             threadID + " " + logType + " " + level + " " + message;
 }
 
+void AccessLog::stamp(const char *level, const std::string &message) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME_COARSE, &now);
+    record.timestamp = static_cast<int64_t>(now.tv_sec) * 1000000
+            + now.tv_nsec / 1000;
+    record.threadID = threadID();
+    size_t length = strnlen(level, sizeof(record.level) - 1);
+    memcpy(record.level, level, length);
+    record.level[length] = '\0';
+    copy(record.message, message);
+}
+
 std::string AccessLog::LogToPrint(std::string level, std::string message) {
-    std::time_t stime = std::time(nullptr);
-    std::tm *ltime = std::localtime(&stime);
+    stamp(level.c_str(), message);
+    std::time_t stime = record.timestamp / 1000000;
+    struct tm ltime;
+    localtime_r(&stime, &ltime);
     char time_print[30];
-    std::strftime(time_print, 30, "%b %d %H:%M:%S", ltime);
-    this->timestamp = std::string(time_print);
-    this->level = level;
-    this->message = message;
-    return timestamp + " " + hostname + " " + instanceID + " " + PID + " " +
-            threadID + " " + logType + " " + level + " " + localServer + " " +
-            remoteClient + " " + requestType + " " + statusCode + " " +
-            responseTime + " " + responseSize + " " + userID + " " + requestID +
-            " " + message;
+    std::strftime(time_print, 30, "%b %d %H:%M:%S", &ltime);
+    char line[1024];
+    StatsWriter out(line, sizeof(line));
+    FormatAccess(&out, record, time_print, hostname, instanceID, ::getpid());
+    return std::string(line, out.Size());
+}
+
+void AccessLog::Slow(const PhaseTrace &trace) {
+    AsyncLogger *logger = AsyncLogger::Installed();
+    if (logger == nullptr)
+        return;
+    stamp("SLO", "");
+    StatsWriter out(record.message, sizeof(record.message) - 1);
+    trace.Format(&out);
+    record.message[out.Size()] = '\0';
+    logger->Push(record);
+}
+
+void AccessLog::Log(const char *level, const std::string &message) {
+    AsyncLogger *logger = AsyncLogger::Installed();
+    if (logger == nullptr)
+        return;
+    stamp(level, message);
+    logger->Push(record);
 }
 
 
 bool XAttr::retrieveXAttr(int fd) {
     char buffer[sizeBuffer]; // NOLINT
-    int size = sizeBuffer;
-    for (auto &elem : attributes) {
-        if (fgetxattr(fd, (xattrPrefix + elem.xattrName).c_str(), buffer,
-                      size) != 0) {
+    for (unsigned int i = 0; i < kAttrs; i++) {
+        ssize_t size = fgetxattr(fd, kAttributes[i].key, buffer, sizeBuffer);
+        if (size < 0) {
             // TODO(KR): check the error (LOG)
+            values[i].clear();
         } else {
-            elem.value = std::string(buffer, size);
+            values[i].assign(buffer, size);
         }
-        size = sizeBuffer;
+    }
+    return true;
+}
+
+bool XAttr::retrieveXAttr(const std::string &path) {
+    char buffer[sizeBuffer]; // NOLINT
+    for (unsigned int i = 0; i < kAttrs; i++) {
+        ssize_t size = getxattr(path.c_str(), kAttributes[i].key, buffer,
+                                sizeBuffer);
+        if (size < 0 && (errno == ENOENT || errno == ENOTDIR))
+            return false;
+        if (size < 0)
+            values[i].clear();
+        else
+            values[i].assign(buffer, size);
     }
     return true;
 }
 
 bool XAttr::writeXAttr(int fd) {
-    for (auto &elem : attributes) {
-        if (elem.value.empty())
+    for (unsigned int i = 0; i < kAttrs; i++) {
+        if (values[i].empty())
             continue;
-        if (fsetxattr(fd, (xattrPrefix + elem.xattrName).c_str(),
-                      elem.value.c_str(), elem.value.size(), XATTR_CREATE)
-            != 0) {
+        if (fsetxattr(fd, kAttributes[i].key, values[i].c_str(),
+                      values[i].size(), XATTR_CREATE) != 0) {
             // TODO(KR): check the error (LOG)
         }
     }
@@ -105,26 +166,22 @@ bool XAttr::writeXAttr(int fd) {
 
 std::vector<std::pair<std::string, std::string>> XAttr::XAttrNamesValues() {
     std::vector<std::pair<std::string, std::string>> namesValues;
-    for (auto &elem : attributes) {
-        namesValues.push_back(std::pair<std::string, std::string>
-                              (xattrPrefix + elem.xattrName, elem.value));
-    }
+    for (unsigned int i = 0; i < kAttrs; i++)
+        namesValues.emplace_back(kAttributes[i].key, values[i]);
     return namesValues;
 }
 
 std::vector<std::pair<std::string, std::string>> XAttr::HTTPNamesValues() {
     std::vector<std::pair<std::string, std::string>> namesValues;
-    for (auto &elem : attributes) {
-        namesValues.push_back(std::pair<std::string, std::string>
-                              (httpPrefix + elem.httpName, elem.value));
-    }
+    for (unsigned int i = 0; i < kAttrs; i++)
+        namesValues.emplace_back(kAttributes[i].header, values[i]);
     return namesValues;
 }
 
 bool XAttr::addHTTP(std::string name, std::string value) {
-    for (auto &elem : attributes) {
-        if (elem.httpName == name) {
-            elem.value = value;
+    for (unsigned int i = 0; i < kAttrs; i++) {
+        if (name == kAttributes[i].http) {
+            values[i] = std::move(value);
             return true;
         }
     }
@@ -132,9 +189,9 @@ bool XAttr::addHTTP(std::string name, std::string value) {
 }
 
 bool XAttr::addXAttr(std::string name, std::string value) {
-    for (auto &elem : attributes) {
-        if (elem.xattrName == name) {
-            elem.value = value;
+    for (unsigned int i = 0; i < kAttrs; i++) {
+        if (name == kAttributes[i].xattr) {
+            values[i] = std::move(value);
             return true;
         }
     }
@@ -142,126 +199,217 @@ bool XAttr::addXAttr(std::string name, std::string value) {
 }
 
 std::string XAttr::getHTTP(std::string name) {
-    for (auto &elem : attributes) {
-        if (elem.httpName == name) {
-            return elem.value;
-        }
+    for (unsigned int i = 0; i < kAttrs; i++) {
+        if (name == kAttributes[i].http)
+            return values[i];
     }
     return std::string();
 }
 
 std::string XAttr::getXAttr(std::string name) {
-    for (auto &elem : attributes) {
-        if (elem.xattrName == name) {
-            return elem.value;
-        }
+    for (unsigned int i = 0; i < kAttrs; i++) {
+        if (name == kAttributes[i].xattr)
+            return values[i];
     }
     return std::string();
 }
 
-void RequestCounter::incPutTime(unsigned int time) {
-    rcMutex.lock();
-    putTime += time;
-    rcMutex.unlock();
-}
-void RequestCounter::incGetTime(unsigned int time) {
-    rcMutex.lock();
-    getTime += time;
-    rcMutex.unlock();
-}
-void RequestCounter::incDelTime(unsigned int time) {
-    rcMutex.lock();
-    delTime += time;
-    rcMutex.unlock();
-}
-void RequestCounter::incStatTime(unsigned int time) {
-    rcMutex.lock();
-    statTime += time;
-    rcMutex.unlock();
-}
-void RequestCounter::incinfoTime(unsigned int time) {
-    rcMutex.lock();
-    infoTime += time;
-    rcMutex.unlock();
-}
-void RequestCounter::incRawTime(unsigned int time) {
-    rcMutex.lock();
-    rawTime += time;
-    rcMutex.unlock();
-}
-void RequestCounter::incOtherTime(unsigned int time) {
-    rcMutex.lock();
-    otherTime += time;
-    rcMutex.unlock();
+bool XAttr::SetHeader(const std::string &name, const std::string &value) {
+    constexpr size_t prefix = sizeof(kHeaderPrefix) - 1;
+    if (name.size() <= prefix
+            || strncasecmp(name.c_str(), kHeaderPrefix, prefix) != 0)
+        return false;
+    const char *suffix = name.c_str() + prefix;
+    for (unsigned int i = 0; i < kAttrs; i++) {
+        if (strcasecmp(suffix, kAttributes[i].http) == 0) {
+            values[i] = value;
+            return true;
+        }
+    }
+    return false;
 }
 
-void RequestCounter::incPutHits() {
-    rcMutex.lock();
-    putHits++;
-    rcMutex.unlock();
-}
-void RequestCounter::incGetHits() {
-    rcMutex.lock();
-    getHits++;
-    rcMutex.unlock();
+std::string utils::ChunkETag(const std::string &hash) {
+    if (hash.empty())
+        return std::string();
+    return "\"" + hash + "\"";
 }
-void RequestCounter::incDelHits() {
-    rcMutex.lock();
-    delHits++;
-    rcMutex.unlock();
-}
-void RequestCounter::incStatHits() {
-    rcMutex.lock();
-    statHits++;
-    rcMutex.unlock();
+
+void utils::ChunkETag(const std::string &hash, std::string *etag) {
+    etag->clear();
+    if (hash.empty())
+        return;
+    etag->reserve(hash.size() + 2);
+    etag->push_back('"');
+    etag->append(hash);
+    etag->push_back('"');
 }
-void RequestCounter::incInfoHits() {
-    rcMutex.lock();
-    infoHits++;
-    rcMutex.unlock();
+
+/**
+ * @return true if an entity tag of the list matches, or the list is "*".
+ * A strong comparison skips the weak tags, of the list or ours.
+ */
+static bool etagListMatches(const std::string &list, const std::string &etag,
+                            bool weak) {
+    bool weakEtag = etag.compare(0, 2, "W/") == 0;
+    const char *opaque = etag.c_str() + (weakEtag ? 2 : 0);
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t comma = list.find(',', pos);
+        if (comma == std::string::npos)
+            comma = list.size();
+        size_t first = list.find_first_not_of(" \t", pos);
+        std::string tag;
+        if (first < comma) {
+            size_t last = list.find_last_not_of(" \t", comma - 1);
+            tag = list.substr(first, last - first + 1);
+        }
+        pos = comma + 1;
+        if (tag == "*")
+            return true;
+        if (tag.compare(0, 2, "W/") == 0) {
+            if (!weak)
+                continue;
+            tag = tag.substr(2);
+        }
+        if (weakEtag && !weak)
+            continue;
+        if (!tag.empty() && tag.compare(opaque) == 0)
+            return true;
+    }
+    return false;
 }
-void RequestCounter::incRawHits() {
-    rcMutex.lock();
-    rawHits++;
-    rcMutex.unlock();
+
+utils::Precondition utils::EvaluatePreconditions(
+        const std::string &etag, const std::string &ifMatch,
+        const std::string &ifNoneMatch) {
+    if (!ifMatch.empty() && !etagListMatches(ifMatch, etag, false))
+        return Precondition::Failed;
+    if (!ifNoneMatch.empty() && etagListMatches(ifNoneMatch, etag, true))
+        return Precondition::NotModified;
+    return Precondition::Proceed;
 }
-void RequestCounter::incR2xxHits() {
-    rcMutex.lock();
-    r2xxHits++;
-    rcMutex.unlock();
+
+bool utils::RangeApplies(const std::string &etag,
+                         const std::string &ifRange) {
+    size_t first = ifRange.find_first_not_of(" \t");
+    if (first == std::string::npos)
+        return true;
+    size_t last = ifRange.find_last_not_of(" \t");
+    return !etag.empty() && ifRange.substr(first, last - first + 1) == etag;
 }
-void RequestCounter::incR4xxHits() {
-    rcMutex.lock();
-    r4xxHits++;
-    rcMutex.unlock();
+
+bool utils::AcceptsCoding(const std::string &accept,
+                          const std::string &coding) {
+    size_t pos = 0;
+    while (pos < accept.size()) {
+        size_t comma = accept.find(',', pos);
+        if (comma == std::string::npos)
+            comma = accept.size();
+        size_t semicolon = std::min(accept.find(';', pos), comma);
+        size_t first = accept.find_first_not_of(" \t", pos);
+        std::string name;
+        if (first < semicolon) {
+            size_t last = accept.find_last_not_of(" \t", semicolon - 1);
+            name = accept.substr(first, last - first + 1);
+        }
+        std::string params = accept.substr(semicolon, comma - semicolon);
+        pos = comma + 1;
+        if (strcasecmp(name.c_str(), coding.c_str()) != 0)
+            continue;
+        size_t q = params.find("q=");
+        return q == std::string::npos
+                || strtod(params.c_str() + q + 2, nullptr) > 0;
+    }
+    return false;
 }
-void RequestCounter::incR5xxHits() {
-    rcMutex.lock();
-    r5xxHits++;
-    rcMutex.unlock();
+
+namespace {
+
+/**
+ * Hands out the smallest free slot to each thread asking for one,
+ * and takes it back when the thread exits.
+ */
+class ThreadSlots {
+ public:
+    unsigned int acquire() {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (unsigned int i = 0; i < used.size(); i++) {
+            if (!used[i]) {
+                used[i] = true;
+                return i;
+            }
+        }
+        used.push_back(true);
+        return used.size() - 1;
+    }
+    void release(unsigned int slot) {
+        std::lock_guard<std::mutex> lock(mutex);
+        used[slot] = false;
+    }
+ private:
+    std::mutex mutex;
+    std::vector<bool> used;
+};
+
+ThreadSlots &threadSlots() {
+    static ThreadSlots *slots = new ThreadSlots();
+    return *slots;
 }
-void RequestCounter::incOtherHits() {
-    rcMutex.lock();
-    otherHits++;
-    rcMutex.unlock();
+
+struct SlotHolder {
+    SlotHolder() : index{threadSlots().acquire()} {}
+    ~SlotHolder() { threadSlots().release(index); }
+    unsigned int index;
+};
+
+}  // namespace
+
+unsigned int utils::ThreadSlot() {
+    static thread_local SlotHolder slot;
+    return slot.index;
 }
-void RequestCounter::incR403Hits() {
-    rcMutex.lock();
-    r403Hits++;
-    rcMutex.unlock();
+
+constexpr unsigned int RequestCounter::kMaxShards;
+
+RequestCounter::RequestCounter() {
+    void *memory = nullptr;
+    if (posix_memalign(&memory, 64, kMaxShards * sizeof(Shard)) != 0)
+        throw std::bad_alloc();
+    shards = static_cast<Shard *>(memory);
+    for (unsigned int i = 0; i < kMaxShards; i++)
+        new (&shards[i]) Shard();
+    for (auto &value : overflow.values)
+        value.store(0, std::memory_order_relaxed);
 }
-void RequestCounter::incR404Hits() {
-    rcMutex.lock();
-    r404Hits++;
-    rcMutex.unlock();
+
+RequestCounter::~RequestCounter() {
+    free(shards);
 }
-void RequestCounter::incBread(unsigned count) {
-    rcMutex.lock();
-    bread += count;
-    rcMutex.unlock();
+
+RequestStats RequestCounter::Snapshot() const {
+    RequestStats stats;
+    for (unsigned int s = 0; s < kMaxShards; s++) {
+        for (unsigned int i = 0; i < kStats; i++)
+            stats.values[i] += shards[s].values[i].load(
+                std::memory_order_relaxed);
+    }
+    for (unsigned int i = 0; i < kStats; i++)
+        stats.values[i] += overflow.values[i].load(std::memory_order_relaxed);
+    return stats;
 }
-void RequestCounter::incBwritten(unsigned count) {
-    rcMutex.lock();
-    bwritten += count;
-    rcMutex.unlock();
+
+const char *RequestCounter::Name(Stat stat) {
+    static const char *names[kStats] = {
+        "req.time.put", "req.time.get", "req.time.del", "req.time.stat",
+        "req.time.info", "req.time.raw", "req.time.other",
+        "req.hits.put", "req.hits.get", "req.hits.del", "req.hits.stat",
+        "req.hits.info", "req.hits.raw",
+        "rep.hits.2xx", "rep.hits.4xx", "rep.hits.5xx", "rep.hits.other",
+        "rep.hits.403", "rep.hits.404",
+        "rep.bread", "rep.bwritten", "req.paused", "req.coalesced",
+        "rep.bread.shared", "req.pooled", "rep.bcompressed.plain",
+        "rep.bcompressed.stored", "req.time.compress", "req.time.decompress"
+    };
+    return names[static_cast<unsigned int>(stat)];
 }
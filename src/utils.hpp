@@ -19,11 +19,18 @@
 #ifndef SRC_UTILS_HPP_
 #define SRC_UTILS_HPP_
 
+#include <array>
+#include <atomic>
+#include <cstring>
 #include <mutex> //NOLINT
 #include <utility>
 #include <vector>
 #include <string>
 #include <gflags/gflags.h> //NOLINT
+#include "affinity.hpp"
+#include "histogram.hpp"
+#include "logger.hpp"
+#include "trace.hpp"
 
 
 
@@ -31,56 +38,60 @@ namespace utils {
 
 
 /**
- * This structure contains the fields to log access to services
+ * This structure contains the fields to log access to services.
+ * The fields are kept in a fixed-size record: Log() copies it to the
+ * installed AsyncLogger without any allocation nor formatting.
  */
 class AccessLog {
  public:
     AccessLog() {}
     void SetUpBasic(std::string hostname, std::string instanceID);
+    /** Format the line synchronously */
     std::string LogToPrint(std::string level, std::string message);
+    /** Hand the record to the installed AsyncLogger, if any */
+    void Log(const char *level, const std::string &message);
+    /** Log the time spent per phase by a slow request, with level SLO */
+    void Slow(const PhaseTrace &trace);
 
-    inline void RemoteClient(std::string remoteClient) {
-        this->remoteClient = remoteClient;
+    inline void RemoteClient(const std::string &remoteClient) {
+        copy(record.remoteClient, remoteClient);
     }
-    inline void StatusCode(std::string statusCode) {
-        this->statusCode = statusCode;
+    inline void StatusCode(int statusCode) {
+        record.statusCode = statusCode;
     }
-    inline void RequestType(std::string requestType) {
-        this->requestType = requestType;
+    inline void RequestType(const std::string &requestType) {
+        copy(record.requestType, requestType);
     }
-    inline void ResponseTime(std::string responseTime) {
-        this->responseTime = responseTime;
+    /** @param responseTime in microseconds */
+    inline void ResponseTime(uint64_t responseTime) {
+        record.responseTime = responseTime;
     }
-    inline void ResponseSize(std::string responseSize) {
-        this->responseSize = responseSize;
+    inline void ResponseSize(uint64_t responseSize) {
+        record.responseSize = responseSize;
     }
-    inline void UserID(std::string userID) {
-        this->userID = userID;
+    inline void UserID(const std::string &userID) {
+        copy(record.userID, userID);
     }
-    inline void RequestID(std::string requestID) {
-        this->requestID = requestID;
+    inline void RequestID(const std::string &requestID) {
+        copy(record.requestID, requestID);
     }
-    inline void LocalServer(std::string localServer) {
-        this->localServer = localServer;
+    inline void LocalServer(const std::string &localServer) {
+        copy(record.localServer, localServer);
     }
 
  private:
-    std::string timestamp;
-    std::string hostname;
-    std::string instanceID;
-    std::string PID;
-    std::string threadID;
-    std::string logType;
-    std::string level;
-    std::string localServer;
-    std::string remoteClient;
-    std::string requestType;
-    std::string statusCode;
-    std::string responseTime;
-    std::string responseSize;
-    std::string userID {"-"};
-    std::string requestID {"-"};
-    std::string message;
+    /** Truncating copy to a record field */
+    template <size_t N>
+    static inline void copy(char (&field)[N], const std::string &value) {
+        size_t length = value.size() < N - 1 ? value.size() : N - 1;
+        memcpy(field, value.data(), length);
+        field[length] = '\0';
+    }
+    void stamp(const char *level, const std::string &message);
+
+    AccessRecord record;
+    std::string hostname {"-"};
+    std::string instanceID {"-"};
 };
 
 /**
@@ -103,101 +114,305 @@ struct ServiceLog {
     std::string message;
 };
 
+/** The attributes of a chunk, in the order of kAttributes */
+enum class Attr : unsigned int {
+    ContentContainer, ContentId, ContentPath, ContentVersion,
+    ContentStoragePolicy, ContentChunkMethod, MetachunkSize, MetachunkHash,
+    ChunkId, ChunkHash, ChunkPosition, ChunkSize
+};
+
+constexpr unsigned int kAttrs = 12;
+
+/** The names of an attribute, the prefixed ones spelled out once for all */
+struct AttrNames {
+    /** In the extended attributes, after the prefix */
+    const char *xattr;
+    /** In the headers, after the prefix */
+    const char *http;
+    /** The full header name */
+    const char *header;
+    /** The full extended attribute name */
+    const char *key;
+};
+
+constexpr char kHeaderPrefix[] = "X-oio-chunk-meta-";
+constexpr char kXAttrPrefix[] = "user.grid.";
+
+constexpr AttrNames kAttributes[kAttrs] = {
+    {"content.container", "container-id",
+     "X-oio-chunk-meta-container-id", "user.grid.content.container"},
+    {"content.id", "content-id",
+     "X-oio-chunk-meta-content-id", "user.grid.content.id"},
+    {"content.path", "content-path",
+     "X-oio-chunk-meta-content-path", "user.grid.content.path"},
+    {"content.version", "content-version",
+     "X-oio-chunk-meta-content-version", "user.grid.content.version"},
+    {"content.storage_policy", "content-storage-policy",
+     "X-oio-chunk-meta-content-storage-policy",
+     "user.grid.content.storage_policy"},
+    {"content.chunk_method", "content-chunk-method",
+     "X-oio-chunk-meta-content-chunk-method",
+     "user.grid.content.chunk_method"},
+    {"metachunk.size", "metachunk-size",
+     "X-oio-chunk-meta-metachunk-size", "user.grid.metachunk.size"},
+    {"metachunk.hash", "metachunk-hash",
+     "X-oio-chunk-meta-metachunk-hash", "user.grid.metachunk.hash"},
+    {"chunk.id", "chunk-id",
+     "X-oio-chunk-meta-chunk-id", "user.grid.chunk.id"},
+    {"chunk.hash", "chunk-hash",
+     "X-oio-chunk-meta-chunk-hash", "user.grid.chunk.hash"},
+    {"chunk.position", "chunk-pos",
+     "X-oio-chunk-meta-chunk-pos", "user.grid.chunk.position"},
+    {"chunk.size", "chunk-size",
+     "X-oio-chunk-meta-chunk-size", "user.grid.chunk.size"},
+};
+
+constexpr const AttrNames &NamesOf(Attr attr) {
+    return kAttributes[static_cast<unsigned int>(attr)];
+}
+
 /**
  * This class permit to retrieve Extended Attribute and convert them to
  * OIO HTTP Headers format and vice versa
  */
-struct XAttrTuple{
-    std::string xattrName;
-    std::string httpName;
-    std::string value;
-};
-
 class XAttr {
  public:
     XAttr() {}
     bool retrieveXAttr(int fd);
+    /**
+     * Read the attributes of a chunk by its path, without opening it.
+     * @return false if the chunk doesn't exist
+     */
+    bool retrieveXAttr(const std::string &path);
     bool writeXAttr(int fd);
     bool addHTTP(std::string name, std::string value);
     bool addXAttr(std::string name, std::string value);
     std::string getHTTP(std::string name);
     std::string getXAttr(std::string name);
-    inline std::string HttpPrefix() {return httpPrefix;}
-    inline std::string XAttrPrefix() {return xattrPrefix;}
+    inline const std::string &Get(Attr attr) const {
+        return values[static_cast<unsigned int>(attr)];
+    }
+    inline void Set(Attr attr, const std::string &value) {
+        values[static_cast<unsigned int>(attr)] = value;
+    }
+    /** Empty the values, keeping their buffers */
+    inline void Clear() {
+        for (auto &value : values)
+            value.clear();
+    }
+    /**
+     * Keep the value of a request header naming an attribute, whatever the
+     * case of its name (HTTP/2 lowers them).
+     * @return false for the other headers
+     */
+    bool SetHeader(const std::string &name, const std::string &value);
+    inline std::string HttpPrefix() {return kHeaderPrefix;}
+    inline std::string XAttrPrefix() {return kXAttrPrefix;}
     std::vector<std::pair<std::string, std::string>> XAttrNamesValues();
     std::vector<std::pair<std::string, std::string>> HTTPNamesValues();
 
  private:
-    std::vector<XAttrTuple> attributes {
-        {"content.container", "container-id", ""},
-        {"content.id", "content-id", ""},
-        {"content.path", "content-path", ""},
-        {"content.version", "content-version", ""},
-        {"content.storage_policy", "content-storage-policy", ""},
-        {"content.chunk_method", "content-chunk-method", ""},
-        {"metachunk.size", "metachunk-size", ""},
-        {"metachunk.hash", "metachunk-hash", ""},
-        {"chunk.id", "chunk-id", ""},
-        {"chunk.hash", "chunk-hash", ""},
-        {"chunk.position", "chunk-pos", ""},
-        {"chunk.size", "chunk-size", ""}
-    };
-    std::string httpPrefix {"X-oio-chunk-meta-"};
-    std::string xattrPrefix {"user.grid."};
-    size_t sizeBuffer;
+    std::array<std::string, kAttrs> values;
+    size_t sizeBuffer {4096};
+};
+
+/** Empty a spare XAttr (see Spares) */
+inline void Reset(XAttr *xattr) noexcept {
+    xattr->Clear();
+}
+
+/**
+ * Strong entity tag of a chunk: its chunk.hash, quoted.
+ * @return an empty string for a chunk without hash
+ */
+std::string ChunkETag(const std::string &hash);
+
+/** The same, written in place: the buffer of etag is reused */
+void ChunkETag(const std::string &hash, std::string *etag);
+
+/** Outcome of the conditional headers of a GET */
+enum class Precondition {
+    Proceed, NotModified, Failed
+};
+
+/**
+ * Evaluate If-Match then If-None-Match (RFC 7232, section 6) for an
+ * existing chunk, an absent header being empty. If-Match compares the
+ * tags strongly, If-None-Match weakly.
+ * @param etag the tag the reply would carry, weak for a chunk sent as stored
+ */
+Precondition EvaluatePreconditions(const std::string &etag,
+                                   const std::string &ifMatch,
+                                   const std::string &ifNoneMatch);
+
+/**
+ * @return true if the Range of a request applies: without If-Range, or
+ * with an If-Range naming the entity tag. A date never matches since no
+ * Last-Modified is sent.
+ */
+bool RangeApplies(const std::string &etag, const std::string &ifRange);
+
+/**
+ * @return true if an Accept-Encoding value names the content-coding with a
+ * non-zero quality. "*" doesn't match: the coding must be asked for.
+ */
+bool AcceptsCoding(const std::string &accept, const std::string &coding);
+
+/**
+ * @return a small index identifying the calling thread among the live
+ * ones, reused after the thread exits. Used to pick per-thread shards.
+ */
+unsigned int ThreadSlot();
+
+/**
+ * Index of each counter kept by the RequestCounter
+ */
+enum class Stat : unsigned int {
+    PutTime, GetTime, DelTime, StatTime, InfoTime, RawTime, OtherTime,
+    PutHits, GetHits, DelHits, StatHits, InfoHits, RawHits,
+    R2xxHits, R4xxHits, R5xxHits, OtherHits, R403Hits, R404Hits,
+    Bread, Bwritten, Paused, Coalesced, Bshared, Pooled,
+    Bcompressed, Bstored, CompressTime, DecompressTime,
+    Count
+};
+
+constexpr unsigned int kStats = static_cast<unsigned int>(Stat::Count);
+
+/**
+ * Aggregated values of a RequestCounter at a given time
+ */
+struct RequestStats {
+    std::array<uint64_t, kStats> values {};
+    inline uint64_t operator[](Stat stat) const {
+        return values[static_cast<unsigned int>(stat)];
+    }
 };
 
+/**
+ * Counters of the requests, updated by each request thread in its own
+ * cache-line aligned shard: an increment is a plain load and store, no
+ * lock and no atomic read-modify-write. The shards are only summed when
+ * the stats are read.
+ * Threads beyond kMaxShards share an overflow shard updated atomically.
+ */
 class RequestCounter {
  public:
-    void incPutTime(unsigned int time);
-    void incGetTime(unsigned int time);
-    void incDelTime(unsigned int time);
-    void incStatTime(unsigned int time);
-    void incinfoTime(unsigned int time);
-    void incRawTime(unsigned int time);
-    void incOtherTime(unsigned int time);
-    void incPutHits();
-    void incGetHits();
-    void incDelHits();
-    void incStatHits();
-    void incInfoHits();
-    void incRawHits();
-    void incR2xxHits();
-    void incR4xxHits();
-    void incR5xxHits();
-    void incOtherHits();
-    void incR403Hits();
-    void incR404Hits();
-    void incBread(unsigned count);
-    void incBwritten(unsigned count);
+    static constexpr unsigned int kMaxShards = 256;
+
+    RequestCounter();
+    ~RequestCounter();
+    RequestCounter(const RequestCounter&) = delete;
+    RequestCounter& operator=(const RequestCounter&) = delete;
+
+    inline void incPutTime(uint64_t time) { add(Stat::PutTime, time); }
+    inline void incGetTime(uint64_t time) { add(Stat::GetTime, time); }
+    inline void incDelTime(uint64_t time) { add(Stat::DelTime, time); }
+    inline void incStatTime(uint64_t time) { add(Stat::StatTime, time); }
+    inline void incinfoTime(uint64_t time) { add(Stat::InfoTime, time); }
+    inline void incRawTime(uint64_t time) { add(Stat::RawTime, time); }
+    inline void incOtherTime(uint64_t time) { add(Stat::OtherTime, time); }
+    inline void incPutHits() { add(Stat::PutHits, 1); }
+    inline void incGetHits() { add(Stat::GetHits, 1); }
+    inline void incDelHits() { add(Stat::DelHits, 1); }
+    inline void incStatHits() { add(Stat::StatHits, 1); }
+    inline void incInfoHits() { add(Stat::InfoHits, 1); }
+    inline void incRawHits() { add(Stat::RawHits, 1); }
+    inline void incR2xxHits() { add(Stat::R2xxHits, 1); }
+    inline void incR4xxHits() { add(Stat::R4xxHits, 1); }
+    inline void incR5xxHits() { add(Stat::R5xxHits, 1); }
+    inline void incOtherHits() { add(Stat::OtherHits, 1); }
+    inline void incR403Hits() { add(Stat::R403Hits, 1); }
+    inline void incR404Hits() { add(Stat::R404Hits, 1); }
+    inline void incBread(uint64_t count) { add(Stat::Bread, count); }
+    inline void incBwritten(uint64_t count) { add(Stat::Bwritten, count); }
+    inline void incPaused() { add(Stat::Paused, 1); }
+    /** A GET joined the reads of a concurrent one */
+    inline void incCoalesced() { add(Stat::Coalesced, 1); }
+    /** Bytes sent by a GET that a concurrent one read */
+    inline void incBshared(uint64_t count) { add(Stat::Bshared, count); }
+    /** A handler was made in the memory of a former one */
+    inline void incPooled() { add(Stat::Pooled, 1); }
+    /** Plain bytes of a compressed chunk, and the bytes stored for them */
+    inline void incCompressed(uint64_t plain, uint64_t stored) {
+        add(Stat::Bcompressed, plain);
+        add(Stat::Bstored, stored);
+    }
+    /** CPU time spent in the codecs, in microseconds */
+    inline void incCompressTime(uint64_t time) {
+        add(Stat::CompressTime, time);
+    }
+    inline void incDecompressTime(uint64_t time) {
+        add(Stat::DecompressTime, time);
+    }
+
+    /** Requests being served, waited for when draining */
+    inline void incInflight() {
+        inflight.fetch_add(1, std::memory_order_relaxed);
+    }
+    inline void decInflight() {
+        inflight.fetch_sub(1, std::memory_order_relaxed);
+    }
+    inline int64_t Inflight() const {
+        return inflight.load(std::memory_order_relaxed);
+    }
+
+    /** Bytes of the uploads received and not written yet */
+    inline void incBuffered(int64_t bytes) {
+        buffered.fetch_add(bytes, std::memory_order_relaxed);
+    }
+    inline void decBuffered(int64_t bytes) {
+        buffered.fetch_sub(bytes, std::memory_order_relaxed);
+    }
+    inline int64_t Buffered() const {
+        return buffered.load(std::memory_order_relaxed);
+    }
+
+    /** Sum all the shards */
+    RequestStats Snapshot() const;
+
+    /** Latency histograms per method and status class */
+    inline LatencyStats &Latency() { return latency; }
+    inline const LatencyStats &Latency() const { return latency; }
+
+    /** Per-phase histograms and settings of the request tracing */
+    inline PhaseStats &Phases() { return phases; }
+    inline const PhaseStats &Phases() const { return phases; }
+
+    /** I/O per NUMA node of the volumes, to check the steering */
+    inline NodeTraffic &Nodes() { return nodes; }
+    inline const NodeTraffic &Nodes() const { return nodes; }
+
+    /** @return the name of the counter, as exposed in the stats */
+    static const char *Name(Stat stat);
 
  private:
-    //
-    unsigned int putTime;
-    unsigned int getTime;
-    unsigned int delTime;
-    unsigned int statTime;
-    unsigned int infoTime;
-    unsigned int rawTime;
-    unsigned int otherTime;
-    //
-    unsigned int putHits;
-    unsigned int getHits;
-    unsigned int delHits;
-    unsigned int statHits;
-    unsigned int infoHits;
-    unsigned int rawHits;
-    unsigned int r2xxHits;
-    unsigned int r4xxHits;
-    unsigned int r5xxHits;
-    unsigned int otherHits;
-    unsigned int r403Hits;
-    unsigned int r404Hits;
-    //
-    unsigned int bread;
-    unsigned int bwritten;
-    //
-    std::mutex rcMutex;
+    /** Padded to a multiple of the cache line, allocated aligned on it */
+    struct Shard {
+        std::atomic<uint64_t> values[kStats];
+        char padding[64 - (kStats * sizeof(uint64_t)) % 64];
+    };
+
+    inline void add(Stat stat, uint64_t count) {
+        unsigned int slot = ThreadSlot();
+        auto index = static_cast<unsigned int>(stat);
+        if (slot < kMaxShards) {
+            auto &value = shards[slot].values[index];
+            // Single writer: no need for an atomic increment
+            value.store(value.load(std::memory_order_relaxed) + count,
+                        std::memory_order_relaxed);
+        } else {
+            overflow.values[index].fetch_add(count,
+                                             std::memory_order_relaxed);
+        }
+    }
+
+    Shard *shards {nullptr};
+    Shard overflow;
+    std::atomic<int64_t> inflight {0};
+    std::atomic<int64_t> buffered {0};
+    LatencyStats latency;
+    PhaseStats phases;
+    NodeTraffic nodes;
 };
 
 }  // namespace utils
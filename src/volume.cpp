@@ -0,0 +1,181 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <unistd.h>
+#include <cctype>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "stats.hpp"
+#include "volume.hpp"
+
+using blob::Volume;
+using blob::Volumes;
+
+bool blob::ValidChunkId(const std::string &id) {
+    if (id.size() < 3)
+        return false;
+    for (char c : id) {
+        if (!isxdigit(static_cast<unsigned char>(c)))
+            return false;
+    }
+    return true;
+}
+
+std::string blob::ChunkPathIn(const std::string &volume,
+                              const std::string &id) {
+    std::string path;
+    ChunkPathIn(volume, id, &path);
+    return path;
+}
+
+void blob::ChunkPathIn(const std::string &volume, const std::string &id,
+                       std::string *path) {
+    path->clear();
+    path->reserve(volume.size() + id.size() + 5);
+    path->append(volume).append(1, '/');
+    path->append(id, 0, 3).append(1, '/').append(id);
+}
+
+bool blob::ParseVolumeList(
+        const std::string &value,
+        std::vector<std::pair<std::string, std::string>> *out) {
+    std::stringstream ss(value);
+    std::string item;
+    out->clear();
+    while (std::getline(ss, item, ',')) {
+        std::string id, path;
+        auto eq = item.find('=');
+        if (eq != std::string::npos) {
+            id = item.substr(0, eq);
+            path = item.substr(eq + 1);
+        } else {
+            path = item;
+            std::string trimmed = path.substr(0,
+                                              path.find_last_not_of('/') + 1);
+            id = trimmed.substr(trimmed.rfind('/') + 1);
+        }
+        if (id.empty() || path.empty())
+            return false;
+        out->emplace_back(id, path);
+    }
+    return !out->empty();
+}
+
+bool Volumes::Add(std::shared_ptr<Volume> volume) {
+    if (Find(volume->id))
+        return false;
+    volumes.push_back(volume);
+    return true;
+}
+
+std::shared_ptr<Volume> Volumes::Find(const std::string &id) const {
+    for (auto &volume : volumes) {
+        if (volume->id == id)
+            return volume;
+    }
+    return nullptr;
+}
+
+std::shared_ptr<Volume> Volumes::Route(const std::string &url,
+                                       std::string *chunkId) const {
+    size_t start = (!url.empty() && url[0] == '/') ? 1 : 0;
+    auto slash = url.find('/', start);
+    if (slash == std::string::npos) {
+        *chunkId = url.substr(start);
+        return nullptr;
+    }
+    auto volume = Find(url.substr(start, slash - start));
+    *chunkId = volume ? url.substr(slash + 1) : "";
+    return volume;
+}
+
+std::shared_ptr<Volume> Volumes::Locate(const std::string &chunkId) const {
+    if (volumes.size() == 1)
+        return volumes.front();
+    for (auto &volume : volumes) {
+        if (access(ChunkPathIn(volume->path, chunkId).c_str(), F_OK) == 0)
+            return volume;
+    }
+    return nullptr;
+}
+
+static int64_t nowMillis() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+std::shared_ptr<Volume> Volumes::Place(uint64_t size) {
+    uint64_t total = 0;
+    for (auto &volume : volumes) {
+        uint64_t avail = volume->availBytes;
+        if (avail > size)
+            total += avail;
+    }
+    if (total == 0)
+        return nullptr;
+
+    thread_local std::minstd_rand random(std::random_device{}());
+    auto draw = [this, size, total]() {
+        uint64_t x = std::uniform_int_distribution<uint64_t>(
+            0, total - 1)(random);
+        for (auto &volume : volumes) {
+            uint64_t avail = volume->availBytes;
+            if (avail <= size)
+                continue;
+            if (x < avail)
+                return volume;
+            x -= avail;
+        }
+        // The space changed meanwhile
+        return volumes.back();
+    };
+    auto first = draw();
+    auto second = draw();
+    return second->inflight < first->inflight ? second : first;
+}
+
+void Volumes::Refresh() {
+    for (auto &volume : volumes) {
+        utils::VolumeUsage usage;
+        bool stated = utils::VolumeUsageOf(volume->path, &usage);
+        if (!stated)
+            usage = utils::VolumeUsage();
+        volume->totalBytes = usage.totalBytes;
+        volume->freeBytes = usage.freeBytes;
+        volume->availBytes = usage.availBytes;
+        volume->totalInodes = usage.totalInodes;
+        volume->freeInodes = usage.freeInodes;
+        volume->stated = stated;
+    }
+    refreshed = nowMillis();
+}
+
+bool Volumes::Stale() const {
+    return nowMillis() - refreshed.load() >= refresh.count();
+}
+
+void Volumes::RefreshIfStale() {
+    int64_t now = nowMillis();
+    int64_t last = refreshed.load();
+    // A single thread refreshes, the others go on with the previous values
+    if (now - last >= refresh.count()
+            && refreshed.compare_exchange_strong(last, now))
+        Refresh();
+}
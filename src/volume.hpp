@@ -0,0 +1,149 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#ifndef SRC_VOLUME_HPP_
+#define SRC_VOLUME_HPP_
+
+#include <atomic>
+#include <chrono> // NOLINT
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace blob {
+
+class Scrubber;
+
+/** @return true if the id is made of at least 3 hexadecimal characters */
+bool ValidChunkId(const std::string &id);
+
+/**
+ * Path of a chunk in a volume, with a fan-out on the first 3 characters of
+ * the id.
+ */
+std::string ChunkPathIn(const std::string &volume, const std::string &id);
+
+/** The same, written in place: the buffer of path is reused */
+void ChunkPathIn(const std::string &volume, const std::string &id,
+                 std::string *path);
+
+/**
+ * Parse a list of volumes, "<path>" or "<id>=<path>" separated by commas.
+ * Without explicit id, a volume is named after the last component of its
+ * path.
+ * @return false if an entry is empty
+ */
+bool ParseVolumeList(const std::string &value,
+                     std::vector<std::pair<std::string, std::string>> *out);
+
+/**
+ * A directory of chunks, on one disk.
+ */
+struct Volume {
+    /** Service id, also the prefix of the URLs routed to the volume */
+    std::string id;
+    std::string path {"."};
+    /** NUMA node of the controller of the disk, -1 if unknown */
+    int node {-1};
+
+    /** Activity, updated by the handlers */
+    std::atomic<int64_t> inflight {0};
+    /** Upload bytes received and not written yet */
+    std::atomic<int64_t> buffered {0};
+    std::atomic<uint64_t> requests {0};
+    std::atomic<uint64_t> bytesRead {0};
+    std::atomic<uint64_t> bytesWritten {0};
+
+    /** Space, refreshed by Volumes::Refresh(), all 0 if the statvfs failed */
+    std::atomic<bool> stated {false};
+    std::atomic<uint64_t> totalBytes {0};
+    std::atomic<uint64_t> freeBytes {0};
+    std::atomic<uint64_t> availBytes {0};
+    std::atomic<uint64_t> totalInodes {0};
+    std::atomic<uint64_t> freeInodes {0};
+
+    /** Checks the chunks of the volume in the background, null if none */
+    std::shared_ptr<Scrubber> scrubber;
+};
+
+/**
+ * The volumes served by the process, fixed once the server started: the
+ * lookups take no lock.
+ */
+class Volumes {
+ public:
+    /**
+     * @param refresh interval between two statvfs() of the volumes done by
+     * RefreshIfStale()
+     */
+    explicit Volumes(std::chrono::milliseconds refresh
+                     = std::chrono::seconds(1))
+            : refresh{refresh} {}
+
+    /** @return false if the id is already used */
+    bool Add(std::shared_ptr<Volume> volume);
+    inline const std::vector<std::shared_ptr<Volume>> &All() const {
+        return volumes;
+    }
+    /** @return the volume with this id, or null */
+    std::shared_ptr<Volume> Find(const std::string &id) const;
+
+    /**
+     * Split a URL, "/<volume-id>/<chunk-id>" or "/<chunk-id>".
+     * @return the volume named by the URL, null when the URL has no prefix
+     * or an unknown one (the chunk id is then empty)
+     */
+    std::shared_ptr<Volume> Route(const std::string &url,
+                                  std::string *chunkId) const;
+
+    /**
+     * Search the chunk in every volume, without any stat when there is
+     * only one.
+     * @return the volume holding the chunk, or null
+     */
+    std::shared_ptr<Volume> Locate(const std::string &chunkId) const;
+
+    /**
+     * Choose the volume of a new chunk. Two volumes are drawn with a
+     * probability proportional to their available space, the least busy
+     * one wins: the free space is evened out over time while a burst of
+     * uploads spreads over the disks. Only the space known from the last
+     * refresh is read: no system call.
+     * @param size expected size of the chunk, 0 if unknown
+     * @return null if no volume has room for the chunk
+     */
+    std::shared_ptr<Volume> Place(uint64_t size);
+
+    /** statvfs() each volume */
+    void Refresh();
+    /** @return true once the space is older than the refresh interval */
+    bool Stale() const;
+    /** Refresh() if Stale(), from a single thread at once */
+    void RefreshIfStale();
+
+ private:
+    std::vector<std::shared_ptr<Volume>> volumes;
+    const std::chrono::milliseconds refresh;
+    std::atomic<int64_t> refreshed {0};
+};
+
+}  // namespace blob
+
+#endif  // SRC_VOLUME_HPP_
@@ -0,0 +1,226 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <ftw.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <folly/SocketAddress.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <proxygen/httpserver/HTTPServer.h>
+#include <proxygen/httpserver/RequestHandlerFactory.h>
+#include <fstream>
+#include <future> // NOLINT
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread> // NOLINT
+#include <vector>
+#include "rawx.hpp"
+#include "loadgen.hpp"
+#include "perf.hpp"
+
+DEFINE_string(baseline, "baseline.txt", "Reference results of the workloads");
+DEFINE_bool(update, false, "Rewrite the baseline with the measured values");
+DEFINE_string(volume, "", "Directory of the chunks (default: a temporary "
+              "directory, the filesystem must support user xattrs)");
+DEFINE_string(only, "", "Run only this workload");
+DEFINE_int32(duration, 10, "Duration of each workload in seconds");
+DEFINE_int32(threads, 4, "Threads of the server");
+
+using loadgen::Op;
+using loadgen::Workload;
+using proxygen::HTTPServer;
+using proxygen::HTTPServerOptions;
+using proxygen::RequestHandlerChain;
+
+namespace {
+
+struct PerfWorkload {
+    std::string name;
+    /** The operation whose metrics are compared */
+    Op op;
+    Workload workload;
+};
+
+std::vector<PerfWorkload> workloads(uint16_t port) {
+    std::vector<PerfWorkload> all;
+    Workload w;
+    w.port = port;
+    w.duration = std::chrono::seconds(FLAGS_duration);
+    w.seed = 42;
+
+    // Many small chunks: the cost of the request and of the metadata
+    Workload put = w;
+    put.concurrency = 32;
+    put.mix.Parse("put=1");
+    put.sizes.Parse("4K-64K");
+    all.push_back({"put-storm", Op::Put, put});
+
+    // A few large chunks read from start to end: the bandwidth
+    Workload get = w;
+    get.concurrency = 4;
+    get.prefill = 32;
+    get.mix.Parse("get=1");
+    get.sizes.Parse("8M");
+    all.push_back({"large-get", Op::Get, get});
+
+    // Random 64K ranges in 1M chunks: the cost of the seeks
+    Workload range = w;
+    range.concurrency = 16;
+    range.prefill = 256;
+    range.mix.Parse("get=1,range=4");
+    range.sizes.Parse("1M");
+    range.rangeSize = 64 * 1024;
+    all.push_back({"mixed-range", Op::Range, range});
+
+    // Deletions only: stop before the pool runs dry
+    Workload del = w;
+    del.concurrency = 16;
+    del.prefill = 20000;
+    del.requests = del.prefill;
+    del.duration = std::chrono::seconds(FLAGS_duration * 6);
+    del.mix.Parse("delete=1");
+    del.sizes.Parse("4K");
+    all.push_back({"delete-storm", Op::Delete, del});
+    return all;
+}
+
+int removeEntry(const char *path, const struct stat *, int, struct FTW *) {
+    return remove(path);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    google::InitGoogleLogging(argv[0]);
+
+    std::vector<loadgen::Expectation> baseline;
+    {
+        std::ifstream in(FLAGS_baseline);
+        std::string error;
+        if (!in || !loadgen::ParseBaseline(in, &baseline, &error)) {
+            std::cerr << "Invalid baseline " << FLAGS_baseline
+                      << (error.empty() ? "" : ": " + error) << std::endl;
+            return 2;
+        }
+    }
+
+    std::string volume = FLAGS_volume;
+    bool temporary = volume.empty();
+    if (temporary) {
+        const char *tmp = getenv("TMPDIR");
+        std::string pattern = std::string(tmp ? tmp : "/var/tmp")
+                + "/rawx-perf-XXXXXX";
+        if (mkdtemp(&pattern[0]) == nullptr) {
+            std::cerr << "Cannot create the volume " << pattern << std::endl;
+            return 2;
+        }
+        volume = pattern;
+    }
+
+    auto factory = std::unique_ptr<rawx::RawxHandlerFactory>(
+        new rawx::RawxHandlerFactory());
+    factory->Volume(volume);
+    HTTPServerOptions options;
+    options.threads = static_cast<size_t>(FLAGS_threads);
+    options.idleTimeout = std::chrono::milliseconds(60000);
+    options.enableContentCompression = false;
+    options.handlerFactories = RequestHandlerChain()
+            .addThen(std::move(factory))
+            .build();
+    HTTPServer server(std::move(options));
+    server.bind({{folly::SocketAddress("127.0.0.1", 0, true),
+                  HTTPServer::Protocol::HTTP}});
+    std::promise<void> started;
+    std::thread serving([&]() {
+        server.start([&]() { started.set_value(); });
+    });
+    started.get_future().wait();
+    uint16_t port = server.addresses()[0].address.getPort();
+
+    std::map<std::string, double> measured;
+    unsigned int failed = 0;
+    for (auto &perf : workloads(port)) {
+        if (!FLAGS_only.empty() && perf.name != FLAGS_only)
+            continue;
+        std::cout << "== " << perf.name << std::endl;
+        auto report = loadgen::Run(perf.workload);
+        report.Print(std::cout);
+        for (auto &op : report.ops) {
+            if (op.errors > 0) {
+                std::cout << perf.name << ": " << op.errors
+                          << " requests failed" << std::endl;
+                failed++;
+            }
+        }
+        for (auto metric : {"rps", "mibps", "p99_ms"})
+            measured[perf.name + " " + metric] =
+                    loadgen::Metric(report, perf.op, metric);
+    }
+
+    server.stop();
+    serving.join();
+    std::string machine = loadgen::MachineSpec(volume);
+    if (temporary)
+        nftw(volume.c_str(), removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+
+    if (FLAGS_update) {
+        if (failed > 0) {
+            std::cout << "Baseline not updated: " << failed
+                      << " workload(s) with errors" << std::endl;
+            return 1;
+        }
+        for (auto &e : baseline) {
+            auto it = measured.find(e.workload + " " + e.metric);
+            if (it != measured.end())
+                e.value = it->second;
+        }
+        std::ofstream out(FLAGS_baseline);
+        loadgen::PrintBaseline(out, baseline, {
+            "Reference results of perf-rawx, regenerate on the reference "
+            "machine with:",
+            "  perf-rawx --baseline tests/perf/baseline.txt --update",
+            "Measured with " + std::to_string(FLAGS_threads)
+                + " server threads, " + std::to_string(FLAGS_duration)
+                + " s per workload, on:",
+            machine});
+        std::cout << "Baseline " << FLAGS_baseline << " updated" << std::endl;
+        return 0;
+    }
+
+    std::cout << std::endl;
+    auto verdicts = loadgen::Compare(baseline, measured);
+    auto regressions = loadgen::PrintVerdicts(std::cout, verdicts);
+    unsigned int unmeasured = 0;
+    for (auto &v : verdicts) {
+        if (v.unmeasured)
+            unmeasured++;
+    }
+    if (regressions > 0 || failed > 0 || unmeasured > 0) {
+        std::cout << std::endl << regressions
+                  << " metric(s) regressed beyond the tolerance, " << failed
+                  << " workload(s) with errors, " << unmeasured
+                  << " metric(s) never measured (run with --update on the "
+                  << "reference machine)" << std::endl;
+        return 1;
+    }
+    return 0;
+}
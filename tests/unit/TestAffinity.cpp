@@ -0,0 +1,97 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <gtest/gtest.h>
+#include <sched.h>
+#include <thread> // NOLINT
+#include <vector>
+#include "affinity.hpp"
+
+TEST(Affinity, ParseCpuList) {
+    std::vector<int> cpus;
+    ASSERT_TRUE(utils::ParseCpuList("0-3,8,10-11", &cpus));
+    ASSERT_EQ((std::vector<int>{0, 1, 2, 3, 8, 10, 11}), cpus);
+    ASSERT_TRUE(utils::ParseCpuList("5", &cpus));
+    ASSERT_EQ(std::vector<int>{5}, cpus);
+    ASSERT_FALSE(utils::ParseCpuList("", &cpus));
+    ASSERT_FALSE(utils::ParseCpuList("3-1", &cpus));
+    ASSERT_FALSE(utils::ParseCpuList("a", &cpus));
+    ASSERT_FALSE(utils::ParseCpuList("1-", &cpus));
+    ASSERT_FALSE(utils::ParseCpuList("-1", &cpus));
+    ASSERT_EQ(std::vector<int>{5}, cpus);
+}
+
+TEST(Affinity, PinThread) {
+    cpu_set_t allowed;
+    ASSERT_EQ(0, sched_getaffinity(0, sizeof(allowed), &allowed));
+    int cpu = 0;
+    while (!CPU_ISSET(cpu, &allowed))
+        cpu++;
+    std::thread([cpu]() {
+        ASSERT_TRUE(utils::PinThread(cpu));
+        ASSERT_EQ(cpu, sched_getcpu());
+    }).join();
+    ASSERT_FALSE(utils::PinThread(-1));
+}
+
+TEST(Affinity, PinThreadSet) {
+    cpu_set_t allowed;
+    ASSERT_EQ(0, sched_getaffinity(0, sizeof(allowed), &allowed));
+    std::vector<int> cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed))
+            cpus.push_back(cpu);
+    }
+    std::thread([cpus]() {
+        ASSERT_TRUE(utils::PinThread(cpus));
+        cpu_set_t set;
+        ASSERT_EQ(0, sched_getaffinity(0, sizeof(set), &set));
+        ASSERT_EQ(static_cast<int>(cpus.size()), CPU_COUNT(&set));
+    }).join();
+    ASSERT_FALSE(utils::PinThread(std::vector<int>{}));
+}
+
+TEST(Affinity, Nodes) {
+    ASSERT_GE(utils::NodeCount(), 1);
+    ASSERT_GE(utils::CpuNode(0), -1);
+    ASSERT_GE(utils::CurrentNode(), 0);
+    ASSERT_LT(utils::CurrentNode(), utils::NodeCount());
+    ASSERT_GE(utils::VolumeNode("."), -1);
+    ASSERT_EQ(-1, utils::VolumeNode("/nonexistent/volume"));
+    ASSERT_FALSE(utils::PreferNode(-1));
+}
+
+TEST(Affinity, NodeTraffic) {
+    utils::NodeTraffic traffic;
+    traffic.Record(0, 0, 10);
+    traffic.Record(0, 1, 20);
+    traffic.Record(0, -1, 30);
+    traffic.Record(-1, 0, 1000);
+    traffic.Record(utils::NodeTraffic::kMaxNodes, 0, 1000);
+    auto counts = traffic.Get(0);
+    ASSERT_EQ(1u, counts.local);
+    ASSERT_EQ(2u, counts.remote);
+    ASSERT_EQ(60u, counts.bytes);
+    ASSERT_EQ(0u, traffic.Get(1).bytes);
+    ASSERT_EQ(0u, traffic.Get(utils::NodeTraffic::kMaxNodes).bytes);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -18,14 +18,29 @@
 
 #include <gtest/gtest.h>
 #include <gflags/gflags.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
 #include "blob.hpp"
 #include "utils.hpp"
 
 using blob::Status;
 using blob::Cause;
+using blob::CachePolicy;
+using blob::FileSlice;
 using blob::DiskUpload;
 using blob::DiskDownload;
 using blob::DiskRemoval;
+using blob::Mapping;
+using blob::Codec;
+using blob::FrameOptions;
 using utils::XAttr;
 
 class DiskUploadFixture : public testing::Test {
@@ -72,12 +87,31 @@ class DiskRemovalFixture : public testing::Test {
     XAttr *xattr;
     DiskRemoval removal;
 };
+static std::string pattern(size_t size) {
+    std::string data(size, '\0');
+    for (size_t i = 0; i < size; i++)
+        data[i] = 'a' + i % 23;
+    return data;
+}
+
+TEST(CachePolicy, Drop) {
+    CachePolicy policy;
+    policy.dropAbove = 1000;
+    ASSERT_FALSE(policy.Drop(999));
+    ASSERT_TRUE(policy.Drop(1000));
+    policy.dropAbove = 0;
+    ASSERT_FALSE(policy.Drop(1 << 30));
+    policy.dropBehind = true;
+    ASSERT_TRUE(policy.Drop(0));
+}
+
 // TEST DISKUPLOAD
 
 TEST_F(DiskUploadFixture, GoodPathCreate) {
     std::string path {"./goodpath"};
     upload.Path(path);
     ASSERT_TRUE(upload.Prepare().Ok());
+    ASSERT_TRUE(upload.Commit().Ok());
 }
 
 TEST_F(DiskUploadFixture, BadPathError) {
@@ -92,12 +126,152 @@ TEST_F(DiskUploadFixture, EmptyPathError) {
     ASSERT_FALSE(upload.Prepare().Ok());
 }
 
+TEST_F(DiskUploadFixture, ExistingChunk) {
+    std::string path {"./existingchunk"};
+    int fd = open(path.c_str(), O_CREAT|O_WRONLY, 0644);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    upload.Path(path);
+    ASSERT_EQ(upload.Prepare().Why(), blob::Cause::Already);
+    unlink(path.c_str());
+}
+
+TEST_F(DiskUploadFixture, ConcurrentUploads) {
+    std::string path {"./racedchunk"};
+    unlink(path.c_str());
+    upload.Path(path);
+    ASSERT_TRUE(upload.Prepare().Ok());
+    XAttr attrs;
+    DiskUpload second;
+    second.XAttr(&attrs);
+    second.Path(path);
+    ASSERT_TRUE(second.Prepare().Ok());
+    ASSERT_TRUE(upload.Commit().Ok());
+    ASSERT_EQ(blob::Cause::Already, second.Commit().Why());
+    second.Abort();
+    // Too late for the body of a third one
+    DiskUpload third;
+    third.XAttr(&attrs);
+    third.Path(path);
+    ASSERT_EQ(blob::Cause::Already, third.Prepare().Why());
+    unlink(path.c_str());
+}
+
+TEST_F(DiskUploadFixture, AbortedLeavesNothing) {
+    std::string path {"./abortedchunk"};
+    unlink(path.c_str());
+    upload.Path(path);
+    ASSERT_TRUE(upload.Prepare().Ok());
+    std::string data {"partial"};
+    auto slice = std::make_shared<FileSlice>(
+        reinterpret_cast<uint8_t *>(&data[0]), data.size());
+    ASSERT_TRUE(upload.Write(slice).Ok());
+    upload.Abort();
+    struct stat sb;
+    ASSERT_NE(0, stat(path.c_str(), &sb));
+    // Neither the chunk nor its temporary file
+    DIR *dir = opendir(".");
+    ASSERT_TRUE(dir != nullptr);
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr)
+        ASSERT_EQ(nullptr, strstr(entry->d_name, "abortedchunk"));
+    closedir(dir);
+}
+
+TEST(SweepUploads, OtherProcesses) {
+    std::string volume {"./sweptvolume"};
+    mkdir(volume.c_str(), 0755);
+    mkdir((volume + "/ABC").c_str(), 0755);
+    mkdir((volume + "/.quarantine").c_str(), 0755);
+    std::vector<std::string> swept {"/ABC/.ABC01.1.0", "/.ABC02.1.7"};
+    std::vector<std::string> kept {
+        "/ABC/.ABC03." + std::to_string(getpid()) + ".0", "/ABC/ABC04",
+        "/ABC/.ABC05.1", "/.quarantine/.ABC06.1.0"};
+    for (auto &name : swept)
+        close(open((volume + name).c_str(), O_CREAT|O_WRONLY, 0644));
+    for (auto &name : kept)
+        close(open((volume + name).c_str(), O_CREAT|O_WRONLY, 0644));
+    ASSERT_EQ(2u, blob::SweepUploads(volume));
+    struct stat sb;
+    for (auto &name : swept)
+        ASSERT_NE(0, stat((volume + name).c_str(), &sb)) << name;
+    for (auto &name : kept)
+        ASSERT_EQ(0, stat((volume + name).c_str(), &sb)) << name;
+}
+
+TEST_F(DiskUploadFixture, AttributesAtCommit) {
+    std::string path {"./streamedchunk"};
+    unlink(path.c_str());
+    xattr->addHTTP("chunk-id", "0123");
+    upload.Path(path);
+    ASSERT_TRUE(upload.Prepare().Ok());
+    xattr->addHTTP("chunk-id", "4567");
+    xattr->addHTTP("chunk-size", "42");
+    ASSERT_TRUE(upload.Commit().Ok());
+    upload.Abort();
+    XAttr written;
+    ASSERT_TRUE(written.retrieveXAttr(path));
+    // Attributes are written once, the late ones are added
+    if (written.getXAttr("chunk.id") == "0123") {
+        ASSERT_EQ("42", written.getXAttr("chunk.size"));
+    }
+    unlink(path.c_str());
+}
+
 TEST_F(DiskUploadFixture, makeParentOnGoodPath) {
     std::string path {"./goodpathdir/good/path/good"};
     upload.Path(path);
     ASSERT_TRUE(upload.Prepare().Ok());
 }
 
+TEST_F(DiskUploadFixture, WritebackAndDrop) {
+    std::string path {"./cachedchunk"};
+    unlink(path.c_str());
+    CachePolicy policy;
+    policy.writeback = 4096;
+    policy.dropBehind = true;
+    upload.Path(path);
+    upload.Cache(policy);
+    ASSERT_TRUE(upload.Prepare().Ok());
+    std::string data = pattern(30000);
+    for (size_t offset = 0; offset < data.size(); offset += 3000) {
+        auto slice = std::make_shared<FileSlice>(
+            reinterpret_cast<uint8_t *>(&data[offset]), 3000);
+        ASSERT_TRUE(upload.Write(slice).Ok());
+    }
+    ASSERT_TRUE(upload.Commit().Ok());
+    upload.Abort();
+    std::ifstream in(path);
+    std::stringstream content;
+    content << in.rdbuf();
+    ASSERT_EQ(data, content.str());
+}
+
+TEST_F(DiskUploadFixture, Compressed) {
+    std::string path {"./compressedchunk"};
+    unlink(path.c_str());
+    xattr->Set(utils::Attr::ContentChunkMethod, "plain/compression=zstd");
+    FrameOptions options;
+    options.frameSize = 4096;
+    upload.Path(path);
+    upload.Compression(Codec::Zstd, options);
+    ASSERT_TRUE(upload.Prepare().Ok());
+    std::string data = pattern(30000);
+    for (size_t offset = 0; offset < data.size(); offset += 3000) {
+        auto slice = std::make_shared<FileSlice>(
+            reinterpret_cast<uint8_t *>(&data[offset]), 3000);
+        ASSERT_TRUE(upload.Write(slice).Ok());
+    }
+    ASSERT_TRUE(upload.Commit().Ok());
+    upload.Abort();
+    auto frames = upload.Frames();
+    ASSERT_TRUE(frames != nullptr);
+    ASSERT_EQ(30000u, frames->PlainBytes());
+    ASSERT_LT(frames->StoredBytes(), 30000u);
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    ASSERT_EQ(frames->StoredBytes(), static_cast<uint64_t>(in.tellg()));
+}
+
 // TEST DISKDOWNLOAD
 
 TEST_F(DiskDownloadFixture, GoodPathOpen) {
@@ -118,6 +292,115 @@ TEST_F(DiskDownloadFixture, EmptyPathError) {
     ASSERT_FALSE(download.Prepare().Ok());
 }
 
+TEST_F(DiskDownloadFixture, RandomRange) {
+    CachePolicy policy;
+    policy.randomBelow = 1 << 20;
+    policy.dropBehind = true;
+    download.Path("./cachedchunk");
+    download.Cache(policy);
+    ASSERT_TRUE(download.setRange(100, 5099));
+    ASSERT_TRUE(download.Prepare().Ok());
+    download.BufferSize(1000);
+    auto slice = std::make_shared<FileSlice>();
+    while (!download.isEof())
+        ASSERT_TRUE(download.Read(slice).Ok());
+    ASSERT_EQ(pattern(30000).substr(100, 5000),
+              std::string(reinterpret_cast<char *>(slice->data()),
+                          slice->size()));
+}
+
+TEST_F(DiskDownloadFixture, ReadAt) {
+    download.Path("./cachedchunk");
+    ASSERT_TRUE(download.setRange(100, 5099));
+    ASSERT_TRUE(download.Prepare().Ok());
+    ASSERT_EQ(100u, download.Start());
+    ASSERT_EQ(5100u, download.Stop());
+    std::string block(3000, '\0');
+    uint32_t got = 0;
+    uint8_t *data = reinterpret_cast<uint8_t *>(&block[0]);
+    ASSERT_TRUE(download.ReadAt(2100, data, 3000, &got).Ok());
+    ASSERT_EQ(3000u, got);
+    ASSERT_EQ(pattern(30000).substr(2100, 3000), block);
+    // Short at the end of the file
+    ASSERT_TRUE(download.ReadAt(29000, data, 3000, &got).Ok());
+    ASSERT_EQ(1000u, got);
+    ASSERT_TRUE(download.ReadAt(40000, data, 3000, &got).Ok());
+    ASSERT_EQ(0u, got);
+}
+
+TEST_F(DiskDownloadFixture, MapSmallChunk) {
+    CachePolicy policy;
+    policy.mapBelow = 1 << 20;
+    download.Path("./cachedchunk");
+    download.Cache(policy);
+    ASSERT_TRUE(download.Prepare().Ok());
+    auto mapping = download.Mapped();
+    ASSERT_TRUE(mapping != nullptr);
+    ASSERT_EQ(30000u, mapping->Size());
+    ASSERT_TRUE(mapping->Touch(0, 30000));
+    ASSERT_EQ(pattern(30000), std::string(
+        reinterpret_cast<char *>(mapping->Data()), mapping->Size()));
+
+    // Too large, or dropped from the cache
+    DiskDownload large;
+    XAttr attrs;
+    policy.mapBelow = 30000;
+    large.Path("./cachedchunk");
+    large.XAttr(&attrs);
+    large.Cache(policy);
+    ASSERT_TRUE(large.Prepare().Ok());
+    ASSERT_TRUE(large.Mapped() == nullptr);
+    large.Abort();
+}
+
+TEST_F(DiskDownloadFixture, Compressed) {
+    CachePolicy policy;
+    policy.mapBelow = 1 << 20;
+    download.Path("./compressedchunk");
+    download.Cache(policy);
+    ASSERT_TRUE(download.Prepare().Ok());
+    // Without extended attributes, the chunk is served as stored
+    if (xattr->Get(utils::Attr::ContentChunkMethod).empty())
+        return;
+    ASSERT_TRUE(download.Frames() != nullptr);
+    ASSERT_TRUE(download.Mapped() == nullptr);
+    ASSERT_EQ(30000u, download.Size());
+    std::string block(9000, '\0');
+    uint32_t got = 0;
+    uint8_t *data = reinterpret_cast<uint8_t *>(&block[0]);
+    ASSERT_TRUE(download.ReadAt(5000, data, 9000, &got).Ok());
+    ASSERT_EQ(9000u, got);
+    ASSERT_EQ(pattern(30000).substr(5000, 9000), block);
+    // As stored: a zstd stream
+    download.Stored();
+    ASSERT_LT(download.Size(), 30000u);
+    ASSERT_TRUE(download.ReadAt(0, data, 4, &got).Ok());
+    ASSERT_EQ(std::string("\x28\xb5\x2f\xfd"), block.substr(0, 4));
+}
+
+TEST(Mapping, Truncated) {
+    const char *path = "./truncatedchunk";
+    size_t page = sysconf(_SC_PAGESIZE);
+    std::string data = pattern(3 * page);
+    std::ofstream(path) << data;
+    int fd = open(path, O_RDONLY);
+    ASSERT_LE(0, fd);
+    auto mapping = Mapping::Map(fd, data.size());
+    ASSERT_TRUE(mapping != nullptr);
+    ASSERT_TRUE(mapping->Touch(0, data.size()));
+    ASSERT_FALSE(mapping->Truncated());
+
+    ASSERT_EQ(0, truncate(path, page));
+    // No SIGBUS: the lost pages read as zeros
+    ASSERT_FALSE(mapping->Touch(page, page));
+    ASSERT_TRUE(mapping->Truncated());
+    ASSERT_EQ(0, mapping->Data()[2 * page]);
+    ASSERT_EQ(data[10], mapping->Data()[10]);
+    mapping = nullptr;
+    close(fd);
+    unlink(path);
+}
+
 // TEST DISKREMOVAL
 
 TEST_F(DiskRemovalFixture, GoodPathExist) {
@@ -0,0 +1,175 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zstd.h>
+#include <string>
+#include <vector>
+#include "blob.hpp"
+#include "compress.hpp"
+
+using blob::Cause;
+using blob::Codec;
+using blob::FrameOptions;
+using blob::FrameReader;
+using blob::FrameWriter;
+
+/** Text that compresses well, yet differs from a frame to the next */
+static std::string logLines(size_t size) {
+    std::string data;
+    for (unsigned int i = 0; data.size() < size; i++)
+        data += "GET /chunk/" + std::to_string(i * 7919 % 10007)
+                + " 200 OK\n";
+    data.resize(size);
+    return data;
+}
+
+/** @return the data compressed in writes of `step` bytes */
+static std::vector<uint8_t> compress(Codec codec, const std::string &data,
+                                     uint32_t frameSize, size_t step) {
+    FrameOptions options;
+    options.frameSize = frameSize;
+    FrameWriter writer(codec, options);
+    std::vector<uint8_t> out;
+    auto bytes = reinterpret_cast<const uint8_t *>(data.data());
+    for (size_t offset = 0; offset < data.size(); offset += step) {
+        size_t length = std::min(step, data.size() - offset);
+        EXPECT_TRUE(writer.Write(bytes + offset, length, &out));
+    }
+    EXPECT_TRUE(writer.Finish(&out));
+    EXPECT_EQ(data.size(), writer.PlainBytes());
+    EXPECT_EQ(out.size(), writer.StoredBytes());
+    return out;
+}
+
+/** An open file holding the bytes, removed when closed */
+static int store(const std::vector<uint8_t> &bytes) {
+    char path[] = "./compressed-XXXXXX";
+    int fd = mkstemp(path);
+    unlink(path);
+    EXPECT_EQ(static_cast<ssize_t>(bytes.size()),
+              pwrite(fd, bytes.data(), bytes.size(), 0));
+    return fd;
+}
+
+static std::string readAt(FrameReader *reader, uint64_t offset,
+                          uint32_t length) {
+    std::string block(length, '\0');
+    uint32_t got = 0;
+    auto status = reader->ReadAt(offset, reinterpret_cast<uint8_t *>(
+        &block[0]), length, &got);
+    EXPECT_TRUE(status.Ok());
+    block.resize(got);
+    return block;
+}
+
+TEST(Codec, ChunkMethod) {
+    ASSERT_EQ(Codec::Zstd,
+              blob::ChunkCodec("plain/nb_copy=3,compression=zstd"));
+    ASSERT_EQ(Codec::Lz4, blob::ChunkCodec("plain/compression=LZ4"));
+    ASSERT_EQ(Codec::None, blob::ChunkCodec("plain/nb_copy=3"));
+    ASSERT_EQ(Codec::None, blob::ChunkCodec("ec/algo=isa_l_rs_vand,k=6,m=3"));
+    ASSERT_EQ(Codec::None, blob::ChunkCodec("plain/compression=snappy"));
+    ASSERT_EQ(Codec::None, blob::ChunkCodec("compression=zstd"));
+}
+
+TEST(Frames, RoundTrip) {
+    std::string data = logLines(100000);
+    for (auto codec : {Codec::Lz4, Codec::Zstd}) {
+        auto stored = compress(codec, data, 16384, 5000);
+        ASSERT_LT(stored.size() * 3, data.size());
+        int fd = store(stored);
+        FrameReader reader;
+        ASSERT_TRUE(reader.Open(fd, stored.size()).Ok());
+        ASSERT_EQ(codec, reader.Compression());
+        ASSERT_EQ(data.size(), reader.PlainSize());
+        ASSERT_EQ(7u, reader.Frames());
+        ASSERT_EQ(data, readAt(&reader, 0, data.size()));
+        close(fd);
+    }
+}
+
+TEST(Frames, Ranges) {
+    std::string data = logLines(100000);
+    auto stored = compress(Codec::Zstd, data, 16384, 40000);
+    int fd = store(stored);
+    FrameReader reader;
+    ASSERT_TRUE(reader.Open(fd, stored.size()).Ok());
+    // Within a frame, across frames, and a whole frame
+    ASSERT_EQ(data.substr(100, 50), readAt(&reader, 100, 50));
+    ASSERT_EQ(data.substr(16000, 20000), readAt(&reader, 16000, 20000));
+    ASSERT_EQ(data.substr(16384, 16384), readAt(&reader, 16384, 16384));
+    // Short at the end of the chunk
+    ASSERT_EQ(data.substr(99000), readAt(&reader, 99000, 3000));
+    ASSERT_EQ("", readAt(&reader, 100000, 3000));
+    ASSERT_EQ(reader.StoredOffset(16384), reader.StoredOffset(20000));
+    ASSERT_LT(reader.StoredOffset(0), reader.StoredOffset(16384));
+    close(fd);
+}
+
+/** The frames and the seek table form a valid stream of the codec */
+TEST(Frames, ValidStream) {
+    std::string data = logLines(50000);
+    auto stored = compress(Codec::Zstd, data, 8192, 50000);
+    std::string plain(data.size(), '\0');
+    size_t made = ZSTD_decompress(&plain[0], plain.size(), stored.data(),
+                                  stored.size());
+    ASSERT_FALSE(ZSTD_isError(made));
+    ASSERT_EQ(data.size(), made);
+    ASSERT_EQ(data, plain);
+}
+
+TEST(Frames, Empty) {
+    auto stored = compress(Codec::Lz4, "", 8192, 1);
+    int fd = store(stored);
+    FrameReader reader;
+    ASSERT_TRUE(reader.Open(fd, stored.size()).Ok());
+    ASSERT_EQ(0u, reader.PlainSize());
+    ASSERT_EQ(0u, reader.Frames());
+    ASSERT_EQ("", readAt(&reader, 0, 100));
+    close(fd);
+}
+
+TEST(Frames, Corrupted) {
+    std::string data = logLines(50000);
+    auto stored = compress(Codec::Zstd, data, 8192, 50000);
+    // Truncated: no seek table at the end
+    int fd = store(stored);
+    FrameReader reader;
+    ASSERT_EQ(Cause::Corrupted, reader.Open(fd, stored.size() - 1).Why());
+    close(fd);
+    // A frame overwritten
+    for (size_t i = 0; i < 16; i++)
+        stored[i] = 0;
+    fd = store(stored);
+    ASSERT_TRUE(reader.Open(fd, stored.size()).Ok());
+    ASSERT_EQ(data.substr(9000, 100), readAt(&reader, 9000, 100));
+    std::string block(100, '\0');
+    uint32_t got = 0;
+    ASSERT_EQ(Cause::Corrupted, reader.ReadAt(
+        0, reinterpret_cast<uint8_t *>(&block[0]), 100, &got).Why());
+    close(fd);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,127 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "flight.hpp"
+
+using blob::BlockRef;
+using blob::Flight;
+using blob::Flights;
+using blob::SharedBlock;
+
+static BlockRef block(uint64_t offset, uint32_t length, uint64_t reader) {
+    auto out = std::make_shared<SharedBlock>(offset, length, reader);
+    out->length = length;
+    return out;
+}
+
+TEST(Flight, Claim) {
+    Flight flight(100, 350, 0);
+    uint64_t offset = 0;
+    uint32_t length = 0;
+    ASSERT_TRUE(flight.Claim(100, &offset, &length));
+    ASSERT_EQ(100u, offset);
+    ASSERT_EQ(100u, length);
+    ASSERT_TRUE(flight.Claim(100, &offset, &length));
+    ASSERT_EQ(200u, offset);
+    ASSERT_TRUE(flight.Claim(100, &offset, &length));
+    ASSERT_EQ(300u, offset);
+    ASSERT_EQ(50u, length);
+    ASSERT_FALSE(flight.Claim(100, &offset, &length));
+}
+
+TEST(Flight, FanOut) {
+    Flight flight(0, 300, 1000);
+    std::vector<BlockRef> first, second;
+    auto seat1 = flight.Join([&](const BlockRef &b) { first.push_back(b); });
+    ASSERT_EQ(1u, seat1.id);
+    ASSERT_FALSE(seat1.shared);
+    auto seat2 = flight.Join([&](const BlockRef &b) { second.push_back(b); });
+    ASSERT_TRUE(seat2.shared);
+    ASSERT_EQ(2u, flight.Readers());
+
+    flight.Publish(block(0, 100, seat1.id));
+    ASSERT_EQ(1u, first.size());
+    ASSERT_EQ(1u, second.size());
+    // The very same buffer
+    ASSERT_EQ(first[0].get(), second[0].get());
+
+    flight.Leave(seat2.id);
+    flight.Publish(block(100, 100, seat1.id));
+    ASSERT_EQ(2u, first.size());
+    ASSERT_EQ(1u, second.size());
+}
+
+TEST(Flight, LateJoiner) {
+    Flight flight(0, 1000, 250);
+    auto seat = flight.Join([](const BlockRef &) {});
+    flight.Publish(block(0, 100, seat.id));
+    flight.Publish(block(100, 100, seat.id));
+    std::vector<BlockRef> late;
+    auto joined = flight.Join([&](const BlockRef &b) { late.push_back(b); });
+    ASSERT_NE(0u, joined.id);
+    ASSERT_EQ(2u, joined.retained.size());
+    ASSERT_EQ(100u, joined.retained[1]->offset);
+    flight.Publish(block(200, 100, seat.id));
+    ASSERT_EQ(1u, late.size());
+    // Past the window
+    ASSERT_FALSE(flight.Joinable());
+    ASSERT_EQ(0u, flight.Join([](const BlockRef &) {}).id);
+}
+
+TEST(Flight, Fail) {
+    Flight flight(0, 1000, 1000);
+    int failures = 0;
+    flight.Join([&](const BlockRef &b) { failures += b == nullptr; });
+    flight.Join([&](const BlockRef &b) { failures += b == nullptr; });
+    flight.Fail();
+    ASSERT_EQ(2, failures);
+    ASSERT_FALSE(flight.Joinable());
+    uint64_t offset = 0;
+    uint32_t length = 0;
+    ASSERT_FALSE(flight.Claim(100, &offset, &length));
+}
+
+TEST(Flights, Registry) {
+    Flights flights(100);
+    auto flight = flights.Get("/vol/ABC/ABCD:0-1000", 0, 1000);
+    ASSERT_EQ(flight, flights.Get("/vol/ABC/ABCD:0-1000", 0, 1000));
+    ASSERT_NE(flight, flights.Get("/vol/ABC/ABCD:0-99", 0, 99));
+    ASSERT_EQ(2u, flights.Size());
+
+    auto seat = flight->Join([](const BlockRef &) {});
+    flight->Publish(block(0, 200, seat.id));
+    // Closed to new readers: a new flight replaces it
+    auto next = flights.Get("/vol/ABC/ABCD:0-1000", 0, 1000);
+    ASSERT_NE(flight, next);
+    // The former flight isn't the one known anymore
+    flights.Leave("/vol/ABC/ABCD:0-1000", flight, seat.id);
+    ASSERT_EQ(2u, flights.Size());
+
+    seat = next->Join([](const BlockRef &) {});
+    flights.Leave("/vol/ABC/ABCD:0-1000", next, seat.id);
+    ASSERT_EQ(1u, flights.Size());
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,83 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include <thread> // NOLINT
+#include <vector>
+#include "histogram.hpp"
+
+using utils::HistogramBucket;
+using utils::HistogramBucketValue;
+using utils::LatencyHistogram;
+using utils::LatencyStats;
+using utils::Method;
+using utils::StatusClass;
+
+TEST(Histogram, BucketsAreMonotonic) {
+    unsigned int last = 0;
+    for (uint64_t v = 0; v < (1ull << 20); v += 7) {
+        unsigned int bucket = HistogramBucket(v);
+        ASSERT_LE(last, bucket);
+        last = bucket;
+    }
+    ASSERT_EQ(utils::kHistogramBuckets - 1, HistogramBucket(~0ull));
+}
+
+TEST(Histogram, RelativeError) {
+    for (uint64_t v = 1; v < (1ull << 34); v = v * 3 + 1) {
+        double mid = HistogramBucketValue(HistogramBucket(v));
+        ASSERT_NEAR(static_cast<double>(v), mid, v / 16.0 + 1);
+    }
+}
+
+TEST(Histogram, Percentiles) {
+    LatencyHistogram histogram;
+    for (uint64_t i = 1; i <= 1000; i++)
+        histogram.Record(i * 1000);
+    auto snapshot = histogram.Snapshot();
+    ASSERT_EQ(1000u, snapshot.count);
+    ASSERT_EQ(500500u, snapshot.Mean());
+    uint64_t p50 = snapshot.Percentile(0.5);
+    uint64_t p99 = snapshot.Percentile(0.99);
+    ASSERT_NEAR(500000.0, p50, 500000.0 / 8);
+    ASSERT_NEAR(990000.0, p99, 990000.0 / 8);
+    ASSERT_LE(p50, p99);
+}
+
+TEST(Histogram, ConcurrentRecords) {
+    LatencyStats stats;
+    std::vector<std::thread> workers;
+    for (int t = 0; t < 8; t++) {
+        workers.emplace_back([&stats]() {
+            for (int i = 0; i < 10000; i++)
+                stats.Record(Method::Get, 200, 1000, 5000);
+        });
+    }
+    for (auto &w : workers)
+        w.join();
+    ASSERT_EQ(80000u, stats.Total(Method::Get, StatusClass::R2xx).count);
+    ASSERT_EQ(80000u, stats.FirstByte(Method::Get, StatusClass::R2xx).count);
+    ASSERT_EQ(0u, stats.Total(Method::Put, StatusClass::R2xx).count);
+    ASSERT_EQ(0u, stats.Total(Method::Get, StatusClass::R5xx).count);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,79 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cstring>
+#include <vector>
+#include "listener.hpp"
+
+TEST(Listener, ReusePort) {
+    utils::ListenOptions options;
+    options.host = "127.0.0.1";
+    options.port = 0;
+    options.sockets = 4;
+    auto fds = utils::ListenReusePort(options);
+    ASSERT_EQ(4u, fds.size());
+    uint16_t port = utils::LocalPort(fds[0]);
+    ASSERT_NE(0, port);
+    for (int fd : fds)
+        ASSERT_EQ(port, utils::LocalPort(fd));
+
+    // Connections land on one of the sockets
+    int client = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    ASSERT_EQ(0, connect(client, reinterpret_cast<struct sockaddr *>(&addr),
+                         sizeof(addr)));
+    close(client);
+    for (int fd : fds)
+        close(fd);
+}
+
+TEST(Listener, AddressInUse) {
+    utils::ListenOptions options;
+    options.host = "127.0.0.1";
+    options.port = 0;
+    auto fds = utils::ListenReusePort(options);
+    ASSERT_EQ(1u, fds.size());
+
+    // A plain socket can't share the port
+    int other = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(utils::LocalPort(fds[0]));
+    ASSERT_NE(0, bind(other, reinterpret_cast<struct sockaddr *>(&addr),
+                      sizeof(addr)));
+    close(other);
+    close(fds[0]);
+
+    options.host = "not-an-address.invalid";
+    ASSERT_TRUE(utils::ListenReusePort(options).empty());
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
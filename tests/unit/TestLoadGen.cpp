@@ -0,0 +1,269 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstring>
+#include <map>
+#include <string>
+#include <thread> // NOLINT
+#include <vector>
+#include "loadgen.hpp"
+
+using loadgen::Op;
+using loadgen::OpMix;
+using loadgen::Request;
+using loadgen::Response;
+using loadgen::SizeDistribution;
+
+/**
+ * Minimal HTTP/1.1 server replying canned answers, one connection at a
+ * time, to check the client's framing.
+ */
+class FakeServer {
+ public:
+    explicit FakeServer(std::vector<std::string> replies)
+            : replies{std::move(replies)} {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+        socklen_t len = sizeof(addr);
+        getsockname(fd, reinterpret_cast<struct sockaddr *>(&addr), &len);
+        port = ntohs(addr.sin_port);
+        listen(fd, 8);
+        worker = std::thread([this]() { serve(); });
+    }
+    ~FakeServer() {
+        shutdown(fd, SHUT_RDWR);
+        close(fd);
+        worker.join();
+    }
+
+    uint16_t port {0};
+    std::atomic<int> connections {0};
+    std::vector<std::string> requests;
+
+ private:
+    /** Read one request, its body included, @return false at EOF */
+    bool readRequest(int client, std::string *pending) {
+        size_t eoh;
+        char buf[4096];
+        while ((eoh = pending->find("\r\n\r\n")) == std::string::npos) {
+            ssize_t rc = recv(client, buf, sizeof(buf), 0);
+            if (rc <= 0)
+                return false;
+            pending->append(buf, rc);
+        }
+        std::string head = pending->substr(0, eoh + 4);
+        size_t length = 0;
+        auto cl = head.find("Content-Length: ");
+        if (cl != std::string::npos)
+            length = std::stoul(head.substr(cl + 16));
+        while (pending->size() < head.size() + length) {
+            ssize_t rc = recv(client, buf, sizeof(buf), 0);
+            if (rc <= 0)
+                return false;
+            pending->append(buf, rc);
+        }
+        requests.push_back(head);
+        pending->erase(0, head.size() + length);
+        return true;
+    }
+
+    void serve() {
+        size_t next = 0;
+        while (next < replies.size()) {
+            int client = accept(fd, nullptr, nullptr);
+            if (client < 0)
+                return;
+            connections++;
+            std::string pending;
+            while (next < replies.size() && readRequest(client, &pending)) {
+                auto &reply = replies[next++];
+                send(client, reply.data(), reply.size(), MSG_NOSIGNAL);
+                if (reply.find("Connection: close") != std::string::npos)
+                    break;
+            }
+            close(client);
+        }
+    }
+
+    int fd;
+    std::vector<std::string> replies;
+    std::thread worker;
+};
+
+TEST(LoadGen, ParseSize) {
+    uint64_t size = 0;
+    ASSERT_TRUE(loadgen::ParseSize("512", &size));
+    ASSERT_EQ(512u, size);
+    ASSERT_TRUE(loadgen::ParseSize("4K", &size));
+    ASSERT_EQ(4096u, size);
+    ASSERT_TRUE(loadgen::ParseSize("2m", &size));
+    ASSERT_EQ(2u << 20, size);
+    ASSERT_TRUE(loadgen::ParseSize("1G", &size));
+    ASSERT_EQ(1u << 30, size);
+    ASSERT_FALSE(loadgen::ParseSize("", &size));
+    ASSERT_FALSE(loadgen::ParseSize("K", &size));
+    ASSERT_FALSE(loadgen::ParseSize("4KB", &size));
+}
+
+TEST(LoadGen, OpMix) {
+    OpMix mix;
+    ASSERT_FALSE(mix.Parse("put=1,copy=1"));
+    ASSERT_FALSE(mix.Parse("put=0"));
+    ASSERT_TRUE(mix.Parse("put=1,range=3"));
+    ASSERT_EQ(1u, mix.Weight(Op::Put));
+    ASSERT_EQ(0u, mix.Weight(Op::Get));
+    ASSERT_EQ(3u, mix.Weight(Op::Range));
+
+    std::mt19937_64 rng(1);
+    std::map<Op, int> picked;
+    for (int i = 0; i < 4000; i++)
+        picked[mix.Pick(&rng)]++;
+    ASSERT_EQ(0, picked[Op::Get]);
+    ASSERT_EQ(0, picked[Op::Delete]);
+    ASSERT_NEAR(3.0, static_cast<double>(picked[Op::Range]) / picked[Op::Put],
+                0.5);
+}
+
+TEST(LoadGen, SizeDistribution) {
+    SizeDistribution sizes;
+    std::mt19937_64 rng(1);
+    ASSERT_EQ(1u << 20, sizes.Pick(&rng));
+    ASSERT_FALSE(sizes.Parse("1M-4K"));
+    ASSERT_FALSE(sizes.Parse("4K:0"));
+    ASSERT_TRUE(sizes.Parse("4K-8K"));
+    for (int i = 0; i < 100; i++) {
+        auto size = sizes.Pick(&rng);
+        ASSERT_GE(size, 4096u);
+        ASSERT_LE(size, 8192u);
+    }
+    ASSERT_TRUE(sizes.Parse("1K:1,1M:1"));
+    for (int i = 0; i < 100; i++) {
+        auto size = sizes.Pick(&rng);
+        ASSERT_TRUE(size == 1024u || size == (1u << 20));
+    }
+}
+
+TEST(LoadGen, PutHeaders) {
+    std::mt19937_64 rng(1);
+    loadgen::Chunk chunk {loadgen::RandomHex(&rng, 64), 1234};
+    ASSERT_EQ(std::string::npos,
+              chunk.id.find_first_not_of("0123456789ABCDEF"));
+    auto headers = loadgen::PutHeaders(chunk, loadgen::RandomHex(&rng, 64),
+                                       "req");
+    std::map<std::string, std::string> found(headers.begin(), headers.end());
+    ASSERT_EQ(chunk.id, found["X-oio-chunk-meta-chunk-id"]);
+    ASSERT_EQ(64u, found["X-oio-chunk-meta-container-id"].size());
+    ASSERT_EQ(32u, found["X-oio-chunk-meta-content-id"].size());
+    ASSERT_EQ("1234", found["X-oio-chunk-meta-metachunk-size"]);
+    ASSERT_EQ("0", found["X-oio-chunk-meta-chunk-pos"]);
+    ASSERT_EQ("req", found["X-oio-req-id"]);
+}
+
+TEST(LoadGen, Http1Framing) {
+    FakeServer server({
+        "HTTP/1.1 201 Created\r\nContent-Length: 0\r\n\r\n",
+        "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhello",
+        "HTTP/1.1 206 Partial\r\nTransfer-Encoding: chunked\r\n\r\n"
+            "3\r\nabc\r\n4\r\ndefg\r\n0\r\n\r\n",
+        "HTTP/1.1 204 No Content\r\n\r\n",
+        "HTTP/1.1 200 OK\r\nConnection: close\r\n\r\nuntil the end",
+        "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n",
+    });
+    auto client = loadgen::NewHttp1Client("127.0.0.1", server.port, true);
+    Response response;
+
+    Request put {"PUT", "/0123", {{"X-oio-req-id", "r"}}, 100000};
+    ASSERT_TRUE(client->Execute(put, &response));
+    ASSERT_EQ(201, response.status);
+
+    Request get {"GET", "/0123", {}, 0};
+    ASSERT_TRUE(client->Execute(get, &response));
+    ASSERT_EQ(200, response.status);
+    ASSERT_EQ(5u, response.bytes);
+    ASSERT_TRUE(client->Execute(get, &response));
+    ASSERT_EQ(206, response.status);
+    ASSERT_EQ(7u, response.bytes);
+
+    Request del {"DELETE", "/0123", {}, 0};
+    ASSERT_TRUE(client->Execute(del, &response));
+    ASSERT_EQ(204, response.status);
+
+    ASSERT_TRUE(client->Execute(get, &response));
+    ASSERT_EQ(200, response.status);
+    ASSERT_EQ(13u, response.bytes);
+    ASSERT_EQ(1, server.connections.load());
+
+    // The server closed, the client reconnects
+    ASSERT_TRUE(client->Execute(get, &response));
+    ASSERT_EQ(404, response.status);
+    ASSERT_EQ(2, server.connections.load());
+    ASSERT_NE(std::string::npos,
+              server.requests[0].find("Content-Length: 100000\r\n"));
+    ASSERT_NE(std::string::npos, server.requests[0].find("X-oio-req-id: r"));
+}
+
+TEST(LoadGen, Http1NoReuse) {
+    FakeServer server({
+        "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n",
+        "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n",
+    });
+    auto client = loadgen::NewHttp1Client("127.0.0.1", server.port, false);
+    Request get {"GET", "/0123", {}, 0};
+    Response response;
+    ASSERT_TRUE(client->Execute(get, &response));
+    ASSERT_TRUE(client->Execute(get, &response));
+    ASSERT_EQ(2, server.connections.load());
+    ASSERT_NE(std::string::npos,
+              server.requests[0].find("Connection: close\r\n"));
+}
+
+TEST(LoadGen, Run) {
+    std::vector<std::string> replies(20,
+        "HTTP/1.1 201 Created\r\nContent-Length: 0\r\n\r\n");
+    FakeServer server(replies);
+    loadgen::Workload workload;
+    workload.port = server.port;
+    workload.concurrency = 1;
+    workload.requests = 20;
+    workload.mix.Parse("put=1");
+    workload.sizes.Parse("1K-4K");
+    auto report = loadgen::Run(workload);
+    auto &puts = report.ops[static_cast<unsigned int>(Op::Put)];
+    ASSERT_EQ(20u, puts.ok);
+    ASSERT_EQ(0u, puts.errors);
+    ASSERT_EQ(20u, puts.latency.count);
+    ASSERT_GE(puts.bytes, 20u * 1024);
+    ASSERT_LE(puts.bytes, 20u * 4096);
+    std::ostringstream out;
+    report.PrintJson(out);
+    ASSERT_NE(std::string::npos, out.str().find("\"put\": {\"ok\": 20"));
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,119 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include <unistd.h>
+#include <fstream>
+#include <string>
+#include <thread> // NOLINT
+#include <vector>
+#include "utils.hpp"
+
+using utils::AccessLog;
+using utils::AccessRecord;
+using utils::AsyncLogger;
+using utils::LoggerOptions;
+using utils::LogRing;
+using utils::LogSink;
+
+static size_t countLines(const std::string &path) {
+    std::ifstream in(path);
+    std::string line;
+    size_t count = 0;
+    while (std::getline(in, line))
+        count++;
+    return count;
+}
+
+TEST(LogRing, FullThenEmpty) {
+    LogRing ring(3);
+    AccessRecord record;
+    for (int i = 0; i < 4; i++) {
+        record.statusCode = 200 + i;
+        ASSERT_TRUE(ring.TryPush(record));
+    }
+    ASSERT_FALSE(ring.TryPush(record));
+    for (int i = 0; i < 4; i++) {
+        ASSERT_NE(nullptr, ring.Front());
+        ASSERT_EQ(200 + i, ring.Front()->statusCode);
+        ring.Pop();
+    }
+    ASSERT_EQ(nullptr, ring.Front());
+}
+
+TEST(AccessLog, LogToPrint) {
+    AccessLog log;
+    log.SetUpBasic("host", "rawx-1");
+    log.RequestType("GET");
+    log.StatusCode(206);
+    log.ResponseTime(1234);
+    log.UserID(std::string(200, 'A'));
+    std::string line = log.LogToPrint("INF", "0123ABCD");
+    std::string pid = " " + std::to_string(getpid()) + " ";
+    ASSERT_NE(std::string::npos, line.find("host rawx-1" + pid));
+    ASSERT_NE(std::string::npos, line.find(" access INF - - GET 206 1234 0 "));
+    ASSERT_NE(std::string::npos, line.find(std::string(71, 'A') + " - "));
+    ASSERT_EQ(std::string::npos, line.find(std::string(72, 'A')));
+    ASSERT_EQ("0123ABCD", line.substr(line.size() - 8));
+}
+
+TEST(AsyncLogger, DropWhenFull) {
+    LoggerOptions options;
+    options.ringSize = 16;
+    AsyncLogger logger(options);
+    AccessRecord record;
+    for (int i = 0; i < 20; i++)
+        logger.Push(record);
+    ASSERT_EQ(4u, logger.Dropped());
+}
+
+TEST(AsyncLogger, ManyThreadsToFile) {
+    std::string path = "./access.log";
+    unlink(path.c_str());
+    LoggerOptions options;
+    options.sink = LogSink::File;
+    options.path = path;
+    options.ringSize = 65536;
+    options.batchSize = 4096;
+    AsyncLogger logger(options);
+    ASSERT_TRUE(logger.Start());
+    AsyncLogger::Install(&logger);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < 4; t++) {
+        workers.emplace_back([]() {
+            AccessLog log;
+            log.RequestType("PUT");
+            log.StatusCode(201);
+            for (int i = 0; i < 1000; i++)
+                log.Log("INF", "chunk");
+        });
+    }
+    for (auto &w : workers)
+        w.join();
+    AsyncLogger::Install(nullptr);
+    logger.Stop();
+    ASSERT_EQ(0u, logger.Dropped());
+    ASSERT_EQ(4000u, logger.Written());
+    ASSERT_EQ(4000u, countLines(path));
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
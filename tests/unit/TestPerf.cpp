@@ -0,0 +1,128 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <gtest/gtest.h>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "perf.hpp"
+
+using loadgen::Expectation;
+using loadgen::Op;
+
+static std::vector<Expectation> parse(const std::string &text) {
+    std::istringstream in(text);
+    std::vector<Expectation> baseline;
+    std::string error;
+    EXPECT_TRUE(loadgen::ParseBaseline(in, &baseline, &error)) << error;
+    return baseline;
+}
+
+TEST(Perf, ParseBaseline) {
+    auto baseline = parse("# comment\n\nput-storm rps 1000 0.2  # inline\n"
+                          "put-storm p99_ms 12.5 0.5\n");
+    ASSERT_EQ(2u, baseline.size());
+    ASSERT_EQ("put-storm", baseline[0].workload);
+    ASSERT_EQ("rps", baseline[0].metric);
+    ASSERT_DOUBLE_EQ(1000, baseline[0].value);
+    ASSERT_DOUBLE_EQ(0.2, baseline[0].tolerance);
+    ASSERT_DOUBLE_EQ(12.5, baseline[1].value);
+
+    std::vector<Expectation> ignored;
+    std::string error;
+    std::istringstream unknown("put-storm qps 1000 0.2\n");
+    ASSERT_FALSE(loadgen::ParseBaseline(unknown, &ignored, &error));
+    ASSERT_EQ("put-storm qps 1000 0.2", error);
+    std::istringstream truncated("put-storm rps 1000\n");
+    ASSERT_FALSE(loadgen::ParseBaseline(truncated, &ignored, &error));
+    std::istringstream extra("put-storm rps 1000 0.2 x\n");
+    ASSERT_FALSE(loadgen::ParseBaseline(extra, &ignored, &error));
+}
+
+TEST(Perf, RoundTrip) {
+    auto baseline = parse("get rps 1000 0.2\nget p99_ms 3 0.5\n");
+    std::ostringstream out;
+    loadgen::PrintBaseline(out, baseline, {"machine: test"});
+    ASSERT_EQ(0u, out.str().find("# machine: test\n"));
+    auto again = parse(out.str());
+    ASSERT_EQ(baseline.size(), again.size());
+    ASSERT_EQ("p99_ms", again[1].metric);
+    ASSERT_DOUBLE_EQ(3, again[1].value);
+}
+
+TEST(Perf, Compare) {
+    auto baseline = parse("a rps 1000 0.2\n"
+                          "a p99_ms 10 0.5\n"
+                          "b mibps 100 0.1\n"
+                          "c rps 10 0.1\n");
+    std::map<std::string, double> measured {
+        {"a rps", 850},      // -15%, tolerated
+        {"a p99_ms", 16},    // +60%, regression
+        {"b mibps", 120},    // better
+    };
+    auto verdicts = loadgen::Compare(baseline, measured);
+    ASSERT_EQ(3u, verdicts.size());
+    ASSERT_FALSE(verdicts[0].regression);
+    ASSERT_NEAR(-0.15, verdicts[0].change, 1e-9);
+    ASSERT_TRUE(verdicts[1].regression);
+    ASSERT_NEAR(-0.6, verdicts[1].change, 1e-9);
+    ASSERT_FALSE(verdicts[2].regression);
+    ASSERT_NEAR(0.2, verdicts[2].change, 1e-9);
+
+    std::ostringstream out;
+    ASSERT_EQ(1u, loadgen::PrintVerdicts(out, verdicts));
+    ASSERT_NE(std::string::npos, out.str().find("REGRESSION"));
+}
+
+TEST(Perf, Unmeasured) {
+    auto baseline = parse("a rps 0 0.2\n");
+    std::map<std::string, double> measured {{"a rps", 10}};
+    auto verdicts = loadgen::Compare(baseline, measured);
+    ASSERT_EQ(1u, verdicts.size());
+    ASSERT_TRUE(verdicts[0].unmeasured);
+    ASSERT_FALSE(verdicts[0].regression);
+    std::ostringstream out;
+    ASSERT_EQ(0u, loadgen::PrintVerdicts(out, verdicts));
+    ASSERT_NE(std::string::npos, out.str().find("UNMEASURED"));
+}
+
+TEST(Perf, MachineSpec) {
+    auto spec = loadgen::MachineSpec(".");
+    ASSERT_NE(std::string::npos, spec.find(", Linux "));
+    ASSERT_NE(std::string::npos, spec.find("volume on "));
+}
+
+TEST(Perf, Metric) {
+    loadgen::Report report;
+    report.seconds = 2;
+    auto &get = report.ops[static_cast<unsigned int>(Op::Get)];
+    get.ok = 100;
+    get.bytes = 4 << 20;
+    get.latency.buckets[utils::HistogramBucket(5000000)] = 100;
+    get.latency.count = 100;
+    ASSERT_DOUBLE_EQ(50, loadgen::Metric(report, Op::Get, "rps"));
+    ASSERT_DOUBLE_EQ(2, loadgen::Metric(report, Op::Get, "mibps"));
+    ASSERT_NEAR(5, loadgen::Metric(report, Op::Get, "p99_ms"), 0.5);
+    ASSERT_LT(loadgen::Metric(report, Op::Get, "unknown"), 0);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
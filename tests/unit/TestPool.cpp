@@ -0,0 +1,165 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include <set>
+#include <string>
+#include <thread> // NOLINT
+#include <vector>
+#include "pool.hpp"
+#include "utils.hpp"
+
+using utils::BlockCache;
+using utils::Loan;
+using utils::Pooled;
+using utils::Spares;
+
+namespace {
+
+struct Object : public Pooled<Object> {
+    explicit Object(int value) : value{value} {}
+    virtual ~Object() {}
+    int value;
+    char payload[200];
+};
+
+struct Larger : public Object {
+    Larger() : Object(1) {}
+    char more[100];
+};
+
+}  // namespace
+
+TEST(BlockCache, Reuse) {
+    using Cache = BlockCache<48>;
+    void *first = Cache::Get();
+    Cache::Put(first);
+    ASSERT_TRUE(Cache::Available());
+    ASSERT_EQ(first, Cache::Get());
+    ASSERT_FALSE(Cache::Available());
+    Cache::Put(first);
+}
+
+TEST(BlockCache, Bounded) {
+    using Cache = BlockCache<56>;
+    std::vector<void *> blocks;
+    for (size_t i = 0; i < 2 * Cache::kKept; i++)
+        blocks.push_back(Cache::Get());
+    for (auto block : blocks)
+        Cache::Put(block);
+    std::set<void *> kept;
+    while (Cache::Available())
+        kept.insert(Cache::Get());
+    ASSERT_EQ(Cache::kKept, kept.size());
+    for (auto block : kept)
+        Cache::Put(block);
+}
+
+TEST(BlockCache, PerThread) {
+    using Cache = BlockCache<72>;
+    Cache::Put(Cache::Get());
+    std::thread other([]() { ASSERT_FALSE(Cache::Available()); });
+    other.join();
+    ASSERT_TRUE(Cache::Available());
+}
+
+TEST(Pooled, Recycled) {
+    Object *object = new Object(7);
+    delete object;
+    ASSERT_TRUE(Object::Recycled());
+    Object *next = new Object(8);
+    ASSERT_EQ(object, next);
+    ASSERT_EQ(8, next->value);
+    ASSERT_FALSE(Object::Recycled());
+    delete next;
+}
+
+TEST(Pooled, DerivedFromTheAllocator) {
+    std::vector<Object *> held;
+    while (Object::Recycled())
+        held.push_back(new Object(0));
+    // Freed by the virtual destructor, with its own size
+    Object *larger = new Larger();
+    delete larger;
+    ASSERT_FALSE(Object::Recycled());
+    for (auto object : held)
+        delete object;
+}
+
+TEST(Spares, CapacityKept) {
+    const char *buffer;
+    {
+        std::string member;
+        Loan<std::string> loan {&member};
+        member.assign(200, 'x');
+        buffer = member.data();
+    }
+    ASSERT_EQ(1u, Spares<std::string>::Kept());
+    std::string member;
+    Loan<std::string> loan {&member};
+    ASSERT_EQ(0u, Spares<std::string>::Kept());
+    ASSERT_TRUE(member.empty());
+    ASSERT_LE(200u, member.capacity());
+    member.assign(100, 'y');
+    ASSERT_EQ(buffer, member.data());
+}
+
+TEST(Spares, XAttrCleared) {
+    {
+        utils::XAttr xattr;
+        Loan<utils::XAttr> loan {&xattr};
+        xattr.Set(utils::Attr::ChunkId, std::string(64, 'A'));
+    }
+    utils::XAttr xattr;
+    Loan<utils::XAttr> loan {&xattr};
+    ASSERT_EQ("", xattr.Get(utils::Attr::ChunkId));
+}
+
+TEST(Spares, Bounded) {
+    using Strings = Spares<std::string>;
+    {
+        std::vector<std::string> members(2 * Strings::kKept);
+        for (auto &member : members)
+            member.assign(100, 'x');
+        for (auto &member : members)
+            Strings::Return(&member);
+    }
+    ASSERT_EQ(Strings::kKept, Strings::Kept());
+    std::thread other([]() { ASSERT_EQ(0u, Strings::Kept()); });
+    other.join();
+    std::string member;
+    while (Strings::Kept() > 0)
+        Strings::Lend(&member);
+}
+
+TEST(HeapAllocations, Counted) {
+    uint64_t before = utils::HeapAllocations();
+    std::thread other([]() {
+        for (int i = 0; i < 10; i++)
+            utils::CountAllocation();
+    });
+    other.join();
+    utils::CountAllocation();
+    ASSERT_EQ(before + 11, utils::HeapAllocations());
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -90,6 +90,41 @@ TEST_F(RawxHandlerFactoryFixture, DELETE_Header_return_RemovalHandler) {
                 ==  typeid(*handler).hash_code());
 }
 
+TEST(ChunkPath, FanOut) {
+    std::string path;
+    ASSERT_TRUE(rawx::ChunkPath("/vol", "/09C7861345B1834C", &path));
+    ASSERT_EQ("/vol/09C/09C7861345B1834C", path);
+    ASSERT_TRUE(rawx::ChunkPath(".", "ABCD", &path));
+    ASSERT_EQ("./ABC/ABCD", path);
+    ASSERT_FALSE(rawx::ChunkPath("/vol", "/", &path));
+    ASSERT_FALSE(rawx::ChunkPath("/vol", "/AB", &path));
+    ASSERT_FALSE(rawx::ChunkPath("/vol", "/../etc/passwd", &path));
+    ASSERT_FALSE(rawx::ChunkPath("/vol", "/09C/09C7", &path));
+}
+
+TEST(ReplyETag, WeakWhenSentAsStored) {
+    utils::XAttr xattr;
+    xattr.Set(utils::Attr::ChunkHash, "09C7");
+    xattr.Set(utils::Attr::ContentChunkMethod,
+              "plain/nb_copy=3,compression=zstd");
+    std::string etag;
+    rawx::ReplyETag(xattr, "gzip, zstd", false, &etag);
+    ASSERT_EQ("W/\"09C7\"", etag);
+    // A range, or a client without the codec, gets the plain bytes
+    rawx::ReplyETag(xattr, "gzip, zstd", true, &etag);
+    ASSERT_EQ("\"09C7\"", etag);
+    rawx::ReplyETag(xattr, "gzip", false, &etag);
+    ASSERT_EQ("\"09C7\"", etag);
+    xattr.Set(utils::Attr::ContentChunkMethod, "plain/nb_copy=3");
+    rawx::ReplyETag(xattr, "zstd", false, &etag);
+    ASSERT_EQ("\"09C7\"", etag);
+    // The tag of the 304 matches the one of the 200 it stands for
+    xattr.Set(utils::Attr::ContentChunkMethod, "plain/compression=lz4");
+    rawx::ReplyETag(xattr, "lz4", false, &etag);
+    ASSERT_EQ(utils::Precondition::NotModified,
+              utils::EvaluatePreconditions(etag, "", "W/\"09C7\""));
+}
+
 // Testing DownloadHandler
 TEST_F(DownloadHandlerFixture, CheckAllValueHere) {
     HTTPMessage msg;
@@ -111,6 +146,8 @@ TEST_F(DownloadHandlerFixture, CheckMissingValue) {
 TEST_F(UploadHandlerFixture, CheckAllValueHere) {
     HTTPMessage msg;
     HTTPHeaders &headers = msg.getHeaders();
+    msg.setURL("/09C7861345B1834C36C7493A2322A3D4C"
+               "0237FADB407E68155F51E5066922972");
     //    PUT //09C7861345B1834C36C7493A2322A3D4C0237FADB407E68155F51E5066922972
     // HTTP/1.1
     //            Host: 127.0.0.1:6010
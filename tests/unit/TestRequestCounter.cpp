@@ -0,0 +1,92 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include <thread> // NOLINT
+#include <vector>
+#include "utils.hpp"
+
+using utils::RequestCounter;
+using utils::Stat;
+
+class RequestCounterFixture : public testing::Test {
+ public:
+    void SetUp() override {}
+    void TearDown() override {}
+ protected:
+    void hammer(unsigned int threads, unsigned int loops) {
+        std::vector<std::thread> workers;
+        for (unsigned int t = 0; t < threads; t++) {
+            workers.emplace_back([this, loops]() {
+                for (unsigned int i = 0; i < loops; i++) {
+                    counter.incGetHits();
+                    counter.incBread(10);
+                }
+            });
+        }
+        for (auto &w : workers)
+            w.join();
+    }
+    RequestCounter counter;
+};
+
+TEST_F(RequestCounterFixture, StartsAtZero) {
+    auto stats = counter.Snapshot();
+    for (auto value : stats.values)
+        ASSERT_EQ(0u, value);
+}
+
+TEST_F(RequestCounterFixture, SumOfThreads) {
+    hammer(8, 10000);
+    auto stats = counter.Snapshot();
+    ASSERT_EQ(80000u, stats[Stat::GetHits]);
+    ASSERT_EQ(800000u, stats[Stat::Bread]);
+    ASSERT_EQ(0u, stats[Stat::PutHits]);
+}
+
+TEST_F(RequestCounterFixture, MoreThreadsThanShards) {
+    std::vector<std::thread> idle;
+    std::atomic<bool> release {false};
+    // Keep slots busy so that the next threads land in the overflow shard
+    for (unsigned int t = 0; t < RequestCounter::kMaxShards; t++) {
+        idle.emplace_back([this, &release]() {
+            counter.incPutHits();
+            while (!release)
+                std::this_thread::yield();
+        });
+    }
+    hammer(4, 1000);
+    release = true;
+    for (auto &t : idle)
+        t.join();
+    auto stats = counter.Snapshot();
+    ASSERT_EQ(RequestCounter::kMaxShards, stats[Stat::PutHits]);
+    ASSERT_EQ(4000u, stats[Stat::GetHits]);
+}
+
+TEST_F(RequestCounterFixture, 64BitsCounters) {
+    counter.incBwritten(1ULL << 33);
+    counter.incBwritten(1ULL << 33);
+    ASSERT_EQ(1ULL << 34, counter.Snapshot()[Stat::Bwritten]);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,119 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include <future> // NOLINT
+#include <vector>
+#include "affinity.hpp"
+#include "scheduler.hpp"
+
+using blob::IoClass;
+using blob::IoTask;
+using blob::IoScheduler;
+using blob::IoSchedulerOptions;
+
+class IoSchedulerFixture : public testing::Test {
+ public:
+    void SetUp() override {
+        options.threads = 1;
+        options.volumeInflight = 1;
+        options.weights = {{4, 1}};
+    }
+    void TearDown() override {}
+
+ protected:
+    /** Occupy the single worker until the returned promise is fulfilled */
+    std::shared_ptr<std::promise<void>> block(IoScheduler *scheduler) {
+        auto gate = std::make_shared<std::promise<void>>();
+        auto future = gate->get_future().share();
+        IoTask task;
+        task.run = [future]() { future.wait(); };
+        scheduler->Submit(task);
+        return gate;
+    }
+    IoTask task(IoClass cls) {
+        IoTask t;
+        t.cls = cls;
+        t.run = [this, cls]() { order.push_back(cls); };
+        return t;
+    }
+    IoSchedulerOptions options;
+    std::vector<IoClass> order;
+};
+
+TEST_F(IoSchedulerFixture, WeightedSharing) {
+    IoScheduler scheduler(options);
+    auto gate = block(&scheduler);
+    for (int i = 0; i < 20; i++) {
+        scheduler.Submit(task(IoClass::Background));
+        scheduler.Submit(task(IoClass::Foreground));
+    }
+    gate->set_value();
+    scheduler.Stop();
+    ASSERT_EQ(40u, order.size());
+    int foreground = 0;
+    for (int i = 0; i < 10; i++)
+        foreground += (order[i] == IoClass::Foreground);
+    ASSERT_GE(foreground, 7);
+    auto stats = scheduler.Stats();
+    ASSERT_EQ(20u, stats.classes[1].dispatched);
+}
+
+TEST_F(IoSchedulerFixture, ExpiredDeadlineFirst) {
+    IoScheduler scheduler(options);
+    auto gate = block(&scheduler);
+    for (int i = 0; i < 5; i++)
+        scheduler.Submit(task(IoClass::Foreground));
+    auto late = task(IoClass::Background);
+    late.deadline = std::chrono::steady_clock::now();
+    scheduler.Submit(late);
+    gate->set_value();
+    scheduler.Stop();
+    ASSERT_EQ(IoClass::Background, order.front());
+}
+
+TEST_F(IoSchedulerFixture, RefusedWhenStopped) {
+    IoScheduler scheduler(options);
+    scheduler.Stop();
+    ASSERT_FALSE(scheduler.Submit(task(IoClass::Foreground)));
+}
+
+TEST_F(IoSchedulerFixture, VolumeNode) {
+    options.volumeNodes["/numa"] = 0;
+    options.nodeThreads = 1;
+    IoScheduler scheduler(options);
+    // The worker of the node stays free while the other is busy
+    auto gate = block(&scheduler);
+    std::promise<int> ran;
+    IoTask local;
+    local.volume = "/numa";
+    local.run = [&ran]() { ran.set_value(utils::CurrentNode()); };
+    ASSERT_TRUE(scheduler.Submit(local));
+    auto node = ran.get_future();
+    ASSERT_EQ(std::future_status::ready,
+              node.wait_for(std::chrono::seconds(5)));
+    ASSERT_EQ(0, node.get());
+    gate->set_value();
+    scheduler.Stop();
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
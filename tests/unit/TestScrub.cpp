@@ -0,0 +1,151 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include <attr/xattr.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "compress.hpp"
+#include "scrub.hpp"
+
+using blob::Cause;
+using blob::ChunkHasher;
+using blob::Throttle;
+using blob::Scrubber;
+using blob::ScrubOptions;
+
+class ScrubberFixture : public testing::Test {
+ public:
+    void SetUp() override {
+        mkdir(volume.c_str(), 0755);
+        mkdir((volume + "/ABC").c_str(), 0755);
+        options.volume = volume;
+        options.bytesPerSec = 0;
+        options.iops = 0;
+    }
+    void TearDown() override {}
+
+ protected:
+    void writeChunk(std::string name, std::string data, std::string hash) {
+        std::string path = volume + "/ABC/" + name;
+        int fd = open(path.c_str(), O_CREAT|O_TRUNC|O_WRONLY, 0644);
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(static_cast<ssize_t>(data.size()),
+                  write(fd, data.data(), data.size()));
+        std::string size = std::to_string(data.size());
+        fsetxattr(fd, "user.grid.chunk.hash", hash.data(), hash.size(), 0);
+        fsetxattr(fd, "user.grid.chunk.size", size.data(), size.size(), 0);
+        close(fd);
+    }
+    std::string volume {"./scrubvolume"};
+    ScrubOptions options;
+};
+
+TEST(ChunkHasher, MD5) {
+    ChunkHasher hasher;
+    ASSERT_TRUE(hasher.Init(32));
+    hasher.Update(reinterpret_cast<const uint8_t *>("hello"), 5);
+    ASSERT_EQ("5D41402ABC4B2A76B9719D911017C592", hasher.Final());
+}
+
+TEST(ChunkHasher, UnknownLength) {
+    ChunkHasher hasher;
+    ASSERT_FALSE(hasher.Init(12));
+}
+
+TEST(Throttle, BackOffOnLatency) {
+    Throttle throttle(0, 0, std::chrono::microseconds(1000));
+    for (int i = 0; i < 100; i++)
+        throttle.Feedback(std::chrono::microseconds(100000));
+    ASSERT_LT(throttle.Factor(), 0.5);
+    for (int i = 0; i < 1000; i++)
+        throttle.Feedback(std::chrono::microseconds(0));
+    ASSERT_DOUBLE_EQ(1.0, throttle.Factor());
+}
+
+TEST_F(ScrubberFixture, GoodChunk) {
+    writeChunk("ABC0001", "hello", "5D41402ABC4B2A76B9719D911017C592");
+    Scrubber scrubber(options);
+    ASSERT_TRUE(scrubber.Verify(volume + "/ABC/ABC0001").Ok());
+}
+
+TEST_F(ScrubberFixture, StoppedChunkInterrupted) {
+    writeChunk("ABC0005", "hellO", "5D41402ABC4B2A76B9719D911017C592");
+    Scrubber scrubber(options);
+    scrubber.Stop();
+    ASSERT_EQ(Cause::Interrupted,
+              scrubber.Verify(volume + "/ABC/ABC0005").Why());
+}
+
+TEST_F(ScrubberFixture, CorruptedChunkQuarantined) {
+    writeChunk("ABC0002", "hellO", "5D41402ABC4B2A76B9719D911017C592");
+    Scrubber scrubber(options);
+    ASSERT_EQ(Cause::Corrupted,
+              scrubber.Verify(volume + "/ABC/ABC0002").Why());
+    scrubber.RunOnce();
+    auto stats = scrubber.Stats();
+    ASSERT_EQ(1u, stats.passes);
+    ASSERT_LE(1u, stats.corrupted);
+    ASSERT_LE(1u, stats.quarantined);
+    struct stat sb;
+    ASSERT_EQ(0, stat((volume + "/.quarantine/ABC0002").c_str(), &sb));
+}
+
+TEST_F(ScrubberFixture, BackgroundReads) {
+    writeChunk("ABC0004", "hello", "5D41402ABC4B2A76B9719D911017C592");
+    auto scheduler = std::make_shared<blob::IoScheduler>(
+        blob::IoSchedulerOptions());
+    Scrubber scrubber(options);
+    scrubber.Scheduler(scheduler);
+    ASSERT_TRUE(scrubber.Verify(volume + "/ABC/ABC0004").Ok());
+    auto stats = scheduler->Stats();
+    auto background = static_cast<unsigned int>(blob::IoClass::Background);
+    ASSERT_LE(1u, stats.classes[background].dispatched);
+    ASSERT_EQ(0u, stats.classes[0].dispatched);
+}
+
+TEST_F(ScrubberFixture, CompressedChunk) {
+    blob::FrameWriter writer(blob::Codec::Lz4, blob::FrameOptions());
+    std::vector<uint8_t> stored;
+    ASSERT_TRUE(writer.Write(reinterpret_cast<const uint8_t *>("hello"), 5,
+                             &stored));
+    ASSERT_TRUE(writer.Finish(&stored));
+    writeChunk("ABC0003", std::string(stored.begin(), stored.end()),
+               "5D41402ABC4B2A76B9719D911017C592");
+    // The hash and the size are those of the plain bytes
+    std::string path = volume + "/ABC/ABC0003";
+    std::string method {"plain/compression=lz4"};
+    setxattr(path.c_str(), "user.grid.content.chunk_method", method.data(),
+             method.size(), 0);
+    setxattr(path.c_str(), "user.grid.chunk.size", "5", 1, 0);
+    Scrubber scrubber(options);
+    ASSERT_TRUE(scrubber.Verify(path).Ok());
+    // Stored as is, the frames aren't the plain bytes
+    removexattr(path.c_str(), "user.grid.content.chunk_method");
+    ASSERT_EQ(Cause::Corrupted, scrubber.Verify(path).Why());
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,239 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include <string>
+#include <vector>
+#include "stats.hpp"
+
+using utils::RequestCounter;
+using utils::RenderStats;
+using utils::StatsFormat;
+using utils::StatsWriter;
+using utils::VolumeUsage;
+
+static std::string render(StatsFormat format, const RequestCounter &counter,
+                          const VolumeUsage *usage) {
+    std::vector<char> buffer(utils::kStatsBufferSize);
+    size_t needed = RenderStats(format, counter, "/vol", usage,
+                                buffer.data(), buffer.size());
+    EXPECT_LE(needed, buffer.size());
+    return std::string(buffer.data(), needed);
+}
+
+TEST(StatsWriter, Overflow) {
+    char buffer[8];
+    StatsWriter out(buffer, sizeof(buffer));
+    out.Text("abc");
+    out.Number(18446744073709551615ull);
+    out.Text("d");
+    ASSERT_EQ(3u, out.Size());
+    ASSERT_EQ(24u, out.Needed());
+    ASSERT_TRUE(out.Overflow());
+    ASSERT_EQ("abc", std::string(buffer, out.Size()));
+}
+
+TEST(Stats, Oio) {
+    RequestCounter counter;
+    counter.incGetHits();
+    counter.incBread(1234);
+    counter.incInflight();
+    counter.incInflight();
+    counter.decInflight();
+    counter.incBuffered(4096);
+    counter.decBuffered(1024);
+    counter.incPaused();
+    counter.incCoalesced();
+    counter.incBshared(512);
+    counter.incPooled();
+    auto text = render(StatsFormat::Oio, counter, nullptr);
+    ASSERT_NE(std::string::npos, text.find("gauge req.inflight 1\n"));
+    ASSERT_NE(std::string::npos, text.find("gauge req.buffered 3072\n"));
+    ASSERT_NE(std::string::npos, text.find("counter req.paused 1\n"));
+    ASSERT_NE(std::string::npos, text.find("counter req.coalesced 1\n"));
+    ASSERT_NE(std::string::npos,
+              text.find("counter rep.bread.shared 512\n"));
+    ASSERT_NE(std::string::npos, text.find("counter req.pooled 1\n"));
+    ASSERT_NE(std::string::npos, text.find("counter heap.allocs "));
+    ASSERT_EQ(std::string::npos, text.find("numa"));
+    ASSERT_NE(std::string::npos, text.find("counter req.hits.get 1\n"));
+    ASSERT_NE(std::string::npos, text.find("counter req.hits.put 0\n"));
+    ASSERT_NE(std::string::npos, text.find("counter rep.bread 1234\n"));
+    ASSERT_NE(std::string::npos, text.find("config volume /vol\n"));
+    ASSERT_EQ(std::string::npos, text.find("space"));
+}
+
+TEST(Stats, Prometheus) {
+    RequestCounter counter;
+    counter.incPutHits();
+    counter.incBwritten(42);
+    counter.incCompressed(600, 100);
+    counter.Latency().Record(utils::Method::Put, 201, 1000000, 2000000);
+    VolumeUsage usage;
+    usage.totalBytes = 100;
+    auto text = render(StatsFormat::Prometheus, counter, &usage);
+    ASSERT_NE(std::string::npos,
+              text.find("# TYPE rawx_requests_total counter\n"));
+    ASSERT_NE(std::string::npos,
+              text.find("rawx_requests_total{method=\"put\"} 1\n"));
+    ASSERT_NE(std::string::npos, text.find("rawx_written_bytes_total 42\n"));
+    // The statuses with their own counter aren't summed with the classes
+    ASSERT_EQ(std::string::npos, text.find("rawx_replies_total{status=\"404"));
+    ASSERT_NE(std::string::npos, text.find(
+        "rawx_replies_by_code_total{status=\"404\"} 0\n"));
+    ASSERT_NE(std::string::npos, text.find(
+        "rawx_compression_bytes_total{side=\"plain\"} 600\n"));
+    ASSERT_NE(std::string::npos, text.find(
+        "rawx_compression_bytes_total{side=\"stored\"} 100\n"));
+    ASSERT_NE(std::string::npos, text.find("rawx_requests_inflight 0\n"));
+    ASSERT_NE(std::string::npos, text.find("rawx_upload_buffered_bytes 0\n"));
+    ASSERT_NE(std::string::npos, text.find("rawx_ingress_pauses_total 0\n"));
+    ASSERT_NE(std::string::npos, text.find(
+        "rawx_request_duration_microseconds_count"
+        "{method=\"put\",status=\"2xx\"} 1\n"));
+    ASSERT_EQ(std::string::npos, text.find("method=\"get\",status"));
+    ASSERT_NE(std::string::npos, text.find(
+        "rawx_volume_bytes{volume=\"/vol\",kind=\"total\"} 100\n"));
+}
+
+TEST(Stats, Nodes) {
+    RequestCounter counter;
+    counter.Nodes().Record(1, 1, 100);
+    counter.Nodes().Record(1, 0, 50);
+    counter.Nodes().Record(-1, 0, 50);
+    auto text = render(StatsFormat::Oio, counter, nullptr);
+    ASSERT_NE(std::string::npos, text.find("counter numa.1.io.local 1\n"));
+    ASSERT_NE(std::string::npos, text.find("counter numa.1.io.remote 1\n"));
+    ASSERT_NE(std::string::npos, text.find("counter numa.1.bytes 150\n"));
+    ASSERT_EQ(std::string::npos, text.find("numa.0"));
+    text = render(StatsFormat::Prometheus, counter, nullptr);
+    ASSERT_NE(std::string::npos, text.find(
+        "rawx_numa_io_total{node=\"1\",locality=\"remote\"} 1\n"));
+    ASSERT_NE(std::string::npos, text.find(
+        "rawx_numa_io_bytes_total{node=\"1\"} 150\n"));
+}
+
+TEST(Stats, Volumes) {
+    RequestCounter counter;
+    std::vector<utils::VolumeReport> volumes(2);
+    volumes[0].id = "disk1";
+    volumes[0].path = "/srv/disk1";
+    volumes[0].requests = 3;
+    volumes[0].bytesRead = 100;
+    volumes[0].inflight = 1;
+    volumes[0].buffered = 512;
+    volumes[1].id = "disk2";
+    volumes[1].path = "/srv/disk2";
+    volumes[1].hasUsage = true;
+    volumes[1].usage.availBytes = 42;
+    std::vector<char> buffer(utils::kStatsBufferSize);
+    size_t needed = RenderStats(StatsFormat::Oio, counter, volumes,
+                                buffer.data(), buffer.size());
+    std::string text(buffer.data(), needed);
+    ASSERT_NE(std::string::npos, text.find("config volume /srv/disk1\n"));
+    ASSERT_NE(std::string::npos, text.find(
+        "config volume.disk2 /srv/disk2\n"));
+    ASSERT_NE(std::string::npos, text.find("counter volume.disk1.req 3\n"));
+    ASSERT_NE(std::string::npos, text.find(
+        "counter volume.disk1.bread 100\n"));
+    ASSERT_NE(std::string::npos, text.find(
+        "gauge volume.disk1.inflight 1\n"));
+    ASSERT_NE(std::string::npos, text.find(
+        "gauge volume.disk1.buffered 512\n"));
+    ASSERT_NE(std::string::npos, text.find(
+        "gauge volume.disk2.space.avail 42\n"));
+    ASSERT_EQ(std::string::npos, text.find("volume.disk1.space"));
+
+    needed = RenderStats(StatsFormat::Prometheus, counter, volumes,
+                         buffer.data(), buffer.size());
+    text.assign(buffer.data(), needed);
+    ASSERT_NE(std::string::npos, text.find(
+        "rawx_volume_requests_total{volume=\"disk1\"} 3\n"));
+    ASSERT_NE(std::string::npos, text.find(
+        "rawx_volume_buffered_bytes{volume=\"disk1\"} 512\n"));
+    ASSERT_NE(std::string::npos, text.find(
+        "rawx_volume_io_bytes_total{volume=\"disk1\",direction=\"read\"} "
+        "100\n"));
+    ASSERT_NE(std::string::npos, text.find(
+        "rawx_volume_bytes{volume=\"/srv/disk2\",kind=\"avail\"} 42\n"));
+    ASSERT_EQ(std::string::npos, text.find(
+        "rawx_volume_bytes{volume=\"/srv/disk1\""));
+}
+
+TEST(Stats, Scrub) {
+    RequestCounter counter;
+    std::vector<utils::VolumeReport> volumes(2);
+    volumes[0].id = "disk1";
+    volumes[0].path = "/srv/disk1";
+    volumes[0].scrubbed = true;
+    volumes[0].scrub.chunks = 12;
+    volumes[0].scrub.corrupted = 2;
+    volumes[0].scrub.fanout = 4;
+    volumes[0].scrub.throttle = 0.25;
+    volumes[1].id = "disk2";
+    volumes[1].path = "/srv/disk2";
+    std::vector<char> buffer(utils::kStatsBufferSize);
+    size_t needed = RenderStats(StatsFormat::Oio, counter, volumes,
+                                buffer.data(), buffer.size());
+    std::string text(buffer.data(), needed);
+    ASSERT_NE(std::string::npos, text.find(
+        "counter volume.disk1.scrub.chunks 12\n"));
+    ASSERT_NE(std::string::npos, text.find(
+        "counter volume.disk1.scrub.corrupted 2\n"));
+    ASSERT_NE(std::string::npos, text.find(
+        "gauge volume.disk1.scrub.fanout 4\n"));
+    ASSERT_NE(std::string::npos, text.find(
+        "gauge volume.disk1.scrub.throttle.pct 25\n"));
+    ASSERT_EQ(std::string::npos, text.find("volume.disk2.scrub"));
+
+    needed = RenderStats(StatsFormat::Prometheus, counter, volumes,
+                         buffer.data(), buffer.size());
+    text.assign(buffer.data(), needed);
+    ASSERT_NE(std::string::npos, text.find(
+        "rawx_scrub_chunks_total{volume=\"disk1\"} 12\n"));
+    ASSERT_NE(std::string::npos, text.find(
+        "rawx_scrub_errors_total{volume=\"disk1\",kind=\"corrupted\"} "
+        "2\n"));
+    ASSERT_NE(std::string::npos, text.find(
+        "rawx_scrub_throttle_percent{volume=\"disk1\"} 25\n"));
+    auto type = text.find("# TYPE rawx_scrub_errors_total counter\n");
+    ASSERT_NE(std::string::npos, type);
+    ASSERT_EQ(type, text.rfind("# TYPE rawx_scrub_errors_total"));
+    ASSERT_EQ(std::string::npos, text.find("volume=\"disk2\",kind=\"io"));
+}
+
+TEST(Stats, TooSmall) {
+    RequestCounter counter;
+    char buffer[16];
+    size_t needed = RenderStats(StatsFormat::Oio, counter, "/vol", nullptr,
+                                buffer, sizeof(buffer));
+    ASSERT_GT(needed, sizeof(buffer));
+}
+
+TEST(Stats, VolumeUsage) {
+    VolumeUsage usage;
+    ASSERT_TRUE(utils::VolumeUsageOf(".", &usage));
+    ASSERT_LE(usage.freeBytes, usage.totalBytes);
+    ASSERT_FALSE(utils::VolumeUsageOf("/nonexistent/volume", &usage));
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,93 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include <unistd.h>
+#include <memory>
+#include <string>
+#include "blob.hpp"
+#include "stats.hpp"
+#include "utils.hpp"
+
+using blob::DiskDownload;
+using blob::DiskUpload;
+using blob::FileSlice;
+using utils::Phase;
+using utils::PhaseScope;
+using utils::PhaseStats;
+using utils::PhaseTrace;
+using utils::StatsWriter;
+using utils::XAttr;
+
+TEST(PhaseTrace, Format) {
+    PhaseTrace trace;
+    trace.Add(Phase::Open, 12000);
+    trace.Add(Phase::Read, 1000);
+    trace.Add(Phase::Read, 2000);
+    char buffer[128];
+    StatsWriter out(buffer, sizeof(buffer));
+    trace.Format(&out);
+    ASSERT_EQ("open=12 read=3", std::string(buffer, out.Size()));
+    ASSERT_EQ(2u, trace.Count(Phase::Read));
+}
+
+TEST(PhaseTrace, NullScope) {
+    PhaseScope scope(nullptr, Phase::Open);
+}
+
+TEST(PhaseTrace, BlobPhases) {
+    std::string path {"./traced"};
+    unlink(path.c_str());
+    PhaseTrace trace;
+    XAttr xattr;
+    xattr.addXAttr("chunk.id", "0123");
+    {
+        DiskUpload upload(path);
+        upload.XAttr(&xattr);
+        upload.Trace(&trace);
+        ASSERT_TRUE(upload.Prepare().Ok());
+        uint8_t data[] = "hello";
+        ASSERT_TRUE(upload.Write(std::make_shared<FileSlice>(data, 5)).Ok());
+        ASSERT_TRUE(upload.Commit().Ok());
+        upload.Abort();
+    }
+    DiskDownload download;
+    download.Path(path);
+    download.XAttr(&xattr);
+    download.Trace(&trace);
+    ASSERT_TRUE(download.Prepare().Ok());
+    ASSERT_TRUE(download.Read(std::make_shared<FileSlice>()).Ok());
+    download.Abort();
+    ASSERT_EQ(2u, trace.Count(Phase::Open));
+    ASSERT_EQ(2u, trace.Count(Phase::XAttr));
+    ASSERT_EQ(1u, trace.Count(Phase::Write));
+    ASSERT_EQ(1u, trace.Count(Phase::Commit));
+    ASSERT_EQ(1u, trace.Count(Phase::Read));
+    ASSERT_EQ(0u, trace.Count(Phase::Remove));
+
+    PhaseStats stats;
+    stats.Record(trace);
+    ASSERT_EQ(1u, stats.Snapshot(Phase::Open).count);
+    ASSERT_EQ(0u, stats.Snapshot(Phase::Egress).count);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,182 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "volume.hpp"
+
+using blob::Volume;
+using blob::Volumes;
+
+class VolumesFixture : public testing::Test {
+ public:
+    void SetUp() override {
+        for (auto id : {"vol-1", "vol-2", "vol-3"}) {
+            auto volume = std::make_shared<Volume>();
+            volume->id = id;
+            volume->path = std::string("./") + id;
+            mkdir(volume->path.c_str(), 0755);
+            mkdir((volume->path + "/ABC").c_str(), 0755);
+            volumes.Add(volume);
+        }
+        // Keep the space set by the tests
+        volumes.Refresh();
+    }
+    void TearDown() override {}
+
+ protected:
+    Volumes volumes {std::chrono::hours(1)};
+};
+
+TEST(Volume, ChunkId) {
+    ASSERT_TRUE(blob::ValidChunkId("09C7861345B1834C"));
+    ASSERT_TRUE(blob::ValidChunkId("abc"));
+    ASSERT_FALSE(blob::ValidChunkId("AB"));
+    ASSERT_FALSE(blob::ValidChunkId("09C/09C7"));
+    ASSERT_FALSE(blob::ValidChunkId("../etc"));
+    ASSERT_EQ("/vol/09C/09C7", blob::ChunkPathIn("/vol", "09C7"));
+    std::string path(64, 'x');
+    blob::ChunkPathIn("/vol", "09C7", &path);
+    ASSERT_EQ("/vol/09C/09C7", path);
+}
+
+TEST(Volume, ParseList) {
+    std::vector<std::pair<std::string, std::string>> list;
+    ASSERT_TRUE(blob::ParseVolumeList("/srv/disk1/,rawx-2=/srv/disk2", &list));
+    ASSERT_EQ(2u, list.size());
+    ASSERT_EQ("disk1", list[0].first);
+    ASSERT_EQ("/srv/disk1/", list[0].second);
+    ASSERT_EQ("rawx-2", list[1].first);
+    ASSERT_EQ("/srv/disk2", list[1].second);
+    ASSERT_TRUE(blob::ParseVolumeList("data", &list));
+    ASSERT_EQ("data", list[0].first);
+    ASSERT_FALSE(blob::ParseVolumeList("", &list));
+    ASSERT_FALSE(blob::ParseVolumeList("/srv/a,,/srv/b", &list));
+    ASSERT_FALSE(blob::ParseVolumeList("=/srv/a", &list));
+    ASSERT_FALSE(blob::ParseVolumeList("/", &list));
+}
+
+TEST_F(VolumesFixture, Add) {
+    auto twin = std::make_shared<Volume>();
+    twin->id = "vol-1";
+    ASSERT_FALSE(volumes.Add(twin));
+    ASSERT_EQ(3u, volumes.All().size());
+    ASSERT_EQ("./vol-2", volumes.Find("vol-2")->path);
+    ASSERT_EQ(nullptr, volumes.Find("vol-4"));
+}
+
+TEST_F(VolumesFixture, Route) {
+    std::string id;
+    auto volume = volumes.Route("/vol-2/09C7861345B1834C", &id);
+    ASSERT_NE(nullptr, volume);
+    ASSERT_EQ("vol-2", volume->id);
+    ASSERT_EQ("09C7861345B1834C", id);
+    ASSERT_EQ(nullptr, volumes.Route("/09C7861345B1834C", &id));
+    ASSERT_EQ("09C7861345B1834C", id);
+    ASSERT_EQ(nullptr, volumes.Route("/vol-4/09C7861345B1834C", &id));
+    ASSERT_EQ("", id);
+}
+
+TEST_F(VolumesFixture, Locate) {
+    int fd = open("./vol-3/ABC/ABCDEF", O_CREAT|O_WRONLY, 0644);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    auto volume = volumes.Locate("ABCDEF");
+    ASSERT_NE(nullptr, volume);
+    ASSERT_EQ("vol-3", volume->id);
+    ASSERT_EQ(nullptr, volumes.Locate("ABCDEE"));
+    unlink("./vol-3/ABC/ABCDEF");
+
+    Volumes single;
+    single.Add(volumes.Find("vol-1"));
+    ASSERT_EQ("vol-1", single.Locate("ABCDEE")->id);
+}
+
+TEST_F(VolumesFixture, PlaceByFreeSpace) {
+    volumes.Find("vol-1")->availBytes = 0;
+    volumes.Find("vol-2")->availBytes = 1000;
+    volumes.Find("vol-3")->availBytes = 3000;
+    std::map<std::string, int> placed;
+    for (int i = 0; i < 4000; i++)
+        placed[volumes.Place(0)->id]++;
+    ASSERT_EQ(0, placed["vol-1"]);
+    ASSERT_GT(placed["vol-3"], placed["vol-2"]);
+    // Too large for vol-2
+    for (int i = 0; i < 100; i++)
+        ASSERT_EQ("vol-3", volumes.Place(2000)->id);
+    ASSERT_EQ(nullptr, volumes.Place(5000));
+}
+
+TEST_F(VolumesFixture, PlaceWithoutRefresh) {
+    for (auto &volume : volumes.All())
+        volume->availBytes = 0;
+    ASSERT_FALSE(volumes.Stale());
+    ASSERT_EQ(nullptr, volumes.Place(0));
+    volumes.RefreshIfStale();
+    ASSERT_EQ(0u, volumes.Find("vol-1")->availBytes);
+
+    Volumes often {std::chrono::milliseconds(0)};
+    often.Add(volumes.Find("vol-1"));
+    ASSERT_TRUE(often.Stale());
+    often.RefreshIfStale();
+    ASSERT_LT(0u, volumes.Find("vol-1")->availBytes);
+    ASSERT_EQ("vol-1", often.Place(0)->id);
+}
+
+TEST_F(VolumesFixture, RefreshKeepsUsage) {
+    auto volume = volumes.Find("vol-1");
+    ASSERT_TRUE(volume->stated);
+    ASSERT_LT(0u, volume->totalBytes);
+    ASSERT_LE(volume->availBytes, volume->freeBytes);
+    ASSERT_LE(volume->freeBytes, volume->totalBytes);
+    ASSERT_LE(volume->freeInodes, volume->totalInodes);
+
+    auto missing = std::make_shared<Volume>();
+    missing->id = "vol-missing";
+    missing->path = "./vol-missing";
+    Volumes lost;
+    lost.Add(missing);
+    lost.Refresh();
+    ASSERT_FALSE(missing->stated);
+    ASSERT_EQ(0u, missing->totalBytes);
+}
+
+TEST_F(VolumesFixture, PlaceByLoad) {
+    for (auto &volume : volumes.All())
+        volume->availBytes = 1000;
+    volumes.Find("vol-1")->inflight = 10;
+    std::map<std::string, int> placed;
+    for (int i = 0; i < 3000; i++)
+        placed[volumes.Place(0)->id]++;
+    // Only chosen when drawn twice
+    ASSERT_LT(placed["vol-1"], placed["vol-2"] / 2);
+    ASSERT_LT(placed["vol-1"], placed["vol-3"] / 2);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -19,6 +19,9 @@
 #include <glog/logging.h>
 #include <gflags/gflags.h>
 #include <gtest/gtest.h>
+#include <unistd.h>
+#include <cstdio>
+#include <string>
 #include "utils.hpp"
 
 using utils::XAttr;
@@ -192,6 +195,108 @@ TEST_F(XAttrFixture, XATTR_2_HTTP_chunk_size) {
     ASSERT_EQ(test_message, xattr.getHTTP(http_field_name));
 }
 
+TEST(AttrNames, Prefixed) {
+    for (auto &names : utils::kAttributes) {
+        ASSERT_EQ(std::string(utils::kHeaderPrefix) + names.http,
+                  names.header);
+        ASSERT_EQ(std::string(utils::kXAttrPrefix) + names.xattr, names.key);
+    }
+    ASSERT_STREQ("chunk-pos", utils::NamesOf(utils::Attr::ChunkPosition).http);
+}
+
+TEST_F(XAttrFixture, SetHeader) {
+    ASSERT_TRUE(xattr.SetHeader("X-oio-chunk-meta-chunk-id", "AB"));
+    ASSERT_EQ("AB", xattr.Get(utils::Attr::ChunkId));
+    // HTTP/2 lowers the names
+    ASSERT_TRUE(xattr.SetHeader("x-oio-chunk-meta-container-id", "CD"));
+    ASSERT_EQ("CD", xattr.getHTTP("container-id"));
+    ASSERT_FALSE(xattr.SetHeader("X-oio-chunk-meta-unknown", "EF"));
+    ASSERT_FALSE(xattr.SetHeader("X-oio-chunk-meta-", "EF"));
+    ASSERT_FALSE(xattr.SetHeader("Content-Length", "12"));
+}
+
+TEST_F(XAttrFixture, RetrieveByPath) {
+    ASSERT_FALSE(xattr.retrieveXAttr(std::string("./nosuchchunk")));
+    FILE *file = fopen("./plainchunk", "w");
+    ASSERT_TRUE(file != NULL);
+    fclose(file);
+    ASSERT_TRUE(xattr.retrieveXAttr(std::string("./plainchunk")));
+    ASSERT_EQ("", xattr.getXAttr("chunk.hash"));
+    unlink("./plainchunk");
+}
+
+TEST(ETag, FromHash) {
+    ASSERT_EQ("\"09C7\"", utils::ChunkETag("09C7"));
+    ASSERT_EQ("", utils::ChunkETag(""));
+    std::string etag("\"previous\"");
+    utils::ChunkETag("09C7", &etag);
+    ASSERT_EQ("\"09C7\"", etag);
+    utils::ChunkETag("", &etag);
+    ASSERT_EQ("", etag);
+}
+
+TEST(ETag, Preconditions) {
+    using utils::Precondition;
+    using utils::EvaluatePreconditions;
+    std::string etag {"\"09C7\""};
+    ASSERT_EQ(Precondition::Proceed, EvaluatePreconditions(etag, "", ""));
+    ASSERT_EQ(Precondition::Proceed,
+              EvaluatePreconditions(etag, "\"AB\", \"09C7\"", ""));
+    ASSERT_EQ(Precondition::Proceed, EvaluatePreconditions(etag, "*", ""));
+    ASSERT_EQ(Precondition::Failed,
+              EvaluatePreconditions(etag, "\"AB\"", ""));
+    // If-Match compares strongly
+    ASSERT_EQ(Precondition::Failed,
+              EvaluatePreconditions(etag, "W/\"09C7\"", ""));
+    ASSERT_EQ(Precondition::Failed, EvaluatePreconditions("", "\"AB\"", ""));
+    ASSERT_EQ(Precondition::NotModified,
+              EvaluatePreconditions(etag, "", "\"AB\" ,W/\"09C7\""));
+    ASSERT_EQ(Precondition::NotModified,
+              EvaluatePreconditions(etag, "", "*"));
+    ASSERT_EQ(Precondition::Proceed,
+              EvaluatePreconditions(etag, "", "\"AB\""));
+    // If-Match first
+    ASSERT_EQ(Precondition::Failed,
+              EvaluatePreconditions(etag, "\"AB\"", "\"09C7\""));
+}
+
+TEST(ETag, WeakPreconditions) {
+    using utils::Precondition;
+    using utils::EvaluatePreconditions;
+    // The tag of a chunk sent as stored, revalidated by its own 200
+    std::string etag {"W/\"09C7\""};
+    ASSERT_EQ(Precondition::NotModified,
+              EvaluatePreconditions(etag, "", "W/\"09C7\""));
+    ASSERT_EQ(Precondition::NotModified,
+              EvaluatePreconditions(etag, "", "\"09C7\""));
+    ASSERT_EQ(Precondition::Proceed,
+              EvaluatePreconditions(etag, "", "W/\"AB\""));
+    // Never strongly equal, but present
+    ASSERT_EQ(Precondition::Failed,
+              EvaluatePreconditions(etag, "W/\"09C7\"", ""));
+    ASSERT_EQ(Precondition::Proceed, EvaluatePreconditions(etag, "*", ""));
+}
+
+TEST(ETag, IfRange) {
+    std::string etag {"\"09C7\""};
+    ASSERT_TRUE(utils::RangeApplies(etag, ""));
+    ASSERT_TRUE(utils::RangeApplies(etag, " \"09C7\""));
+    ASSERT_FALSE(utils::RangeApplies(etag, "\"AB\""));
+    ASSERT_FALSE(utils::RangeApplies(etag, "W/\"09C7\""));
+    ASSERT_FALSE(utils::RangeApplies(etag, "Wed, 21 Oct 2015 07:28:00 GMT"));
+    ASSERT_FALSE(utils::RangeApplies("", "\"09C7\""));
+}
+
+TEST(Encoding, Accepts) {
+    ASSERT_TRUE(utils::AcceptsCoding("zstd", "zstd"));
+    ASSERT_TRUE(utils::AcceptsCoding("gzip, ZSTD;q=0.5", "zstd"));
+    ASSERT_TRUE(utils::AcceptsCoding(" lz4 ,gzip", "lz4"));
+    ASSERT_FALSE(utils::AcceptsCoding("zstd;q=0", "zstd"));
+    ASSERT_FALSE(utils::AcceptsCoding("gzip, br", "zstd"));
+    ASSERT_FALSE(utils::AcceptsCoding("*", "zstd"));
+    ASSERT_FALSE(utils::AcceptsCoding("", "zstd"));
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
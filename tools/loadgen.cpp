@@ -0,0 +1,684 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <mutex> // NOLINT
+#include <sstream>
+#include <string>
+#include <thread> // NOLINT
+#include <vector>
+#include "loadgen.hpp"
+
+using loadgen::Chunk;
+using loadgen::Client;
+using loadgen::Headers;
+using loadgen::Op;
+using loadgen::OpMix;
+using loadgen::Protocol;
+using loadgen::Report;
+using loadgen::Request;
+using loadgen::Response;
+using loadgen::SizeDistribution;
+using loadgen::Workload;
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+/** Body of the uploads, sent again and again */
+const std::vector<char> &pattern() {
+    static std::vector<char> data = []() {
+        std::vector<char> data(64 * 1024);
+        for (size_t i = 0; i < data.size(); i++)
+            data[i] = 'a' + (i % 26);
+        return data;
+    }();
+    return data;
+}
+
+std::vector<std::string> split(const std::string &value, char separator) {
+    std::vector<std::string> parts;
+    std::stringstream in(value);
+    std::string part;
+    while (std::getline(in, part, separator))
+        parts.push_back(part);
+    return parts;
+}
+
+/**
+ * HTTP/1.1 over a blocking socket, with a buffered reader for the replies
+ * (Content-Length, chunked, or up to the close of the connection).
+ */
+class Http1Client : public Client {
+ public:
+    Http1Client(const std::string &host, uint16_t port, bool reuse)
+            : host{host}, port{port}, reuse{reuse}, buffer(64 * 1024) {}
+    ~Http1Client() { disconnect(); }
+
+    bool Execute(const Request &request, Response *response) override {
+        if (fd < 0 && !connect())
+            return false;
+        if (!send(request) || !receive(request, response)) {
+            disconnect();
+            return false;
+        }
+        if (!reuse || closing)
+            disconnect();
+        return true;
+    }
+
+ private:
+    bool connect() {
+        struct addrinfo hints, *result = nullptr;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints,
+                        &result) != 0)
+            return false;
+        for (auto ai = result; ai != nullptr; ai = ai->ai_next) {
+            fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC,
+                        ai->ai_protocol);
+            if (fd < 0)
+                continue;
+            if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+                break;
+            ::close(fd);
+            fd = -1;
+        }
+        freeaddrinfo(result);
+        if (fd < 0)
+            return false;
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        start = end = 0;
+        closing = false;
+        return true;
+    }
+
+    void disconnect() {
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+    }
+
+    bool sendAll(const char *data, size_t length) {
+        while (length > 0) {
+            ssize_t rc = ::send(fd, data, length, MSG_NOSIGNAL);
+            if (rc < 0 && errno == EINTR)
+                continue;
+            if (rc <= 0)
+                return false;
+            data += rc;
+            length -= rc;
+        }
+        return true;
+    }
+
+    bool send(const Request &request) {
+        std::string head = request.method + " " + request.path
+                + " HTTP/1.1\r\nHost: " + host + ":" + std::to_string(port)
+                + "\r\n";
+        if (request.method == "PUT")
+            head += "Content-Length: " + std::to_string(request.bodySize)
+                    + "\r\n";
+        for (auto &header : request.headers)
+            head += header.first + ": " + header.second + "\r\n";
+        if (!reuse)
+            head += "Connection: close\r\n";
+        head += "\r\n";
+        if (!sendAll(head.data(), head.size()))
+            return false;
+        auto &body = pattern();
+        for (uint64_t sent = 0; sent < request.bodySize;) {
+            size_t length = std::min<uint64_t>(body.size(),
+                                               request.bodySize - sent);
+            if (!sendAll(body.data(), length))
+                return false;
+            sent += length;
+        }
+        return true;
+    }
+
+    /** Make sure some bytes are buffered. @return false at EOF/error */
+    bool fill() {
+        if (start < end)
+            return true;
+        start = end = 0;
+        while (true) {
+            ssize_t rc = ::recv(fd, buffer.data(), buffer.size(), 0);
+            if (rc < 0 && errno == EINTR)
+                continue;
+            if (rc <= 0)
+                return false;
+            end = rc;
+            return true;
+        }
+    }
+
+    bool readLine(std::string *line) {
+        line->clear();
+        while (fill()) {
+            char *data = buffer.data() + start;
+            char *eol = static_cast<char *>(memchr(data, '\n', end - start));
+            if (eol == nullptr) {
+                line->append(data, end - start);
+                start = end;
+                continue;
+            }
+            line->append(data, eol - data);
+            start += eol - data + 1;
+            if (!line->empty() && line->back() == '\r')
+                line->pop_back();
+            return true;
+        }
+        return false;
+    }
+
+    /** Read and drop length bytes of body */
+    bool skip(uint64_t length, Response *response) {
+        while (length > 0) {
+            if (!fill())
+                return false;
+            uint64_t n = std::min<uint64_t>(length, end - start);
+            start += n;
+            length -= n;
+            response->bytes += n;
+        }
+        return true;
+    }
+
+    bool receive(const Request &request, Response *response) {
+        std::string line;
+        if (!readLine(&line) || line.compare(0, 5, "HTTP/") != 0)
+            return false;
+        auto space = line.find(' ');
+        if (space == std::string::npos)
+            return false;
+        response->status = atoi(line.c_str() + space + 1);
+        response->bytes = 0;
+        int64_t length = -1;
+        bool chunked = false;
+        closing = line.compare(0, 8, "HTTP/1.0") == 0;
+        while (true) {
+            if (!readLine(&line))
+                return false;
+            if (line.empty())
+                break;
+            auto colon = line.find(':');
+            if (colon == std::string::npos)
+                continue;
+            std::string name = line.substr(0, colon);
+            std::string value = line.substr(
+                line.find_first_not_of(' ', colon + 1) == std::string::npos
+                ? line.size() : line.find_first_not_of(' ', colon + 1));
+            if (strcasecmp(name.c_str(), "Content-Length") == 0)
+                length = strtoll(value.c_str(), nullptr, 10);
+            else if (strcasecmp(name.c_str(), "Transfer-Encoding") == 0)
+                chunked = strcasestr(value.c_str(), "chunked") != nullptr;
+            else if (strcasecmp(name.c_str(), "Connection") == 0)
+                closing = strcasecmp(value.c_str(), "close") == 0;
+        }
+        if (request.method == "HEAD" || response->status == 204
+                || response->status == 304 || response->status / 100 == 1)
+            return true;
+        if (chunked) {
+            while (true) {
+                if (!readLine(&line))
+                    return false;
+                uint64_t size = strtoull(line.c_str(), nullptr, 16);
+                if (size == 0)
+                    break;
+                if (!skip(size, response) || !readLine(&line))
+                    return false;
+            }
+            // Trailers
+            do {
+                if (!readLine(&line))
+                    return false;
+            } while (!line.empty());
+            return true;
+        }
+        if (length >= 0)
+            return skip(length, response);
+        // Delimited by the end of the connection
+        closing = true;
+        while (fill()) {
+            response->bytes += end - start;
+            start = end;
+        }
+        return true;
+    }
+
+    std::string host;
+    uint16_t port;
+    bool reuse;
+    int fd {-1};
+    bool closing {false};
+    std::vector<char> buffer;
+    size_t start {0};
+    size_t end {0};
+};
+
+/**
+ * The chunks uploaded so far, where the reads and the deletions pick.
+ */
+class ChunkPool {
+ public:
+    void Add(Chunk chunk) {
+        std::lock_guard<std::mutex> lock(mutex);
+        chunks.push_back(std::move(chunk));
+    }
+    bool Pick(std::mt19937_64 *rng, Chunk *chunk) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (chunks.empty())
+            return false;
+        *chunk = chunks[(*rng)() % chunks.size()];
+        return true;
+    }
+    bool Take(std::mt19937_64 *rng, Chunk *chunk) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (chunks.empty())
+            return false;
+        size_t i = (*rng)() % chunks.size();
+        *chunk = std::move(chunks[i]);
+        chunks[i] = std::move(chunks.back());
+        chunks.pop_back();
+        return true;
+    }
+
+ private:
+    std::mutex mutex;
+    std::vector<Chunk> chunks;
+};
+
+struct OpCounters {
+    std::atomic<uint64_t> ok {0};
+    std::atomic<uint64_t> errors {0};
+    std::atomic<uint64_t> bytes {0};
+    utils::LatencyHistogram latency;
+};
+
+/**
+ * State shared by the threads of a run.
+ */
+struct Shared {
+    const Workload &workload;
+    std::string containerID;
+    ChunkPool pool;
+    std::array<OpCounters, loadgen::kOps> ops;
+    std::atomic<uint64_t> issued {0};
+    Clock::time_point deadline;
+    explicit Shared(const Workload &workload) : workload{workload} {}
+};
+
+bool expected(Op op, int status) {
+    switch (op) {
+        case Op::Put:
+            return status == 201;
+        case Op::Get:
+            return status == 200 || status == 206;
+        case Op::Range:
+            return status == 206;
+        case Op::Delete:
+            return status == 204;
+        case Op::Count:
+            break;
+    }
+    return false;
+}
+
+/**
+ * Build the request of the operation. The reads and the deletions turn
+ * into uploads while no chunk is available.
+ */
+Op prepare(Shared *shared, std::mt19937_64 *rng, Op op, Request *request,
+           Chunk *chunk) {
+    const Workload &workload = shared->workload;
+    std::string requestID = loadgen::RandomHex(rng, 32);
+    if (op == Op::Delete && !shared->pool.Take(rng, chunk))
+        op = Op::Put;
+    if ((op == Op::Get || op == Op::Range) && !shared->pool.Pick(rng, chunk))
+        op = Op::Put;
+    request->headers.clear();
+    request->bodySize = 0;
+    if (op == Op::Put) {
+        chunk->id = loadgen::RandomHex(rng, 64);
+        chunk->size = workload.sizes.Pick(rng);
+        request->method = "PUT";
+        request->headers = loadgen::PutHeaders(*chunk, shared->containerID,
+                                               requestID);
+        request->bodySize = chunk->size;
+    } else {
+        request->method = op == Op::Delete ? "DELETE" : "GET";
+        request->headers.emplace_back("X-oio-req-id", requestID);
+    }
+    if (op == Op::Range && chunk->size > 0) {
+        uint64_t length = std::min(workload.rangeSize, chunk->size);
+        uint64_t begin = (*rng)() % (chunk->size - length + 1);
+        request->headers.emplace_back("Range", "bytes="
+            + std::to_string(begin) + "-" + std::to_string(begin + length - 1));
+    }
+    request->path = "/" + chunk->id;
+    return op;
+}
+
+std::unique_ptr<Client> newClient(const Workload &workload) {
+    if (workload.protocol == Protocol::H2c)
+        return loadgen::NewH2cClient(workload.host, workload.port,
+                                     workload.reuse);
+    return loadgen::NewHttp1Client(workload.host, workload.port,
+                                   workload.reuse);
+}
+
+void prefill(Shared *shared, unsigned int thread, unsigned int count) {
+    std::mt19937_64 rng(shared->workload.seed * 1000003 + thread + 7);
+    auto client = newClient(shared->workload);
+    for (unsigned int i = 0; i < count; i++) {
+        Request request;
+        Response response;
+        Chunk chunk;
+        prepare(shared, &rng, Op::Put, &request, &chunk);
+        if (client->Execute(request, &response) && response.status == 201)
+            shared->pool.Add(chunk);
+    }
+}
+
+void work(Shared *shared, unsigned int thread) {
+    const Workload &workload = shared->workload;
+    std::mt19937_64 rng(workload.seed * 1000003 + thread);
+    auto client = newClient(workload);
+    Request request;
+    Chunk chunk;
+    while (Clock::now() < shared->deadline) {
+        if (workload.requests > 0 && shared->issued++ >= workload.requests)
+            break;
+        Op op = prepare(shared, &rng, workload.mix.Pick(&rng), &request,
+                        &chunk);
+        Response response;
+        auto start = Clock::now();
+        bool ok = client->Execute(request, &response);
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            Clock::now() - start).count();
+        auto &counters = shared->ops[static_cast<unsigned int>(op)];
+        counters.latency.Record(elapsed);
+        if (ok && expected(op, response.status)) {
+            counters.ok++;
+            counters.bytes += op == Op::Put ? request.bodySize
+                    : response.bytes;
+            if (op == Op::Put)
+                shared->pool.Add(chunk);
+        } else {
+            counters.errors++;
+        }
+    }
+}
+
+}  // namespace
+
+const char *loadgen::OpName(Op op) {
+    static const char *names[kOps] = {"put", "get", "range", "delete"};
+    return names[static_cast<unsigned int>(op)];
+}
+
+bool loadgen::ProtocolParse(const std::string &value, Protocol *protocol) {
+    if (strcasecmp(value.c_str(), "http1") == 0) {
+        *protocol = Protocol::Http1;
+        return true;
+    }
+    if (strcasecmp(value.c_str(), "h2c") == 0) {
+        *protocol = Protocol::H2c;
+        return true;
+    }
+    return false;
+}
+
+bool loadgen::ParseSize(const std::string &value, uint64_t *size) {
+    if (value.empty())
+        return false;
+    char *end = nullptr;
+    uint64_t n = strtoull(value.c_str(), &end, 10);
+    if (end == value.c_str())
+        return false;
+    switch (*end) {
+        case '\0':
+            break;
+        case 'k': case 'K':
+            n <<= 10;
+            end++;
+            break;
+        case 'm': case 'M':
+            n <<= 20;
+            end++;
+            break;
+        case 'g': case 'G':
+            n <<= 30;
+            end++;
+            break;
+        default:
+            return false;
+    }
+    if (*end != '\0')
+        return false;
+    *size = n;
+    return true;
+}
+
+bool OpMix::Parse(const std::string &value) {
+    std::array<unsigned int, kOps> parsed {{0, 0, 0, 0}};
+    unsigned int total = 0;
+    for (auto &part : split(value, ',')) {
+        auto eq = part.find('=');
+        if (eq == std::string::npos)
+            return false;
+        std::string name = part.substr(0, eq);
+        unsigned int i = 0;
+        while (i < kOps && name != OpName(static_cast<Op>(i)))
+            i++;
+        if (i == kOps)
+            return false;
+        parsed[i] = atoi(part.c_str() + eq + 1);
+        total += parsed[i];
+    }
+    if (total == 0)
+        return false;
+    weights = parsed;
+    return true;
+}
+
+Op OpMix::Pick(std::mt19937_64 *rng) const {
+    unsigned int total = 0;
+    for (auto w : weights)
+        total += w;
+    unsigned int n = (*rng)() % total;
+    for (unsigned int i = 0; i < kOps; i++) {
+        if (n < weights[i])
+            return static_cast<Op>(i);
+        n -= weights[i];
+    }
+    return Op::Put;
+}
+
+bool SizeDistribution::Parse(const std::string &value) {
+    std::vector<Bucket> parsed;
+    for (auto &part : split(value, ',')) {
+        Bucket bucket {0, 0, 1};
+        auto colon = part.find(':');
+        if (colon != std::string::npos) {
+            bucket.weight = atoi(part.c_str() + colon + 1);
+            part.resize(colon);
+        }
+        auto dash = part.find('-');
+        if (!ParseSize(part.substr(0, dash), &bucket.low))
+            return false;
+        bucket.high = bucket.low;
+        if (dash != std::string::npos
+                && !ParseSize(part.substr(dash + 1), &bucket.high))
+            return false;
+        if (bucket.high < bucket.low || bucket.weight == 0)
+            return false;
+        parsed.push_back(bucket);
+    }
+    if (parsed.empty())
+        return false;
+    buckets = parsed;
+    return true;
+}
+
+uint64_t SizeDistribution::Pick(std::mt19937_64 *rng) const {
+    unsigned int total = 0;
+    for (auto &b : buckets)
+        total += b.weight;
+    unsigned int n = (*rng)() % total;
+    for (auto &b : buckets) {
+        if (n < b.weight)
+            return b.low + (*rng)() % (b.high - b.low + 1);
+        n -= b.weight;
+    }
+    return buckets.back().low;
+}
+
+std::string loadgen::RandomHex(std::mt19937_64 *rng, size_t length) {
+    static const char hex[] = "0123456789ABCDEF";
+    std::string out(length, '0');
+    uint64_t bits = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (i % 16 == 0)
+            bits = (*rng)();
+        out[i] = hex[bits & 0x0F];
+        bits >>= 4;
+    }
+    return out;
+}
+
+Headers loadgen::PutHeaders(const Chunk &chunk, const std::string &containerID,
+                            const std::string &requestID) {
+    const std::string prefix {"X-oio-chunk-meta-"};
+    return Headers {
+        {"X-oio-req-id", requestID},
+        {prefix + "container-id", containerID},
+        {prefix + "content-id", chunk.id.substr(0, 32)},
+        {prefix + "content-path", "loadgen-" + chunk.id.substr(0, 16)},
+        {prefix + "content-version", "1"},
+        {prefix + "content-storage-policy", "SINGLE"},
+        {prefix + "content-chunk-method", "plain/nb_copy=1"},
+        {prefix + "metachunk-size", std::to_string(chunk.size)},
+        {prefix + "chunk-id", chunk.id},
+        {prefix + "chunk-pos", "0"},
+    };
+}
+
+std::unique_ptr<Client> loadgen::NewHttp1Client(const std::string &host,
+                                                uint16_t port, bool reuse) {
+    return std::unique_ptr<Client>(new Http1Client(host, port, reuse));
+}
+
+Report loadgen::Run(const Workload &workload) {
+    Shared shared(workload);
+    std::mt19937_64 rng(workload.seed);
+    shared.containerID = RandomHex(&rng, 64);
+    unsigned int threads = std::max(workload.concurrency, 1u);
+
+    std::vector<std::thread> workers;
+    for (unsigned int i = 0; i < threads; i++) {
+        unsigned int count = workload.prefill / threads
+                + (i < workload.prefill % threads ? 1 : 0);
+        workers.emplace_back(prefill, &shared, i, count);
+    }
+    for (auto &w : workers)
+        w.join();
+    workers.clear();
+
+    auto start = Clock::now();
+    shared.deadline = start + workload.duration;
+    for (unsigned int i = 0; i < threads; i++)
+        workers.emplace_back(work, &shared, i);
+    for (auto &w : workers)
+        w.join();
+
+    Report report;
+    report.seconds = std::chrono::duration<double>(
+        Clock::now() - start).count();
+    for (unsigned int i = 0; i < kOps; i++) {
+        auto &op = report.ops[i];
+        op.ok = shared.ops[i].ok;
+        op.errors = shared.ops[i].errors;
+        op.bytes = shared.ops[i].bytes;
+        op.latency = shared.ops[i].latency.Snapshot();
+    }
+    return report;
+}
+
+static double millis(uint64_t nanos) {
+    return nanos / 1e6;
+}
+
+void Report::Print(std::ostream &out) const {
+    char line[256];
+    snprintf(line, sizeof(line), "%-7s %10s %8s %10s %10s %9s %9s %9s %9s\n",
+             "op", "ok", "errors", "req/s", "MiB/s", "p50 ms", "p90 ms",
+             "p99 ms", "p999 ms");
+    out << line;
+    for (unsigned int i = 0; i < kOps; i++) {
+        auto &op = ops[i];
+        if (op.ok + op.errors == 0)
+            continue;
+        snprintf(line, sizeof(line),
+                 "%-7s %10lu %8lu %10.1f %10.2f %9.3f %9.3f %9.3f %9.3f\n",
+                 OpName(static_cast<Op>(i)),
+                 static_cast<unsigned long>(op.ok),  // NOLINT
+                 static_cast<unsigned long>(op.errors),  // NOLINT
+                 Throughput(static_cast<Op>(i)),
+                 seconds > 0 ? op.bytes / seconds / (1 << 20) : 0,
+                 millis(op.latency.Percentile(0.5)),
+                 millis(op.latency.Percentile(0.9)),
+                 millis(op.latency.Percentile(0.99)),
+                 millis(op.latency.Percentile(0.999)));
+        out << line;
+    }
+}
+
+void Report::PrintJson(std::ostream &out) const {
+    out << "{\"seconds\": " << seconds << ", \"ops\": {";
+    bool first = true;
+    for (unsigned int i = 0; i < kOps; i++) {
+        auto &op = ops[i];
+        if (op.ok + op.errors == 0)
+            continue;
+        out << (first ? "" : ", ") << "\"" << OpName(static_cast<Op>(i))
+            << "\": {\"ok\": " << op.ok << ", \"errors\": " << op.errors
+            << ", \"bytes\": " << op.bytes
+            << ", \"rps\": " << Throughput(static_cast<Op>(i))
+            << ", \"p50_ms\": " << millis(op.latency.Percentile(0.5))
+            << ", \"p99_ms\": " << millis(op.latency.Percentile(0.99))
+            << "}";
+        first = false;
+    }
+    out << "}}\n";
+}
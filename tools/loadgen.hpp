@@ -0,0 +1,180 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#ifndef TOOLS_LOADGEN_HPP_
+#define TOOLS_LOADGEN_HPP_
+
+#include <array>
+#include <chrono> // NOLINT
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+#include "histogram.hpp"
+
+namespace loadgen {
+
+enum class Op : unsigned int {
+    Put, Get, Range, Delete, Count
+};
+
+constexpr unsigned int kOps = static_cast<unsigned int>(Op::Count);
+
+const char *OpName(Op op);
+
+enum class Protocol {
+    Http1, H2c
+};
+
+/** Parse "http1" or "h2c" */
+bool ProtocolParse(const std::string &value, Protocol *protocol);
+
+/**
+ * Parse a size with an optional K, M or G suffix (powers of 1024).
+ * @return false if the value is not a size
+ */
+bool ParseSize(const std::string &value, uint64_t *size);
+
+/**
+ * Weighted choice of the operations, e.g. "put=1,get=4,range=2,delete=1".
+ * The missing operations have a null weight.
+ */
+class OpMix {
+ public:
+    bool Parse(const std::string &value);
+    Op Pick(std::mt19937_64 *rng) const;
+    inline unsigned int Weight(Op op) const {
+        return weights[static_cast<unsigned int>(op)];
+    }
+
+ private:
+    std::array<unsigned int, kOps> weights {{1, 1, 0, 0}};
+};
+
+/**
+ * Distribution of the chunk sizes: "1M" (fixed), "4K-1M" (uniform), or a
+ * weighted list of sizes and ranges "4K:50,64K-1M:40,8M:10".
+ */
+class SizeDistribution {
+ public:
+    bool Parse(const std::string &value);
+    uint64_t Pick(std::mt19937_64 *rng) const;
+
+ private:
+    struct Bucket {
+        uint64_t low;
+        uint64_t high;
+        unsigned int weight;
+    };
+    std::vector<Bucket> buckets {{1 << 20, 1 << 20, 1}};
+};
+
+struct Workload {
+    std::string host {"127.0.0.1"};
+    uint16_t port {6200};
+    Protocol protocol {Protocol::Http1};
+    /** Number of requests in flight, one connection each */
+    unsigned int concurrency {8};
+    /** Keep the connections open between the requests */
+    bool reuse {true};
+    OpMix mix;
+    SizeDistribution sizes;
+    /** Length of the Range reads */
+    uint64_t rangeSize {64 * 1024};
+    /** Chunks uploaded before the measure, for the reads */
+    unsigned int prefill {0};
+    std::chrono::seconds duration {10};
+    /** Stop after this many requests, 0 for no limit */
+    uint64_t requests {0};
+    uint64_t seed {0};
+};
+
+using Headers = std::vector<std::pair<std::string, std::string>>;
+
+struct Chunk {
+    std::string id;
+    uint64_t size {0};
+};
+
+/** @return a random uppercase hexadecimal string */
+std::string RandomHex(std::mt19937_64 *rng, size_t length);
+
+/**
+ * The headers of a PUT as sent by the oio clients, the chunk is the only
+ * one of a content stored with a single copy.
+ */
+Headers PutHeaders(const Chunk &chunk, const std::string &containerID,
+                   const std::string &requestID);
+
+struct Request {
+    std::string method;
+    std::string path;
+    Headers headers;
+    /** Size of the generated body */
+    uint64_t bodySize {0};
+};
+
+struct Response {
+    int status {0};
+    uint64_t bytes {0};
+};
+
+/**
+ * A connection to the rawx, used by one thread.
+ */
+class Client {
+ public:
+    virtual ~Client() {}
+    /** @return false on a transport error, the connection is dropped */
+    virtual bool Execute(const Request &request, Response *response) = 0;
+};
+
+std::unique_ptr<Client> NewHttp1Client(const std::string &host, uint16_t port,
+                                       bool reuse);
+std::unique_ptr<Client> NewH2cClient(const std::string &host, uint16_t port,
+                                     bool reuse);
+
+struct OpReport {
+    uint64_t ok {0};
+    uint64_t errors {0};
+    uint64_t bytes {0};
+    utils::HistogramSnapshot latency;
+};
+
+struct Report {
+    std::array<OpReport, kOps> ops;
+    double seconds {0};
+
+    inline double Throughput(Op op) const {
+        auto &r = ops[static_cast<unsigned int>(op)];
+        return seconds > 0 ? (r.ok + r.errors) / seconds : 0;
+    }
+    /** Human readable table, one line per operation */
+    void Print(std::ostream &out) const;
+    void PrintJson(std::ostream &out) const;
+};
+
+/** Run the workload against the rawx, from several threads */
+Report Run(const Workload &workload);
+
+}  // namespace loadgen
+
+#endif  // TOOLS_LOADGEN_HPP_
@@ -0,0 +1,186 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <folly/SocketAddress.h>
+#include <folly/io/IOBuf.h>
+#include <folly/io/async/EventBase.h>
+#include <folly/io/async/HHWheelTimer.h>
+#include <proxygen/lib/http/HTTPConnector.h>
+#include <proxygen/lib/http/HTTPMessage.h>
+#include <proxygen/lib/http/session/HTTPTransaction.h>
+#include <proxygen/lib/http/session/HTTPUpstreamSession.h>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+#include "loadgen.hpp"
+
+using loadgen::Client;
+using loadgen::Request;
+using loadgen::Response;
+
+namespace {
+
+/**
+ * HTTP/2 over cleartext, without upgrade (prior knowledge). Each client
+ * owns an EventBase looped by the calling thread until the reply is
+ * complete, so the Execute() stays blocking like the HTTP/1.1 client.
+ */
+class H2cClient : public Client,
+                  private proxygen::HTTPConnector::Callback,
+                  private proxygen::HTTPTransactionHandler {
+ public:
+    H2cClient(const std::string &host, uint16_t port, bool reuse)
+            : address{host, port, true}, reuse{reuse},
+              timer{folly::HHWheelTimer::newTimer(
+                  &evb, std::chrono::milliseconds(
+                      folly::HHWheelTimer::DEFAULT_TICK_INTERVAL),
+                  folly::AsyncTimeout::InternalEnum::NORMAL,
+                  std::chrono::seconds(30))},
+              body(64 * 1024, 'x') {}
+
+    ~H2cClient() { disconnect(); }
+
+    bool Execute(const Request &request, Response *response) override {
+        if (session == nullptr && !connect())
+            return false;
+        this->response = response;
+        response->status = 0;
+        response->bytes = 0;
+        done = failed = paused = false;
+        remaining = request.bodySize;
+
+        auto txn = session->newTransaction(this);
+        if (txn == nullptr) {
+            disconnect();
+            return false;
+        }
+        proxygen::HTTPMessage message;
+        message.setMethod(request.method);
+        message.setURL(request.path);
+        message.setHTTPVersion(1, 1);
+        message.getHeaders().add(proxygen::HTTP_HEADER_HOST,
+                                 address.describe());
+        for (auto &header : request.headers)
+            message.getHeaders().add(header.first, header.second);
+        if (request.method == "PUT")
+            message.getHeaders().add(proxygen::HTTP_HEADER_CONTENT_LENGTH,
+                                     std::to_string(request.bodySize));
+        txn->sendHeaders(message);
+        pump();
+        while (!done)
+            evb.loopOnce();
+        if (failed || !reuse)
+            disconnect();
+        return !failed;
+    }
+
+ private:
+    bool connect() {
+        connected = false;
+        proxygen::HTTPConnector connector(this, timer.get());
+        connector.setPlaintextProtocol("h2c");
+        connector.connect(&evb, address, std::chrono::seconds(5));
+        while (connector.isBusy())
+            evb.loopOnce();
+        return connected;
+    }
+
+    void disconnect() {
+        if (session != nullptr) {
+            session->dropConnection();
+            session = nullptr;
+        }
+        evb.loopOnce(EVLOOP_NONBLOCK);
+    }
+
+    /** Send the body while the flow control allows it */
+    void pump() {
+        while (transaction != nullptr && !paused && remaining > 0) {
+            size_t length = std::min<uint64_t>(body.size(), remaining);
+            transaction->sendBody(folly::IOBuf::copyBuffer(body.data(),
+                                                           length));
+            remaining -= length;
+        }
+        if (transaction != nullptr && remaining == 0 && !eomSent) {
+            eomSent = true;
+            transaction->sendEOM();
+        }
+    }
+
+    // HTTPConnector::Callback
+    void connectSuccess(proxygen::HTTPUpstreamSession *s) override {
+        session = s;
+        connected = true;
+    }
+    void connectError(const folly::AsyncSocketException &) override {
+        session = nullptr;
+        connected = false;
+    }
+
+    // HTTPTransactionHandler
+    void setTransaction(proxygen::HTTPTransaction *txn) noexcept override {
+        transaction = txn;
+        eomSent = false;
+    }
+    void detachTransaction() noexcept override {
+        transaction = nullptr;
+        done = true;
+    }
+    void onHeadersComplete(
+            std::unique_ptr<proxygen::HTTPMessage> msg) noexcept override {
+        response->status = msg->getStatusCode();
+    }
+    void onBody(std::unique_ptr<folly::IOBuf> chain) noexcept override {
+        response->bytes += chain->computeChainDataLength();
+    }
+    void onTrailers(
+            std::unique_ptr<proxygen::HTTPHeaders>) noexcept override {}
+    void onEOM() noexcept override { done = true; }
+    void onUpgrade(proxygen::UpgradeProtocol) noexcept override {}
+    void onError(const proxygen::HTTPException &) noexcept override {
+        failed = done = true;
+    }
+    void onEgressPaused() noexcept override { paused = true; }
+    void onEgressResumed() noexcept override {
+        paused = false;
+        pump();
+    }
+
+    folly::SocketAddress address;
+    bool reuse;
+    folly::EventBase evb;
+    folly::HHWheelTimer::UniquePtr timer;
+    proxygen::HTTPUpstreamSession *session {nullptr};
+    proxygen::HTTPTransaction *transaction {nullptr};
+    Response *response {nullptr};
+    std::vector<char> body;
+    uint64_t remaining {0};
+    bool connected {false};
+    bool done {false};
+    bool failed {false};
+    bool paused {false};
+    bool eomSent {false};
+};
+
+}  // namespace
+
+std::unique_ptr<Client> loadgen::NewH2cClient(const std::string &host,
+                                              uint16_t port, bool reuse) {
+    return std::unique_ptr<Client>(new H2cClient(host, port, reuse));
+}
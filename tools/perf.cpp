@@ -0,0 +1,178 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <sys/statfs.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "perf.hpp"
+
+using loadgen::Expectation;
+using loadgen::Op;
+using loadgen::Report;
+using loadgen::Verdict;
+
+static bool lowerIsBetter(const std::string &metric) {
+    return metric == "p99_ms";
+}
+
+bool loadgen::ParseBaseline(std::istream &in,
+                            std::vector<Expectation> *baseline,
+                            std::string *error) {
+    std::string line;
+    while (std::getline(in, line)) {
+        auto hash = line.find('#');
+        if (hash != std::string::npos)
+            line.resize(hash);
+        std::istringstream fields(line);
+        Expectation e;
+        if (!(fields >> e.workload))
+            continue;
+        std::string extra;
+        if (!(fields >> e.metric >> e.value >> e.tolerance) || (fields >> extra)
+                || (e.metric != "rps" && e.metric != "mibps"
+                    && e.metric != "p99_ms")
+                || e.tolerance < 0) {
+            *error = line;
+            return false;
+        }
+        baseline->push_back(e);
+    }
+    return true;
+}
+
+void loadgen::PrintBaseline(std::ostream &out,
+                            const std::vector<Expectation> &baseline,
+                            const std::vector<std::string> &comment) {
+    for (auto &line : comment)
+        out << "# " << line << "\n";
+    out << "# workload metric value tolerance\n";
+    char line[256];
+    for (auto &e : baseline) {
+        snprintf(line, sizeof(line), "%-14s %-7s %12.3f %5.2f\n",
+                 e.workload.c_str(), e.metric.c_str(), e.value, e.tolerance);
+        out << line;
+    }
+}
+
+/** @return the value of the first line of the file starting with key */
+static std::string field(const char *file, const std::string &key) {
+    std::ifstream in(file);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.compare(0, key.size(), key) != 0)
+            continue;
+        auto colon = line.find(':');
+        if (colon == std::string::npos)
+            return "";
+        auto start = line.find_first_not_of(" \t", colon + 1);
+        return start == std::string::npos ? "" : line.substr(start);
+    }
+    return "";
+}
+
+static const char *filesystemName(int64_t type) {
+    switch (type) {
+        case 0xEF53:
+            return "ext4";
+        case 0x58465342:
+            return "xfs";
+        case 0x9123683E:
+            return "btrfs";
+        case 0x01021994:
+            return "tmpfs";
+        default:
+            return "unknown";
+    }
+}
+
+std::string loadgen::MachineSpec(const std::string &volume) {
+    std::string cpu = field("/proc/cpuinfo", "model name");
+    std::string memory = field("/proc/meminfo", "MemTotal");
+    struct utsname name;
+    std::string kernel = uname(&name) == 0 ? name.release : "unknown";
+    struct statfs fs;
+    std::string filesystem = statfs(volume.c_str(), &fs) == 0
+            ? filesystemName(fs.f_type) : "unknown";
+    return (cpu.empty() ? "unknown CPU" : cpu) + " x "
+            + std::to_string(sysconf(_SC_NPROCESSORS_ONLN)) + ", "
+            + (memory.empty() ? "unknown memory" : memory) + ", Linux "
+            + kernel + ", volume on " + filesystem;
+}
+
+double loadgen::Metric(const Report &report, Op op,
+                       const std::string &metric) {
+    auto &r = report.ops[static_cast<unsigned int>(op)];
+    if (metric == "rps")
+        return report.Throughput(op);
+    if (metric == "mibps")
+        return report.seconds > 0 ? r.bytes / report.seconds / (1 << 20) : 0;
+    if (metric == "p99_ms")
+        return r.latency.Percentile(0.99) / 1e6;
+    return -1;
+}
+
+std::vector<Verdict> loadgen::Compare(
+        const std::vector<Expectation> &baseline,
+        const std::map<std::string, double> &measured) {
+    std::vector<Verdict> verdicts;
+    for (auto &e : baseline) {
+        auto it = measured.find(e.workload + " " + e.metric);
+        if (it == measured.end())
+            continue;
+        Verdict v;
+        v.expected = e;
+        v.measured = it->second;
+        v.unmeasured = e.value <= 0;
+        if (!v.unmeasured) {
+            v.change = (v.measured - e.value) / e.value;
+            if (lowerIsBetter(e.metric))
+                v.change = -v.change;
+        }
+        v.regression = v.change < -e.tolerance;
+        verdicts.push_back(v);
+    }
+    return verdicts;
+}
+
+unsigned int loadgen::PrintVerdicts(std::ostream &out,
+                                    const std::vector<Verdict> &verdicts) {
+    char line[256];
+    snprintf(line, sizeof(line), "%-14s %-7s %12s %12s %8s %6s  %s\n",
+             "workload", "metric", "baseline", "measured", "change", "tol",
+             "verdict");
+    out << line;
+    unsigned int regressions = 0;
+    for (auto &v : verdicts) {
+        snprintf(line, sizeof(line),
+                 "%-14s %-7s %12.3f %12.3f %+7.1f%% %5.0f%%  %s\n",
+                 v.expected.workload.c_str(), v.expected.metric.c_str(),
+                 v.expected.value, v.measured, 100 * v.change,
+                 100 * v.expected.tolerance,
+                 v.unmeasured ? "UNMEASURED"
+                 : (v.regression ? "REGRESSION" : "ok"));
+        out << line;
+        if (v.regression)
+            regressions++;
+    }
+    return regressions;
+}
@@ -0,0 +1,96 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#ifndef TOOLS_PERF_HPP_
+#define TOOLS_PERF_HPP_
+
+#include <istream>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "loadgen.hpp"
+
+namespace loadgen {
+
+/**
+ * Reference value of one metric of a workload, with the relative
+ * degradation tolerated before the run is declared a regression.
+ * Metrics: "rps" and "mibps" (higher is better), "p99_ms" (lower is
+ * better), always for the main operation of the workload. A value of 0
+ * was never measured.
+ */
+struct Expectation {
+    std::string workload;
+    std::string metric;
+    double value {0};
+    double tolerance {0};
+};
+
+/**
+ * Parse a baseline, one "<workload> <metric> <value> <tolerance>" per line,
+ * with '#' comments.
+ * @return false (and the faulty line in error) if a line is malformed
+ */
+bool ParseBaseline(std::istream &in, std::vector<Expectation> *baseline,
+                   std::string *error);
+
+/**
+ * Print a baseline ParseBaseline() reads back.
+ * @param comment lines printed first as comments, e.g. the machine
+ */
+void PrintBaseline(std::ostream &out,
+                   const std::vector<Expectation> &baseline,
+                   const std::vector<std::string> &comment = {});
+
+/**
+ * @return a description of the machine the results depend on: CPU model
+ * and count, memory, kernel, and the filesystem of the volume
+ */
+std::string MachineSpec(const std::string &volume);
+
+/** @return the value of the metric for the operation, or a negative value */
+double Metric(const Report &report, Op op, const std::string &metric);
+
+struct Verdict {
+    Expectation expected;
+    double measured {0};
+    /** Relative change, positive when better */
+    double change {0};
+    bool regression {false};
+    /** The baseline has no value for the metric yet */
+    bool unmeasured {false};
+};
+
+/**
+ * Compare the results of the workloads against the baseline. Workloads
+ * without result are skipped.
+ */
+std::vector<Verdict> Compare(const std::vector<Expectation> &baseline,
+                             const std::map<std::string, double> &measured);
+
+/**
+ * Print a table of the verdicts. @return the number of regressions, the
+ * unmeasured metrics aren't
+ */
+unsigned int PrintVerdicts(std::ostream &out,
+                           const std::vector<Verdict> &verdicts);
+
+}  // namespace loadgen
+
+#endif  // TOOLS_PERF_HPP_
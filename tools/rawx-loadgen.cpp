@@ -0,0 +1,78 @@
+/**
+ * This file is part of the OpenIO client libraries
+ * Copyright (C) 2017 OpenIO SAS
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <gflags/gflags.h>
+#include <iostream>
+#include <string>
+#include "loadgen.hpp"
+
+DEFINE_string(host, "127.0.0.1", "Address of the rawx");
+DEFINE_int32(port, 6200, "Port of the rawx");
+DEFINE_string(protocol, "http1", "http1 or h2c");
+DEFINE_int32(concurrency, 8, "Requests in flight, one connection each");
+DEFINE_bool(reuse, true, "Keep the connections open between the requests");
+DEFINE_string(mix, "put=1,get=1", "Weights of put, get, range and delete");
+DEFINE_string(sizes, "1M", "Chunk sizes, e.g. 1M, 4K-1M or 4K:50,1M-8M:50");
+DEFINE_string(range_size, "64K", "Length of the Range reads");
+DEFINE_int32(prefill, 0, "Chunks uploaded before the measure");
+DEFINE_int32(duration, 10, "Duration of the run in seconds");
+DEFINE_int64(requests, 0, "Stop after this many requests (0: no limit)");
+DEFINE_int64(seed, 0, "Seed of the random generators");
+DEFINE_bool(json, false, "Print the report as JSON");
+
+int main(int argc, char **argv) {
+    gflags::SetUsageMessage("Load generator for the rawx");
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+    loadgen::Workload workload;
+    workload.host = FLAGS_host;
+    workload.port = FLAGS_port;
+    workload.concurrency = FLAGS_concurrency;
+    workload.reuse = FLAGS_reuse;
+    workload.prefill = FLAGS_prefill;
+    workload.duration = std::chrono::seconds(FLAGS_duration);
+    workload.requests = FLAGS_requests;
+    workload.seed = FLAGS_seed;
+    if (!loadgen::ProtocolParse(FLAGS_protocol, &workload.protocol)) {
+        std::cerr << "Invalid protocol: " << FLAGS_protocol << std::endl;
+        return 2;
+    }
+    if (!workload.mix.Parse(FLAGS_mix)) {
+        std::cerr << "Invalid mix: " << FLAGS_mix << std::endl;
+        return 2;
+    }
+    if (!workload.sizes.Parse(FLAGS_sizes)) {
+        std::cerr << "Invalid sizes: " << FLAGS_sizes << std::endl;
+        return 2;
+    }
+    if (!loadgen::ParseSize(FLAGS_range_size, &workload.rangeSize)
+            || workload.rangeSize == 0) {
+        std::cerr << "Invalid range size: " << FLAGS_range_size << std::endl;
+        return 2;
+    }
+
+    auto report = loadgen::Run(workload);
+    if (FLAGS_json)
+        report.PrintJson(std::cout);
+    else
+        report.Print(std::cout);
+    uint64_t errors = 0;
+    for (auto &op : report.ops)
+        errors += op.errors;
+    return errors > 0 ? 1 : 0;
+}